@@ -1,11 +1,158 @@
 #include "AuditLogDialog.hpp"
+#include "config.hpp"
+#include <QColor>
 #include <QHBoxLayout>
 #include <QHeaderView>
-#include <QLabel>
+#include <QIntValidator>
 #include <QPushButton>
 #include <QVBoxLayout>
+#include <climits>
 
-AuditLogDialog::AuditLogDialog(Database& db, QWidget* parent) : QDialog(parent), m_db(db) {
+// ---------------------------------------------------------------------------
+// AuditLogModel
+// ---------------------------------------------------------------------------
+static const QStringList kHeaders = {"#", "User", "Action", "Table", "Record ID", "Detail", "Timestamp"};
+
+AuditLogModel::AuditLogModel(Database& db, AuditArchive* archive, QObject* parent)
+    : QAbstractTableModel(parent), m_db(db), m_archive(archive) {
+    m_archived.done = m_archive == nullptr;
+}
+
+void AuditLogModel::setFilter(const AuditFilter& filter) {
+    beginResetModel();
+    m_filter = filter;
+    m_entries.clear();
+    m_live = Source{};
+    m_archived = Source{};
+    m_archived.done = m_archive == nullptr;
+    m_exhausted = false;
+    endResetModel();
+}
+
+int AuditLogModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(m_entries.size());
+}
+
+int AuditLogModel::columnCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(kHeaders.size());
+}
+
+QVariant AuditLogModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= m_entries.size()) {
+        return {};
+    }
+    const AuditEntry& e = m_entries.at(index.row());
+
+    if (role == Qt::BackgroundRole) {
+        static const QColor insertColour("#e6f4ea");
+        static const QColor updateColour("#fff8e1");
+        static const QColor deleteColour("#fce8e6");
+        if (e.action == "INSERT") {
+            return QVariant::fromValue(insertColour);
+        }
+        if (e.action == "UPDATE") {
+            return QVariant::fromValue(updateColour);
+        }
+        if (e.action == "DELETE") {
+            return QVariant::fromValue(deleteColour);
+        }
+        return {};
+    }
+    if (role != Qt::DisplayRole) {
+        return {};
+    }
+
+    switch (index.column()) {
+        case 0:
+            return e.id;
+        case 1:
+            return e.username;
+        case 2:
+            return e.action;
+        case 3:
+            return e.tableName;
+        case 4:
+            return e.recordId;
+        case 5:
+            return e.detail;
+        case 6:
+            return e.changedAt;
+        default:
+            return {};
+    }
+}
+
+QVariant AuditLogModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+        return kHeaders.value(section);
+    }
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+bool AuditLogModel::canFetchMore(const QModelIndex& parent) const { return !parent.isValid() && !m_exhausted; }
+
+void AuditLogModel::refill(Source& source, bool archive) {
+    // Keep a full page buffered so the merge below never runs a source dry
+    // while it may still hold newer ids than the other one.
+    if (source.done || source.pending.size() >= kPageSize) {
+        return;
+    }
+    const QList<AuditEntry> page = archive ? m_archive->query(m_filter, source.beforeId, kPageSize)
+                                           : m_db.getAuditPage(m_filter, source.beforeId, kPageSize);
+    if (page.size() < kPageSize) {
+        source.done = true;
+    }
+    if (!page.isEmpty()) {
+        source.beforeId = page.last().id;
+        source.pending << page;
+    }
+}
+
+void AuditLogModel::fetchMore(const QModelIndex& parent) {
+    if (parent.isValid() || m_exhausted) {
+        return;
+    }
+    refill(m_live, false);
+    refill(m_archived, true);
+
+    QList<AuditEntry> page;
+    while (page.size() < kPageSize) {
+        // An empty buffer only lets the other source go first once its own
+        // source has nothing older left.
+        const bool liveEmpty = m_live.pending.isEmpty();
+        const bool archivedEmpty = m_archived.pending.isEmpty();
+        if ((liveEmpty && archivedEmpty) || (liveEmpty && !m_live.done) || (archivedEmpty && !m_archived.done)) {
+            break;
+        }
+        if (archivedEmpty) {
+            page << m_live.pending.takeFirst();
+        } else if (liveEmpty) {
+            page << m_archived.pending.takeFirst();
+        } else {
+            const qint64 liveId = m_live.pending.first().id;
+            const qint64 archivedId = m_archived.pending.first().id;
+            if (liveId == archivedId) {
+                // Copied to the archive but not purged yet.
+                m_archived.pending.removeFirst();
+            }
+            page << (liveId >= archivedId ? m_live : m_archived).pending.takeFirst();
+        }
+    }
+    m_exhausted = m_live.done && m_archived.done && m_live.pending.isEmpty() && m_archived.pending.isEmpty();
+    if (page.isEmpty()) {
+        return;
+    }
+    const int first = static_cast<int>(m_entries.size());
+    beginInsertRows(QModelIndex(), first, first + static_cast<int>(page.size()) - 1);
+    m_entries << page;
+    endInsertRows();
+}
+
+// ---------------------------------------------------------------------------
+// AuditLogDialog
+// ---------------------------------------------------------------------------
+AuditLogDialog::AuditLogDialog(Database& db, QWidget* parent)
+    : QDialog(parent), m_db(db), m_archive(loadAuditConfig().archiveDir) {
     setWindowTitle("Audit Log");
     setMinimumSize(900, 500);
 
@@ -15,17 +162,81 @@ AuditLogDialog::AuditLogDialog(Database& db, QWidget* parent) : QDialog(parent),
     titleLabel->setStyleSheet("font-size:16px; font-weight:bold; margin-bottom:6px;");
     vLayout->addWidget(titleLabel);
 
-    m_table = new QTableWidget(this);
-    m_table->setColumnCount(7);
-    m_table->setHorizontalHeaderLabels({"#", "User", "Action", "Table", "Record ID", "Detail", "Timestamp"});
+    // Filter bar
+    auto* filterLayout = new QHBoxLayout();
+
+    m_userCombo = new QComboBox(this);
+    m_userCombo->addItem("All users", QString());
+    for (const User& u : m_db.getAllUsers()) {
+        m_userCombo->addItem(u.username, u.username);
+    }
+    m_userCombo->addItem("system", "system");
+
+    m_actionCombo = new QComboBox(this);
+    m_actionCombo->addItem("All actions", QString());
+    for (const QString& a : {"INSERT", "UPDATE", "DELETE"}) {
+        m_actionCombo->addItem(a, a);
+    }
+
+    m_tableCombo = new QComboBox(this);
+    m_tableCombo->addItem("All tables", QString());
+    for (const QString& t : {"hmis", "diagnoses", "users"}) {
+        m_tableCombo->addItem(t, t);
+    }
+
+    m_recordEdit = new QLineEdit(this);
+    m_recordEdit->setPlaceholderText("Record ID");
+    m_recordEdit->setValidator(new QIntValidator(0, INT_MAX, m_recordEdit));
+    m_recordEdit->setFixedWidth(90);
+
+    m_dateCheck = new QCheckBox("From", this);
+    m_fromEdit = new QDateEdit(QDate::currentDate().addMonths(-1), this);
+    m_toEdit = new QDateEdit(QDate::currentDate(), this);
+    for (QDateEdit* edit : {m_fromEdit, m_toEdit}) {
+        edit->setCalendarPopup(true);
+        edit->setDisplayFormat("yyyy-MM-dd");
+        edit->setEnabled(false);
+    }
+    connect(m_dateCheck, &QCheckBox::toggled, m_fromEdit, &QWidget::setEnabled);
+    connect(m_dateCheck, &QCheckBox::toggled, m_toEdit, &QWidget::setEnabled);
+
+    auto* applyBtn = new QPushButton("Apply", this);
+    auto* resetBtn = new QPushButton("Reset", this);
+    connect(applyBtn, &QPushButton::clicked, this, &AuditLogDialog::applyFilter);
+    connect(resetBtn, &QPushButton::clicked, this, &AuditLogDialog::resetFilter);
+    connect(m_recordEdit, &QLineEdit::returnPressed, this, &AuditLogDialog::applyFilter);
+
+    filterLayout->addWidget(m_userCombo);
+    filterLayout->addWidget(m_actionCombo);
+    filterLayout->addWidget(m_tableCombo);
+    filterLayout->addWidget(m_recordEdit);
+    filterLayout->addWidget(m_dateCheck);
+    filterLayout->addWidget(m_fromEdit);
+    filterLayout->addWidget(new QLabel("to", this));
+    filterLayout->addWidget(m_toEdit);
+    filterLayout->addStretch();
+    filterLayout->addWidget(applyBtn);
+    filterLayout->addWidget(resetBtn);
+    vLayout->addLayout(filterLayout);
+
+    m_model = new AuditLogModel(m_db, &m_archive, this);
+    m_table = new QTableView(this);
+    m_table->setModel(m_model);
     m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
     m_table->setAlternatingRowColors(true);
     m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->verticalHeader()->hide();
+    m_table->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
     m_table->horizontalHeader()->setSectionResizeMode(5, QHeaderView::Stretch);
     m_table->horizontalHeader()->setSectionResizeMode(6, QHeaderView::ResizeToContents);
     vLayout->addWidget(m_table);
 
+    connect(m_model, &QAbstractItemModel::rowsInserted, this, &AuditLogDialog::updateStatus);
+    connect(m_model, &QAbstractItemModel::modelReset, this, &AuditLogDialog::updateStatus);
+
     auto* btnLayout = new QHBoxLayout();
+    m_statusLabel = new QLabel(this);
+    btnLayout->addWidget(m_statusLabel);
     btnLayout->addStretch();
     auto* closeBtn = new QPushButton("Close", this);
     closeBtn->setFixedWidth(100);
@@ -33,40 +244,39 @@ AuditLogDialog::AuditLogDialog(Database& db, QWidget* parent) : QDialog(parent),
     btnLayout->addWidget(closeBtn);
     vLayout->addLayout(btnLayout);
 
-    loadData();
+    applyFilter();
 }
 
-void AuditLogDialog::loadData() {
-    auto entries = m_db.getAuditLog(1000);
-    m_table->setRowCount(static_cast<int>(entries.size()));
-
-    int row = 0;
-    for (const AuditEntry& e : entries) {
-        m_table->setItem(row, 0, new QTableWidgetItem(QString::number(e.id)));
-        m_table->setItem(row, 1, new QTableWidgetItem(e.username));
-        m_table->setItem(row, 2, new QTableWidgetItem(e.action));
-        m_table->setItem(row, 3, new QTableWidgetItem(e.tableName));
-        m_table->setItem(row, 4, new QTableWidgetItem(QString::number(e.recordId)));
-        m_table->setItem(row, 5, new QTableWidgetItem(e.detail));
-        m_table->setItem(row, 6, new QTableWidgetItem(e.changedAt));
-
-        QColor colour;
-        if (e.action == "INSERT") {
-            colour = QColor("#e6f4ea");
-        } else if (e.action == "UPDATE") {
-            colour = QColor("#fff8e1");
-        } else if (e.action == "DELETE") {
-            colour = QColor("#fce8e6");
-        }
-
-        if (colour.isValid()) {
-            for (int col = 0; col < 7; ++col) {
-                if (m_table->item(row, col) != nullptr) {
-                    m_table->item(row, col)->setBackground(colour);
-                }
-            }
-        }
-        row++;
+void AuditLogDialog::applyFilter() {
+    AuditFilter f;
+    f.username = m_userCombo->currentData().toString();
+    f.action = m_actionCombo->currentData().toString();
+    f.tableName = m_tableCombo->currentData().toString();
+    if (!m_recordEdit->text().isEmpty()) {
+        f.recordId = m_recordEdit->text().toInt();
+    }
+    if (m_dateCheck->isChecked()) {
+        f.fromDate = m_fromEdit->date();
+        f.toDate = m_toEdit->date();
     }
-    m_table->resizeColumnsToContents();
+    m_model->setFilter(f);
+    // The view only asks for more rows once it has some; load the first page.
+    if (m_model->canFetchMore(QModelIndex())) {
+        m_model->fetchMore(QModelIndex());
+    }
+}
+
+void AuditLogDialog::resetFilter() {
+    m_userCombo->setCurrentIndex(0);
+    m_actionCombo->setCurrentIndex(0);
+    m_tableCombo->setCurrentIndex(0);
+    m_recordEdit->clear();
+    m_dateCheck->setChecked(false);
+    applyFilter();
+}
+
+void AuditLogDialog::updateStatus() {
+    const int n = m_model->rowCount();
+    m_statusLabel->setText(m_model->canFetchMore(QModelIndex()) ? QString("%1 entries loaded, scroll for more").arg(n)
+                                                                 : QString("%1 entries").arg(n));
 }
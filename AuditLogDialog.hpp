@@ -1,19 +1,80 @@
 #ifndef AUDITLOGDIALOG_H
 #define AUDITLOGDIALOG_H
 
+#include <QAbstractTableModel>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QDateEdit>
 #include <QDialog>
-#include <QTableWidget>
+#include <QLabel>
+#include <QLineEdit>
+#include <QTableView>
+#include "auditarchive.hpp"
 #include "database.hpp"
 
+// Lazy, newest-first view of audit_log. Rows arrive one keyset page at a
+// time as the view scrolls (canFetchMore/fetchMore), merged by id with the
+// archived segments when an archive is attached.
+class AuditLogModel : public QAbstractTableModel {
+    Q_OBJECT
+  public:
+    explicit AuditLogModel(Database& db, AuditArchive* archive = nullptr, QObject* parent = nullptr);
+
+    void setFilter(const AuditFilter& filter);
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+
+  private:
+    static constexpr int kPageSize = 200;
+
+    // Entries read from one source but not shown yet, newest first.
+    struct Source {
+        QList<AuditEntry> pending;
+        qint64 beforeId = 0;  // 0: not read yet
+        bool done = false;
+    };
+
+    void refill(Source& source, bool archive);
+
+    Database& m_db;
+    AuditArchive* m_archive;
+    AuditFilter m_filter;
+    QList<AuditEntry> m_entries;
+    // audit_log and the archive are read side by side and merged by id:
+    // archived rows are not necessarily older than what stays in audit_log.
+    Source m_live;
+    Source m_archived;
+    bool m_exhausted = false;
+};
+
 class AuditLogDialog : public QDialog {
     Q_OBJECT
   public:
     explicit AuditLogDialog(Database& db, QWidget* parent = nullptr);
 
   private:
-    void loadData();
+    void applyFilter();
+    void resetFilter();
+    void updateStatus();
+
     Database& m_db;
-    QTableWidget* m_table;
+    AuditArchive m_archive;
+    AuditLogModel* m_model;
+    QTableView* m_table;
+
+    QComboBox* m_userCombo;
+    QComboBox* m_actionCombo;
+    QComboBox* m_tableCombo;
+    QLineEdit* m_recordEdit;
+    QCheckBox* m_dateCheck;
+    QDateEdit* m_fromEdit;
+    QDateEdit* m_toEdit;
+    QLabel* m_statusLabel;
 };
 
 #endif  // AUDITLOGDIALOG_H
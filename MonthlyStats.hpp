@@ -11,6 +11,7 @@ struct CategoryCount {
     int female = 0;
 
     [[nodiscard]] int total() const { return male + female; }
+    bool operator==(const CategoryCount&) const = default;
 
     void increment(const QString& sex) {
         if (sex == "Male") {
@@ -42,6 +43,18 @@ struct MonthlyStats {
         return *it2;
     }
 
+    // Adds other's counts (partial results over disjoint row sets).
+    void merge(const MonthlyStats& other) {
+        for (auto it = other.data.begin(); it != other.data.end(); ++it) {
+            auto& byAge = data[it.key()];
+            for (auto cell = it->begin(); cell != it->end(); ++cell) {
+                CategoryCount& c = byAge[cell.key()];
+                c.male += cell->male;
+                c.female += cell->female;
+            }
+        }
+    }
+
     bool contains(const QString& key1) const { return data.contains(key1); }
 
     QList<QString> keys() const { return data.keys(); }
@@ -0,0 +1,128 @@
+#include "PerfStatsDialog.hpp"
+#include <QFile>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QSettings>
+#include <QVBoxLayout>
+#include <cmath>
+
+#include "perfstats.hpp"
+
+PerfStatsDialog::PerfStatsDialog(QWidget* parent) : QDialog(parent) {
+    setWindowTitle("Performance");
+    setMinimumSize(1000, 500);
+
+    auto* vLayout = new QVBoxLayout(this);
+
+    auto* titleLabel = new QLabel("Database Performance", this);
+    titleLabel->setStyleSheet("font-size:16px; font-weight:bold; margin-bottom:6px;");
+    vLayout->addWidget(titleLabel);
+
+    m_table = new QTableWidget(this);
+    m_table->setColumnCount(10);
+    m_table->setHorizontalHeaderLabels(
+        {"Operation", "Calls", "Errors", "Rows", "Bytes", "Mean (ms)", "p50 (ms)", "p95 (ms)", "p99 (ms)", "Max (ms)"});
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setAlternatingRowColors(true);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->setSortingEnabled(true);
+    m_table->horizontalHeader()->setSectionResizeMode(0, QHeaderView::Stretch);
+    vLayout->addWidget(m_table);
+
+    auto* btnLayout = new QHBoxLayout();
+    btnLayout->addWidget(new QLabel("Log queries slower than (ms, 0 = off):", this));
+    m_threshold = new QSpinBox(this);
+    m_threshold->setRange(0, 600000);
+    m_threshold->setValue(PerfRegistry::instance().slowQueryThresholdMs());
+    connect(m_threshold, &QSpinBox::valueChanged, this, &PerfStatsDialog::onThresholdChanged);
+    btnLayout->addWidget(m_threshold);
+    btnLayout->addStretch();
+
+    auto* refreshBtn = new QPushButton("Refresh", this);
+    connect(refreshBtn, &QPushButton::clicked, this, &PerfStatsDialog::loadData);
+    btnLayout->addWidget(refreshBtn);
+
+    auto* resetBtn = new QPushButton("Reset", this);
+    connect(resetBtn, &QPushButton::clicked, this, &PerfStatsDialog::onReset);
+    btnLayout->addWidget(resetBtn);
+
+    auto* exportBtn = new QPushButton("Export JSON", this);
+    connect(exportBtn, &QPushButton::clicked, this, &PerfStatsDialog::onExportJson);
+    btnLayout->addWidget(exportBtn);
+
+    auto* closeBtn = new QPushButton("Close", this);
+    closeBtn->setFixedWidth(100);
+    connect(closeBtn, &QPushButton::clicked, this, &QDialog::accept);
+    btnLayout->addWidget(closeBtn);
+    vLayout->addLayout(btnLayout);
+
+    loadData();
+}
+
+// Numeric items so that column sorting is by value, not lexical.
+static QTableWidgetItem* countItem(uint64_t value) {
+    auto* item = new QTableWidgetItem();
+    item->setData(Qt::DisplayRole, static_cast<qulonglong>(value));
+    item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+    return item;
+}
+
+static QTableWidgetItem* msItem(double value) {
+    auto* item = new QTableWidgetItem();
+    item->setData(Qt::DisplayRole, std::round(value * 1000.0) / 1000.0);
+    item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+    return item;
+}
+
+void PerfStatsDialog::loadData() {
+    auto snapshot = PerfRegistry::instance().snapshot();
+    m_table->setSortingEnabled(false);
+    m_table->setRowCount(static_cast<int>(snapshot.size()));
+
+    int row = 0;
+    for (const PerfSnapshot& s : snapshot) {
+        m_table->setItem(row, 0, new QTableWidgetItem(s.name));
+        m_table->setItem(row, 1, countItem(s.count));
+        m_table->setItem(row, 2, countItem(s.errors));
+        m_table->setItem(row, 3, countItem(s.rows));
+        m_table->setItem(row, 4, countItem(s.bytes));
+        m_table->setItem(row, 5, msItem(s.meanMs));
+        m_table->setItem(row, 6, msItem(s.p50Ms));
+        m_table->setItem(row, 7, msItem(s.p95Ms));
+        m_table->setItem(row, 8, msItem(s.p99Ms));
+        m_table->setItem(row, 9, msItem(s.maxMs));
+        row++;
+    }
+    m_table->setSortingEnabled(true);
+    m_table->resizeColumnsToContents();
+}
+
+void PerfStatsDialog::onReset() {
+    PerfRegistry::instance().reset();
+    loadData();
+}
+
+void PerfStatsDialog::onExportJson() {
+    QString path =
+        QFileDialog::getSaveFileName(this, "Export Performance Data", "hmis_perf.json", "JSON (*.json);;All Files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        QMessageBox::critical(this, "Export Error", "Cannot write to: " + path);
+        return;
+    }
+    f.write(PerfRegistry::instance().toJson().toJson());
+}
+
+void PerfStatsDialog::onThresholdChanged(int ms) {
+    PerfRegistry::instance().setSlowQueryThresholdMs(ms);
+    QSettings settings;
+    settings.setValue("perf/slowQueryMs", ms);
+}
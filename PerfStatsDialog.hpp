@@ -0,0 +1,24 @@
+#ifndef PERFSTATSDIALOG_H
+#define PERFSTATSDIALOG_H
+
+#include <QDialog>
+#include <QSpinBox>
+#include <QTableWidget>
+
+class PerfStatsDialog : public QDialog {
+    Q_OBJECT
+  public:
+    explicit PerfStatsDialog(QWidget* parent = nullptr);
+
+  private slots:
+    void loadData();
+    void onReset();
+    void onExportJson();
+    void onThresholdChanged(int ms);
+
+  private:
+    QTableWidget* m_table;
+    QSpinBox* m_threshold;
+};
+
+#endif  // PERFSTATSDIALOG_H
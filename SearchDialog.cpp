@@ -0,0 +1,148 @@
+#include "SearchDialog.hpp"
+#include <QDate>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QPushButton>
+#include <QVBoxLayout>
+
+// ---------------------------------------------------------------------------
+// SearchModel
+// ---------------------------------------------------------------------------
+static const QStringList kHeaders = {"Month", "Patient ID", "Age Category", "Sex", "New Attendance", "Diagnoses"};
+
+SearchModel::SearchModel(Database& db, QObject* parent) : QAbstractTableModel(parent), m_db(db) {}
+
+void SearchModel::setText(const QString& text) {
+    beginResetModel();
+    m_text = text.trimmed();
+    m_rows.clear();
+    m_exhausted = m_text.isEmpty();
+    m_failed = false;
+    endResetModel();
+}
+
+int SearchModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(m_rows.size());
+}
+
+int SearchModel::columnCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : static_cast<int>(kHeaders.size());
+}
+
+QVariant SearchModel::data(const QModelIndex& index, int role) const {
+    if (!index.isValid() || index.row() >= m_rows.size() || role != Qt::DisplayRole) {
+        return {};
+    }
+    const HMISRow& r = m_rows.at(index.row());
+    switch (index.column()) {
+        case 0:
+            return QDate(r.year, r.month, 1).toString("yyyy-MM");
+        case 1:
+            return r.ipNumber;
+        case 2:
+            return r.ageCategory;
+        case 3:
+            return r.sex;
+        case 4:
+            return r.newAttendance;
+        case 5:
+            return r.diagnoses.join(", ");
+        default:
+            return {};
+    }
+}
+
+QVariant SearchModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+        return kHeaders.value(section);
+    }
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+bool SearchModel::canFetchMore(const QModelIndex& parent) const { return !parent.isValid() && !m_exhausted; }
+
+void SearchModel::fetchMore(const QModelIndex& parent) {
+    if (parent.isValid() || m_exhausted) {
+        return;
+    }
+    const std::optional<HMISData> page = m_db.searchRegister(m_text, static_cast<int>(m_rows.size()), kPageSize);
+    m_failed = !page.has_value();
+    m_exhausted = m_failed || page->size() < kPageSize;
+    if (!m_failed && !page->isEmpty()) {
+        const int first = static_cast<int>(m_rows.size());
+        beginInsertRows(QModelIndex(), first, first + static_cast<int>(page->size()) - 1);
+        m_rows << *page;
+        endInsertRows();
+    }
+    emit fetched();
+}
+
+// ---------------------------------------------------------------------------
+// SearchDialog
+// ---------------------------------------------------------------------------
+SearchDialog::SearchDialog(Database& db, const QString& text, QWidget* parent) : QDialog(parent), m_db(db) {
+    setWindowTitle("Search Register");
+    setMinimumSize(900, 500);
+
+    auto* vLayout = new QVBoxLayout(this);
+
+    auto* searchLayout = new QHBoxLayout();
+    m_searchEdit = new QLineEdit(text, this);
+    m_searchEdit->setPlaceholderText("IP number or diagnosis, in any month");
+    m_searchEdit->setClearButtonEnabled(true);
+    auto* searchBtn = new QPushButton("Search", this);
+    connect(searchBtn, &QPushButton::clicked, this, &SearchDialog::search);
+    connect(m_searchEdit, &QLineEdit::returnPressed, this, &SearchDialog::search);
+    searchLayout->addWidget(m_searchEdit);
+    searchLayout->addWidget(searchBtn);
+    vLayout->addLayout(searchLayout);
+
+    m_model = new SearchModel(m_db, this);
+    m_table = new QTableView(this);
+    m_table->setModel(m_model);
+    m_table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_table->setAlternatingRowColors(true);
+    m_table->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_table->verticalHeader()->hide();
+    m_table->horizontalHeader()->setSectionResizeMode(QHeaderView::ResizeToContents);
+    m_table->horizontalHeader()->setSectionResizeMode(5, QHeaderView::Stretch);
+    vLayout->addWidget(m_table);
+
+    connect(m_table, &QTableView::doubleClicked, this, [this](const QModelIndex& index) {
+        const HMISRow& r = m_model->rowAt(index.row());
+        emit openMonth(r.year, r.month, r.ipNumber);
+    });
+    connect(m_model, &SearchModel::fetched, this, &SearchDialog::updateStatus);
+    connect(m_model, &QAbstractItemModel::modelReset, this, &SearchDialog::updateStatus);
+
+    auto* btnLayout = new QHBoxLayout();
+    m_statusLabel = new QLabel(this);
+    btnLayout->addWidget(m_statusLabel);
+    btnLayout->addStretch();
+    auto* closeBtn = new QPushButton("Close", this);
+    closeBtn->setFixedWidth(100);
+    connect(closeBtn, &QPushButton::clicked, this, &QDialog::accept);
+    btnLayout->addWidget(closeBtn);
+    vLayout->addLayout(btnLayout);
+
+    search();
+}
+
+void SearchDialog::search() {
+    m_model->setText(m_searchEdit->text());
+    // The view only asks for more rows once it has some; load the first page.
+    if (m_model->canFetchMore(QModelIndex())) {
+        m_model->fetchMore(QModelIndex());
+    }
+}
+
+void SearchDialog::updateStatus() {
+    const int n = m_model->rowCount();
+    if (m_model->failed()) {
+        m_statusLabel->setText("Search failed: " + m_db.getLastError());
+    } else {
+        m_statusLabel->setText(m_model->canFetchMore(QModelIndex())
+                                   ? QString("%1 matches loaded, scroll for more").arg(n)
+                                   : QString("%1 matches").arg(n));
+    }
+}
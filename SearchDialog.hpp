@@ -0,0 +1,62 @@
+#ifndef SEARCHDIALOG_H
+#define SEARCHDIALOG_H
+
+#include <QAbstractTableModel>
+#include <QDialog>
+#include <QLabel>
+#include <QLineEdit>
+#include <QTableView>
+#include "database.hpp"
+
+// Register rows of every month matching a search, best matches first. Like
+// AuditLogModel, rows arrive one page at a time as the view scrolls.
+class SearchModel : public QAbstractTableModel {
+    Q_OBJECT
+  public:
+    explicit SearchModel(Database& db, QObject* parent = nullptr);
+
+    void setText(const QString& text);
+    [[nodiscard]] bool failed() const { return m_failed; }
+    [[nodiscard]] const HMISRow& rowAt(int row) const { return m_rows.at(row); }
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+
+  signals:
+    void fetched();  // after every page, including empty and failed ones
+
+  private:
+    static constexpr int kPageSize = 100;
+
+    Database& m_db;
+    QString m_text;
+    HMISData m_rows;
+    bool m_exhausted = true;
+    bool m_failed = false;
+};
+
+class SearchDialog : public QDialog {
+    Q_OBJECT
+  public:
+    SearchDialog(Database& db, const QString& text, QWidget* parent = nullptr);
+
+  signals:
+    // A result was double-clicked.
+    void openMonth(int year, int month, const QString& ipNumber);
+
+  private:
+    void search();
+    void updateStatus();
+
+    Database& m_db;
+    SearchModel* m_model;
+    QTableView* m_table;
+    QLineEdit* m_searchEdit;
+    QLabel* m_statusLabel;
+};
+
+#endif  // SEARCHDIALOG_H
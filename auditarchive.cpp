@@ -0,0 +1,278 @@
+#include "auditarchive.hpp"
+#include "perfstats.hpp"
+
+#include <QDataStream>
+#include <QDate>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+
+static const QByteArray kMagic("HMISAUD1");
+static constexpr quint32 kFormatVersion = 1;
+
+static QDataStream& operator<<(QDataStream& s, const AuditEntry& e) {
+    return s << e.id << e.username << e.action << e.tableName << qint32(e.recordId) << e.detail << e.changedAt
+             << e.changeId;
+}
+
+static QDataStream& operator>>(QDataStream& s, AuditEntry& e) {
+    qint32 recordId = 0;
+    s >> e.id >> e.username >> e.action >> e.tableName >> recordId >> e.detail >> e.changedAt >> e.changeId;
+    e.recordId = recordId;
+    return s;
+}
+
+static bool matches(const AuditFilter& f, const AuditEntry& e) {
+    if (!f.username.isEmpty() && e.username != f.username) {
+        return false;
+    }
+    if (!f.action.isEmpty() && e.action != f.action) {
+        return false;
+    }
+    if (!f.tableName.isEmpty() && e.tableName != f.tableName) {
+        return false;
+    }
+    if (f.recordId && e.recordId != *f.recordId) {
+        return false;
+    }
+    if (f.fromDate.isValid() && e.changedAt < f.fromDate.toString(Qt::ISODate)) {
+        return false;
+    }
+    if (f.toDate.isValid() && e.changedAt >= f.toDate.addDays(1).toString(Qt::ISODate)) {
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// AuditArchive
+// ---------------------------------------------------------------------------
+AuditArchive::AuditArchive(QString dir) : m_dir(std::move(dir)), m_cache(200000) {}
+
+bool AuditArchive::readHeader(const QString& path, AuditSegmentInfo* info, QByteArray* payload) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.read(kMagic.size()) != kMagic) {
+        return false;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 version = 0;
+    in >> version;
+    if (version != kFormatVersion) {
+        return false;
+    }
+    qint32 period = 0;
+    in >> period >> info->count >> info->minId >> info->maxId >> info->maxChangeId;
+    info->period = period;
+    info->path = path;
+    if (payload != nullptr) {
+        in >> *payload;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+QList<AuditSegmentInfo> AuditArchive::segments() {
+    QMutexLocker lock(&m_mutex);
+    if (!m_scanned) {
+        m_segments.clear();
+        const QDir dir(m_dir);
+        for (const QString& name : dir.entryList({"audit-*.seg"}, QDir::Files)) {
+            AuditSegmentInfo info;
+            if (readHeader(dir.filePath(name), &info, nullptr)) {
+                m_segments << info;
+            } else {
+                qWarning() << "Skipping unreadable audit segment" << dir.filePath(name);
+            }
+        }
+        std::sort(m_segments.begin(), m_segments.end(),
+                  [](const AuditSegmentInfo& a, const AuditSegmentInfo& b) { return a.maxId > b.maxId; });
+        m_scanned = true;
+    }
+    return m_segments;
+}
+
+bool AuditArchive::writeSegment(int period, const QList<AuditEntry>& entries, AuditSegmentInfo* info,
+                                QString* error) {
+    HMIS_PERF_TIMER(timer, "writeAuditSegment");
+    if (entries.isEmpty()) {
+        *error = "Nothing to archive";
+        return false;
+    }
+    if (!QDir().mkpath(m_dir)) {
+        *error = "Cannot create " + m_dir;
+        timer.fail();
+        return false;
+    }
+
+    AuditSegmentInfo seg;
+    seg.period = period;
+    seg.count = entries.size();
+    seg.minId = entries.first().id;
+    seg.maxId = entries.first().id;
+    QByteArray payload;
+    {
+        QDataStream ps(&payload, QIODevice::WriteOnly);
+        ps.setVersion(QDataStream::Qt_6_0);
+        for (const AuditEntry& e : entries) {
+            seg.minId = std::min(seg.minId, e.id);
+            seg.maxId = std::max(seg.maxId, e.id);
+            seg.maxChangeId = std::max(seg.maxChangeId, e.changeId);
+            ps << e;
+        }
+    }
+    seg.path = QDir(m_dir).filePath(QString("audit-%1-%2.seg").arg(period).arg(seg.maxId));
+    if (QFile::exists(seg.path)) {
+        // Left behind by a run that crashed before purging the rows: reuse it
+        // if it holds exactly these entries.
+        AuditSegmentInfo existing;
+        QByteArray compressed;
+        if (readHeader(seg.path, &existing, &compressed) && existing.count == seg.count &&
+            existing.minId == seg.minId && qUncompress(compressed) == payload) {
+            *info = seg;
+            return true;
+        }
+        *error = "Segment already exists: " + seg.path;
+        timer.fail();
+        return false;
+    }
+
+    QSaveFile file(seg.path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *error = "Cannot write " + seg.path;
+        timer.fail();
+        return false;
+    }
+    file.write(kMagic);
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << kFormatVersion << qint32(period) << seg.count << seg.minId << seg.maxId << seg.maxChangeId
+        << qCompress(payload, 9);
+    if (!file.commit()) {
+        *error = file.errorString();
+        timer.fail();
+        return false;
+    }
+
+    // Read it back before the caller deletes the rows.
+    AuditSegmentInfo check;
+    QByteArray compressed;
+    if (!readHeader(seg.path, &check, &compressed) || check.count != seg.count ||
+        qUncompress(compressed) != payload) {
+        QFile::remove(seg.path);
+        *error = "Verification failed for " + seg.path;
+        timer.fail();
+        return false;
+    }
+
+    QMutexLocker lock(&m_mutex);
+    m_scanned = false;
+    timer.addRows(seg.count);
+    timer.addBytes(compressed.size());
+    *info = seg;
+    return true;
+}
+
+const QList<AuditEntry>* AuditArchive::load(const AuditSegmentInfo& seg) {
+    if (const QList<AuditEntry>* cached = m_cache.object(seg.path)) {
+        return cached;
+    }
+    AuditSegmentInfo info;
+    QByteArray compressed;
+    if (!readHeader(seg.path, &info, &compressed)) {
+        return nullptr;
+    }
+    const QByteArray payload = qUncompress(compressed);
+    QDataStream ps(payload);
+    ps.setVersion(QDataStream::Qt_6_0);
+    auto* entries = new QList<AuditEntry>();
+    entries->reserve(info.count);
+    for (qint64 i = 0; i < info.count; ++i) {
+        AuditEntry e;
+        ps >> e;
+        *entries << e;
+    }
+    if (ps.status() != QDataStream::Ok) {
+        delete entries;
+        return nullptr;
+    }
+    const auto cost = std::max<qsizetype>(entries->size(), 1);
+    m_cache.insert(seg.path, entries, cost);
+    return m_cache.object(seg.path);
+}
+
+QList<AuditEntry> AuditArchive::query(const AuditFilter& filter, qint64 beforeId, int limit) {
+    HMIS_PERF_TIMER(timer, "queryAuditArchive");
+    const QList<AuditSegmentInfo> segs = segments();
+    const int fromPeriod = filter.fromDate.isValid() ? auditPeriodOf(filter.fromDate.toString(Qt::ISODate)) : 0;
+    const int toPeriod = filter.toDate.isValid() ? auditPeriodOf(filter.toDate.toString(Qt::ISODate)) : 999999;
+
+    // Segments of one period can interleave with late-entry segments, so
+    // collect candidates from every overlapping segment and merge by id.
+    QList<AuditEntry> out;
+    QMutexLocker lock(&m_mutex);
+    for (const AuditSegmentInfo& seg : segs) {
+        if ((beforeId > 0 && seg.minId >= beforeId) || seg.period < fromPeriod || seg.period > toPeriod) {
+            continue;
+        }
+        // Segments are ordered by maxId: once we hold `limit` entries newer
+        // than everything this segment has, no later segment can contribute.
+        if (out.size() >= limit && out.at(limit - 1).id > seg.maxId) {
+            break;
+        }
+        const QList<AuditEntry>* entries = load(seg);
+        if (entries == nullptr) {
+            qWarning() << "Cannot read audit segment" << seg.path;
+            continue;
+        }
+        for (const AuditEntry& e : *entries) {
+            if ((beforeId <= 0 || e.id < beforeId) && matches(filter, e)) {
+                out << e;
+            }
+        }
+        std::sort(out.begin(), out.end(), [](const AuditEntry& a, const AuditEntry& b) { return a.id > b.id; });
+        if (out.size() > limit) {
+            out.resize(limit);
+        }
+    }
+    timer.addRows(out.size());
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Archival job
+// ---------------------------------------------------------------------------
+qint64 archiveClosedAuditPeriods(Database& db, AuditArchive& archive, int keepMonths, QString* error) {
+    HMIS_PERF_TIMER(timer, "archiveAudit");
+    const QDate cutoffDate = QDate::currentDate().addMonths(-(std::max(keepMonths, 1) - 1));
+    const int cutoff = (cutoffDate.year() * 100) + cutoffDate.month();
+
+    qint64 archived = 0;
+    for (int period : db.getAuditPeriodsBefore(cutoff)) {
+        const auto entries = db.getAuditPeriodEntries(period);
+        if (!entries) {
+            *error = db.getLastError();
+            timer.fail();
+            return -1;
+        }
+        if (entries->isEmpty()) {
+            continue;
+        }
+        AuditSegmentInfo seg;
+        if (!archive.writeSegment(period, *entries, &seg, error)) {
+            timer.fail();
+            return -1;
+        }
+        if (!db.purgeAuditPeriod(period, seg.maxId, seg.count, seg.maxChangeId)) {
+            // The purge rolled back, so the rows are still hot; drop the
+            // segment to keep every entry in exactly one place.
+            QFile::remove(seg.path);
+            *error = db.getLastError();
+            timer.fail();
+            return -1;
+        }
+        archived += seg.count;
+    }
+    timer.addRows(archived);
+    return archived;
+}
@@ -0,0 +1,58 @@
+#ifndef AUDITARCHIVE_H
+#define AUDITARCHIVE_H
+
+#include <QCache>
+#include <QList>
+#include <QMutex>
+#include <QString>
+
+#include "database.hpp"
+
+// Closed audit periods moved out of the hot audit_log table.
+//
+// Each archived month becomes a write-once segment file
+// "audit-<yyyymm>-<maxId>.seg" in the archive directory: the 8-byte magic
+// "HMISAUD1", then a QDataStream header (format version, period, entry
+// count, id range, highest change_id) and a qCompress'd block of entries,
+// newest first. Late entries for an already archived month go into a new
+// segment; existing files are never rewritten.
+struct AuditSegmentInfo {
+    QString path;
+    int period = 0;
+    qint64 count = 0;
+    qint64 minId = 0;
+    qint64 maxId = 0;
+    qint64 maxChangeId = 0;
+};
+
+class AuditArchive {
+  public:
+    explicit AuditArchive(QString dir);
+
+    [[nodiscard]] const QString& dir() const { return m_dir; }
+
+    // Headers of all segments, newest (highest ids) first.
+    QList<AuditSegmentInfo> segments();
+
+    bool writeSegment(int period, const QList<AuditEntry>& entries, AuditSegmentInfo* info, QString* error);
+
+    // Same contract as Database::getAuditPage, over the archived entries.
+    QList<AuditEntry> query(const AuditFilter& filter, qint64 beforeId, int limit);
+
+  private:
+    static bool readHeader(const QString& path, AuditSegmentInfo* info, QByteArray* payload);
+    const QList<AuditEntry>* load(const AuditSegmentInfo& seg);
+
+    QString m_dir;
+    QMutex m_mutex;
+    QList<AuditSegmentInfo> m_segments;
+    bool m_scanned = false;
+    QCache<QString, QList<AuditEntry>> m_cache;  // decompressed segments, cost = entries
+};
+
+// Moves every audit period older than keepMonths (counting the current month)
+// into segment files, verifying each segment before purging its rows.
+// Returns the number of entries archived or -1.
+qint64 archiveClosedAuditPeriods(Database& db, AuditArchive& archive, int keepMonths, QString* error);
+
+#endif  // AUDITARCHIVE_H
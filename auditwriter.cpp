@@ -0,0 +1,86 @@
+#include "auditwriter.hpp"
+
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <algorithm>
+
+AuditWriter::AuditWriter(const ConnOptions& options, int groupCommitMs)
+    : m_options(options), m_intervalMs(std::max(groupCommitMs, 1)) {
+    m_thread.reset(QThread::create([this] { run(); }));
+    m_thread->setObjectName("AuditWriter");
+    m_thread->start();
+}
+
+AuditWriter::~AuditWriter() {
+    m_stop.store(true);
+    m_wake.release();
+    m_thread->wait();
+}
+
+void AuditWriter::enqueue(AuditRecord record) {
+    m_queue.push(std::move(record));
+    m_enqueued.fetch_add(1, std::memory_order_release);
+}
+
+bool AuditWriter::flush(int timeoutMs) {
+    const qint64 target = m_enqueued.load(std::memory_order_acquire);
+    m_wake.release();
+
+    QDeadlineTimer deadline(timeoutMs);
+    QMutexLocker lock(&m_mutex);
+    while (m_done.load() < target) {
+        if (!m_doneChanged.wait(&m_mutex, deadline)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AuditWriter::markDone(qint64 n) {
+    QMutexLocker lock(&m_mutex);
+    m_done.fetch_add(n);
+    m_doneChanged.wakeAll();
+}
+
+void AuditWriter::run() {
+    // The connection must be created and used on this thread.
+    Database db;
+    bool connected = true;
+    try {
+        db.Connect(m_options);
+    } catch (const std::exception& e) {
+        qWarning() << "AuditWriter: cannot open connection:" << e.what()
+                   << "- queued entries will be recovered from change_journal on restart";
+        connected = false;
+    }
+
+    QList<AuditRecord> batch;
+    for (;;) {
+        m_wake.tryAcquire(1, m_intervalMs);
+        const bool stopping = m_stop.load();
+
+        while (auto r = m_queue.pop()) {
+            batch << std::move(*r);
+        }
+        if (!batch.isEmpty()) {
+            if (!connected) {
+                markDone(batch.size());
+                batch.clear();
+            } else if (db.insertAuditBatch(batch)) {
+                markDone(batch.size());
+                batch.clear();
+            } else {
+                // Keep the batch and retry on the next tick (e.g. the database
+                // was locked). On shutdown give up: recoverAudit() backfills.
+                qWarning() << "AuditWriter: batch of" << batch.size() << "failed:" << db.getLastError();
+                if (stopping) {
+                    markDone(batch.size());
+                    batch.clear();
+                }
+            }
+        }
+        if (stopping && batch.isEmpty() && m_done.load() >= m_enqueued.load()) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef AUDITWRITER_H
+#define AUDITWRITER_H
+
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <memory>
+
+#include "database.hpp"
+#include "mpscqueue.hpp"
+
+// Group-commit audit writer (AuditDurability::GroupCommit).
+//
+// Database hands over audit records after the user's transaction commits;
+// enqueue() is a wait-free push, so the clerk's save no longer pays for the
+// audit insert. A background thread with its own connection wakes every
+// groupCommitMs, drains the queue and writes everything in multi-row INSERTs
+// inside one transaction. Records still queued when the process dies are
+// rebuilt from change_journal by Database::recoverAudit() on the next start.
+class AuditWriter {
+  public:
+    AuditWriter(const ConnOptions& options, int groupCommitMs);
+    ~AuditWriter();  // writes whatever is queued, then stops
+
+    AuditWriter(const AuditWriter&) = delete;
+    AuditWriter& operator=(const AuditWriter&) = delete;
+
+    void enqueue(AuditRecord record);
+
+    // Blocks until every record enqueued before the call is written.
+    bool flush(int timeoutMs = 5000);
+
+    [[nodiscard]] qint64 pending() const { return m_enqueued.load() - m_done.load(); }
+
+  private:
+    void run();
+    void markDone(qint64 n);
+
+    ConnOptions m_options;
+    int m_intervalMs;
+
+    MpscQueue<AuditRecord> m_queue;
+    std::atomic<qint64> m_enqueued{0};
+    std::atomic<qint64> m_done{0};  // written, or given up on (recovered on restart)
+    std::atomic<bool> m_stop{false};
+
+    QSemaphore m_wake;
+    QMutex m_mutex;
+    QWaitCondition m_doneChanged;
+    std::unique_ptr<QThread> m_thread;
+};
+
+#endif  // AUDITWRITER_H
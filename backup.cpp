@@ -0,0 +1,380 @@
+#include "backup.hpp"
+#include "perfstats.hpp"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <algorithm>
+#include <array>
+
+#ifdef HMIS_HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+
+namespace backup {
+
+// ---------------------------------------------------------------------------
+// gzip (no zlib dependency: qCompress output is re-framed as gzip members)
+// ---------------------------------------------------------------------------
+static constexpr std::array<quint32, 256> makeCrcTable() {
+    std::array<quint32, 256> table{};
+    for (quint32 i = 0; i < 256; ++i) {
+        quint32 c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+static constexpr auto kCrcTable = makeCrcTable();
+
+quint32 crc32(const char* data, qint64 size) {
+    quint32 c = 0xFFFFFFFFu;
+    for (qint64 i = 0; i < size; ++i) {
+        c = kCrcTable[(c ^ static_cast<quint8>(data[i])) & 0xFFu] ^ (c >> 8);
+    }
+    return c ^ 0xFFFFFFFFu;
+}
+
+static void putLE32(QByteArray& out, quint32 v) {
+    out.append(static_cast<char>(v & 0xFF));
+    out.append(static_cast<char>((v >> 8) & 0xFF));
+    out.append(static_cast<char>((v >> 16) & 0xFF));
+    out.append(static_cast<char>((v >> 24) & 0xFF));
+}
+
+// One self-contained gzip member (RFC 1952). qCompress returns a 4-byte
+// length prefix followed by a zlib stream; the raw deflate data sits between
+// the 2-byte zlib header and the 4-byte Adler-32 trailer.
+static QByteArray gzipMember(const QByteArray& chunk) {
+    static const char header[10] = {'\x1f', '\x8b', 8, 0, 0, 0, 0, 0, 0, '\xff'};
+    QByteArray out(header, sizeof(header));
+    const QByteArray z = qCompress(chunk, 6);
+    if (z.size() > 10) {
+        out.append(z.constData() + 6, z.size() - 10);
+    } else {
+        out.append("\x03\x00", 2);  // empty final deflate block
+    }
+    putLE32(out, crc32(chunk.constData(), chunk.size()));
+    putLE32(out, static_cast<quint32>(chunk.size()));
+    return out;
+}
+
+bool gzipFile(const QString& srcPath, const QString& destPath, const ProgressFn& progress, QString* error) {
+    constexpr qint64 kChunk = 4 * 1024 * 1024;
+
+    QFile in(srcPath);
+    if (!in.open(QIODevice::ReadOnly)) {
+        *error = "Cannot read " + srcPath;
+        return false;
+    }
+    QFile out(destPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = "Cannot write " + destPath;
+        return false;
+    }
+
+    const qint64 total = in.size();
+    qint64 done = 0;
+    do {
+        const QByteArray chunk = in.read(kChunk);
+        if (out.write(gzipMember(chunk)) < 0) {
+            *error = out.errorString();
+            return false;
+        }
+        done += chunk.size();
+        if (progress && !progress(Phase::Compressing, done, total)) {
+            *error = "Cancelled";
+            return false;
+        }
+    } while (!in.atEnd());
+    return out.flush();
+}
+
+// ---------------------------------------------------------------------------
+// Page copy
+// ---------------------------------------------------------------------------
+#ifdef HMIS_HAVE_SQLITE3
+// Source handles are opened with our own SQLite library, not borrowed from
+// the QSQLITE plugin, which may bundle a different copy. They are kept open
+// for the life of the process on purpose: closing a second handle on a file
+// would drop the POSIX locks the application's own connection holds on it.
+static sqlite3* sourceHandle(const QString& path, QString* error) {
+    static QMutex mutex;
+    static QHash<QString, sqlite3*> handles;
+
+    QMutexLocker lock(&mutex);
+    const QString key = QFileInfo(path).absoluteFilePath();
+    if (sqlite3* h = handles.value(key)) {
+        return h;
+    }
+    sqlite3* h = nullptr;
+    const int rc =
+        sqlite3_open_v2(key.toUtf8().constData(), &h, SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, nullptr);
+    if (rc != SQLITE_OK) {
+        *error = QString::fromUtf8(h ? sqlite3_errmsg(h) : sqlite3_errstr(rc));
+        sqlite3_close(h);
+        return nullptr;
+    }
+    sqlite3_busy_timeout(h, 5000);
+    handles.insert(key, h);
+    return h;
+}
+
+static bool isWal(sqlite3* h) {
+    sqlite3_stmt* st = nullptr;
+    bool wal = false;
+    if (sqlite3_prepare_v2(h, "PRAGMA journal_mode", -1, &st, nullptr) == SQLITE_OK && sqlite3_step(st) == SQLITE_ROW) {
+        wal = qstricmp(reinterpret_cast<const char*>(sqlite3_column_text(st, 0)), "wal") == 0;
+    }
+    sqlite3_finalize(st);
+    return wal;
+}
+
+// Copies pagesPerStep pages at a time. In WAL mode the source connection
+// holds one read transaction for the whole copy: the backup sees a fixed
+// snapshot and is never restarted by commits from other connections, while
+// those writers carry on appending to the WAL.
+static bool copyPages(const QString& srcPath, const QString& destPath, const Options& options,
+                      const ProgressFn& progress, bool* cancelled, QString* error) {
+    sqlite3* src = sourceHandle(srcPath, error);
+    if (src == nullptr) {
+        return false;
+    }
+
+    sqlite3* dest = nullptr;
+    if (sqlite3_open_v2(destPath.toUtf8().constData(), &dest, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) !=
+        SQLITE_OK) {
+        *error = QString::fromUtf8(sqlite3_errmsg(dest));
+        sqlite3_close(dest);
+        return false;
+    }
+
+    const bool snapshot = isWal(src) && sqlite3_exec(src, "BEGIN; SELECT count(*) FROM sqlite_schema;", nullptr,
+                                                     nullptr, nullptr) == SQLITE_OK;
+
+    bool ok = false;
+    sqlite3_backup* b = sqlite3_backup_init(dest, "main", src, "main");
+    if (b == nullptr) {
+        *error = QString::fromUtf8(sqlite3_errmsg(dest));
+    } else {
+        int rc = SQLITE_OK;
+        do {
+            rc = sqlite3_backup_step(b, std::max(options.pagesPerStep, 1));
+            const qint64 total = sqlite3_backup_pagecount(b);
+            const qint64 done = total - sqlite3_backup_remaining(b);
+            if (progress && !progress(Phase::Copying, done, total)) {
+                *cancelled = true;
+                break;
+            }
+            if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+                QThread::msleep(50);
+            } else if (rc == SQLITE_OK && options.stepPauseMs > 0) {
+                QThread::msleep(options.stepPauseMs);
+            }
+        } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+        sqlite3_backup_finish(b);
+        ok = !*cancelled && rc == SQLITE_DONE;
+        if (!ok && !*cancelled) {
+            *error = QString::fromUtf8(sqlite3_errstr(rc));
+        }
+    }
+
+    if (snapshot) {
+        sqlite3_exec(src, "COMMIT", nullptr, nullptr, nullptr);
+    }
+    sqlite3_close(dest);
+    return ok;
+}
+#else
+// VACUUM INTO reads one consistent snapshot (WAL included) without blocking
+// writers, but runs as a single statement: there is no intermediate progress,
+// and a cancel takes effect only once it returns.
+static bool copyPages(const QString& srcPath, const QString& destPath, const Options&, const ProgressFn& progress,
+                      bool* cancelled, QString* error) {
+    static std::atomic<int> nextId{0};
+    const QString name = QString("hmis_backup_%1").arg(nextId.fetch_add(1));
+    bool ok = false;
+    {
+        QSqlDatabase src = QSqlDatabase::addDatabase("QSQLITE", name);
+        src.setDatabaseName(srcPath);
+        src.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+        if (!src.open()) {
+            *error = src.lastError().text();
+        } else {
+            if (progress && !progress(Phase::Copying, 0, 1)) {
+                *cancelled = true;
+            } else {
+                QSqlQuery q(src);
+                q.prepare("VACUUM INTO ?");
+                q.addBindValue(destPath);
+                ok = q.exec();
+                if (!ok) {
+                    *error = q.lastError().text();
+                } else if (progress && !progress(Phase::Copying, 1, 1)) {
+                    *cancelled = true;
+                    ok = false;
+                }
+            }
+            src.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    return ok;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Verification
+// ---------------------------------------------------------------------------
+// Switches the copy to a single-file journal mode and optionally runs
+// PRAGMA integrity_check on it, all on this (worker) thread.
+static bool finalizeCopy(const QString& path, bool verify, QString* error) {
+    static std::atomic<int> nextId{0};
+    const QString name = QString("hmis_backup_check_%1").arg(nextId.fetch_add(1));
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(path);
+        if (!db.open()) {
+            *error = db.lastError().text();
+        } else {
+            QSqlQuery q(db);
+            q.exec("PRAGMA journal_mode=DELETE");
+            ok = true;
+            if (verify) {
+                if (!q.exec("PRAGMA integrity_check")) {
+                    *error = q.lastError().text();
+                    ok = false;
+                } else {
+                    QStringList problems;
+                    while (q.next()) {
+                        const QString line = q.value(0).toString();
+                        if (line != "ok") {
+                            problems << line;
+                        }
+                    }
+                    if (!problems.isEmpty()) {
+                        *error = "Integrity check failed: " + problems.mid(0, 5).join("; ");
+                        ok = false;
+                    }
+                }
+            }
+            q.finish();
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    return ok;
+}
+
+static void removeWithSidecars(const QString& path) {
+    QFile::remove(path);
+    QFile::remove(path + "-wal");
+    QFile::remove(path + "-shm");
+    QFile::remove(path + "-journal");
+}
+
+// ---------------------------------------------------------------------------
+// Entry point
+// ---------------------------------------------------------------------------
+Result run(const QString& srcPath, const QString& destPath, const Options& options, const ProgressFn& progress) {
+    HMIS_PERF_TIMER(timer, "backup");
+    Result result;
+    if (srcPath.isEmpty() || srcPath == ":memory:" || !QFile::exists(srcPath)) {
+        result.message = "Nothing to back up: " + srcPath;
+        timer.fail();
+        return result;
+    }
+    if (QFileInfo(srcPath).absoluteFilePath() == QFileInfo(destPath).absoluteFilePath()) {
+        result.message = "Backup destination is the live database";
+        timer.fail();
+        return result;
+    }
+
+    // The copy is built next to the destination and only renamed into place
+    // once it is complete and verified.
+    const QString copyPath = destPath + ".partial";
+    removeWithSidecars(copyPath);
+
+    bool cancelled = false;
+    QString error;
+    bool ok = copyPages(srcPath, copyPath, options, progress, &cancelled, &error);
+
+    if (ok) {
+        if (progress && !progress(Phase::Verifying, 0, 1)) {
+            cancelled = true;
+            ok = false;
+        } else {
+            ok = finalizeCopy(copyPath, options.verify, &error);
+        }
+    }
+
+    if (ok) {
+        QFile::remove(destPath);
+        if (options.compression == Compression::Gzip) {
+            ok = gzipFile(copyPath, destPath, progress, &error);
+            cancelled = !ok && error == "Cancelled";
+            if (!ok) {
+                QFile::remove(destPath);
+            }
+        } else if (!QFile::rename(copyPath, destPath)) {
+            error = "Cannot move backup into place: " + destPath;
+            ok = false;
+        }
+    }
+    removeWithSidecars(copyPath);
+
+    result.ok = ok;
+    result.cancelled = cancelled;
+    if (ok) {
+        result.bytesWritten = QFileInfo(destPath).size();
+        result.message = destPath;
+        timer.addBytes(result.bytesWritten);
+    } else {
+        result.message = cancelled ? QString("Backup cancelled") : error;
+        timer.fail();
+        if (!cancelled) {
+            qWarning() << "Backup failed:" << error;
+        }
+    }
+    return result;
+}
+
+}  // namespace backup
+
+// ---------------------------------------------------------------------------
+// BackupEngine
+// ---------------------------------------------------------------------------
+BackupEngine::BackupEngine(QObject* parent) : QObject(parent) {}
+
+BackupEngine::~BackupEngine() {
+    m_cancel.store(true);
+    m_future.waitForFinished();
+}
+
+bool BackupEngine::start(const QString& srcPath, const QString& destPath, const backup::Options& options) {
+    if (isRunning()) {
+        return false;
+    }
+    m_cancel.store(false);
+    m_future = QtConcurrent::run([this, srcPath, destPath, options] {
+        const backup::Result r =
+            backup::run(srcPath, destPath, options, [this](backup::Phase phase, qint64 done, qint64 total) {
+                emit progress(static_cast<int>(phase), done, total);
+                return !m_cancel.load();
+            });
+        emit finished(r.ok, r.cancelled, r.message);
+    });
+    return true;
+}
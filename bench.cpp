@@ -0,0 +1,530 @@
+// hmis_bench: times the hot Database paths on synthetic SQLite registers.
+//
+//   hmis_bench [--sizes 10000,100000,1000000] [--iterations N] [--years N]
+//              [--seed N] [--diagnoses FILE] [--dir DIR] [--out FILE]
+//   hmis_bench --selftest
+//   hmis_bench --daemon-test [--clients N] [--rows N] [--hmisd PATH]
+//
+// Results are written as JSON (stdout or --out) so runs can be diffed or
+// tracked over time; a human-readable table goes to stderr. The
+// histogram/<isa> entries fold every seeded row, so their items_per_sec is
+// rows per second for each instruction set this CPU supports, and the
+// parallel*/t<N> entries carry the speedup of N threads over one.
+//
+// --selftest checks the histogram kernels and the chunked parallel folds
+// against the row-by-row Database::build*Stats folds, and that the read
+// mirror picks up journal entries committed out of id order, and that
+// offline edits replay onto the server, and that delta backups carry no
+// password hashes; it exits non-zero on any failure.
+//
+// --daemon-test starts hmisd (next to hmis_bench unless --hmisd is given)
+// on a scratch SQLite file and runs N client processes that each save
+// --rows visits through it, first one request per round trip and then 32
+// in flight. Every saved row must come back exactly once with a distinct IP
+// number; the wall time includes starting the client processes.
+
+#include <QCoreApplication>
+#include <QDate>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSet>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "daemonclient.hpp"
+#include "database.hpp"
+#include "diffbackup.hpp"
+#include "histogram.hpp"
+#include "journalcursor.hpp"
+#include "parallelstats.hpp"
+#include "replicator.hpp"
+#include "synthetic.hpp"
+
+struct BenchResult {
+    QString op;
+    qint64 datasetRows = 0;
+    int iterations = 0;
+    qint64 itemsPerIteration = 0;  // rows touched by one call
+    double minMs = 0;
+    double meanMs = 0;
+    double p50Ms = 0;
+    double maxMs = 0;
+    double speedup = 0;  // against the 1-thread run, for parallel folds
+
+    [[nodiscard]] QJsonObject toJson() const {
+        QJsonObject o;
+        o["op"] = op;
+        o["dataset_rows"] = datasetRows;
+        o["iterations"] = iterations;
+        o["items_per_iteration"] = itemsPerIteration;
+        o["min_ms"] = minMs;
+        o["mean_ms"] = meanMs;
+        o["p50_ms"] = p50Ms;
+        o["max_ms"] = maxMs;
+        o["items_per_sec"] = meanMs > 0 ? static_cast<double>(itemsPerIteration) * 1000.0 / meanMs : 0.0;
+        if (speedup > 0) {
+            o["speedup"] = speedup;
+        }
+        return o;
+    }
+};
+
+static BenchResult timeOp(const QString& op, qint64 datasetRows, int iterations, qint64 items,
+                          const std::function<void(int)>& fn) {
+    QList<double> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        QElapsedTimer t;
+        t.start();
+        fn(i);
+        samples << static_cast<double>(t.nsecsElapsed()) / 1e6;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult r;
+    r.op = op;
+    r.datasetRows = datasetRows;
+    r.iterations = iterations;
+    r.itemsPerIteration = items;
+    if (!samples.isEmpty()) {
+        double sum = 0;
+        for (double s : samples) {
+            sum += s;
+        }
+        r.minMs = samples.first();
+        r.maxMs = samples.last();
+        r.meanMs = sum / static_cast<double>(samples.size());
+        r.p50Ms = samples.at(samples.size() / 2);
+    }
+    return r;
+}
+
+static QString argValue(const QStringList& args, const QString& flag, const QString& fallback = {}) {
+    const qsizetype idx = args.indexOf(flag);
+    if (idx >= 0 && idx + 1 < args.size()) {
+        return args.at(idx + 1);
+    }
+    return fallback;
+}
+
+// Seeds a fresh SQLite file with `rows` visits and times each operation on it.
+static QList<BenchResult> runDataset(const QString& dbPath, qint64 rows, const QStringList& diagnoses,
+                                     const SyntheticConfig& base, int iterations, QTextStream& log) {
+    QList<BenchResult> results;
+    Database db;
+    db.Connect(ConnOptions(SqliteOptions(dbPath)));
+    db.createSchema();
+
+    SyntheticConfig cfg = base;
+    cfg.rows = rows;
+
+    QElapsedTimer seedTimer;
+    seedTimer.start();
+    const qint64 written = seedSyntheticData(db, diagnoses, cfg);
+    if (written != rows) {
+        log << "Seeding failed: " << db.getLastError() << "\n";
+        return results;
+    }
+    BenchResult seed;
+    seed.op = "seedSynthetic";
+    seed.datasetRows = rows;
+    seed.iterations = 1;
+    seed.itemsPerIteration = rows;
+    seed.minMs = seed.meanMs = seed.p50Ms = seed.maxMs = static_cast<double>(seedTimer.nsecsElapsed()) / 1e6;
+    results << seed;
+
+    // The busiest recent month is what a clerk looks at every day.
+    const int year = cfg.lastYear;
+    const int month = 12;
+    const HMISData monthRows = db.fetchHMISData(year, month);
+    const qint64 monthCount = monthRows.size();
+
+    QStringList dxNames;
+    if (auto all = db.getAllDiagnoses()) {
+        for (const Diagnosis& d : *all) {
+            dxNames << d.name;
+        }
+    }
+
+    results << timeOp("fetchHMISData", rows, iterations, monthCount, [&](int) { db.fetchHMISData(year, month); });
+    results << timeOp("buildAttendanceStats", rows, iterations, monthCount,
+                      [&](int) { db.buildAttendanceStats(monthRows); });
+    results << timeOp("buildDiagnosisStats", rows, iterations, monthCount,
+                      [&](int) { db.buildDiagnosisStats(monthRows, dxNames); });
+    results << timeOp("getMonthlySummary", rows, iterations, monthCount,
+                      [&](int) { db.getMonthlySummary(year, month); });
+    results << timeOp("exportCSV", rows, iterations, monthCount, [&](int) { db.exportCSV(year, month); });
+    results << timeOp("nextIPNumber", rows, iterations, 1, [&](int) { db.nextIPNumber(year, month); });
+    // A clerk looking up a returning patient, and a first page of one diagnosis.
+    if (!monthRows.isEmpty() && !dxNames.isEmpty()) {
+        const QString ip = monthRows.first().ipNumber;
+        results << timeOp("searchRegister/ip", rows, iterations, 1, [&](int) { db.searchRegister(ip, 0, 50); });
+        results << timeOp("searchRegister/diagnosis", rows, iterations, 50,
+                          [&](int) { db.searchRegister(dxNames.first(), 0, 50); });
+    }
+
+    SyntheticGenerator gen(diagnoses, cfg.seed + 1);
+    const int firstSerial = db.nextIPNumber(year, month).toInt();
+    results << timeOp("saveNewRow", rows, iterations, 1,
+                      [&](int i) { db.saveNewRow(gen.visit(year, month, firstSerial + i)); });
+
+    // Whole-register folds: the row-by-row path against the coded kernels.
+    const HMISData allRows = db.fetchHMISRange(cfg.lastYear - cfg.years + 1, 1, cfg.lastYear, 12);
+    const qint64 allCount = allRows.size();
+    histogram::CodedRows coded;
+    for (const HMISRow& row : allRows) {
+        if (!coded.append(row)) {
+            log << "Cannot encode the register for the histogram kernels\n";
+            return results;
+        }
+    }
+    results << timeOp("buildAttendanceStats/all", rows, iterations, allCount,
+                      [&](int) { db.buildAttendanceStats(allRows); });
+    results << timeOp("buildDiagnosisStats/all", rows, iterations, allCount,
+                      [&](int) { db.buildDiagnosisStats(allRows, dxNames); });
+    for (histogram::Isa isa : histogram::available()) {
+        const QString suffix = histogram::name(isa);
+        results << timeOp("histogramAttendance/" + suffix, rows, iterations, allCount,
+                          [&](int) { histogram::attendanceStats(coded, isa); });
+        results << timeOp("histogramDiagnoses/" + suffix, rows, iterations, allCount,
+                          [&](int) { histogram::diagnosisStats(coded, isa); });
+    }
+
+    // The same folds chunked across threads; speedup is against one thread.
+    for (const QString& fold : {QString("parallelAttendanceStats"), QString("parallelDiagnosisStats")}) {
+        double oneThreadMs = 0;
+        for (int threads : {1, 2, 4, 8}) {
+            const ParallelOptions options{.threads = threads};
+            BenchResult r = timeOp(QString("%1/t%2").arg(fold).arg(threads), rows, iterations, allCount, [&](int) {
+                if (fold == "parallelAttendanceStats") {
+                    parallel::attendanceStats(db, allRows, options);
+                } else {
+                    parallel::diagnosisStats(db, allRows, dxNames, options);
+                }
+            });
+            if (threads == 1) {
+                oneThreadMs = r.meanMs;
+            }
+            r.speedup = r.meanMs > 0 ? oneThreadMs / r.meanMs : 0;
+            results << r;
+        }
+    }
+    return results;
+}
+
+// ---------------------------------------------------------------------------
+// hmisd load test
+// ---------------------------------------------------------------------------
+
+static const QString kDaemonUser = "bench";
+static const QString kDaemonPassword = "bench-password";
+
+// One --daemon-worker process: saves --rows visits through hmisd with at
+// most --pipeline requests awaiting replies.
+static int runDaemonWorker(const QStringList& args, const QStringList& diagnoses, QTextStream& log) {
+    const int rows = std::max(1, argValue(args, "--rows", "1000").toInt());
+    const int pipeline = std::max(1, argValue(args, "--pipeline", "1").toInt());
+    const int worker = argValue(args, "--worker", "0").toInt();
+    const int year = argValue(args, "--year").toInt();
+    const int month = argValue(args, "--month").toInt();
+
+    DaemonOptions options(argValue(args, "--daemon-worker"));
+    options.username = kDaemonUser;
+    options.password = kDaemonPassword;
+    DaemonClient client{options};
+    QString error;
+    if (!client.open(&error)) {
+        log << "Worker " << worker << ": " << error << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // One block for all rows, as a clerk's reservation would be.
+    qint64 first = -1;
+    if (const auto reply = client.call(hmisd::Op::ReserveIpNumbers, hmisd::pack(year, month, rows))) {
+        QDataStream in(*reply);
+        in.setVersion(QDataStream::Qt_6_0);
+        in >> first >> error;
+    } else {
+        error = client.lastError();
+    }
+    if (first < 0) {
+        log << "Worker " << worker << ": cannot reserve IP numbers: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0;
+    auto settle = [&](quint32 id) {
+        bool ok = false;
+        QString why;
+        if (const auto reply = client.wait(id)) {
+            QDataStream in(*reply);
+            in.setVersion(QDataStream::Qt_6_0);
+            in >> ok >> why;
+        } else {
+            why = client.lastError();
+        }
+        if (!ok && failures++ == 0) {
+            log << "Worker " << worker << ": save failed: " << why << "\n";
+        }
+    };
+
+    // Each wait() also sends whatever was queued since the last one.
+    SyntheticGenerator gen(diagnoses, 1000 + quint32(worker));
+    QList<quint32> inFlight;
+    for (int i = 0; i < rows; ++i) {
+        if (inFlight.size() == pipeline) {
+            settle(inFlight.takeFirst());
+        }
+        inFlight << client.send(hmisd::Op::SaveNewRow, hmisd::pack(gen.visit(year, month, int(first) + i), 0));
+    }
+    for (quint32 id : inFlight) {
+        settle(id);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static QList<BenchResult> runDaemonTest(const QStringList& args, const QString& dir, QTextStream& log) {
+    const int clients = std::max(1, argValue(args, "--clients", "4").toInt());
+    const int rows = std::max(1, argValue(args, "--rows", "2000").toInt());
+    const QString hmisdPath = argValue(args, "--hmisd", QDir(QCoreApplication::applicationDirPath()).filePath("hmisd"));
+    const QString dbPath = QDir(dir).filePath("hmis_bench_hmisd.sqlite3");
+    const QString address = QString("hmisd-bench-%1").arg(QCoreApplication::applicationPid());
+    QFile::remove(dbPath);
+
+    QProcess daemon;
+    daemon.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("HMIS_DB_DRIVER", "sqlite3");
+    env.remove("HMISD_LISTEN");
+    env.remove("HMISD_TOKEN");
+    daemon.setProcessEnvironment(env);
+    daemon.start(hmisdPath, {"--sqlite", dbPath, "--local", address, "--listen", ""});
+    if (!daemon.waitForStarted()) {
+        log << "Cannot start " << hmisdPath << ": " << daemon.errorString() << "\n";
+        return {};
+    }
+    struct StopDaemon {
+        QProcess& process;
+        ~StopDaemon() {
+            process.terminate();
+            if (!process.waitForFinished(10000)) {
+                process.kill();
+            }
+        }
+    } stopDaemon{daemon};
+
+    // Connect() throws until hmisd has opened the file and is listening.
+    Database db;
+    bool up = false;
+    for (int attempt = 0; attempt < 100 && !up && daemon.state() == QProcess::Running; ++attempt) {
+        try {
+            db.Connect(ConnOptions(DaemonOptions(address)));
+            up = true;
+        } catch (const std::exception&) {
+            QThread::msleep(100);
+        }
+    }
+    if (!up) {
+        log << "hmisd did not come up on " << address << "\n";
+        return {};
+    }
+    // hmisd serves signed-in users only; the workers sign in as this one.
+    if (!db.createUser(kDaemonUser, kDaemonPassword, UserRole::Admin) ||
+        !db.authenticate(kDaemonUser, kDaemonPassword)) {
+        log << "Cannot sign in to hmisd: " << db.getLastError() << "\n";
+        return {};
+    }
+
+    const int year = QDate::currentDate().year();
+    const qint64 total = qint64(clients) * rows;
+    QList<BenchResult> results;
+    int month = 0;
+    for (int pipeline : {1, 32}) {
+        ++month;  // a fresh month per round, so each can be checked alone
+        log << "Saving " << total << " rows from " << clients << " clients, " << pipeline << " in flight...\n";
+        log.flush();
+
+        std::vector<std::unique_ptr<QProcess>> workers;
+        QElapsedTimer wall;
+        wall.start();
+        for (int k = 0; k < clients; ++k) {
+            auto worker = std::make_unique<QProcess>();
+            worker->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+            worker->start(QCoreApplication::applicationFilePath(),
+                          {"--daemon-worker", address, "--rows", QString::number(rows), "--pipeline",
+                           QString::number(pipeline), "--worker", QString::number(k), "--year", QString::number(year),
+                           "--month", QString::number(month)});
+            workers.push_back(std::move(worker));
+        }
+        bool ok = true;
+        for (const auto& worker : workers) {
+            ok = worker->waitForFinished(-1) && worker->exitStatus() == QProcess::NormalExit &&
+                 worker->exitCode() == EXIT_SUCCESS && ok;
+        }
+        const double ms = static_cast<double>(wall.nsecsElapsed()) / 1e6;
+        if (!ok) {
+            log << "A client process failed\n";
+            return {};
+        }
+
+        const HMISData saved = db.fetchHMISData(year, month);
+        QSet<QString> ipNumbers;
+        for (const HMISRow& row : saved) {
+            ipNumbers.insert(row.ipNumber);
+        }
+        if (saved.size() != total || ipNumbers.size() != total) {
+            log << QString("Expected %1 rows with distinct IP numbers, found %2 rows and %3 numbers\n")
+                       .arg(total)
+                       .arg(saved.size())
+                       .arg(ipNumbers.size());
+            return {};
+        }
+
+        BenchResult r;
+        r.op = QString("hmisdSaveNewRow/c%1/p%2").arg(clients).arg(pipeline);
+        r.datasetRows = total;
+        r.iterations = 1;
+        r.itemsPerIteration = total;
+        r.minMs = r.meanMs = r.p50Ms = r.maxMs = ms;
+        results << r;
+    }
+    return results;
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("hmis_bench");
+    Q_INIT_RESOURCE(CoreResources);
+
+    const QStringList args = QCoreApplication::arguments();
+    QTextStream log(stderr);
+
+    QList<qint64> sizes;
+    for (const QString& s : argValue(args, "--sizes", "10000,100000,1000000").split(',', Qt::SkipEmptyParts)) {
+        sizes << s.trimmed().toLongLong();
+    }
+    const int iterations = std::max(1, argValue(args, "--iterations", "20").toInt());
+
+    SyntheticConfig base;
+    base.lastYear = QDate::currentDate().year() - 1;  // a full, closed year
+    base.years = std::max(1, argValue(args, "--years", "5").toInt());
+    base.seed = argValue(args, "--seed", "105").toUInt();
+
+    const QStringList diagnoses = loadDiagnosisNames(argValue(args, "--diagnoses", ":/diagnoses.txt"));
+    if (diagnoses.isEmpty()) {
+        log << "No diagnoses loaded; pass --diagnoses FILE\n";
+        return EXIT_FAILURE;
+    }
+
+    if (args.contains("--selftest")) {
+        const Database db;  // the folds need no connection
+        QString report;
+        bool ok = histogram::selfTest(db, diagnoses, 10007, &report);
+        log << (ok ? "PASS: " : "FAIL: ") << "histogram: " << report << "\n";
+        if (ok) {
+            ok = parallel::selfTest(db, diagnoses, 10007, &report);
+            log << (ok ? "PASS: " : "FAIL: ") << "parallel: " << report << "\n";
+        }
+        if (ok) {
+            ok = journal::selfTest(&report);
+            log << (ok ? "PASS: " : "FAIL: ") << "journal: " << report << "\n";
+        }
+        if (ok) {
+            ok = replication::selfTest(&report);
+            log << (ok ? "PASS: " : "FAIL: ") << "replication: " << report << "\n";
+        }
+        if (ok) {
+            ok = diffbackup::selfTest(&report);
+            log << (ok ? "PASS: " : "FAIL: ") << "diffbackup: " << report << "\n";
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (args.contains("--daemon-worker")) {
+        return runDaemonWorker(args, diagnoses, log);
+    }
+
+    QTemporaryDir tmp;
+    const QString dir = argValue(args, "--dir", tmp.path());
+    QDir().mkpath(dir);
+
+    QJsonArray results;
+    auto report = [&](const QList<BenchResult>& rs) {
+        for (const BenchResult& r : rs) {
+            log << QString("%1 %2  mean %3 ms  p50 %4 ms  max %5 ms")
+                       .arg(r.op, -32)
+                       .arg(r.datasetRows, 9)
+                       .arg(r.meanMs, 9, 'f', 3)
+                       .arg(r.p50Ms, 9, 'f', 3)
+                       .arg(r.maxMs, 9, 'f', 3);
+            if (r.speedup > 0) {
+                log << QString("  x%1").arg(r.speedup, 0, 'f', 2);
+            }
+            log << "\n";
+            results.append(r.toJson());
+        }
+        log.flush();
+    };
+
+    const bool daemonTest = args.contains("--daemon-test");
+    if (daemonTest) {
+        const QList<BenchResult> rs = runDaemonTest(args, dir, log);
+        if (rs.isEmpty()) {
+            log << "FAIL: hmisd\n";
+            return EXIT_FAILURE;
+        }
+        report(rs);
+    }
+    for (qint64 size : daemonTest ? QList<qint64>() : sizes) {
+        const QString dbPath = QDir(dir).filePath(QString("hmis_bench_%1.sqlite3").arg(size));
+        QFile::remove(dbPath);
+        log << "Seeding " << size << " rows into " << dbPath << "...\n";
+        log.flush();
+
+        try {
+            report(runDataset(dbPath, size, diagnoses, base, iterations, log));
+        } catch (const std::exception& e) {
+            log << "Benchmark failed: " << e.what() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    QJsonObject root;
+    root["benchmark"] = "hmis_bench";
+    root["version"] = QString(HMIS_VERSION);
+    root["driver"] = daemonTest ? "HMISD" : "QSQLITE";
+    root["qt_version"] = QString(qVersion());
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["threads"] = QThread::idealThreadCount();
+    root["histogram_isa"] = histogram::name(histogram::best());
+    root["iterations"] = iterations;
+    root["seed"] = static_cast<qint64>(base.seed);
+    root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    root["results"] = results;
+
+    const QByteArray json = QJsonDocument(root).toJson();
+    const QString outPath = argValue(args, "--out");
+    if (outPath.isEmpty()) {
+        QTextStream(stdout) << json;
+        return EXIT_SUCCESS;
+    }
+    QFile out(outPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        log << "Cannot write " << outPath << "\n";
+        return EXIT_FAILURE;
+    }
+    out.write(json);
+    return EXIT_SUCCESS;
+}
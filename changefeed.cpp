@@ -0,0 +1,247 @@
+#include "changefeed.hpp"
+#include "perfstats.hpp"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QUuid>
+
+namespace changefeed {
+
+static const QByteArray kMagic("HMISFED1");
+static constexpr quint32 kFormatVersion = 1;
+static constexpr int kPageSize = 5000;
+
+static const QString kFacilityIdKey = "feed.facility_id";
+static const QString kFacilityCodeKey = "feed.facility_code";
+static const QString kAckedKey = "feed.acked_version";
+
+// ---------------------------------------------------------------------------
+// Facility side
+// ---------------------------------------------------------------------------
+QString facilityId(Database& db) {
+    QString id = db.getState(kFacilityIdKey);
+    if (id.isEmpty()) {
+        id = QUuid::createUuid().toString(QUuid::WithoutBraces);
+        if (!db.setState(kFacilityIdKey, id)) {
+            return {};
+        }
+    }
+    return id;
+}
+
+qint64 acknowledgedVersion(Database& db) { return db.getState(kAckedKey, "0").toLongLong(); }
+
+bool acknowledge(Database& db, qint64 version, QString* error) {
+    const qint64 current = db.maxChangeId();
+    if (current < 0) {
+        *error = db.getLastError();
+        return false;
+    }
+    if (version < 0 || version > current) {
+        *error = QString("Version %1 is outside this database's feed (0-%2).").arg(version).arg(current);
+        return false;
+    }
+    if (!db.setState(kAckedKey, QString::number(version))) {
+        *error = db.getLastError();
+        return false;
+    }
+    return true;
+}
+
+static QByteArray compactJson(const QJsonObject& row) {
+    return row.isEmpty() ? QByteArray() : QJsonDocument(row).toJson(QJsonDocument::Compact);
+}
+
+bool exportFeed(Database& db, const QString& facilityCode, const QString& path, std::optional<qint64> since,
+                FeedBundle* bundle, QString* error) {
+    HMIS_PERF_TIMER(timer, "exportFeed");
+    QString code = db.getState(kFacilityCodeKey);
+    if (!facilityCode.isEmpty() && facilityCode != code) {
+        if (!code.isEmpty()) {
+            *error = QString("This facility exports as %1; the central server knows it by that code.").arg(code);
+            timer.fail();
+            return false;
+        }
+        if (facilityCode.contains('/') || !db.setState(kFacilityCodeKey, facilityCode)) {
+            *error = facilityCode.contains('/') ? "Facility codes cannot contain '/'." : db.getLastError();
+            timer.fail();
+            return false;
+        }
+        code = facilityCode;
+    }
+    if (code.isEmpty()) {
+        *error = "No facility code set; pass one with the first export.";
+        timer.fail();
+        return false;
+    }
+
+    FeedBundle out;
+    out.facilityId = facilityId(db);
+    out.facilityCode = code;
+    out.fromVersion = since ? *since : acknowledgedVersion(db);
+    out.toVersion = db.maxChangeId();
+    out.snapshot = out.fromVersion == 0;
+    out.createdAt = QDateTime::currentDateTime().toString(Qt::ISODate);
+    if (out.facilityId.isEmpty() || out.toVersion < 0) {
+        *error = db.getLastError();
+        timer.fail();
+        return false;
+    }
+
+    QByteArray payload;
+    QDataStream ps(&payload, QIODevice::WriteOnly);
+    ps.setVersion(QDataStream::Qt_6_0);
+    qint64 count = 0;
+
+    if (out.snapshot) {
+        // Rows written after toVersion was read may show up here too; the next
+        // bundle replays them and the importer treats that as an update.
+        for (const QString table : {QString("diagnoses"), QString("hmis")}) {
+            qint64 cursor = 0;
+            for (;;) {
+                const auto page = db.tableImages(table, cursor, kPageSize);
+                if (!page) {
+                    *error = db.getLastError();
+                    timer.fail();
+                    return false;
+                }
+                if (page->isEmpty()) {
+                    break;
+                }
+                for (const QJsonObject& row : *page) {
+                    cursor = row.value("id").toInteger();
+                    ps << out.toVersion << table << QString("UPSERT") << qint32(cursor) << compactJson(row);
+                    ++count;
+                }
+            }
+        }
+    } else {
+        qint64 cursor = out.fromVersion;
+        while (cursor < out.toVersion) {
+            const auto page = db.getChangesSince(cursor, kPageSize);
+            if (!page) {
+                *error = db.getLastError();
+                timer.fail();
+                return false;
+            }
+            if (page->isEmpty()) {
+                break;
+            }
+            for (const ChangeEntry& e : *page) {
+                if (e.id > out.toVersion) {
+                    break;  // the next bundle picks it up
+                }
+                if (e.tableName != "hmis" && e.tableName != "diagnoses") {
+                    continue;
+                }
+                // Entries stay separate and in order: merging a row's changes
+                // could reorder IP number swaps between rows.
+                ps << e.id << e.tableName << QString(e.op == "DELETE" ? "DELETE" : "UPSERT") << qint32(e.recordId)
+                   << e.after;
+                ++count;
+            }
+            cursor = page->last().id;
+        }
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *error = "Cannot write " + path;
+        timer.fail();
+        return false;
+    }
+    file.write(kMagic);
+    QDataStream fs(&file);
+    fs.setVersion(QDataStream::Qt_6_0);
+    fs << kFormatVersion << out.facilityId << out.facilityCode << out.fromVersion << out.toVersion << out.snapshot
+       << count << out.createdAt << qCompress(payload, 9);
+    if (!file.commit()) {
+        *error = file.errorString();
+        timer.fail();
+        return false;
+    }
+
+    timer.addRows(count);
+    timer.addBytes(payload.size());
+    *bundle = out;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Central side
+// ---------------------------------------------------------------------------
+bool readBundle(const QString& path, FeedBundle* bundle, QString* error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = "Cannot read " + path;
+        return false;
+    }
+    if (file.read(kMagic.size()) != kMagic) {
+        *error = path + " is not an HMIS sync bundle";
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 version = 0;
+    in >> version;
+    if (version != kFormatVersion) {
+        *error = QString("%1: unsupported bundle format version %2").arg(path).arg(version);
+        return false;
+    }
+    qint64 count = 0;
+    QByteArray compressed;
+    in >> bundle->facilityId >> bundle->facilityCode >> bundle->fromVersion >> bundle->toVersion >>
+        bundle->snapshot >> count >> bundle->createdAt >> compressed;
+    if (in.status() != QDataStream::Ok) {
+        *error = path + " is truncated";
+        return false;
+    }
+
+    const QByteArray payload = qUncompress(compressed);
+    if (payload.isEmpty() && count > 0) {
+        *error = path + " is corrupt";
+        return false;
+    }
+    QDataStream ps(payload);
+    ps.setVersion(QDataStream::Qt_6_0);
+    bundle->entries.clear();
+    bundle->entries.reserve(count);
+    for (qint64 i = 0; i < count; ++i) {
+        FeedEntry e;
+        qint32 recordId = 0;
+        QByteArray row;
+        ps >> e.version >> e.tableName >> e.op >> recordId >> row;
+        e.recordId = recordId;
+        if (!row.isEmpty()) {
+            e.row = QJsonDocument::fromJson(row).object();
+        }
+        bundle->entries << e;
+    }
+    if (ps.status() != QDataStream::Ok) {
+        *error = path + " is corrupt";
+        return false;
+    }
+    return true;
+}
+
+qint64 importFeed(Database& central, const QString& path, FeedBundle* bundle, QString* error) {
+    HMIS_PERF_TIMER(timer, "importFeed");
+    if (!readBundle(path, bundle, error)) {
+        timer.fail();
+        return -1;
+    }
+    const qint64 applied = central.applyFeedBundle(*bundle);
+    if (applied < 0) {
+        *error = central.getLastError();
+        timer.fail();
+        return -1;
+    }
+    timer.addRows(applied);
+    return applied;
+}
+
+}  // namespace changefeed
@@ -0,0 +1,51 @@
+#ifndef CHANGEFEED_H
+#define CHANGEFEED_H
+
+#include <QString>
+#include <optional>
+
+#include "database.hpp"
+
+// Incremental multi-facility sync.
+//
+// A facility's change_journal is its change feed: ids increase monotonically,
+// so the id of the newest entry is the database's version. exportFeed()
+// writes the hmis and diagnoses entries after the version the central server
+// last acknowledged, so a bundle grows with the activity since then rather
+// than with the size of the database. Only the very first bundle (nothing
+// acknowledged yet) is a snapshot of both tables.
+//
+// The central server applies bundles with Database::applyFeedBundle(), which
+// remembers the last version imported per facility: importing a bundle twice,
+// or one that overlaps the previous, is harmless, while a gap is refused.
+// Facility row ids map to central ids through feed_rows, and IP numbers are
+// stored with the facility code in front ("KAB/12").
+//
+// Bundle layout: the 8-byte magic "HMISFED1", then a QDataStream with the
+// format version, facility id and code, the (from, to] version range, the
+// snapshot flag, the entry count, the creation time and a qCompress'd block
+// of entries (version, table, op, facility row id, compact JSON row).
+namespace changefeed {
+
+// Random id of this database, created on first use and kept in app_state.
+QString facilityId(Database& db);
+
+// Version the central server has confirmed it holds (0 = none yet).
+qint64 acknowledgedVersion(Database& db);
+bool acknowledge(Database& db, qint64 version, QString* error);
+
+// Writes the changes after since (default: the acknowledged version) to
+// path. facilityCode is remembered after the first export and may then be
+// left empty. On success *bundle describes what was written (no entries).
+bool exportFeed(Database& db, const QString& facilityCode, const QString& path, std::optional<qint64> since,
+                FeedBundle* bundle, QString* error);
+
+bool readBundle(const QString& path, FeedBundle* bundle, QString* error);
+
+// Central side: reads path and applies it. Returns the entries applied
+// (0 when it was already imported) or -1.
+qint64 importFeed(Database& central, const QString& path, FeedBundle* bundle, QString* error);
+
+}  // namespace changefeed
+
+#endif  // CHANGEFEED_H
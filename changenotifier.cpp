@@ -0,0 +1,213 @@
+#include "changenotifier.hpp"
+#include "database.hpp"
+#include "journalcursor.hpp"
+#include "perfstats.hpp"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QHash>
+#include <QJsonDocument>
+#include <QTimer>
+#include <algorithm>
+#include <utility>
+
+static const QString kChannel = "hmis_changes";
+static constexpr int kPageSize = 1000;
+static constexpr int kMaxRowsPerEvent = 500;  // beyond this a reload is cheaper
+static constexpr int kListenSafetyMs = 30000;  // PostgreSQL: catch notifications missed while reconnecting
+static constexpr int kRetryMs = 15000;
+
+// Lives on the notifier's thread and owns everything used there.
+class ChangeWatcher : public QObject {
+  public:
+    ChangeWatcher(ChangeNotifier* owner, ConnOptions options, int pollMs)
+        : m_owner(owner), m_options(std::move(options)), m_pollMs(pollMs) {}
+
+    void start() {
+        m_timer = new QTimer(this);
+        connect(m_timer, &QTimer::timeout, this, [this] { tick(); });
+        tick();
+    }
+
+    void tick() {
+        if (!ensureConnected()) {
+            return;
+        }
+        if (m_listening) {
+            readJournal();
+            return;
+        }
+        // Cheap probes first; the journal is read only when something moved.
+        const qint64 version = m_db.dataVersion();
+        if (version >= 0) {
+            if (version != m_dataVersion) {
+                m_dataVersion = version;
+                readJournal();
+            }
+            return;
+        }
+        const qint64 newest = m_db.maxChangeId();
+        if (newest < 0) {
+            lostConnection();
+        } else if (newest > m_cursor.position() || m_cursor.hasGaps()) {
+            readJournal();  // a late commit below newest does not move it
+        }
+    }
+
+  private:
+    bool ensureConnected() {
+        if (m_connected) {
+            return true;
+        }
+        try {
+            if (m_connectCalled) {
+                if (!m_db.reconnect()) {
+                    throw std::runtime_error(m_db.getLastError().toStdString());
+                }
+            } else {
+                m_connectCalled = true;
+                m_db.Connect(m_options);
+            }
+        } catch (const std::exception& e) {
+            qWarning() << "ChangeNotifier: cannot connect:" << e.what();
+            m_timer->start(kRetryMs);
+            return false;
+        }
+
+        m_connected = true;
+        if (!m_started) {
+            // Only report what happens from now on.
+            const qint64 newest = m_db.maxChangeId();
+            if (newest < 0 || !m_cursor.startAt(m_db, newest, QDateTime::currentMSecsSinceEpoch())) {
+                lostConnection();
+                return false;
+            }
+            m_started = true;
+        }
+        m_dataVersion = -1;
+        if (QSqlDriver* driver = m_db.listen(kChannel)) {
+            if (!m_listening) {
+                connect(driver, &QSqlDriver::notification, this, [this](const QString& name) {
+                    if (name == kChannel) {
+                        readJournal();
+                    }
+                });
+                m_listening = true;
+            }
+            m_timer->start(kListenSafetyMs);
+        } else {
+            m_timer->start(m_pollMs);
+        }
+        return true;
+    }
+
+    void lostConnection() {
+        qWarning() << "ChangeNotifier: lost connection:" << m_db.getLastError();
+        m_connected = false;
+        m_timer->start(kRetryMs);
+    }
+
+    void readJournal() {
+        HMIS_PERF_TIMER(timer, "readChangeFeed");
+        QHash<int, QList<RowChange>> months;  // year * 100 + month
+        bool diagnoses = false;
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        qint64 after = m_cursor.readFrom();
+        for (;;) {
+            const auto page = m_db.getRegisterChangesSince(after, kPageSize);
+            if (!page) {
+                timer.fail();
+                lostConnection();
+                break;
+            }
+            for (const ChangeEntry& e : *page) {
+                if (!m_cursor.accept(e.id, now)) {
+                    continue;  // re-read while looking for a late commit below it
+                }
+                if (e.tableName == "diagnoses") {
+                    diagnoses = true;
+                } else if (e.tableName == "hmis") {
+                    const bool deleted = e.op == "DELETE";
+                    const QJsonObject image = QJsonDocument::fromJson(deleted ? e.before : e.after).object();
+                    HMISRow row = m_db.rowFromImage(image);
+                    row.id = e.recordId;
+                    QList<RowChange>& changes = months[(row.year * 100) + row.month];
+                    if (changes.size() <= kMaxRowsPerEvent) {
+                        changes << RowChange{.id = e.recordId, .deleted = deleted, .row = deleted ? HMISRow{} : row};
+                    }
+                }
+            }
+            timer.addRows(page->size());
+            if (page->size() < kPageSize) {
+                break;
+            }
+            after = page->last().id;
+        }
+        m_cursor.expire(now);
+
+        for (auto it = months.begin(); it != months.end(); ++it) {
+            const bool tooMany = it.value().size() > kMaxRowsPerEvent;
+            emit m_owner->monthChanged(it.key() / 100, it.key() % 100, tooMany ? QList<RowChange>() : it.value());
+        }
+        if (diagnoses) {
+            emit m_owner->diagnosesChanged();
+        }
+    }
+
+    ChangeNotifier* m_owner;
+    ConnOptions m_options;
+    int m_pollMs;
+    Database m_db;
+    QTimer* m_timer = nullptr;
+    bool m_connectCalled = false;
+    bool m_connected = false;
+    bool m_listening = false;
+    bool m_started = false;
+    JournalCursor m_cursor;
+    qint64 m_dataVersion = -1;
+};
+
+void applyRowChanges(QList<HMISRow>& rows, const QList<RowChange>& changes) {
+    QHash<int, qsizetype> index;
+    for (qsizetype i = 0; i < rows.size(); ++i) {
+        index.insert(rows.at(i).id, i);
+    }
+    bool removed = false;
+    for (const RowChange& c : changes) {
+        const auto it = index.constFind(c.id);
+        if (c.deleted) {
+            if (it != index.constEnd()) {
+                rows[*it].id = 0;  // compacted below
+                index.remove(c.id);
+                removed = true;
+            }
+        } else if (it != index.constEnd()) {
+            rows[*it] = c.row;
+        } else {
+            index.insert(c.id, rows.size());
+            rows << c.row;
+        }
+    }
+    if (removed) {
+        rows.removeIf([](const HMISRow& r) { return r.id == 0; });
+    }
+}
+
+ChangeNotifier::ChangeNotifier(const ConnOptions& options, int pollMs, QObject* parent)
+    : QObject(parent), m_watcher(new ChangeWatcher(this, options, std::max(pollMs, 100))) {
+    m_watcher->moveToThread(&m_thread);
+    // Deleted on its own thread, where its connection was opened.
+    connect(&m_thread, &QThread::finished, m_watcher, &QObject::deleteLater);
+    m_thread.setObjectName("ChangeNotifier");
+    m_thread.start();
+    QMetaObject::invokeMethod(m_watcher, [watcher = m_watcher] { watcher->start(); });
+}
+
+void ChangeNotifier::checkNow() {
+    QMetaObject::invokeMethod(m_watcher, [watcher = m_watcher] { watcher->tick(); });
+}
+
+ChangeNotifier::~ChangeNotifier() {
+    m_thread.quit();
+    m_thread.wait();
+}
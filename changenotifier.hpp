@@ -0,0 +1,57 @@
+#ifndef CHANGENOTIFIER_H
+#define CHANGENOTIFIER_H
+
+#include <QList>
+#include <QObject>
+#include <QThread>
+
+#include "HMISRow.hpp"
+#include "databaseOptions.hpp"
+
+// One register row committed by some client. row holds the new contents;
+// it is unset for deletes.
+struct RowChange {
+    int id = 0;
+    bool deleted = false;
+    HMISRow row;
+};
+
+class ChangeWatcher;
+
+// Applies changes to rows loaded earlier: updates and inserts by id, drops
+// deleted ids.
+void applyRowChanges(QList<HMISRow>& rows, const QList<RowChange>& changes);
+
+// Tells open windows what other clients changed in the shared database, so
+// they can patch what they show instead of reloading it.
+//
+// How a commit is noticed depends on the driver:
+//   PostgreSQL - a trigger on change_journal NOTIFYs "hmis_changes"; the
+//                notifier LISTENs on its own connection.
+//   SQLite     - PRAGMA data_version moves whenever another connection
+//                commits; it is polled on a timer.
+//   MySQL      - the newest change_journal id is polled on a timer.
+// The notifier then reads the new change_journal entries, which name each
+// row that changed. All database work happens on a worker thread; the
+// signals arrive queued on the receivers' threads.
+class ChangeNotifier : public QObject {
+    Q_OBJECT
+  public:
+    explicit ChangeNotifier(const ConnOptions& options, int pollMs = 1000, QObject* parent = nullptr);
+    ~ChangeNotifier() override;
+
+    // Looks for new changes now instead of at the next poll, e.g. right
+    // after this client saved so its own write shows without a reload.
+    void checkNow();
+
+  signals:
+    // rows is empty when too many rows changed at once; reload the month.
+    void monthChanged(int year, int month, const QList<RowChange>& rows);
+    void diagnosesChanged();
+
+  private:
+    QThread m_thread;
+    ChangeWatcher* m_watcher;  // lives on m_thread
+};
+
+#endif  // CHANGENOTIFIER_H
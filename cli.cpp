@@ -0,0 +1,633 @@
+// hmis_cli: headless maintenance commands against the configured database.
+//
+//   hmis_cli --create-superuser
+//   hmis_cli --seed-synthetic N
+//   hmis_cli --export-csv YEAR-MONTH [--out FILE]
+//   hmis_cli --backup FILE [--no-verify]
+//   hmis_cli --backup-delta FILE
+//   hmis_cli --restore BASE [DELTA...] --to FILE
+//   hmis_cli --archive-audit [--keep-months N]
+//   hmis_cli --sync-status | --sync-now | --sync-retry SEQ | --sync-discard SEQ
+//   hmis_cli --feed-export FILE [--facility CODE] [--since VERSION]
+//   hmis_cli --feed-import BUNDLE... | --feed-ack VERSION
+//   hmis_cli --maintain [--vacuum]
+//   hmis_cli --columnar-export FIRST[-LAST] [--out FILE]
+//   hmis_cli --range-report FROM TO [--threads N]
+//   hmis_cli --migrate [--from SPEC] --to SPEC [--chunk-rows N] [--no-copy]
+//   hmis_cli --search TEXT [--page N] | --rebuild-search
+//
+// Connection settings come from the same environment variables as the GUI.
+// --perf-json FILE writes per-operation timings when the command finishes.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <algorithm>
+#include <optional>
+
+#include "auditarchive.hpp"
+#include "changefeed.hpp"
+#include "colarchive.hpp"
+#include "config.hpp"
+#include "database.hpp"
+#include "diffbackup.hpp"
+#include "maintenance.hpp"
+#include "migrate.hpp"
+#include "outbox.hpp"
+#include "perfstats.hpp"
+#include "replicator.hpp"
+#include "synthetic.hpp"
+
+static QString argValue(const QStringList& args, const QString& flag) {
+    const qsizetype idx = args.indexOf(flag);
+    if (idx >= 0 && idx + 1 < args.size()) {
+        return args.at(idx + 1);
+    }
+    return {};
+}
+
+static void usage(QTextStream& out) {
+    out << "Usage: hmis_cli <command> [options]\n"
+           "  --create-superuser              Create an admin account (prompts for credentials)\n"
+           "  --seed-synthetic N              Insert N synthetic visits\n"
+           "  --export-csv YEAR-MONTH         Write the month's register as CSV (--out FILE)\n"
+           "  --backup FILE                   Online SQLite backup; FILE ending in .gz is gzip-compressed\n"
+           "                                  (--no-verify skips the integrity check)\n"
+           "  --backup-delta FILE             Write changes since the last backup to a delta file\n"
+           "  --restore BASE [DELTA...]       Rebuild a database from a full backup plus deltas (--to FILE)\n"
+           "  --archive-audit                 Move closed audit months to segment files (--keep-months N)\n"
+           "  --sync-status                   List offline-first writes waiting for the server and conflicts\n"
+           "  --sync-now                      Push the outbox to the server and exit\n"
+           "  --sync-retry SEQ                Queue a conflicting outbox entry again\n"
+           "  --sync-discard SEQ              Drop a conflicting outbox entry\n"
+           "  --feed-export FILE              Write changes since the last acknowledged version to a sync bundle\n"
+           "                                  (--facility CODE on the first export, --since VERSION to resend)\n"
+           "  --feed-import BUNDLE...         Apply facility bundles to this (central) database\n"
+           "  --feed-ack VERSION              Record that the central server holds changes up to VERSION\n"
+           "  --maintain                      SQLite checkpoint, ANALYZE and incremental vacuum\n"
+           "                                  (--vacuum first converts an older file to incremental vacuum)\n"
+           "  --columnar-export FIRST[-LAST]  Write closed years to a columnar archive for range reports\n"
+           "                                  (--out FILE; default is the configured archive directory)\n"
+           "  --range-report FROM TO          Monthly totals and top diagnoses for YEAR-MONTH..YEAR-MONTH\n"
+           "                                  (--threads N; default reports/threads, 0 = one per core)\n"
+           "  --migrate --to SPEC             Copy every table to another driver and verify it (--from SPEC,\n"
+           "                                  default HMIS_DB_DRIVER; SPEC is sqlite:PATH, sqlite3, postgresql\n"
+           "                                  or mysql; --chunk-rows N, --no-copy)\n"
+           "  --search TEXT                   Register rows of any month matching an IP number or diagnosis\n"
+           "                                  (--page N, 50 rows a page)\n"
+           "  --rebuild-search                Refill the full-text search index from the register\n"
+           "  --perf-json FILE                Dump per-operation timings on exit\n";
+}
+
+static int createSuperuser(Database& db, QTextStream& qout) {
+    QTextStream qin(stdin);
+    qout << "Create superuser (admin)\n";
+    qout << "Username: ";
+    qout.flush();
+    QString username = qin.readLine().trimmed();
+    if (username.isEmpty()) {
+        qout << "Username cannot be empty.\n";
+        return EXIT_FAILURE;
+    }
+    if (db.userExists(username)) {
+        qout << "User already exists.\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Password: ";
+    qout.flush();
+    QString password = qin.readLine();
+    if (password.isEmpty()) {
+        qout << "Password cannot be empty.\n";
+        return EXIT_FAILURE;
+    }
+    if (db.createUser(username, password, UserRole::Admin)) {
+        qout << "Superuser created successfully.\n";
+        return EXIT_SUCCESS;
+    }
+    qout << "Failed to create superuser: " << db.getLastError() << "\n";
+    return EXIT_FAILURE;
+}
+
+// "YEAR-MONTH" into *year and *month.
+static bool parsePeriod(const QString& period, int* year, int* month) {
+    const QStringList parts = period.split('-');
+    bool okYear = false;
+    bool okMonth = false;
+    *year = parts.value(0).toInt(&okYear);
+    *month = parts.value(1).toInt(&okMonth);
+    return parts.size() == 2 && okYear && okMonth && *month >= 1 && *month <= 12;
+}
+
+static int exportCsv(Database& db, const QString& period, const QString& outPath, QTextStream& qout) {
+    int year = 0;
+    int month = 0;
+    if (!parsePeriod(period, &year, &month)) {
+        qout << "Expected YEAR-MONTH, e.g. 2024-03\n";
+        return EXIT_FAILURE;
+    }
+
+    const QByteArray csv = db.exportCSV(year, month).toUtf8();
+    if (outPath.isEmpty()) {
+        qout << csv;
+        return EXIT_SUCCESS;
+    }
+    QFile f(outPath);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qout << "Cannot write to: " << outPath << "\n";
+        return EXIT_FAILURE;
+    }
+    f.write(csv);
+    return EXIT_SUCCESS;
+}
+
+static int columnarExport(Database& db, const QString& years, const QString& outArg, QTextStream& qout) {
+    bool okFirst = false;
+    bool okLast = false;
+    const int first = years.section('-', 0, 0).toInt(&okFirst);
+    const int last = years.contains('-') ? years.section('-', 1, 1).toInt(&okLast) : first;
+    if (!okFirst || (years.contains('-') && !okLast)) {
+        qout << "Expected YEAR or FIRST-LAST, e.g. 2019-2023\n";
+        return EXIT_FAILURE;
+    }
+    const ColumnarStore store(loadColumnarDir());
+    const QString path = outArg.isEmpty() ? store.pathFor(first, last) : outArg;
+    if (outArg.isEmpty() && !QDir().mkpath(store.dir())) {
+        qout << "Cannot create " << store.dir() << "\n";
+        return EXIT_FAILURE;
+    }
+    QString error;
+    if (!ColumnArchive::write(db, first, last, path, &error)) {
+        qout << "Columnar export failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Wrote " << path << " (" << QFileInfo(path).size() / 1024 << " KiB)\n";
+    return EXIT_SUCCESS;
+}
+
+static int rangeReport(Database& db, const QStringList& args, QTextStream& qout) {
+    const qsizetype idx = args.indexOf("--range-report");
+    int fromYear = 0;
+    int fromMonth = 0;
+    int toYear = 0;
+    int toMonth = 0;
+    if (!parsePeriod(args.value(idx + 1), &fromYear, &fromMonth) ||
+        !parsePeriod(args.value(idx + 2), &toYear, &toMonth) || (fromYear * 12) + fromMonth > (toYear * 12) + toMonth) {
+        qout << "Expected FROM TO as YEAR-MONTH, e.g. 2019-01 2023-12\n";
+        return EXIT_FAILURE;
+    }
+
+    ParallelOptions parallel = loadParallelOptions();
+    if (args.contains("--threads")) {
+        parallel.threads = std::max(argValue(args, "--threads").toInt(), 0);
+    }
+    ColumnarStore store(loadColumnarDir(), parallel);
+    store.load();
+    const RangeReport report = store.report(db, fromYear, fromMonth, toYear, toMonth, {});
+
+    qout << "Month      Patients  New\n";
+    qint64 patients = 0;
+    for (const MonthTotals& t : report.months) {
+        qout << QString("%1-%2  %3  %4\n")
+                    .arg(t.year)
+                    .arg(t.month, 2, 10, QChar('0'))
+                    .arg(t.patients, 9)
+                    .arg(t.newAttendances, 5);
+        patients += t.patients;
+    }
+
+    QList<QPair<qint64, QString>> totals;
+    for (auto it = report.diagnoses.data.begin(); it != report.diagnoses.data.end(); ++it) {
+        qint64 n = 0;
+        for (const CategoryCount& c : *it) {
+            n += c.total();
+        }
+        totals << qMakePair(n, it.key());
+    }
+    std::sort(totals.begin(), totals.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    qout << "\nTop diagnoses\n";
+    for (qsizetype i = 0; i < std::min<qsizetype>(totals.size(), 10); ++i) {
+        qout << QString("%1  %2\n").arg(totals.at(i).first, 9).arg(totals.at(i).second);
+    }
+    qout << "\n" << patients << " visits, " << report.archivedRows << " read from columnar archives.\n";
+    return EXIT_SUCCESS;
+}
+
+static int backupDatabase(Database& db, const QString& destPath, bool verify, QTextStream& qout) {
+    backup::Options options;
+    options.verify = verify;
+    if (destPath.endsWith(".gz", Qt::CaseInsensitive)) {
+        options.compression = backup::Compression::Gzip;
+    }
+    QString error;
+    if (!diffbackup::writeFull(db, destPath, options, &error)) {
+        qout << "Backup failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Backed up to " << destPath << "\n";
+    return EXIT_SUCCESS;
+}
+
+static int backupDelta(Database& db, const QString& destPath, QTextStream& qout) {
+    QString error;
+    const qint64 n = diffbackup::writeDelta(db, destPath, &error);
+    if (n < 0) {
+        qout << "Differential backup failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Wrote " << n << " changes to " << destPath << "\n";
+    return EXIT_SUCCESS;
+}
+
+// --restore BASE [DELTA...] --to FILE. Works on files only; no connection needed.
+static int restoreChain(const QStringList& args, QTextStream& qout) {
+    QStringList files;
+    for (qsizetype i = args.indexOf("--restore") + 1; i < args.size() && !args.at(i).startsWith("--"); ++i) {
+        files << args.at(i);
+    }
+    const QString target = argValue(args, "--to");
+    if (files.isEmpty() || target.isEmpty()) {
+        qout << "Usage: hmis_cli --restore BASE [DELTA...] --to FILE\n";
+        return EXIT_FAILURE;
+    }
+    QString error;
+    if (!diffbackup::restore(files.takeFirst(), files, target, &error)) {
+        qout << "Restore failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Restored to " << target << "\n";
+    return EXIT_SUCCESS;
+}
+
+// --migrate [--from SPEC] --to SPEC. Opens its own two connections.
+static int migrateDatabase(const QStringList& args, QTextStream& qout) {
+    const QString toSpec = argValue(args, "--to");
+    if (toSpec.isEmpty()) {
+        qout << "Usage: hmis_cli --migrate [--from SPEC] --to SPEC [--chunk-rows N] [--no-copy]\n";
+        return EXIT_FAILURE;
+    }
+    migrate::Options options;
+    if (args.contains("--chunk-rows")) {
+        options.chunkRows = std::max(argValue(args, "--chunk-rows").toInt(), 1);
+    }
+    options.useCopy = !args.contains("--no-copy");
+
+    ConnOptions from;
+    ConnOptions to;
+    try {
+        from = args.contains("--from") ? connOptionsFor(argValue(args, "--from")) : loadConnOptions();
+        to = connOptionsFor(toSpec);
+    } catch (const std::exception& e) {
+        qout << "Database error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Migrating " << from.getDriverName() << " to " << to.getDriverName()
+         << (options.useCopy && migrate::copyAvailable() ? "" : " (without COPY)") << "\n";
+    qout.flush();
+
+    QList<migrate::TableReport> report;
+    QString error;
+    const bool ok = migrate::run(from, to, options, &report, &error, [&](const migrate::TableReport& r) {
+        qout << QString("  %1 %2 rows in %3 ms%4\n")
+                    .arg(r.table, -16)
+                    .arg(r.rows, 10)
+                    .arg(r.ms, 0, 'f', 1)
+                    .arg(r.copied ? " (COPY)" : "");
+        qout.flush();
+    });
+    if (!ok) {
+        qout << "Migration failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qint64 rows = 0;
+    for (const migrate::TableReport& r : report) {
+        rows += r.rows;
+    }
+    qout << "Copied and verified " << rows << " rows in " << report.size() << " tables\n";
+    return EXIT_SUCCESS;
+}
+
+static int archiveAudit(Database& db, const AuditConfig& cfg, const QString& keepArg, QTextStream& qout) {
+    const int keepMonths = keepArg.isEmpty() ? cfg.keepMonths : keepArg.toInt();
+    if (keepMonths < 1) {
+        qout << "--keep-months must be at least 1.\n";
+        return EXIT_FAILURE;
+    }
+    AuditArchive archive(cfg.archiveDir);
+    QString error;
+    const qint64 n = archiveClosedAuditPeriods(db, archive, keepMonths, &error);
+    if (n < 0) {
+        qout << "Audit archival failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Archived " << n << " audit entries to " << archive.dir() << "\n";
+    return EXIT_SUCCESS;
+}
+
+static int maintain(Database& db, bool convert, QTextStream& qout) {
+    if (convert) {
+        qout << "Rebuilding the file for incremental vacuum (other clients wait)...\n";
+        qout.flush();
+        if (!db.enableIncrementalVacuum()) {
+            qout << "VACUUM failed: " << db.getLastError() << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    const qint64 walBefore = db.walSizeBytes();
+    QString error;
+    if (!runMaintenance(db, &error)) {
+        qout << "Maintenance failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Checkpointed " << walBefore / 1024 << " KiB of WAL, refreshed statistics.\n";
+    return EXIT_SUCCESS;
+}
+
+static int searchRegister(Database& db, const QString& text, const QString& pageArg, QTextStream& qout) {
+    static constexpr int kPageRows = 50;
+    const int page = pageArg.isEmpty() ? 1 : pageArg.toInt();
+    if (page < 1) {
+        qout << "Expected --page N with N >= 1\n";
+        return EXIT_FAILURE;
+    }
+    const std::optional<HMISData> rows = db.searchRegister(text, (page - 1) * kPageRows, kPageRows);
+    if (!rows) {
+        qout << "Search failed: " << db.getLastError() << "\n";
+        return EXIT_FAILURE;
+    }
+    for (const HMISRow& r : *rows) {
+        qout << QString("%1-%2").arg(r.year).arg(r.month, 2, 10, QChar('0')) << '\t' << r.ipNumber << '\t'
+             << r.ageCategory << '\t' << r.sex << '\t' << r.newAttendance << '\t' << r.diagnoses.join(", ") << "\n";
+    }
+    if (rows->size() == kPageRows) {
+        qout << "More with --page " << page + 1 << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+// --sync-status / --sync-retry / --sync-discard work on the outbox file alone.
+static int syncOutbox(const QStringList& args, QTextStream& qout) {
+    Outbox outbox(loadSyncConfig().outboxPath);
+    QString error;
+    if (!outbox.open(&error)) {
+        qout << "Cannot open outbox " << outbox.path() << ": " << error << "\n";
+        return EXIT_FAILURE;
+    }
+
+    const QString retrySeq = argValue(args, "--sync-retry");
+    if (!retrySeq.isEmpty()) {
+        if (!outbox.requeue(retrySeq.toLongLong())) {
+            qout << outbox.lastError() << "\n";
+            return EXIT_FAILURE;
+        }
+        qout << "Entry " << retrySeq << " queued again.\n";
+        return EXIT_SUCCESS;
+    }
+    const QString discardSeq = argValue(args, "--sync-discard");
+    if (!discardSeq.isEmpty()) {
+        if (!outbox.discard(discardSeq.toLongLong())) {
+            qout << outbox.lastError() << "\n";
+            return EXIT_FAILURE;
+        }
+        qout << "Entry " << discardSeq << " discarded.\n";
+        return EXIT_SUCCESS;
+    }
+
+    qout << "Outbox: " << outbox.path() << "\n";
+    qout << "Waiting: " << outbox.count("pending") << "\n";
+    const QList<PendingWrite> conflicts = outbox.conflicts();
+    qout << "Conflicts: " << conflicts.size() << "\n";
+    for (const PendingWrite& w : conflicts) {
+        qout << "  #" << w.seq << " " << w.op << " record " << w.recordId << " ip "
+             << w.after.value("ip_number").toString() << " (" << w.createdAt << "): " << w.lastError << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+static int syncNow(Database& db, QTextStream& qout) {
+    Outbox outbox(loadSyncConfig().outboxPath);
+    QString error;
+    if (!outbox.open(&error)) {
+        qout << "Cannot open outbox " << outbox.path() << ": " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    outbox.resetInflight();  // assumes the GUI is not syncing the same file right now
+
+    qint64 applied = 0;
+    qint64 conflicts = 0;
+    for (;;) {
+        const SyncPass pass = replicatePending(db, outbox, 500);
+        applied += pass.applied;
+        conflicts += pass.conflicts;
+        if (!pass.ok) {
+            qout << "Sync stopped: " << pass.error << "\n";
+            return EXIT_FAILURE;
+        }
+        if (pass.applied + pass.conflicts == 0) {
+            break;
+        }
+    }
+    qout << "Pushed " << applied << " entries, " << conflicts << " new conflict(s).\n";
+    return conflicts > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int feedExport(Database& db, const QStringList& args, QTextStream& qout) {
+    std::optional<qint64> since;
+    const QString sinceArg = argValue(args, "--since");
+    if (!sinceArg.isEmpty()) {
+        since = sinceArg.toLongLong();
+    }
+    const QString path = argValue(args, "--feed-export");
+    FeedBundle bundle;
+    QString error;
+    if (!changefeed::exportFeed(db, argValue(args, "--facility"), path, since, &bundle, &error)) {
+        qout << "Export failed: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << (bundle.snapshot ? "Snapshot" : "Changes") << " of " << bundle.facilityCode << " up to version "
+         << bundle.toVersion << " written to " << path << "\n";
+    return EXIT_SUCCESS;
+}
+
+static int feedImport(Database& db, const QStringList& args, QTextStream& qout) {
+    QStringList files;
+    for (qsizetype i = args.indexOf("--feed-import") + 1; i < args.size() && !args.at(i).startsWith("--"); ++i) {
+        files << args.at(i);
+    }
+    if (files.isEmpty()) {
+        qout << "Usage: hmis_cli --feed-import BUNDLE...\n";
+        return EXIT_FAILURE;
+    }
+    // Oldest first, whatever order the shell listed them in.
+    QList<std::pair<qint64, QString>> ordered;
+    for (const QString& path : files) {
+        FeedBundle bundle;
+        QString error;
+        if (!changefeed::readBundle(path, &bundle, &error)) {
+            qout << error << "\n";
+            return EXIT_FAILURE;
+        }
+        ordered << std::make_pair(bundle.fromVersion, path);
+    }
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    for (const auto& [from, path] : ordered) {
+        FeedBundle bundle;
+        QString error;
+        const qint64 n = changefeed::importFeed(db, path, &bundle, &error);
+        if (n < 0) {
+            qout << path << ": import failed: " << error << "\n";
+            return EXIT_FAILURE;
+        }
+        qout << path << ": " << bundle.facilityCode << " " << n << " change(s) applied; acknowledge with "
+             << "--feed-ack " << bundle.toVersion << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+static int feedAck(Database& db, const QString& versionArg, QTextStream& qout) {
+    bool ok = false;
+    const qint64 version = versionArg.toLongLong(&ok);
+    QString error;
+    if (!ok || !changefeed::acknowledge(db, version, &error)) {
+        qout << (ok ? error : "Expected a version number.") << "\n";
+        return EXIT_FAILURE;
+    }
+    qout << "Next export starts after version " << version << "\n";
+    return EXIT_SUCCESS;
+}
+
+static int run(const QStringList& args, QTextStream& qout) {
+    if (args.contains("--restore")) {
+        return restoreChain(args, qout);
+    }
+    if (args.contains("--migrate")) {
+        return migrateDatabase(args, qout);
+    }
+    if (args.contains("--sync-status") || args.contains("--sync-retry") || args.contains("--sync-discard")) {
+        return syncOutbox(args, qout);
+    }
+
+    Database db;
+    try {
+        db.Connect(loadConnOptions());
+        db.createSchema();
+    } catch (const std::exception& e) {
+        qout << "Database error: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    const AuditConfig auditCfg = loadAuditConfig();
+    db.recoverAudit();
+    db.setAuditDurability(auditCfg.durability, auditCfg.groupCommitMs);
+    // A one-shot command gains nothing from loading a mirror; replicas still apply.
+    const QString readEndpoint = loadReadEndpoint();
+    if (!readEndpoint.isEmpty() && readEndpoint != "mirror") {
+        try {
+            db.useReadReplica(replicaOptions(loadConnOptions(), readEndpoint));
+        } catch (const std::exception& e) {
+            qout << "Read endpoint unavailable, using the primary: " << e.what() << "\n";
+        }
+    }
+
+    if (args.contains("--create-superuser")) {
+        return createSuperuser(db, qout);
+    }
+
+    const QString seedArg = argValue(args, "--seed-synthetic");
+    if (!seedArg.isEmpty()) {
+        SyntheticConfig cfg;
+        cfg.rows = seedArg.toLongLong();
+        qint64 n = seedSyntheticData(db, loadDiagnosisNames(":/diagnoses.txt"), cfg);
+        if (n < 0) {
+            qout << "Seeding failed: " << db.getLastError() << "\n";
+            return EXIT_FAILURE;
+        }
+        qout << "Inserted " << n << " synthetic rows.\n";
+        return EXIT_SUCCESS;
+    }
+
+    const QString period = argValue(args, "--export-csv");
+    if (!period.isEmpty()) {
+        return exportCsv(db, period, argValue(args, "--out"), qout);
+    }
+
+    const QString backupPath = argValue(args, "--backup");
+    if (!backupPath.isEmpty()) {
+        return backupDatabase(db, backupPath, !args.contains("--no-verify"), qout);
+    }
+
+    const QString deltaPath = argValue(args, "--backup-delta");
+    if (!deltaPath.isEmpty()) {
+        return backupDelta(db, deltaPath, qout);
+    }
+
+    if (args.contains("--sync-now")) {
+        return syncNow(db, qout);
+    }
+
+    if (args.contains("--archive-audit")) {
+        return archiveAudit(db, auditCfg, argValue(args, "--keep-months"), qout);
+    }
+
+    if (args.contains("--feed-export")) {
+        return feedExport(db, args, qout);
+    }
+    if (args.contains("--feed-import")) {
+        return feedImport(db, args, qout);
+    }
+    const QString ackArg = argValue(args, "--feed-ack");
+    if (!ackArg.isEmpty()) {
+        return feedAck(db, ackArg, qout);
+    }
+
+    const QString columnarArg = argValue(args, "--columnar-export");
+    if (!columnarArg.isEmpty()) {
+        return columnarExport(db, columnarArg, argValue(args, "--out"), qout);
+    }
+    if (args.contains("--range-report")) {
+        return rangeReport(db, args, qout);
+    }
+
+    if (args.contains("--maintain")) {
+        return maintain(db, args.contains("--vacuum"), qout);
+    }
+
+    const QString searchArg = argValue(args, "--search");
+    if (!searchArg.isEmpty()) {
+        return searchRegister(db, searchArg, argValue(args, "--page"), qout);
+    }
+    if (args.contains("--rebuild-search")) {
+        if (!db.rebuildSearchIndex()) {
+            qout << "Rebuilding the search index failed: " << db.getLastError() << "\n";
+            return EXIT_FAILURE;
+        }
+        qout << (db.hasSearchIndex() ? "Search index rebuilt.\n" : "This database has no search index; searches scan.\n");
+        return EXIT_SUCCESS;
+    }
+
+    usage(qout);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("HMIS");
+    app.setOrganizationName("Yo Medical Files (U) Limited");
+    app.setOrganizationDomain("yomedicalfiles.com");
+    Q_INIT_RESOURCE(CoreResources);
+
+    const QStringList args = QCoreApplication::arguments();
+    QTextStream qout(stdout);
+    const int rc = run(args, qout);
+
+    const QString perfPath = argValue(args, "--perf-json");
+    if (!perfPath.isEmpty()) {
+        QFile f(perfPath);
+        if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+            f.write(PerfRegistry::instance().toJson().toJson());
+        }
+    }
+    return rc;
+}
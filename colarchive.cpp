@@ -0,0 +1,485 @@
+#include "colarchive.hpp"
+#include "backup.hpp"
+#include "histogram.hpp"
+#include "perfstats.hpp"
+
+#include <QDataStream>
+#include <QDate>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QSysInfo>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+static const char kMagic[8] = {'H', 'M', 'I', 'S', 'C', 'O', 'L', '1'};
+static constexpr quint32 kFormatVersion = 1;
+
+namespace {
+
+struct Header {
+    char magic[8];
+    quint32 version;
+    quint32 headerSize;
+    qint32 firstYear;
+    qint32 lastYear;
+    quint64 rows;
+    quint64 dxEntries;
+    qint64 sourceVersion;  // change_journal id at export
+    quint64 monthIndex;    // section offsets from the start of the file
+    quint64 age;
+    quint64 sex;
+    quint64 attendance;
+    quint64 dxOffsets;
+    quint64 dxIds;
+    quint64 dictionary;
+    quint64 dictionarySize;
+    quint64 fileSize;
+    quint32 crc;  // of bytes [headerSize, fileSize)
+    quint32 reserved;
+};
+static_assert(sizeof(Header) == 128, "Header is written as raw bytes");
+
+// Month number from year 0, so ranges can be compared and iterated.
+int monthNumber(int year, int month) { return (year * 12) + month - 1; }
+
+// Sums per-worker dense counts into the first.
+std::vector<quint32> sumPartials(std::vector<std::vector<quint32>>& partials) {
+    std::vector<quint32> counts = std::move(partials.front());
+    for (std::size_t p = 1; p < partials.size(); ++p) {
+        for (std::size_t c = 0; c < counts.size(); ++c) {
+            counts[c] += partials[p][c];
+        }
+    }
+    return counts;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Writing
+// ---------------------------------------------------------------------------
+bool ColumnArchive::write(Database& db, int firstYear, int lastYear, const QString& path, QString* error) {
+    HMIS_PERF_TIMER(timer, "writeColumnArchive");
+    if constexpr (QSysInfo::ByteOrder != QSysInfo::LittleEndian) {
+        *error = "Columnar archives need a little-endian machine";
+        return false;
+    }
+    if (firstYear > lastYear || lastYear >= QDate::currentDate().year()) {
+        *error = QString("Only closed years (before %1) can be archived").arg(QDate::currentDate().year());
+        return false;
+    }
+    const qint64 sourceVersion = db.maxChangeId();
+    if (sourceVersion < 0) {
+        *error = db.getLastError();
+        timer.fail();
+        return false;
+    }
+
+    const int months = (lastYear - firstYear + 1) * 12;
+    std::vector<quint32> monthIndex(months + 1, 0);
+    histogram::CodedRows coded;
+    for (int year = firstYear; year <= lastYear; ++year) {
+        // Ordered by year, month, id, so counting per month then summing
+        // gives each month's first row.
+        const HMISData rows = db.fetchHMISRange(year, 1, year, 12);
+        for (const HMISRow& row : rows) {
+            const int m = monthNumber(row.year, row.month) - monthNumber(firstYear, 1);
+            if (row.month < 1 || row.month > 12 || m < 0 || m >= months) {
+                continue;
+            }
+            if (!coded.append(row)) {
+                *error = "Too many distinct age, sex, attendance or diagnosis values for the column codes";
+                timer.fail();
+                return false;
+            }
+            ++monthIndex[m + 1];
+        }
+    }
+    if (coded.size() == 0) {
+        *error = QString("No visits recorded in %1-%2").arg(firstYear).arg(lastYear);
+        timer.fail();
+        return false;
+    }
+    for (int m = 0; m < months; ++m) {
+        monthIndex[m + 1] += monthIndex[m];
+    }
+
+    QByteArray file(sizeof(Header), '\0');
+    auto section = [&file](const void* data, qint64 bytes) -> quint64 {
+        file.append((8 - (file.size() % 8)) % 8, '\0');
+        const auto offset = static_cast<quint64>(file.size());
+        file.append(static_cast<const char*>(data), bytes);
+        return offset;
+    };
+    QByteArray dictionary;
+    {
+        QDataStream ds(&dictionary, QIODevice::WriteOnly);
+        ds.setVersion(QDataStream::Qt_6_0);
+        ds << coded.ageNames << coded.sexNames << coded.attendanceNames << coded.dxNames;
+    }
+
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kFormatVersion;
+    h.headerSize = sizeof(Header);
+    h.firstYear = firstYear;
+    h.lastYear = lastYear;
+    h.rows = coded.size();
+    h.dxEntries = coded.dxIds.size();
+    h.sourceVersion = sourceVersion;
+    h.monthIndex = section(monthIndex.data(), qint64(monthIndex.size() * sizeof(quint32)));
+    h.age = section(coded.age.data(), coded.size());
+    h.sex = section(coded.sex.data(), coded.size());
+    h.attendance = section(coded.attendance.data(), coded.size());
+    h.dxOffsets = section(coded.dxOffsets.data(), qint64(coded.dxOffsets.size() * sizeof(quint32)));
+    h.dxIds = section(coded.dxIds.data(), qint64(coded.dxIds.size() * sizeof(quint16)));
+    h.dictionary = section(dictionary.constData(), dictionary.size());
+    h.dictionarySize = dictionary.size();
+    file.append((8 - (file.size() % 8)) % 8, '\0');
+    h.fileSize = file.size();
+    h.crc = backup::crc32(file.constData() + sizeof(Header), file.size() - qint64(sizeof(Header)));
+    std::memcpy(file.data(), &h, sizeof(Header));
+
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(file) != file.size() || !out.commit()) {
+        *error = "Cannot write " + path + ": " + out.errorString();
+        timer.fail();
+        return false;
+    }
+
+    ColumnArchive check;
+    if (!check.open(path, error) || check.rowCount() != qint64(h.rows)) {
+        QFile::remove(path);
+        if (error->isEmpty()) {
+            *error = "Verification failed for " + path;
+        }
+        timer.fail();
+        return false;
+    }
+    timer.addRows(qint64(h.rows));
+    timer.addBytes(file.size());
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+ColumnArchive::~ColumnArchive() { close(); }
+
+void ColumnArchive::close() {
+    if (m_file.isOpen()) {
+        m_file.close();  // also unmaps
+    }
+    m_buffer.reset();
+    m_base = nullptr;
+    m_rows = 0;
+    m_ageNames.clear();
+    m_sexNames.clear();
+    m_attendanceNames.clear();
+    m_dxNames.clear();
+}
+
+bool ColumnArchive::open(const QString& path, QString* error) {
+    HMIS_PERF_TIMER(timer, "openColumnArchive");
+    close();
+    m_path = path;
+    auto fail = [&](const QString& why) {
+        *error = path + ": " + why;
+        close();
+        timer.fail();
+        return false;
+    };
+    if constexpr (QSysInfo::ByteOrder != QSysInfo::LittleEndian) {
+        return fail("columnar archives need a little-endian machine");
+    }
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return fail(m_file.errorString());
+    }
+    const qint64 size = m_file.size();
+    if (size < qint64(sizeof(Header))) {
+        return fail("not a columnar archive");
+    }
+    if (uchar* mapped = m_file.map(0, size)) {
+        m_base = mapped;
+    } else {
+        // Keep 8-byte alignment for the typed section pointers.
+        m_buffer.reset(new quint64[(size + 7) / 8]);
+        if (m_file.read(reinterpret_cast<char*>(m_buffer.get()), size) != size) {
+            return fail(m_file.errorString());
+        }
+        m_base = reinterpret_cast<const uchar*>(m_buffer.get());
+    }
+
+    Header h{};
+    std::memcpy(&h, m_base, sizeof(Header));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.headerSize != sizeof(Header)) {
+        return fail("not a columnar archive");
+    }
+    if (h.version != kFormatVersion) {
+        return fail(QString("unsupported format version %1").arg(h.version));
+    }
+    if (h.fileSize != quint64(size)) {
+        return fail("truncated");
+    }
+    if (h.crc != backup::crc32(reinterpret_cast<const char*>(m_base) + sizeof(Header), size - qint64(sizeof(Header)))) {
+        return fail("checksum mismatch");
+    }
+
+    const quint64 months = quint64(h.lastYear - h.firstYear + 1) * 12;
+    auto inBounds = [size](quint64 offset, quint64 bytes) {
+        return offset % 8 == 0 && offset >= sizeof(Header) && offset <= quint64(size) &&
+               bytes <= quint64(size) - offset;
+    };
+    if (h.firstYear > h.lastYear || h.lastYear - h.firstYear >= 1000 ||
+        h.rows > std::numeric_limits<quint32>::max() || h.dxEntries > std::numeric_limits<quint32>::max() ||
+        !inBounds(h.monthIndex, (months + 1) * sizeof(quint32)) || !inBounds(h.age, h.rows) ||
+        !inBounds(h.sex, h.rows) || !inBounds(h.attendance, h.rows) ||
+        !inBounds(h.dxOffsets, (h.rows + 1) * sizeof(quint32)) || !inBounds(h.dxIds, h.dxEntries * sizeof(quint16)) ||
+        !inBounds(h.dictionary, h.dictionarySize)) {
+        return fail("corrupt header");
+    }
+
+    {
+        QDataStream ds(QByteArray::fromRawData(reinterpret_cast<const char*>(m_base + h.dictionary),
+                                               qsizetype(h.dictionarySize)));
+        ds.setVersion(QDataStream::Qt_6_0);
+        ds >> m_ageNames >> m_sexNames >> m_attendanceNames >> m_dxNames;
+        if (ds.status() != QDataStream::Ok || m_ageNames.size() > 256 || m_sexNames.size() > 256 ||
+            m_attendanceNames.size() > 256 || m_dxNames.size() > 65536) {
+            return fail("corrupt dictionary");
+        }
+    }
+
+    m_monthIndex = reinterpret_cast<const quint32*>(m_base + h.monthIndex);
+    m_age = m_base + h.age;
+    m_sex = m_base + h.sex;
+    m_attendance = m_base + h.attendance;
+    m_dxOffsets = reinterpret_cast<const quint32*>(m_base + h.dxOffsets);
+    m_dxIds = reinterpret_cast<const quint16*>(m_base + h.dxIds);
+
+    // Validate once so the scans can index the dictionaries unchecked.
+    if (m_monthIndex[0] != 0 || m_monthIndex[months] != h.rows || m_dxOffsets[0] != 0 ||
+        m_dxOffsets[h.rows] != h.dxEntries) {
+        return fail("corrupt index");
+    }
+    for (quint64 m = 0; m < months; ++m) {
+        if (m_monthIndex[m] > m_monthIndex[m + 1]) {
+            return fail("corrupt month index");
+        }
+    }
+    for (quint64 r = 0; r < h.rows; ++r) {
+        if (m_age[r] >= m_ageNames.size() || m_sex[r] >= m_sexNames.size() ||
+            m_attendance[r] >= m_attendanceNames.size() || m_dxOffsets[r] > m_dxOffsets[r + 1]) {
+            return fail("corrupt row columns");
+        }
+    }
+    for (quint64 i = 0; i < h.dxEntries; ++i) {
+        if (m_dxIds[i] >= m_dxNames.size()) {
+            return fail("corrupt diagnosis column");
+        }
+    }
+
+    m_firstYear = h.firstYear;
+    m_lastYear = h.lastYear;
+    m_rows = qint64(h.rows);
+    m_sourceVersion = h.sourceVersion;
+    timer.addRows(m_rows);
+    timer.addBytes(size);
+    return true;
+}
+
+bool ColumnArchive::clip(int fromYear, int fromMonth, int toYear, int toMonth, int* first, int* last) const {
+    if (!isOpen()) {
+        return false;
+    }
+    const int base = monthNumber(m_firstYear, 1);
+    *first = std::max(monthNumber(fromYear, fromMonth) - base, 0);
+    *last = std::min(monthNumber(toYear, toMonth) - base, ((m_lastYear - m_firstYear + 1) * 12) - 1);
+    return *first <= *last;
+}
+
+MonthlyStats ColumnArchive::attendanceStats(int fromYear, int fromMonth, int toYear, int toMonth,
+                                            const ParallelOptions& options) const {
+    HMIS_PERF_TIMER(timer, "archiveAttendanceStats");
+    int first = 0;
+    int last = 0;
+    if (!clip(fromYear, fromMonth, toYear, toMonth, &first, &last)) {
+        return {};
+    }
+    const auto ages = static_cast<int>(m_ageNames.size());
+    const auto sexes = static_cast<int>(m_sexNames.size());
+    const auto cells = static_cast<int>(m_attendanceNames.size() * ages * sexes);
+    const quint32 begin = m_monthIndex[first];
+    const quint32 end = m_monthIndex[last + 1];
+    std::vector<std::vector<quint32>> partials(parallel::workersFor(end - begin, options),
+                                               std::vector<quint32>(cells, 0));
+    parallel::forEachChunk(end - begin, options, [&](qint64 from, qint64 to, int worker) {
+        const qint64 r = begin + from;
+        histogram::countCells(m_attendance + r, m_age + r, m_sex + r, to - from, ages, sexes,
+                              partials[worker].data(), cells);
+    });
+    timer.addRows(end - begin);
+    return histogram::toStats(sumPartials(partials), m_attendanceNames, m_ageNames, m_sexNames);
+}
+
+MonthlyStats ColumnArchive::diagnosisStats(int fromYear, int fromMonth, int toYear, int toMonth,
+                                           const ParallelOptions& options) const {
+    HMIS_PERF_TIMER(timer, "archiveDiagnosisStats");
+    int first = 0;
+    int last = 0;
+    if (!clip(fromYear, fromMonth, toYear, toMonth, &first, &last)) {
+        return {};
+    }
+    const auto ages = static_cast<int>(m_ageNames.size());
+    const auto sexes = static_cast<int>(m_sexNames.size());
+    const auto cells = static_cast<int>(m_dxNames.size() * ages * sexes);
+    const quint32 begin = m_monthIndex[first];
+    const quint32 end = m_monthIndex[last + 1];
+    std::vector<std::vector<quint32>> partials(parallel::workersFor(end - begin, options),
+                                               std::vector<quint32>(cells, 0));
+    parallel::forEachChunk(end - begin, options, [&](qint64 from, qint64 to, int worker) {
+        const qint64 r = begin + from;
+        // dxOffsets keeps absolute positions, so dxIds is passed unshifted.
+        histogram::countDiagnoses(m_dxOffsets + r, m_dxIds, m_age + r, m_sex + r, to - from, ages, sexes,
+                                  partials[worker].data(), cells);
+    });
+    timer.addRows(end - begin);
+    return histogram::toStats(sumPartials(partials), m_dxNames, m_ageNames, m_sexNames);
+}
+
+QList<MonthTotals> ColumnArchive::monthlyTotals(int fromYear, int fromMonth, int toYear, int toMonth) const {
+    int first = 0;
+    int last = 0;
+    QList<MonthTotals> out;
+    if (!clip(fromYear, fromMonth, toYear, toMonth, &first, &last)) {
+        return out;
+    }
+    const qsizetype yes = m_attendanceNames.indexOf(ATT_YES);
+    for (int m = first; m <= last; ++m) {
+        MonthTotals t;
+        t.year = m_firstYear + (m / 12);
+        t.month = (m % 12) + 1;
+        t.patients = m_monthIndex[m + 1] - m_monthIndex[m];
+        for (quint32 r = m_monthIndex[m]; r < m_monthIndex[m + 1]; ++r) {
+            t.newAttendances += m_attendance[r] == yes ? 1 : 0;
+        }
+        out << t;
+    }
+    return out;
+}
+
+QList<qint64> ColumnArchive::diagnosisTrend(const QString& diagnosis, int fromYear, int fromMonth, int toYear,
+                                            int toMonth) const {
+    int first = 0;
+    int last = 0;
+    QList<qint64> out;
+    if (!clip(fromYear, fromMonth, toYear, toMonth, &first, &last)) {
+        return out;
+    }
+    const qsizetype code = m_dxNames.indexOf(diagnosis);
+    for (int m = first; m <= last; ++m) {
+        qint64 visits = 0;
+        for (quint32 r = m_monthIndex[m]; code >= 0 && r < m_monthIndex[m + 1]; ++r) {
+            for (quint32 j = m_dxOffsets[r]; j < m_dxOffsets[r + 1]; ++j) {
+                if (m_dxIds[j] == code) {
+                    ++visits;
+                    break;
+                }
+            }
+        }
+        out << visits;
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// ColumnarStore
+// ---------------------------------------------------------------------------
+ColumnarStore::ColumnarStore(QString dir, ParallelOptions parallel)
+    : m_dir(std::move(dir)), m_parallel(parallel) {}
+
+int ColumnarStore::load() {
+    m_archives.clear();
+    const QDir dir(m_dir);
+    for (const QString& name : dir.entryList({"hmis-*.col"}, QDir::Files, QDir::Time)) {
+        auto archive = std::make_shared<ColumnArchive>();
+        QString error;
+        if (archive->open(dir.filePath(name), &error)) {
+            m_archives << archive;
+        } else {
+            qWarning() << "Skipping columnar archive" << error;
+        }
+    }
+    return static_cast<int>(m_archives.size());
+}
+
+const ColumnArchive* ColumnarStore::archiveFor(int year) const {
+    for (const auto& archive : m_archives) {
+        if (archive->covers(year)) {
+            return archive.get();
+        }
+    }
+    return nullptr;
+}
+
+QString ColumnarStore::pathFor(int firstYear, int lastYear) const {
+    return QDir(m_dir).filePath(QString("hmis-%1-%2.col").arg(firstYear).arg(lastYear));
+}
+
+RangeReport ColumnarStore::report(Database& db, int fromYear, int fromMonth, int toYear, int toMonth,
+                                  const QStringList& diagnosisNames) const {
+    HMIS_PERF_TIMER(timer, "rangeReport");
+    RangeReport report;
+    for (const QString& dx : diagnosisNames) {
+        for (const QString& age : AGE_CATEGORIES) {
+            report.diagnoses.data[dx][age];
+        }
+    }
+    const int start = monthNumber(fromYear, fromMonth);
+    const int end = monthNumber(toYear, toMonth);
+    for (int m = start; m <= end; ++m) {
+        report.months << MonthTotals{.year = m / 12, .month = (m % 12) + 1};
+    }
+
+    // Runs of consecutive months served by the same archive, or by the database.
+    for (int m = start; m <= end;) {
+        const ColumnArchive* archive = archiveFor(m / 12);
+        int runEnd = m;
+        while (runEnd < end && archiveFor((runEnd + 1) / 12) == archive) {
+            ++runEnd;
+        }
+        const int fy = m / 12;
+        const int fm = (m % 12) + 1;
+        const int ty = runEnd / 12;
+        const int tm = (runEnd % 12) + 1;
+
+        if (archive != nullptr) {
+            report.attendance.merge(archive->attendanceStats(fy, fm, ty, tm, m_parallel));
+            report.diagnoses.merge(archive->diagnosisStats(fy, fm, ty, tm, m_parallel));
+            for (const MonthTotals& t : archive->monthlyTotals(fy, fm, ty, tm)) {
+                report.months[monthNumber(t.year, t.month) - start] = t;
+                report.archivedRows += t.patients;
+            }
+        } else {
+            const HMISData rows = db.fetchHMISRange(fy, fm, ty, tm);
+            report.attendance.merge(parallel::attendanceStats(db, rows, m_parallel));
+            report.diagnoses.merge(parallel::diagnosisStats(db, rows, {}, m_parallel));
+            for (const HMISRow& row : rows) {
+                const int i = monthNumber(row.year, row.month) - start;
+                if (i >= 0 && i < report.months.size()) {
+                    ++report.months[i].patients;
+                    report.months[i].newAttendances += row.newAttendance == ATT_YES ? 1 : 0;
+                }
+            }
+            timer.addRows(rows.size());
+        }
+        m = runEnd + 1;
+    }
+    timer.addRows(report.archivedRows);
+    return report;
+}
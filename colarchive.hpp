@@ -0,0 +1,132 @@
+#ifndef COLARCHIVE_H
+#define COLARCHIVE_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <vector>
+
+#include "MonthlyStats.hpp"
+#include "database.hpp"
+#include "parallelstats.hpp"
+
+// Closed years of the register in a compact columnar file for multi-year
+// analytics, memory-mapped at read time so range and trend reports scan
+// byte arrays instead of re-splitting diagnosis strings row by row.
+//
+// Layout ("hmis-<first>-<last>.col"), little-endian, every section 8-byte
+// aligned so the mapped file is used in place:
+//   header       magic "HMISCOL1", format version, year range, row and
+//                diagnosis counts, section offsets, the change_journal id
+//                at export and a CRC-32 of everything after the header
+//   month index  quint32[months + 1]; rows of month m are [idx[m], idx[m+1])
+//   age, sex,    quint8[rows] each, codes into the dictionaries below
+//   attendance
+//   dx offsets   quint32[rows + 1]; CSR row pointers into dx ids
+//   dx ids       quint16[diagnosis entries], codes into the diagnosis names
+//   dictionary   QDataStream of four QStringLists: age categories, sexes,
+//                attendance values, diagnosis names
+//
+// Archives are written once per closed year range and never updated; after
+// correcting a closed year, export it again.
+struct MonthTotals {
+    int year = 0;
+    int month = 0;
+    qint64 patients = 0;
+    qint64 newAttendances = 0;
+};
+
+class ColumnArchive {
+  public:
+    ColumnArchive() = default;
+    ~ColumnArchive();
+
+    ColumnArchive(const ColumnArchive&) = delete;
+    ColumnArchive& operator=(const ColumnArchive&) = delete;
+
+    // Maps the file and checks the header, checksum and every code, so the
+    // scans below never bounds-check.
+    bool open(const QString& path, QString* error);
+    void close();
+    [[nodiscard]] bool isOpen() const { return m_base != nullptr; }
+    [[nodiscard]] const QString& path() const { return m_path; }
+
+    [[nodiscard]] int firstYear() const { return m_firstYear; }
+    [[nodiscard]] int lastYear() const { return m_lastYear; }
+    [[nodiscard]] bool covers(int year) const { return isOpen() && year >= m_firstYear && year <= m_lastYear; }
+    [[nodiscard]] qint64 rowCount() const { return m_rows; }
+    [[nodiscard]] qint64 sourceVersion() const { return m_sourceVersion; }
+    [[nodiscard]] const QStringList& diagnosisNames() const { return m_dxNames; }
+
+    // Inclusive month ranges, clipped to the archive. Same results as the
+    // Database helpers over the same rows (diagnosis keys are not pre-seeded).
+    // Large ranges are counted in chunks across options.threads cores.
+    MonthlyStats attendanceStats(int fromYear, int fromMonth, int toYear, int toMonth,
+                                 const ParallelOptions& options = {}) const;
+    MonthlyStats diagnosisStats(int fromYear, int fromMonth, int toYear, int toMonth,
+                                const ParallelOptions& options = {}) const;
+    QList<MonthTotals> monthlyTotals(int fromYear, int fromMonth, int toYear, int toMonth) const;
+    // Visits per month with diagnosis (one entry per month in the clipped range).
+    QList<qint64> diagnosisTrend(const QString& diagnosis, int fromYear, int fromMonth, int toYear,
+                                 int toMonth) const;
+
+    // Writes years firstYear..lastYear (all before the current year) from
+    // the database's read endpoint and verifies the file by opening it.
+    static bool write(Database& db, int firstYear, int lastYear, const QString& path, QString* error);
+
+  private:
+    bool clip(int fromYear, int fromMonth, int toYear, int toMonth, int* first, int* last) const;
+
+    QString m_path;
+    QFile m_file;
+    std::unique_ptr<quint64[]> m_buffer;  // file contents when it cannot be mapped
+    const uchar* m_base = nullptr;
+
+    int m_firstYear = 0;
+    int m_lastYear = 0;
+    qint64 m_rows = 0;
+    qint64 m_sourceVersion = 0;
+    const quint32* m_monthIndex = nullptr;
+    const quint8* m_age = nullptr;
+    const quint8* m_sex = nullptr;
+    const quint8* m_attendance = nullptr;
+    const quint32* m_dxOffsets = nullptr;
+    const quint16* m_dxIds = nullptr;
+    QStringList m_ageNames;
+    QStringList m_sexNames;
+    QStringList m_attendanceNames;
+    QStringList m_dxNames;
+};
+
+// Range reports over every archive in a directory plus the live database
+// for the months no archive covers.
+struct RangeReport {
+    MonthlyStats attendance;
+    MonthlyStats diagnoses;   // pre-seeded with the names passed in
+    QList<MonthTotals> months;  // one per month in the range, oldest first
+    qint64 archivedRows = 0;    // rows read from archives rather than the database
+};
+
+class ColumnarStore {
+  public:
+    explicit ColumnarStore(QString dir, ParallelOptions parallel = {});
+
+    [[nodiscard]] const QString& dir() const { return m_dir; }
+    // (Re)opens every "hmis-*.col" file; unreadable ones are skipped with a
+    // warning. Returns the number opened.
+    int load();
+    [[nodiscard]] const ColumnArchive* archiveFor(int year) const;
+    [[nodiscard]] QString pathFor(int firstYear, int lastYear) const;
+
+    RangeReport report(Database& db, int fromYear, int fromMonth, int toYear, int toMonth,
+                       const QStringList& diagnosisNames) const;
+
+  private:
+    QString m_dir;
+    ParallelOptions m_parallel;
+    QList<std::shared_ptr<ColumnArchive>> m_archives;  // newest export first
+};
+
+#endif  // COLARCHIVE_H
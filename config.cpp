@@ -0,0 +1,358 @@
+#include "config.hpp"
+
+#include <QDir>
+#include <QSettings>
+#include <QStandardPaths>
+#include <algorithm>
+#include <stdexcept>
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Connection option loaders
+// ─────────────────────────────────────────────────────────────────────────────
+
+QString sqlitePath(const QString& dbName) {
+    return QStandardPaths::writableLocation(QStandardPaths::HomeLocation) + QDir::separator() + dbName;
+}
+
+// QSettings sqlite/* keys; HMIS_SQLITE_SYNCHRONOUS overrides sqlite/synchronous.
+static SqliteOptions loadSqliteOptions() {
+    QSettings settings;
+    SqliteOptions opt(sqlitePath("hmis.sqlite3"));
+    QString sync = settings.value("sqlite/synchronous", "full").toString();
+    if (qEnvironmentVariableIsSet("HMIS_SQLITE_SYNCHRONOUS")) {
+        sync = qEnvironmentVariable("HMIS_SQLITE_SYNCHRONOUS");
+    }
+    sync = sync.trimmed().toLower();
+    if (sync == "off") {
+        opt.synchronous = SqliteSync::Off;
+    } else if (sync == "normal") {
+        opt.synchronous = SqliteSync::Normal;
+    } else if (sync == "extra") {
+        opt.synchronous = SqliteSync::Extra;
+    } else {
+        opt.synchronous = SqliteSync::Full;
+    }
+    opt.cacheSizeKiB = std::max(settings.value("sqlite/cacheSizeKiB", opt.cacheSizeKiB).toInt(), 0);
+    opt.mmapSize = std::max<qint64>(settings.value("sqlite/mmapSize", opt.mmapSize).toLongLong(), 0);
+    opt.tempStoreMemory = settings.value("sqlite/tempStoreMemory", opt.tempStoreMemory).toBool();
+    opt.busyTimeoutMs = std::max(settings.value("sqlite/busyTimeoutMs", opt.busyTimeoutMs).toInt(), 0);
+    opt.walAutocheckpoint = std::max(settings.value("sqlite/walAutocheckpoint", opt.walAutocheckpoint).toInt(), 0);
+    return opt;
+}
+
+static PostgresOptions loadPostgresOptions() {
+    QByteArray dbName = qgetenv("PGDATABASE");
+    QByteArray host = qgetenv("PGHOST");
+    QByteArray user = qgetenv("PGUSER");
+    QByteArray password = qgetenv("PGPASSWORD");
+    QByteArray port = qgetenv("PGPORT");
+
+    if (dbName.isEmpty()) {
+        throw std::runtime_error("PGDATABASE environment variable is not set");
+    }
+    if (user.isEmpty()) {
+        throw std::runtime_error("PGUSER environment variable is not set");
+    }
+    if (password.isEmpty()) {
+        throw std::runtime_error("PGPASSWORD environment variable is not set");
+    }
+
+    if (host.isEmpty()) {
+        host = "127.0.0.1";
+    }
+
+    // BUG FIX: original code checked port.isEmpty() instead of !port.isEmpty()
+    int portInt = 5432;
+    if (!port.isEmpty()) {
+        bool ok;
+        int p = port.toInt(&ok);
+        if (ok) {
+            portInt = p;
+        }
+    }
+
+    return {dbName, user, password, host, portInt};
+}
+
+static MysqlOptions loadMysqlOptions() {
+    QByteArray dbName = qgetenv("MYSQL_DATABASE");
+    QByteArray host = qgetenv("MYSQL_HOST");
+    QByteArray user = qgetenv("MYSQL_USER");
+    QByteArray password = qgetenv("MYSQL_PASSWORD");
+    QByteArray port = qgetenv("MYSQL_PORT");
+
+    if (dbName.isEmpty()) {
+        throw std::runtime_error("MYSQL_DATABASE environment variable is not set");
+    }
+    if (user.isEmpty()) {
+        throw std::runtime_error("MYSQL_USER environment variable is not set");
+    }
+    if (password.isEmpty()) {
+        throw std::runtime_error("MYSQL_PASSWORD environment variable is not set");
+    }
+
+    if (host.isEmpty()) {
+        host = "127.0.0.1";
+    }
+
+    int portInt = 3306;
+    if (!port.isEmpty()) {
+        bool ok;
+        int p = port.toInt(&ok);
+        if (ok) {
+            portInt = p;
+        }
+    }
+
+    return {dbName, user, password, host, portInt};
+}
+
+// QSettings hmisd/address, hmisd/token and hmisd/timeoutMs; HMISD_ADDRESS and
+// HMISD_TOKEN override the first two.
+static DaemonOptions loadDaemonOptions() {
+    QSettings settings;
+    DaemonOptions opt(settings.value("hmisd/address", "hmisd").toString());
+    opt.token = settings.value("hmisd/token").toString();
+    opt.timeoutMs = std::max(settings.value("hmisd/timeoutMs", opt.timeoutMs).toInt(), 1);
+    if (qEnvironmentVariableIsSet("HMISD_ADDRESS")) {
+        opt.address = qEnvironmentVariable("HMISD_ADDRESS");
+    }
+    if (qEnvironmentVariableIsSet("HMISD_TOKEN")) {
+        opt.token = qEnvironmentVariable("HMISD_TOKEN");
+    }
+    return opt;
+}
+
+ConnOptions loadConnOptions() { return connOptionsFor(QString::fromLocal8Bit(qgetenv("HMIS_DB_DRIVER"))); }
+
+ConnOptions connOptionsFor(const QString& spec) {
+    const QByteArray driver = spec.toLocal8Bit();
+
+    if (driver.isEmpty() || driver == "sqlite3") {
+        return ConnOptions(loadSqliteOptions());
+    }
+    if (driver.startsWith("sqlite:")) {
+        SqliteOptions opt = loadSqliteOptions();
+        opt.dbName = spec.mid(7);
+        return ConnOptions(opt);
+    }
+    if (driver == "postgresql") {
+        return ConnOptions(loadPostgresOptions());
+    }
+    if (driver == "mysql") {
+        return ConnOptions(loadMysqlOptions());
+    }
+    if (driver == "hmisd") {
+        return ConnOptions(loadDaemonOptions());
+    }
+    throw std::runtime_error("Unknown database driver: " + driver.toStdString());
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Audit durability
+// ─────────────────────────────────────────────────────────────────────────────
+
+AuditConfig loadAuditConfig() {
+    QSettings settings;
+    AuditConfig cfg;
+    QString mode = settings.value("audit/durability", "strict").toString();
+    cfg.groupCommitMs = settings.value("audit/groupCommitMs", cfg.groupCommitMs).toInt();
+    cfg.keepMonths = std::max(settings.value("audit/keepMonths", cfg.keepMonths).toInt(), 1);
+    cfg.archiveDir = settings
+                         .value("audit/archiveDir",
+                                QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation))
+                                    .filePath("audit-archive"))
+                         .toString();
+    if (qEnvironmentVariableIsSet("HMIS_AUDIT_ARCHIVE_DIR")) {
+        cfg.archiveDir = qEnvironmentVariable("HMIS_AUDIT_ARCHIVE_DIR");
+    }
+
+    if (qEnvironmentVariableIsSet("HMIS_AUDIT_DURABILITY")) {
+        mode = qEnvironmentVariable("HMIS_AUDIT_DURABILITY");
+    }
+    bool ok = false;
+    const int envMs = qEnvironmentVariableIntValue("HMIS_AUDIT_GROUP_MS", &ok);
+    if (ok) {
+        cfg.groupCommitMs = envMs;
+    }
+
+    cfg.durability = mode.trimmed().toLower() == "group" ? AuditDurability::GroupCommit : AuditDurability::Strict;
+    return cfg;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  IP number allocation
+// ─────────────────────────────────────────────────────────────────────────────
+
+int loadIpBlockSize() {
+    QSettings settings;
+    int size = settings.value("ip/blockSize", 1).toInt();
+    bool ok = false;
+    const int envSize = qEnvironmentVariableIntValue("HMIS_IP_BLOCK_SIZE", &ok);
+    if (ok) {
+        size = envSize;
+    }
+    return std::max(size, 1);
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Offline-first sync
+// ─────────────────────────────────────────────────────────────────────────────
+
+SyncConfig loadSyncConfig() {
+    QSettings settings;
+    SyncConfig cfg;
+    cfg.offlineFirst = settings.value("sync/offlineFirst", false).toBool();
+    cfg.batchSize = std::max(settings.value("sync/batchSize", cfg.batchSize).toInt(), 1);
+    cfg.outboxPath = settings
+                         .value("sync/outboxPath",
+                                QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation))
+                                    .filePath("outbox.sqlite3"))
+                         .toString();
+
+    bool ok = false;
+    const int envOffline = qEnvironmentVariableIntValue("HMIS_OFFLINE_FIRST", &ok);
+    if (ok) {
+        cfg.offlineFirst = envOffline != 0;
+    }
+    if (qEnvironmentVariableIsSet("HMIS_OUTBOX_PATH")) {
+        cfg.outboxPath = qEnvironmentVariable("HMIS_OUTBOX_PATH");
+    }
+    return cfg;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Change notifications
+// ─────────────────────────────────────────────────────────────────────────────
+
+NotifyConfig loadNotifyConfig() {
+    QSettings settings;
+    NotifyConfig cfg;
+    cfg.enabled = settings.value("notify/enabled", cfg.enabled).toBool();
+    cfg.pollMs = settings.value("notify/pollMs", cfg.pollMs).toInt();
+
+    bool ok = false;
+    const int envEnabled = qEnvironmentVariableIntValue("HMIS_NOTIFY", &ok);
+    if (ok) {
+        cfg.enabled = envEnabled != 0;
+    }
+    const int envPoll = qEnvironmentVariableIntValue("HMIS_NOTIFY_POLL_MS", &ok);
+    if (ok) {
+        cfg.pollMs = envPoll;
+    }
+    cfg.pollMs = std::max(cfg.pollMs, 100);
+    return cfg;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Read endpoint
+// ─────────────────────────────────────────────────────────────────────────────
+
+QString loadReadEndpoint() {
+    QSettings settings;
+    QString endpoint = settings.value("read/endpoint").toString();
+    if (qEnvironmentVariableIsSet("HMIS_READ_ENDPOINT")) {
+        endpoint = qEnvironmentVariable("HMIS_READ_ENDPOINT");
+    }
+    return endpoint.trimmed();
+}
+
+ConnOptions replicaOptions(const ConnOptions& primary, const QString& endpoint) {
+    if (primary.getDriver() == Driver::HMISD) {
+        throw std::runtime_error("Read endpoints are set up on hmisd, not on its clients");
+    }
+    if (primary.getDriver() == Driver::SQLITE) {
+        SqliteOptions opt = primary.get<SqliteOptions>();  // same profile, other file
+        opt.dbName = endpoint;
+        return ConnOptions(opt);
+    }
+    const QString host = endpoint.section(':', 0, 0);
+    bool ok = false;
+    const int port = endpoint.section(':', 1, 1).toInt(&ok);
+    if (primary.getDriver() == Driver::POSTGRES) {
+        const auto& opt = primary.get<PostgresOptions>();
+        return ConnOptions(
+            PostgresOptions(opt.getDbName(), opt.getUser(), opt.getPassword(), host, ok ? port : opt.getPort()));
+    }
+    const auto& opt = primary.get<MysqlOptions>();
+    return ConnOptions(MysqlOptions(opt.getDbName(), opt.getUser(), opt.getPassword(), host, ok ? port : opt.getPort()));
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  SQLite maintenance
+// ─────────────────────────────────────────────────────────────────────────────
+
+MaintenanceConfig loadMaintenanceConfig() {
+    QSettings settings;
+    MaintenanceConfig cfg;
+    cfg.enabled = settings.value("maintenance/enabled", cfg.enabled).toBool();
+    int idleSeconds = settings.value("maintenance/idleSeconds", cfg.policy.idleMs / 1000).toInt();
+
+    bool ok = false;
+    const int envEnabled = qEnvironmentVariableIntValue("HMIS_MAINTENANCE", &ok);
+    if (ok) {
+        cfg.enabled = envEnabled != 0;
+    }
+    const int envIdle = qEnvironmentVariableIntValue("HMIS_MAINTENANCE_IDLE_S", &ok);
+    if (ok) {
+        idleSeconds = envIdle;
+    }
+    cfg.policy.idleMs = std::max(idleSeconds, 1) * 1000;
+    cfg.policy.truncateWalBytes =
+        std::max<qint64>(settings.value("maintenance/walLimitMiB", cfg.policy.truncateWalBytes >> 20).toLongLong(), 1)
+        << 20;
+    return cfg;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Columnar archives
+// ─────────────────────────────────────────────────────────────────────────────
+
+QString loadColumnarDir() {
+    QSettings settings;
+    const QString fallback =
+        QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).filePath("columnar");
+    QString dir = settings.value("archive/columnarDir", fallback).toString();
+    if (qEnvironmentVariableIsSet("HMIS_COLUMNAR_DIR")) {
+        dir = qEnvironmentVariable("HMIS_COLUMNAR_DIR");
+    }
+    return dir;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  Parallel aggregation
+// ─────────────────────────────────────────────────────────────────────────────
+
+ParallelOptions loadParallelOptions() {
+    QSettings settings;
+    ParallelOptions options;
+    options.threads = settings.value("reports/threads", options.threads).toInt();
+    options.minChunkRows = settings.value("reports/minChunkRows", options.minChunkRows).toLongLong();
+    bool ok = false;
+    const int envThreads = qEnvironmentVariableIntValue("HMIS_REPORT_THREADS", &ok);
+    if (ok) {
+        options.threads = envThreads;
+    }
+    options.threads = std::max(options.threads, 0);
+    options.minChunkRows = std::max<qint64>(options.minChunkRows, 1);
+    return options;
+}
+
+// ─────────────────────────────────────────────────────────────────────────────
+//  hmisd
+// ─────────────────────────────────────────────────────────────────────────────
+
+DaemonConfig loadDaemonConfig() {
+    QSettings settings;
+    DaemonConfig cfg;
+    cfg.localName = settings.value("hmisd/localName", cfg.localName).toString();
+    cfg.tcpListen = settings.value("hmisd/listen").toString();
+    cfg.token = settings.value("hmisd/token").toString();
+    if (qEnvironmentVariableIsSet("HMISD_LISTEN")) {
+        cfg.tcpListen = qEnvironmentVariable("HMISD_LISTEN");
+    }
+    if (qEnvironmentVariableIsSet("HMISD_TOKEN")) {
+        cfg.token = qEnvironmentVariable("HMISD_TOKEN");
+    }
+    return cfg;
+}
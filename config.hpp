@@ -0,0 +1,103 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <QString>
+
+#include "database.hpp"
+#include "databaseOptions.hpp"
+#include "maintenance.hpp"
+#include "parallelstats.hpp"
+
+// Path of a SQLite file in the user's home directory.
+QString sqlitePath(const QString& dbName);
+
+// Builds connection options from HMIS_DB_DRIVER ("sqlite3" | "postgresql" |
+// "mysql" | "hmisd") and the driver's environment variables (PG*, MYSQL_*,
+// HMISD_*). Throws std::runtime_error on missing settings.
+// The SQLite profile comes from QSettings sqlite/synchronous ("off" |
+// "normal" | "full" | "extra"), sqlite/cacheSizeKiB, sqlite/mmapSize,
+// sqlite/tempStoreMemory, sqlite/busyTimeoutMs and sqlite/walAutocheckpoint;
+// HMIS_SQLITE_SYNCHRONOUS overrides the first.
+ConnOptions loadConnOptions();
+
+// The same for an explicit driver name instead of HMIS_DB_DRIVER, plus
+// "sqlite:PATH" for a SQLite file other than ~/hmis.sqlite3 (with the
+// configured SQLite profile). Used where one process opens two databases.
+ConnOptions connOptionsFor(const QString& spec);
+
+struct AuditConfig {
+    AuditDurability durability = AuditDurability::Strict;
+    int groupCommitMs = 50;
+    QString archiveDir;  // closed periods are moved here as segment files
+    int keepMonths = 3;  // months kept in audit_log, counting the current one
+};
+
+// QSettings audit/durability ("strict" | "group"), audit/groupCommitMs,
+// audit/archiveDir and audit/keepMonths, overridden by HMIS_AUDIT_DURABILITY,
+// HMIS_AUDIT_GROUP_MS and HMIS_AUDIT_ARCHIVE_DIR.
+AuditConfig loadAuditConfig();
+
+// IP numbers each client reserves per allocation round trip: QSettings
+// ip/blockSize, overridden by HMIS_IP_BLOCK_SIZE. Default 1 (no gaps beyond
+// the number currently shown).
+int loadIpBlockSize();
+
+struct SyncConfig {
+    bool offlineFirst = false;
+    QString outboxPath;   // local SQLite journal of writes waiting for the server
+    int batchSize = 100;  // outbox entries pushed per replicator pass
+};
+
+// QSettings sync/offlineFirst, sync/outboxPath and sync/batchSize, overridden
+// by HMIS_OFFLINE_FIRST (0/1) and HMIS_OUTBOX_PATH.
+SyncConfig loadSyncConfig();
+
+struct NotifyConfig {
+    bool enabled = true;
+    int pollMs = 1000;  // SQLite/MySQL probe interval
+};
+
+// Refreshing open windows when other clients commit (changenotifier.hpp):
+// QSettings notify/enabled and notify/pollMs, overridden by HMIS_NOTIFY (0/1)
+// and HMIS_NOTIFY_POLL_MS.
+NotifyConfig loadNotifyConfig();
+
+// Where analytic reads go (Database::useReadReplica/useReadMirror): QSettings
+// read/endpoint, overridden by HMIS_READ_ENDPOINT. Empty means the primary,
+// "mirror" an in-memory copy, anything else a replica: a SQLite file path,
+// or host[:port] of a server reached with the primary's credentials.
+QString loadReadEndpoint();
+ConnOptions replicaOptions(const ConnOptions& primary, const QString& endpoint);
+
+// Directory of columnar archives of closed years (colarchive.hpp): QSettings
+// archive/columnarDir, overridden by HMIS_COLUMNAR_DIR.
+QString loadColumnarDir();
+
+struct MaintenanceConfig {
+    bool enabled = true;  // SQLite only
+    MaintenancePolicy policy;
+};
+
+// MaintenanceScheduler settings: QSettings maintenance/enabled,
+// maintenance/idleSeconds and maintenance/walLimitMiB, overridden by
+// HMIS_MAINTENANCE (0/1) and HMIS_MAINTENANCE_IDLE_S.
+MaintenanceConfig loadMaintenanceConfig();
+
+// Threads for multi-year report folds (parallelstats.hpp): QSettings
+// reports/threads (0 = one per core) and reports/minChunkRows, overridden by
+// HMIS_REPORT_THREADS.
+ParallelOptions loadParallelOptions();
+
+// What hmisd serves its database on: QSettings hmisd/localName (a local
+// socket name or path; empty disables it), hmisd/listen (host:port for TCP;
+// empty disables it) and hmisd/token (clients must present it), overridden
+// by HMISD_LISTEN and HMISD_TOKEN. The database itself comes from
+// loadConnOptions(), which must name a SQL driver.
+struct DaemonConfig {
+    QString localName = "hmisd";
+    QString tcpListen;
+    QString token;
+};
+DaemonConfig loadDaemonConfig();
+
+#endif  // CONFIG_H
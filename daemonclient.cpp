@@ -0,0 +1,202 @@
+#include "daemonclient.hpp"
+#include "perfstats.hpp"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QTcpSocket>
+
+DaemonClient::DaemonClient(DaemonOptions options) : m_options(std::move(options)) {}
+
+DaemonClient::~DaemonClient() = default;
+
+bool DaemonClient::isOpen() const {
+    if (m_tcp) {
+        return m_tcp->state() == QAbstractSocket::ConnectedState;
+    }
+    return m_local && m_local->state() == QLocalSocket::ConnectedState;
+}
+
+bool DaemonClient::open(QString* error) {
+    HMIS_PERF_TIMER(timer, "daemonConnect");
+    m_socket = nullptr;
+    m_tcp.reset();
+    m_local.reset();
+    m_out.clear();
+    m_in.clear();
+    m_replies.clear();
+
+    // host:port is TCP; names and paths (which may hold a drive letter) are local sockets.
+    const QString& address = m_options.address;
+    const qsizetype colon = address.lastIndexOf(':');
+    quint16 port = 0;
+    if (colon > 0 && !address.startsWith('/') && !address.contains('\\')) {
+        port = address.mid(colon + 1).toUShort();
+    }
+
+    bool connected = false;
+    if (port > 0) {
+        m_tcp = std::make_unique<QTcpSocket>();
+        m_tcp->connectToHost(address.left(colon), port);
+        connected = m_tcp->waitForConnected(m_options.timeoutMs);
+        if (connected) {
+            // Requests are batched here already; Nagle would only delay them.
+            m_tcp->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        }
+        m_lastError = m_tcp->errorString();
+        m_socket = m_tcp.get();
+    } else {
+        m_local = std::make_unique<QLocalSocket>();
+        m_local->connectToServer(address);
+        connected = m_local->waitForConnected(m_options.timeoutMs);
+        m_lastError = m_local->errorString();
+        m_socket = m_local.get();
+    }
+    if (!connected) {
+        *error = QString("Cannot reach hmisd at %1: %2").arg(address, m_lastError);
+        timer.fail();
+        return false;
+    }
+
+    const auto reply = call(hmisd::Op::Hello, hmisd::pack(hmisd::kProtocolVersion, m_options.token));
+    if (!reply) {
+        *error = "hmisd refused the connection: " + m_lastError;
+        timer.fail();
+        return false;
+    }
+    QDataStream in(*reply);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 version = 0;
+    in >> version >> m_server;
+    // hmisd keeps the signed-in user per connection.
+    if (!m_options.username.isEmpty()) {
+        std::optional<User> user;
+        if (const auto signedIn = call(hmisd::Op::Authenticate, hmisd::pack(m_options.username, m_options.password))) {
+            QDataStream userIn(*signedIn);
+            userIn.setVersion(QDataStream::Qt_6_0);
+            userIn >> user;
+        }
+        if (!user) {
+            qWarning() << "DaemonClient: hmisd did not accept the sign-in of" << m_options.username;
+        }
+    }
+    m_lastError.clear();
+    return true;
+}
+
+void DaemonClient::setSignIn(int userId, const QString& username, const QString& password) {
+    m_userId = userId;
+    m_options.username = username;
+    m_options.password = password;
+}
+
+void DaemonClient::passwordChanged(int userId, const QString& password) {
+    if (userId != 0 && userId == m_userId) {
+        m_options.password = password;
+    }
+}
+
+quint32 DaemonClient::send(hmisd::Op op, const QByteArray& payload) {
+    // Reconnect lazily after hmisd restarted; the request that noticed the
+    // drop has already failed.
+    if (m_socket != nullptr && !isOpen()) {
+        QString error;
+        if (!open(&error)) {
+            qWarning() << error;
+        }
+    }
+    const quint32 id = m_nextId++;
+    m_out += hmisd::encodeFrame(id, quint16(op), payload);
+    return id;
+}
+
+bool DaemonClient::flush() {
+    if (m_out.isEmpty()) {
+        return true;
+    }
+    if (!isOpen()) {
+        m_out.clear();
+        m_lastError = "Not connected to hmisd";
+        return false;
+    }
+    m_socket->write(m_out);
+    m_out.clear();
+    while (m_socket->bytesToWrite() > 0) {
+        if (!m_socket->waitForBytesWritten(m_options.timeoutMs)) {
+            drop("Sending to hmisd failed: " + m_socket->errorString());
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<QByteArray> DaemonClient::wait(quint32 id) {
+    if (!flush()) {
+        return std::nullopt;
+    }
+    QElapsedTimer clock;
+    clock.start();
+    for (;;) {
+        const auto it = m_replies.constFind(id);
+        if (it != m_replies.constEnd()) {
+            const hmisd::Frame reply = *it;
+            m_replies.erase(it);
+            if (reply.code != quint16(hmisd::Status::Ok)) {
+                QDataStream in(reply.payload);
+                in.setVersion(QDataStream::Qt_6_0);
+                in >> m_lastError;
+                return std::nullopt;
+            }
+            return reply.payload;
+        }
+        // The GUI's event loop may have buffered replies since the last
+        // call; waitForReadyRead() only reports new data.
+        if (m_socket != nullptr && m_socket->bytesAvailable() > 0) {
+            if (!readSome()) {
+                return std::nullopt;
+            }
+            continue;
+        }
+        if (!isOpen()) {
+            m_lastError = "Not connected to hmisd";
+            return std::nullopt;
+        }
+        const qint64 left = m_options.timeoutMs - clock.elapsed();
+        if (left <= 0 || !m_socket->waitForReadyRead(int(left))) {
+            // Later replies would arrive out of step with their callers.
+            drop(left <= 0 ? QString("hmisd did not answer within %1 ms").arg(m_options.timeoutMs)
+                           : "Lost the connection to hmisd: " + m_socket->errorString());
+            return std::nullopt;
+        }
+        if (!readSome()) {
+            return std::nullopt;
+        }
+    }
+}
+
+bool DaemonClient::readSome() {
+    m_in += m_socket->readAll();
+    bool bad = false;
+    for (hmisd::Frame& frame : hmisd::takeFrames(m_in, &bad)) {
+        m_replies.insert(frame.id, std::move(frame));
+    }
+    if (bad) {
+        drop("Malformed reply from hmisd");
+        return false;
+    }
+    return true;
+}
+
+void DaemonClient::drop(const QString& error) {
+    qWarning() << "DaemonClient:" << error;
+    m_lastError = error;
+    if (m_tcp) {
+        m_tcp->abort();
+    }
+    if (m_local) {
+        m_local->abort();
+    }
+    m_out.clear();
+    m_in.clear();
+    m_replies.clear();
+}
@@ -0,0 +1,74 @@
+#ifndef DAEMONCLIENT_H
+#define DAEMONCLIENT_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <memory>
+#include <optional>
+
+#include "daemonproto.hpp"
+#include "databaseOptions.hpp"
+
+class QIODevice;
+class QLocalSocket;
+class QTcpSocket;
+
+// Client end of an hmisd connection (Driver::HMISD). Database routes its
+// register, diagnosis, user, audit and journal calls through one of these.
+//
+// Calls block like QSqlQuery::exec(), but need not go one at a time:
+// send() only queues a request, so several can be sent before the first
+// reply is awaited. They leave in one write and hmisd answers them back
+// to back, so a batch costs one round trip instead of one per request.
+// Not thread-safe; use one client (one Database) per thread, as with SQL
+// connections.
+class DaemonClient {
+  public:
+    explicit DaemonClient(DaemonOptions options);
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    // Connects (again) and introduces itself with the protocol version and
+    // token, then signs in again as the user of the previous connection.
+    // Replies still expected from a dropped connection are lost.
+    bool open(QString* error);
+    // The credentials hmisd last accepted (Database::authenticate), for
+    // signing in again after a reconnect.
+    void setSignIn(int userId, const QString& username, const QString& password);
+    void passwordChanged(int userId, const QString& password);
+    [[nodiscard]] const DaemonOptions& options() const { return m_options; }
+    [[nodiscard]] bool isOpen() const;
+    [[nodiscard]] const QString& serverDescription() const { return m_server; }
+
+    // Returns the request id to wait() for.
+    quint32 send(hmisd::Op op, const QByteArray& payload);
+    bool flush();
+    // The payload of request id's Ok reply; nullopt (and lastError()) on a
+    // failed reply, a timeout or a dropped connection. Replies to other
+    // requests that arrive meanwhile are kept for their own wait().
+    std::optional<QByteArray> wait(quint32 id);
+    std::optional<QByteArray> call(hmisd::Op op, const QByteArray& payload) { return wait(send(op, payload)); }
+
+    [[nodiscard]] const QString& lastError() const { return m_lastError; }
+
+  private:
+    bool readSome();
+    void drop(const QString& error);
+
+    DaemonOptions m_options;
+    std::unique_ptr<QLocalSocket> m_local;
+    std::unique_ptr<QTcpSocket> m_tcp;
+    QIODevice* m_socket = nullptr;  // whichever of the two is in use
+    QByteArray m_out;               // requests not yet written
+    QByteArray m_in;                // bytes of an incomplete reply frame
+    QHash<quint32, hmisd::Frame> m_replies;
+    quint32 m_nextId = 1;
+    int m_userId = 0;  // of m_options.username, once known
+    QString m_server;
+    QString m_lastError;
+};
+
+#endif  // DAEMONCLIENT_H
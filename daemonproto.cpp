@@ -0,0 +1,140 @@
+#include "daemonproto.hpp"
+
+#include <QtEndian>
+
+namespace hmisd {
+
+QByteArray encodeFrame(quint32 id, quint16 code, const QByteArray& payload) {
+    QByteArray frame(kHeaderBytes, Qt::Uninitialized);
+    qToBigEndian<quint32>(quint32(kHeaderBytes - 4 + payload.size()), frame.data());
+    qToBigEndian<quint32>(id, frame.data() + 4);
+    qToBigEndian<quint16>(code, frame.data() + 8);
+    frame += payload;
+    return frame;
+}
+
+QList<Frame> takeFrames(QByteArray& buffer, bool* bad) {
+    QList<Frame> frames;
+    qsizetype pos = 0;
+    while (buffer.size() - pos >= kHeaderBytes) {
+        const char* p = buffer.constData() + pos;
+        const auto length = qsizetype(qFromBigEndian<quint32>(p));
+        if (length < kHeaderBytes - 4 || length > kMaxFrameBytes) {
+            *bad = true;
+            break;
+        }
+        if (buffer.size() - pos < 4 + length) {
+            break;  // the rest is still on its way
+        }
+        frames << Frame{.id = qFromBigEndian<quint32>(p + 4),
+                        .code = qFromBigEndian<quint16>(p + 8),
+                        .payload = buffer.mid(pos + kHeaderBytes, length - (kHeaderBytes - 4))};
+        pos += 4 + length;
+    }
+    buffer.remove(0, pos);
+    return frames;
+}
+
+}  // namespace hmisd
+
+// ---------------------------------------------------------------------------
+// Type encodings
+// ---------------------------------------------------------------------------
+QDataStream& operator<<(QDataStream& s, const HMISRow& row) {
+    return s << qint32(row.id) << row.ageCategory << row.sex << row.newAttendance << row.diagnoses << row.ipNumber
+             << qint32(row.year) << qint32(row.month);
+}
+
+QDataStream& operator>>(QDataStream& s, HMISRow& row) {
+    qint32 id = 0;
+    qint32 year = 0;
+    qint32 month = 0;
+    s >> id >> row.ageCategory >> row.sex >> row.newAttendance >> row.diagnoses >> row.ipNumber >> year >> month;
+    row.id = id;
+    row.year = year;
+    row.month = month;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const NewHMISData& data) {
+    return s << data.ageCategory << data.sex << data.newAttendance << data.diagnoses << data.ipNumber
+             << qint32(data.month) << qint32(data.year);
+}
+
+QDataStream& operator>>(QDataStream& s, NewHMISData& data) {
+    qint32 month = 0;
+    qint32 year = 0;
+    s >> data.ageCategory >> data.sex >> data.newAttendance >> data.diagnoses >> data.ipNumber >> month >> year;
+    data.month = month;
+    data.year = year;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const Diagnosis& d) { return s << qint32(d.id) << d.name; }
+
+QDataStream& operator>>(QDataStream& s, Diagnosis& d) {
+    qint32 id = 0;
+    s >> id >> d.name;
+    d.id = id;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const User& user) {
+    return s << qint32(user.id) << user.username << quint8(user.role);
+}
+
+QDataStream& operator>>(QDataStream& s, User& user) {
+    qint32 id = 0;
+    quint8 role = 0;
+    s >> id >> user.username >> role;
+    user.id = id;
+    user.role = role == quint8(UserRole::Admin) ? UserRole::Admin : UserRole::Clerk;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const AuditEntry& e) {
+    return s << e.id << e.username << e.action << e.tableName << qint32(e.recordId) << e.detail << e.changedAt
+             << e.changeId;
+}
+
+QDataStream& operator>>(QDataStream& s, AuditEntry& e) {
+    qint32 recordId = 0;
+    s >> e.id >> e.username >> e.action >> e.tableName >> recordId >> e.detail >> e.changedAt >> e.changeId;
+    e.recordId = recordId;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const AuditFilter& f) {
+    return s << f.username << f.action << f.tableName << f.recordId.has_value() << qint32(f.recordId.value_or(0))
+             << f.fromDate << f.toDate;
+}
+
+QDataStream& operator>>(QDataStream& s, AuditFilter& f) {
+    bool hasRecord = false;
+    qint32 recordId = 0;
+    s >> f.username >> f.action >> f.tableName >> hasRecord >> recordId >> f.fromDate >> f.toDate;
+    f.recordId = hasRecord ? std::optional<int>(recordId) : std::nullopt;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const ChangeEntry& e) {
+    return s << e.id << e.tableName << e.op << qint32(e.recordId) << e.before << e.after << qint32(e.userId)
+             << e.changedAt;
+}
+
+QDataStream& operator>>(QDataStream& s, ChangeEntry& e) {
+    qint32 recordId = 0;
+    qint32 userId = 0;
+    s >> e.id >> e.tableName >> e.op >> recordId >> e.before >> e.after >> userId >> e.changedAt;
+    e.recordId = recordId;
+    e.userId = userId;
+    return s;
+}
+
+QDataStream& operator<<(QDataStream& s, const MonthStamp& stamp) {
+    return s << stamp.changeId << stamp.recentChanges << stamp.rows << stamp.maxId;
+}
+
+QDataStream& operator>>(QDataStream& s, MonthStamp& stamp) {
+    return s >> stamp.changeId >> stamp.recentChanges >> stamp.rows >> stamp.maxId;
+}
@@ -0,0 +1,122 @@
+#ifndef DAEMONPROTO_H
+#define DAEMONPROTO_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QList>
+#include <optional>
+
+#include "database.hpp"
+
+// Field-by-field encodings of the types the Database API passes around.
+QDataStream& operator<<(QDataStream& s, const HMISRow& row);
+QDataStream& operator>>(QDataStream& s, HMISRow& row);
+QDataStream& operator<<(QDataStream& s, const NewHMISData& data);
+QDataStream& operator>>(QDataStream& s, NewHMISData& data);
+QDataStream& operator<<(QDataStream& s, const Diagnosis& d);
+QDataStream& operator>>(QDataStream& s, Diagnosis& d);
+QDataStream& operator<<(QDataStream& s, const User& user);
+QDataStream& operator>>(QDataStream& s, User& user);
+QDataStream& operator<<(QDataStream& s, const AuditEntry& e);
+QDataStream& operator>>(QDataStream& s, AuditEntry& e);
+QDataStream& operator<<(QDataStream& s, const AuditFilter& f);
+QDataStream& operator>>(QDataStream& s, AuditFilter& f);
+QDataStream& operator<<(QDataStream& s, const ChangeEntry& e);
+QDataStream& operator>>(QDataStream& s, ChangeEntry& e);
+QDataStream& operator<<(QDataStream& s, const MonthStamp& stamp);
+QDataStream& operator>>(QDataStream& s, MonthStamp& stamp);
+
+template <typename T>
+QDataStream& operator<<(QDataStream& s, const std::optional<T>& value) {
+    s << value.has_value();
+    if (value) {
+        s << *value;
+    }
+    return s;
+}
+
+template <typename T>
+QDataStream& operator>>(QDataStream& s, std::optional<T>& value) {
+    bool present = false;
+    s >> present;
+    value.reset();
+    if (present) {
+        T v{};
+        s >> v;
+        value = std::move(v);
+    }
+    return s;
+}
+
+// Wire format shared by hmisd and DaemonClient.
+//
+// Every message is a frame: a big-endian quint32 byte count of the rest,
+// then the quint32 request id, a quint16 op (requests) or status (replies)
+// and a QDataStream (Qt_6_0) payload. A request's payload is the Database
+// method's arguments in order. An Ok reply carries the method's result,
+// then the daemon's getLastError() when the result signals a failure
+// (false, nullopt or -1) and an empty string otherwise. Any other status
+// carries only an error message.
+//
+// Clients may send any number of requests before reading a reply. hmisd
+// answers each connection in request order, and writes all the replies to
+// one read from a client in a single write.
+namespace hmisd {
+
+inline constexpr quint32 kProtocolVersion = 3;
+inline constexpr int kHeaderBytes = 4 + 4 + 2;
+inline constexpr qsizetype kMaxFrameBytes = 64 * 1024 * 1024;  // a decade of a busy register
+
+// Append-only: the numbers are on the wire.
+enum class Op : quint16 {
+    Hello = 1,  // (version, token) -> (version, server description)
+    FetchMonth = 2,
+    FetchRange = 3,
+    MonthStamp = 4,
+    SaveNewRow = 5,
+    UpdateRow = 6,
+    UpdateRows = 7,
+    DeleteRow = 8,
+    ReserveIpNumbers = 9,
+    GetDiagnoses = 10,
+    InsertDiagnoses = 11,
+    DiagnosisExists = 12,
+    Authenticate = 13,
+    CreateUser = 14,
+    UserExists = 15,
+    GetUsers = 16,
+    ChangePassword = 17,
+    AuditPage = 18,
+    GetState = 19,
+    SetState = 20,
+    ChangesSince = 21,
+    MaxChangeId = 22,
+    SearchRegister = 23,
+    RegisterChangesSince = 24,
+};
+
+enum class Status : quint16 { Ok = 0, BadRequest = 1, Unauthorized = 2, UnknownOp = 3 };
+
+struct Frame {
+    quint32 id = 0;
+    quint16 code = 0;  // Op or Status
+    QByteArray payload;
+};
+
+QByteArray encodeFrame(quint32 id, quint16 code, const QByteArray& payload);
+// Removes the complete frames at the front of buffer and returns them.
+// Sets *bad (and returns nothing more) on a frame larger than kMaxFrameBytes.
+QList<Frame> takeFrames(QByteArray& buffer, bool* bad);
+
+template <typename... Args>
+QByteArray pack(const Args&... args) {
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    (void)(out << ... << args);
+    return payload;
+}
+
+}  // namespace hmisd
+
+#endif  // DAEMONPROTO_H
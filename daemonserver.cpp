@@ -0,0 +1,427 @@
+#include "daemonserver.hpp"
+#include "perfstats.hpp"
+
+#include <QDebug>
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <algorithm>
+
+static constexpr int kMaxIpBlock = 10000;
+
+// Whether a result signals failure, so the reply carries getLastError().
+template <typename T>
+static bool failed(const T&) {
+    return false;
+}
+static bool failed(bool ok) { return !ok; }
+static bool failed(qint64 value) { return value < 0; }
+template <typename T>
+static bool failed(const std::optional<T>& value) {
+    return !value.has_value();
+}
+
+template <typename... Args>
+static bool readArgs(QDataStream& in, Args&... args) {
+    (void)(in >> ... >> args);
+    return in.status() == QDataStream::Ok;
+}
+
+// Server connection strings hold the password, so only a file path is shown.
+DaemonServer::DaemonServer(Database& db, QString token, QObject* parent)
+    : QObject(parent),
+      m_db(db),
+      m_token(std::move(token)),
+      m_description(QString("%1 %2").arg(db.connOptions().getDriverName(), db.connOptions().dbFilePath()).trimmed()) {}
+
+DaemonServer::~DaemonServer() = default;
+
+bool DaemonServer::listenLocal(const QString& name, QString* error) {
+    // A socket file left by a crash would make listen() fail, but removing
+    // one that a running hmisd still serves would orphan its clients.
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(1000)) {
+        *error = "Another hmisd is already serving " + name;
+        return false;
+    }
+    QLocalServer::removeServer(name);
+
+    m_local = new QLocalServer(this);
+    m_local->setSocketOptions(QLocalServer::UserAccessOption | QLocalServer::GroupAccessOption);
+    if (!m_local->listen(name)) {
+        *error = QString("Cannot listen on %1: %2").arg(name, m_local->errorString());
+        return false;
+    }
+    connect(m_local, &QLocalServer::newConnection, this, [this] {
+        while (QLocalSocket* socket = m_local->nextPendingConnection()) {
+            accept(socket);
+        }
+    });
+    return true;
+}
+
+bool DaemonServer::listenTcp(const QString& hostPort, QString* error) {
+    const QString host = hostPort.section(':', 0, -2);
+    bool ok = false;
+    const quint16 port = hostPort.section(':', -1).toUShort(&ok);
+    if (!ok || port == 0 || host.isEmpty()) {
+        *error = "Expected host:port, got " + hostPort;
+        return false;
+    }
+    m_tcp = new QTcpServer(this);
+    const QHostAddress address = host == "*" ? QHostAddress(QHostAddress::Any) : QHostAddress(host);
+    if (!m_tcp->listen(address, port)) {
+        *error = QString("Cannot listen on %1: %2").arg(hostPort, m_tcp->errorString());
+        return false;
+    }
+    connect(m_tcp, &QTcpServer::newConnection, this, [this] {
+        while (QTcpSocket* socket = m_tcp->nextPendingConnection()) {
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            accept(socket);
+        }
+    });
+    return true;
+}
+
+void DaemonServer::accept(QIODevice* socket) {
+    m_clients.insert(socket, Client{});
+    connect(socket, &QIODevice::readyRead, this, [this, socket] { readClient(socket); });
+    auto forget = [this, socket] {
+        m_clients.remove(socket);
+        socket->deleteLater();
+    };
+    if (auto* local = qobject_cast<QLocalSocket*>(socket)) {
+        connect(local, &QLocalSocket::disconnected, this, forget);
+    } else if (auto* tcp = qobject_cast<QTcpSocket*>(socket)) {
+        connect(tcp, &QTcpSocket::disconnected, this, forget);
+    }
+    if (socket->bytesAvailable() > 0) {
+        readClient(socket);
+    }
+}
+
+void DaemonServer::readClient(QIODevice* socket) {
+    const auto it = m_clients.find(socket);
+    if (it == m_clients.end()) {
+        return;
+    }
+    it->in += socket->readAll();
+    bool bad = false;
+    const QList<hmisd::Frame> requests = hmisd::takeFrames(it->in, &bad);
+
+    QByteArray replies;
+    for (const hmisd::Frame& request : requests) {
+        replies += handle(*it, request);
+    }
+    if (bad) {
+        replies += hmisd::encodeFrame(0, quint16(hmisd::Status::BadRequest), hmisd::pack(QString("Frame too large")));
+    }
+    if (!replies.isEmpty()) {
+        socket->write(replies);
+    }
+    if (bad) {
+        qWarning() << "hmisd: dropping a client that sent an oversized frame";
+        socket->close();
+    }
+    if (!requests.isEmpty()) {
+        emit requestsHandled(int(requests.size()));
+    }
+}
+
+QByteArray DaemonServer::handle(Client& client, const hmisd::Frame& request) {
+    HMIS_PERF_TIMER(timer, "daemonServe");
+    timer.addBytes(request.payload.size());
+    auto refuse = [&](hmisd::Status status, const QString& message) {
+        timer.fail();
+        return hmisd::encodeFrame(request.id, quint16(status), hmisd::pack(message));
+    };
+
+    QDataStream in(request.payload);
+    in.setVersion(QDataStream::Qt_6_0);
+    const auto op = hmisd::Op(request.code);
+    if (op == hmisd::Op::Hello) {
+        quint32 version = 0;
+        QString token;
+        if (!readArgs(in, version, token) || version != hmisd::kProtocolVersion) {
+            return refuse(hmisd::Status::BadRequest,
+                          QString("hmisd speaks protocol %1, the client %2").arg(hmisd::kProtocolVersion).arg(version));
+        }
+        if (!m_token.isEmpty() && token != m_token) {
+            return refuse(hmisd::Status::Unauthorized, "Wrong hmisd token");
+        }
+        client.greeted = true;
+        return hmisd::encodeFrame(request.id, quint16(hmisd::Status::Ok),
+                                  hmisd::pack(hmisd::kProtocolVersion, m_description));
+    }
+    if (!client.greeted) {
+        return refuse(hmisd::Status::Unauthorized, "Expected Hello first");
+    }
+
+    QByteArray reply;
+    switch (dispatch(client, op, in, &reply)) {
+        case hmisd::Status::Ok:
+            timer.addBytes(reply.size());
+            return hmisd::encodeFrame(request.id, quint16(hmisd::Status::Ok), reply);
+        case hmisd::Status::UnknownOp:
+            return refuse(hmisd::Status::UnknownOp, QString("Unknown op %1").arg(request.code));
+        case hmisd::Status::Unauthorized:
+            return refuse(hmisd::Status::Unauthorized,
+                          QString(client.userId == 0 ? "Op %1 needs a signed-in user" : "Op %1 needs an administrator")
+                              .arg(request.code));
+        default:
+            return refuse(hmisd::Status::BadRequest, QString("Malformed arguments for op %1").arg(request.code));
+    }
+}
+
+template <typename T>
+QByteArray DaemonServer::result(const T& value) {
+    return hmisd::pack(value, failed(value) ? m_db.getLastError() : QString());
+}
+
+// Register writes carry an actor id for the audit log; hmisd records the
+// connection's signed-in user instead.
+hmisd::Status DaemonServer::dispatch(Client& client, hmisd::Op op, QDataStream& in, QByteArray* reply) {
+    using hmisd::Op;
+    using hmisd::Status;
+    // Before signing in, a connection can only sign in or create the first user.
+    if (client.userId == 0 && op != Op::Authenticate && op != Op::CreateUser) {
+        return Status::Unauthorized;
+    }
+    switch (op) {
+        case Op::Hello:
+            break;
+        case Op::FetchMonth: {
+            int year = 0;
+            int month = 0;
+            if (!readArgs(in, year, month)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.fetchHMISData(year, month));
+            return Status::Ok;
+        }
+        case Op::FetchRange: {
+            int fromYear = 0;
+            int fromMonth = 0;
+            int toYear = 0;
+            int toMonth = 0;
+            if (!readArgs(in, fromYear, fromMonth, toYear, toMonth)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.fetchHMISRange(fromYear, fromMonth, toYear, toMonth));
+            return Status::Ok;
+        }
+        case Op::MonthStamp: {
+            int year = 0;
+            int month = 0;
+            if (!readArgs(in, year, month)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.monthStamp(year, month));
+            return Status::Ok;
+        }
+        case Op::SaveNewRow: {
+            NewHMISData data;
+            int actor = 0;
+            if (!readArgs(in, data, actor)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.saveNewRow(data, client.userId));
+            return Status::Ok;
+        }
+        case Op::UpdateRow: {
+            HMISRow row{};
+            int actor = 0;
+            if (!readArgs(in, row, actor)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.updateHMISRow(row, client.userId));
+            return Status::Ok;
+        }
+        case Op::UpdateRows: {
+            QList<HMISRow> rows;
+            int actor = 0;
+            if (!readArgs(in, rows, actor)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.updateHMISRows(rows, client.userId));
+            return Status::Ok;
+        }
+        case Op::DeleteRow: {
+            int id = 0;
+            int actor = 0;
+            if (!readArgs(in, id, actor)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.deleteHMISRow(id, client.userId));
+            return Status::Ok;
+        }
+        case Op::ReserveIpNumbers: {
+            int year = 0;
+            int month = 0;
+            int count = 0;
+            if (!readArgs(in, year, month, count)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.reserveIpNumbers(year, month, std::clamp(count, 1, kMaxIpBlock)));
+            return Status::Ok;
+        }
+        case Op::GetDiagnoses:
+            *reply = result(m_db.getAllDiagnoses());
+            return Status::Ok;
+        case Op::InsertDiagnoses: {
+            QStringList names;
+            if (!readArgs(in, names)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.insertDiagnoses(names));
+            return Status::Ok;
+        }
+        case Op::DiagnosisExists: {
+            QString name;
+            if (!readArgs(in, name)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.diagnosisExists(name));
+            return Status::Ok;
+        }
+        case Op::Authenticate: {
+            QString username;
+            QString password;
+            if (!readArgs(in, username, password)) {
+                return Status::BadRequest;
+            }
+            // A wrong password (e.g. re-checking the current one before a
+            // password change) leaves the connection's user as it was.
+            const std::optional<User> user = m_db.authenticate(username, password);
+            if (user) {
+                client.userId = user->id;
+                client.role = user->role;
+            }
+            *reply = result(user);
+            return Status::Ok;
+        }
+        case Op::CreateUser: {
+            QString username;
+            QString password;
+            quint8 role = 0;
+            if (!readArgs(in, username, password, role)) {
+                return Status::BadRequest;
+            }
+            // The first user (hmis --create-superuser) has nobody to sign in as.
+            if (!client.admin() && !m_db.getAllUsers().isEmpty()) {
+                return Status::Unauthorized;
+            }
+            *reply = result(m_db.createUser(username, password,
+                                            role == quint8(UserRole::Admin) ? UserRole::Admin : UserRole::Clerk));
+            return Status::Ok;
+        }
+        case Op::UserExists: {
+            QString username;
+            if (!readArgs(in, username)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.userExists(username));
+            return Status::Ok;
+        }
+        case Op::GetUsers:
+            if (!client.admin()) {
+                return Status::Unauthorized;
+            }
+            *reply = result(m_db.getAllUsers());
+            return Status::Ok;
+        case Op::ChangePassword: {
+            int userId = 0;
+            QString password;
+            if (!readArgs(in, userId, password)) {
+                return Status::BadRequest;
+            }
+            if (!client.admin() && (client.userId == 0 || userId != client.userId)) {
+                return Status::Unauthorized;
+            }
+            *reply = result(m_db.changePassword(userId, password));
+            return Status::Ok;
+        }
+        case Op::AuditPage: {
+            AuditFilter filter;
+            qint64 beforeId = 0;
+            int limit = 0;
+            if (!readArgs(in, filter, beforeId, limit)) {
+                return Status::BadRequest;
+            }
+            if (!client.admin()) {
+                return Status::Unauthorized;
+            }
+            *reply = result(m_db.getAuditPage(filter, beforeId, limit));
+            return Status::Ok;
+        }
+        case Op::GetState: {
+            QString name;
+            QString fallback;
+            if (!readArgs(in, name, fallback)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.getState(name, fallback));
+            return Status::Ok;
+        }
+        case Op::SetState: {
+            QString name;
+            QString value;
+            if (!readArgs(in, name, value)) {
+                return Status::BadRequest;
+            }
+            if (!client.admin()) {
+                return Status::Unauthorized;
+            }
+            *reply = result(m_db.setState(name, value));
+            return Status::Ok;
+        }
+        case Op::ChangesSince: {
+            qint64 afterId = 0;
+            int limit = 0;
+            if (!readArgs(in, afterId, limit)) {
+                return Status::BadRequest;
+            }
+            if (!client.admin()) {
+                return Status::Unauthorized;
+            }
+            // User rows stay on the server; the entry itself keeps ids contiguous.
+            auto entries = m_db.getChangesSince(afterId, limit);
+            if (entries) {
+                for (ChangeEntry& e : *entries) {
+                    if (e.tableName == "users") {
+                        e.before.clear();
+                        e.after.clear();
+                    }
+                }
+            }
+            *reply = result(entries);
+            return Status::Ok;
+        }
+        case Op::RegisterChangesSince: {
+            qint64 afterId = 0;
+            int limit = 0;
+            if (!readArgs(in, afterId, limit)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.getRegisterChangesSince(afterId, limit));
+            return Status::Ok;
+        }
+        case Op::MaxChangeId:
+            *reply = result(m_db.maxChangeId());
+            return Status::Ok;
+        case Op::SearchRegister: {
+            QString text;
+            int offset = 0;
+            int limit = 0;
+            if (!readArgs(in, text, offset, limit)) {
+                return Status::BadRequest;
+            }
+            *reply = result(m_db.searchRegister(text, offset, limit));
+            return Status::Ok;
+        }
+    }
+    return Status::UnknownOp;
+}
@@ -0,0 +1,74 @@
+#ifndef DAEMONSERVER_H
+#define DAEMONSERVER_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QHash>
+#include <QObject>
+#include <QString>
+
+#include "daemonproto.hpp"
+#include "database.hpp"
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+
+// hmisd's side of the protocol in daemonproto.hpp: accepts clients on a
+// local socket and/or TCP and runs their requests against one Database.
+//
+// Everything happens on the thread the server lives on, one request at a
+// time, so the database file has exactly one owner and writers never wait
+// on each other's file locks. The requests found in one read from a client
+// are answered in order and their replies leave in one write.
+//
+// The token only admits a client. Each connection then has to sign in with
+// Authenticate before anything else (creating the very first user aside)
+// and acts as that user: register writes are recorded under it, and
+// creating users, setting app state, changing someone else's password and
+// reading the audit log, user list or full change journal need an Admin.
+class DaemonServer : public QObject {
+    Q_OBJECT
+  public:
+    // An empty token admits any client that can reach the sockets.
+    DaemonServer(Database& db, QString token, QObject* parent = nullptr);
+    ~DaemonServer() override;
+
+    // name is a socket name or path. Fails if another hmisd already serves it.
+    bool listenLocal(const QString& name, QString* error);
+    bool listenTcp(const QString& hostPort, QString* error);
+    [[nodiscard]] qsizetype clientCount() const { return m_clients.size(); }
+    [[nodiscard]] const QString& description() const { return m_description; }  // sent in Hello replies
+
+  signals:
+    void requestsHandled(int count);  // for idle detection
+
+  private:
+    struct Client {
+        QByteArray in;  // bytes of an incomplete request frame
+        bool greeted = false;
+        int userId = 0;  // signed-in user; 0 until Authenticate succeeds
+        UserRole role = UserRole::Clerk;
+
+        [[nodiscard]] bool admin() const { return userId != 0 && role == UserRole::Admin; }
+    };
+
+    void accept(QIODevice* socket);
+    void readClient(QIODevice* socket);
+    QByteArray handle(Client& client, const hmisd::Frame& request);
+    // Runs one call; returns BadRequest (and no reply) when the payload does
+    // not hold the op's arguments, Unauthorized when the client's user may
+    // not make it.
+    hmisd::Status dispatch(Client& client, hmisd::Op op, QDataStream& in, QByteArray* reply);
+    template <typename T>
+    QByteArray result(const T& value);
+
+    Database& m_db;
+    QString m_token;
+    QString m_description;
+    QLocalServer* m_local = nullptr;
+    QTcpServer* m_tcp = nullptr;
+    QHash<QIODevice*, Client> m_clients;
+};
+
+#endif  // DAEMONSERVER_H
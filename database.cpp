@@ -1,13 +1,25 @@
 #include "database.hpp"
+#include "auditwriter.hpp"
+#include "backup.hpp"
+#include "daemonclient.hpp"
+#include "outbox.hpp"
+#include "perfstats.hpp"
+#include "sqldialect.hpp"
 
 #include <QCryptographicHash>
 #include <QDateTime>
 #include <QDir>
 #include <QFile>
-#include <QMessageBox>
+#include <QFileInfo>
+#include <QJsonDocument>
 #include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QSet>
 #include <QtSql/QSqlRecord>
+#include <algorithm>
+#include <atomic>
 #include <exception>
+#include <limits>
 #include <utility>
 
 // ---------------------------------------------------------------------------
@@ -29,32 +41,113 @@ struct TransactionGuard {
         }
         return true;
     }
+    void rollback() {
+        if (active) {
+            active = false;
+            db.rollback();
+        }
+    }
 };
 
+static const QString kDuplicateIpError = "IP number already exists for the given month and year.";
+
+// Unique/primary key violation, by SQLSTATE (PostgreSQL), error number
+// (MySQL) or primary/extended result code (SQLite).
+static bool isUniqueViolation(const QSqlError& error) {
+    const QString code = error.nativeErrorCode();
+    return code == "23505" || code == "1062" || code == "2067" || code == "1555" ||
+           (code == "19" && error.databaseText().contains("UNIQUE", Qt::CaseInsensitive));
+}
+
+// Approximate in-memory payload of a row, for the perf "bytes" counter.
+static qsizetype rowBytes(const HMISRow& row) {
+    qsizetype chars = row.ageCategory.size() + row.sex.size() + row.newAttendance.size() + row.ipNumber.size();
+    for (const QString& dx : row.diagnoses) {
+        chars += dx.size();
+    }
+    return (chars * qsizetype(sizeof(QChar))) + qsizetype(3 * sizeof(int));
+}
+
+// Change-journal image of a freshly inserted hmis row, built from the insert
+// parameters to avoid reading the row back.
+static QJsonObject hmisImage(int id, const NewHMISData& data, const QString& dxSeparator) {
+    return QJsonObject{
+        {"id", id},
+        {"age_category", data.ageCategory},
+        {"month", data.month},
+        {"year", data.year},
+        {"sex", data.sex},
+        {"new_attendance", data.newAttendance},
+        {"diagnosis", data.diagnoses.join(dxSeparator)},
+        {"ip_number", data.ipNumber},
+    };
+}
+
+static HMISRow hmisRowFromImage(int id, const QJsonObject& image, const QString& dxSeparator) {
+    HMISRow row;
+    row.id = id;
+    row.ageCategory = image.value("age_category").toString();
+    row.month = image.value("month").toInt();
+    row.year = image.value("year").toInt();
+    row.sex = image.value("sex").toString();
+    row.newAttendance = image.value("new_attendance").toString();
+    row.diagnoses = image.value("diagnosis").toString().split(dxSeparator, Qt::SkipEmptyParts);
+    row.ipNumber = image.value("ip_number").toString();
+    return row;
+}
+
 // ---------------------------------------------------------------------------
 // Construction
 // ---------------------------------------------------------------------------
-Database::Database() = default;
+static std::atomic<int> nextConnectionId{0};
+
+// Each instance owns a named connection so that several databases (bench
+// datasets, backup workers, replicas) can coexist in one process.
+Database::Database() : m_connectionName(QString("hmis_%1").arg(nextConnectionId.fetch_add(1))) {}
+
+Database::~Database() {
+    m_auditWriter.reset();
+    if (db.isValid()) {
+        db.close();
+        db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
+}
 
 // ---------------------------------------------------------------------------
 // Connection
 // ---------------------------------------------------------------------------
 void Database::Connect(const ConnOptions& options) {
+    HMIS_PERF_TIMER(timer, "Connect");
     if (!options.isValid()) {
         throw std::runtime_error("Invalid connection options");
     }
 
+    if (options.getDriver() == Driver::HMISD) {
+        m_connOptions = options;
+        m_sql = nullptr;
+        m_remote = std::make_unique<DaemonClient>(options.get<DaemonOptions>());
+        QString error;
+        if (!m_remote->open(&error)) {
+            timer.fail();
+            throw std::runtime_error(error.toStdString());
+        }
+        return;
+    }
+
     const QString driverName = options.getDriverName();
     if (!QSqlDatabase::isDriverAvailable(driverName)) {
         throw std::runtime_error("Unsupported driver: " + driverName.toStdString());
     }
 
-    db = QSqlDatabase::addDatabase(driverName);
+    db = QSqlDatabase::addDatabase(driverName, m_connectionName);
 
     switch (options.getDriver()) {
         case Driver::SQLITE: {
             const auto& opt = options.get<SqliteOptions>();
             db.setDatabaseName(opt.dbName);
+            // Other connections (audit writer, backups) may briefly hold the write lock.
+            db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(opt.busyTimeoutMs));
             break;
         }
         case Driver::POSTGRES: {
@@ -64,6 +157,8 @@ void Database::Connect(const ConnOptions& options) {
             db.setDatabaseName(opt.getDbName());
             db.setUserName(opt.getUser());
             db.setPassword(opt.getPassword());
+            // Fail fast when the server is unreachable (offline-first retries).
+            db.setConnectOptions("connect_timeout=5");
             break;
         }
         case Driver::MYSQL: {
@@ -73,42 +168,101 @@ void Database::Connect(const ConnOptions& options) {
             db.setDatabaseName(opt.getDbName());
             db.setUserName(opt.getUser());
             db.setPassword(opt.getPassword());
+            db.setConnectOptions("MYSQL_OPT_CONNECT_TIMEOUT=5");
             break;
         }
+        case Driver::HMISD:
+            break;  // handled above
     }
 
+    // Kept even when open() fails, so reconnect() can retry later.
+    m_connOptions = options;
+    m_sql = sql::dialectFor(options);
+
     if (!db.open()) {
+        timer.fail();
         throw std::runtime_error("Database connection failed: " + db.lastError().text().toStdString());
     }
 
-    m_connOptions = options;
-
     // Enable WAL mode for SQLite (better concurrency + crash safety)
     if (options.getDriver() == Driver::SQLITE) {
-        QSqlQuery q;
+        QSqlQuery q(db);
+        // Only takes effect before the first table is created; existing
+        // files are converted by enableIncrementalVacuum().
+        q.exec("PRAGMA auto_vacuum=INCREMENTAL");
         q.exec("PRAGMA journal_mode=WAL");
-        q.exec("PRAGMA foreign_keys=ON");
+        applySqliteProfile();
+    }
+    // Interleaved mode (2, MySQL 8's default) lets concurrent INSERTs take
+    // ids between a multi-row INSERT's own, so lastInsertId() + i is only
+    // safe in modes 0 and 1.
+    m_batchIds = true;
+    if (m_sql->insertedIds == sql::InsertedIds::FirstOfBatch) {
+        QSqlQuery q(db);
+        m_batchIds = q.exec("SELECT @@innodb_autoinc_lock_mode") && q.next() && q.value(0).toInt() < 2;
+    }
+    // Every connection that writes keeps an existing index in step, whether
+    // or not it runs createSchema().
+    m_searchIndexed = !m_sql->searchTable.isEmpty() && db.tables().contains(m_sql->searchTable);
+}
+
+// Per-connection settings, so they are reapplied after every open.
+void Database::applySqliteProfile() {
+    const auto& opt = m_connOptions.get<SqliteOptions>();
+    static const char* const syncLevels[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+    QSqlQuery q(db);
+    q.exec("PRAGMA foreign_keys=ON");
+    q.exec(QString("PRAGMA synchronous=%1").arg(syncLevels[static_cast<int>(opt.synchronous)]));
+    q.exec(QString("PRAGMA cache_size=-%1").arg(std::max(opt.cacheSizeKiB, 0)));
+    q.exec(QString("PRAGMA mmap_size=%1").arg(std::max<qint64>(opt.mmapSize, 0)));
+    q.exec(QString("PRAGMA temp_store=%1").arg(opt.tempStoreMemory ? "MEMORY" : "DEFAULT"));
+    q.exec(QString("PRAGMA wal_autocheckpoint=%1").arg(std::max(opt.walAutocheckpoint, 0)));
+}
+
+bool Database::isConnected() const { return m_remote ? m_remote->isOpen() : db.isOpen(); }
+
+bool Database::reconnect() {
+    HMIS_PERF_TIMER(timer, "reconnect");
+    if (m_remote) {
+        if (!m_remote->open(&m_lastError)) {
+            timer.fail();
+            return false;
+        }
+        m_lastError.clear();
+        return true;
+    }
+    if (!db.isValid()) {
+        m_lastError = "Connect() was never called";
+        return false;
+    }
+    db.close();
+    if (!db.open()) {
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+    m_lastError.clear();
+    if (m_connOptions.getDriver() == Driver::SQLITE) {
+        applySqliteProfile();
     }
+    return true;
 }
 
 // ---------------------------------------------------------------------------
 // Schema creation
 // ---------------------------------------------------------------------------
 void Database::createSchema() {
-    Driver driver = m_connOptions.getDriver();
-    QString pkDef;
-
-    if (driver == Driver::SQLITE) {
-        pkDef = "id integer NOT NULL PRIMARY KEY AUTOINCREMENT";
-    } else if (driver == Driver::POSTGRES) {
-        pkDef = "id SERIAL PRIMARY KEY";
-    } else if (driver == Driver::MYSQL) {
-        pkDef = "id INT NOT NULL AUTO_INCREMENT PRIMARY KEY";
-    } else {
+    HMIS_PERF_TIMER(timer, "createSchema");
+    m_lastError.clear();
+    if (m_remote) {
+        return;  // hmisd created it
+    }
+    if (m_sql == nullptr) {
         throw std::runtime_error("Unsupported database driver");
     }
+    const QString pkDef = m_sql->autoId;
 
-    QSqlQuery q;
+    QSqlQuery q(db);
 
     // Main HMIS table
     if (!q.exec("CREATE TABLE IF NOT EXISTS hmis (" + pkDef +
@@ -123,6 +277,22 @@ void Database::createSchema() {
                 "UNIQUE(ip_number, year, month))")) {
         throw std::runtime_error("Error creating hmis table: " + q.lastError().text().toStdString());
     }
+    // Month views, range reports and monthStamp() all filter on the period.
+    createIndex("idx_hmis_period", "hmis", "year, month, id");
+
+    // Full-text index for searchRegister(), filled once when it is new. A
+    // SQLite library built without FTS5 leaves searches to a scan.
+    if (!m_sql->searchTable.isEmpty() && !m_searchIndexed) {
+        if (q.exec(m_sql->createSearchTable) &&
+            (m_sql->createSearchIndex.isEmpty() || q.exec(m_sql->createSearchIndex))) {
+            m_searchIndexed = true;
+            if (!rebuildSearchIndex()) {
+                qWarning() << "Filling the search index failed, searches scan the register:" << m_lastError;
+            }
+        } else {
+            qWarning() << "Search index unavailable, searches scan the register:" << q.lastError().text();
+        }
+    }
 
     // Diagnoses lookup table
     if (!q.exec("CREATE TABLE IF NOT EXISTS diagnoses (" + pkDef +
@@ -141,34 +311,319 @@ void Database::createSchema() {
         throw std::runtime_error("Error creating users table: " + q.lastError().text().toStdString());
     }
 
-    // Audit log table
-    if (!q.exec("CREATE TABLE IF NOT EXISTS audit_log (" + pkDef +
+    // Audit log table. period (yyyymm) is the archival and partition key.
+    const QString auditColumns =
+        "user_id INT NOT NULL DEFAULT 0,"
+        "username TEXT NOT NULL DEFAULT '',"
+        "action TEXT NOT NULL,"
+        "table_name TEXT NOT NULL DEFAULT 'hmis',"
+        "record_id INT NOT NULL DEFAULT 0,"
+        "detail TEXT NOT NULL DEFAULT '',"
+        "changed_at TEXT NOT NULL,"
+        "change_id BIGINT NOT NULL DEFAULT 0,"
+        "period INT NOT NULL DEFAULT 0";
+    if (m_sql->nativePartitions && !db.tables().contains("audit_log")) {
+        // New PostgreSQL installs get native monthly range partitions; the
+        // primary key must include the partition key.
+        if (!q.exec("CREATE TABLE audit_log (id BIGSERIAL," + auditColumns +
+                    ", PRIMARY KEY (id, period)) PARTITION BY RANGE (period)") ||
+            !q.exec("CREATE TABLE IF NOT EXISTS audit_log_pdefault PARTITION OF audit_log DEFAULT")) {
+            throw std::runtime_error("Error creating audit_log table: " + q.lastError().text().toStdString());
+        }
+    } else if (!q.exec("CREATE TABLE IF NOT EXISTS audit_log (" + pkDef + "," + auditColumns + ")")) {
+        throw std::runtime_error("Error creating audit_log table: " + q.lastError().text().toStdString());
+    }
+    addColumnIfMissing("audit_log", "change_id", "BIGINT NOT NULL DEFAULT 0");
+    if (addColumnIfMissing("audit_log", "period", "INT NOT NULL DEFAULT 0")) {
+        q.exec(QString("UPDATE audit_log SET period = CAST(SUBSTR(changed_at, 1, 4) AS %1) * 100 + "
+                       "CAST(SUBSTR(changed_at, 6, 2) AS %1) WHERE period = 0")
+                   .arg(m_sql->intCast));
+    }
+    m_auditPartitioned = false;
+    if (m_sql->nativePartitions) {
+        m_auditPartitioned = q.exec("SELECT 1 FROM pg_partitioned_table p JOIN pg_class c ON c.oid = p.partrelid "
+                                    "WHERE c.relname = 'audit_log'") &&
+                             q.next();
+        ensureAuditPartitions();
+    }
+
+    // Audit log lookups: each filter seeks an index and walks it in id order,
+    // so keyset pages stay cheap however old the entries are.
+    createIndex("idx_audit_user", "audit_log", "username, id", "username(64), id");
+    createIndex("idx_audit_action", "audit_log", "action, id", "action(16), id");
+    createIndex("idx_audit_table_record", "audit_log", "table_name, record_id, id", "table_name(32), record_id, id");
+    createIndex("idx_audit_changed_at", "audit_log", "changed_at", "changed_at(32)");
+    createIndex("idx_audit_change", "audit_log", "change_id");
+    createIndex("idx_audit_period", "audit_log", "period, id");
+    ensureAuditChangeUnique();
+
+    // Row-level change journal (full before/after images, drives differential backups)
+    if (!q.exec("CREATE TABLE IF NOT EXISTS change_journal (" + pkDef +
                 ","
+                "table_name VARCHAR(32) NOT NULL,"
+                "op VARCHAR(8) NOT NULL,"
+                "record_id INT NOT NULL,"
+                "before_image TEXT,"
+                "after_image TEXT,"
                 "user_id INT NOT NULL DEFAULT 0,"
-                "username TEXT NOT NULL DEFAULT '',"
-                "action TEXT NOT NULL,"
-                "table_name TEXT NOT NULL DEFAULT 'hmis',"
-                "record_id INT NOT NULL DEFAULT 0,"
-                "detail TEXT NOT NULL DEFAULT '',"
-                "changed_at TEXT NOT NULL)")) {
-        throw std::runtime_error("Error creating audit_log table: " + q.lastError().text().toStdString());
+                "changed_at VARCHAR(32) NOT NULL,"
+                "audit_detail TEXT)")) {
+        throw std::runtime_error("Error creating change_journal table: " + q.lastError().text().toStdString());
+    }
+    addColumnIfMissing("change_journal", "audit_detail", "TEXT");
+
+    // Wake listening clients (changenotifier.hpp) once per committed
+    // statement; they read the details from the journal.
+    if (m_sql->listenNotify) {
+        if (!q.exec("CREATE OR REPLACE FUNCTION hmis_notify_change() RETURNS trigger AS $$ "
+                    "BEGIN PERFORM pg_notify('hmis_changes', ''); RETURN NULL; END $$ LANGUAGE plpgsql")) {
+            throw std::runtime_error("Error creating notify function: " + q.lastError().text().toStdString());
+        }
+        const bool haveTrigger =
+            q.exec("SELECT 1 FROM pg_trigger WHERE tgname = 'change_journal_notify'") && q.next();
+        if (!haveTrigger && !q.exec("CREATE TRIGGER change_journal_notify AFTER INSERT ON change_journal "
+                                    "FOR EACH STATEMENT EXECUTE FUNCTION hmis_notify_change()")) {
+            throw std::runtime_error("Error creating notify trigger: " + q.lastError().text().toStdString());
+        }
+    }
+
+    // Catalog of full and differential backups
+    if (!q.exec("CREATE TABLE IF NOT EXISTS backup_state (" + pkDef +
+                ","
+                "kind VARCHAR(8) NOT NULL,"
+                "path TEXT NOT NULL,"
+                "from_change_id BIGINT NOT NULL DEFAULT 0,"
+                "to_change_id BIGINT NOT NULL DEFAULT 0,"
+                "created_at VARCHAR(32) NOT NULL)")) {
+        throw std::runtime_error("Error creating backup_state table: " + q.lastError().text().toStdString());
+    }
+
+    // Small key/value store for bookkeeping (watermarks and the like)
+    if (!q.exec("CREATE TABLE IF NOT EXISTS app_state ("
+                "name VARCHAR(64) NOT NULL PRIMARY KEY,"
+                "value TEXT NOT NULL)")) {
+        throw std::runtime_error("Error creating app_state table: " + q.lastError().text().toStdString());
+    }
+
+    // Op keys of outbox entries already applied (offline-first clients)
+    if (!q.exec("CREATE TABLE IF NOT EXISTS applied_ops ("
+                "op_key VARCHAR(64) NOT NULL PRIMARY KEY,"
+                "applied_at VARCHAR(32) NOT NULL)")) {
+        throw std::runtime_error("Error creating applied_ops table: " + q.lastError().text().toStdString());
+    }
+
+    // Central server of multi-facility sync: how far each facility's feed
+    // has been imported, and which central row each facility row became.
+    if (!q.exec("CREATE TABLE IF NOT EXISTS feed_sources ("
+                "facility_id VARCHAR(64) NOT NULL PRIMARY KEY,"
+                "code VARCHAR(32) NOT NULL UNIQUE,"
+                "applied_version BIGINT NOT NULL DEFAULT 0,"
+                "updated_at VARCHAR(32) NOT NULL)")) {
+        throw std::runtime_error("Error creating feed_sources table: " + q.lastError().text().toStdString());
+    }
+    if (!q.exec("CREATE TABLE IF NOT EXISTS feed_rows ("
+                "facility_id VARCHAR(64) NOT NULL,"
+                "remote_id INT NOT NULL,"
+                "local_id INT NOT NULL,"
+                "PRIMARY KEY (facility_id, remote_id))")) {
+        throw std::runtime_error("Error creating feed_rows table: " + q.lastError().text().toStdString());
+    }
+
+    // IP number counters. next_value is the next unallocated number.
+    const bool newSequences = !db.tables().contains("ip_sequences");
+    if (!q.exec("CREATE TABLE IF NOT EXISTS ip_sequences ("
+                "year INT NOT NULL,"
+                "month INT NOT NULL,"
+                "next_value BIGINT NOT NULL,"
+                "PRIMARY KEY (year, month))")) {
+        throw std::runtime_error("Error creating ip_sequences table: " + q.lastError().text().toStdString());
+    }
+    if (newSequences) {
+        // Continue after the highest numeric IP number already registered.
+        if (!q.exec(QString("INSERT INTO ip_sequences (year, month, next_value) "
+                            "SELECT year, month, MAX(CAST(ip_number AS %1)) + 1 FROM hmis WHERE %2 "
+                            "GROUP BY year, month")
+                        .arg(m_sql->counterCast, m_sql->numericIpNumber))) {
+            qWarning() << "Seeding ip_sequences failed:" << q.lastError().text();
+        }
+    }
+}
+
+// Upgrades tables created by older versions. Returns true if the column was added.
+bool Database::addColumnIfMissing(const QString& table, const QString& column, const QString& definition) {
+    if (db.record(table).contains(column)) {
+        return false;
+    }
+    QSqlQuery q(db);
+    if (!q.exec(QString("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table, column, definition))) {
+        throw std::runtime_error("Error adding " + column.toStdString() + " to " + table.toStdString() + ": " +
+                                 q.lastError().text().toStdString());
+    }
+    return true;
+}
+
+// MySQL has no CREATE INDEX IF NOT EXISTS. True on errors, so callers do
+// not try to create the index.
+bool Database::mysqlIndexExists(const QString& name, const QString& table) {
+    QSqlQuery q(db);
+    q.prepare(
+        "SELECT COUNT(*) FROM information_schema.statistics "
+        "WHERE table_schema = DATABASE() AND table_name = :t AND index_name = :i");
+    q.bindValue(":t", table);
+    q.bindValue(":i", name);
+    return !q.exec() || !q.next() || q.value(0).toInt() > 0;
+}
+
+// Best-effort: a missing index only slows queries down. MySQL has no
+// CREATE INDEX IF NOT EXISTS and needs prefix lengths on TEXT columns.
+void Database::createIndex(const QString& name, const QString& table, const QString& columns,
+                           const QString& mysqlColumns) {
+    QSqlQuery q(db);
+    if (!m_sql->createIndexIfNotExists) {
+        if (mysqlIndexExists(name, table)) {
+            return;
+        }
+        if (!q.exec(QString("CREATE INDEX %1 ON %2 (%3)")
+                        .arg(name, table, mysqlColumns.isEmpty() ? columns : mysqlColumns))) {
+            qWarning() << "Creating index" << name << "failed:" << q.lastError().text();
+        }
+        return;
+    }
+    if (!q.exec(QString("CREATE INDEX IF NOT EXISTS %1 ON %2 (%3)").arg(name, table, columns))) {
+        qWarning() << "Creating index" << name << "failed:" << q.lastError().text();
+    }
+}
+
+// At most one audit row per journal entry. Rows from before the index are
+// deduplicated (keeping the first) once, when creating it fails.
+void Database::ensureAuditChangeUnique() {
+    if (!m_sql->auditChangeKey.isEmpty()) {
+        addColumnIfMissing("audit_log", "change_key", m_sql->auditChangeKey);
+    }
+    if (!m_sql->createIndexIfNotExists && mysqlIndexExists("idx_audit_change_once", "audit_log")) {
+        return;
+    }
+    QSqlQuery q(db);
+    if (q.exec(m_sql->uniqueAuditChange)) {
+        return;
+    }
+    if (!q.exec("DELETE FROM audit_log WHERE change_id > 0 AND id NOT IN (SELECT keep FROM "
+                "(SELECT MIN(id) AS keep FROM audit_log WHERE change_id > 0 GROUP BY change_id) kept)") ||
+        !q.exec(m_sql->uniqueAuditChange)) {
+        qWarning() << "Creating index idx_audit_change_once failed:" << q.lastError().text();
     }
 }
 
 // ---------------------------------------------------------------------------
 // Error
 // ---------------------------------------------------------------------------
-QString Database::getLastError() const { return db.lastError().text(); }
+QString Database::getLastError() const { return m_lastError.isEmpty() ? db.lastError().text() : m_lastError; }
+
+template <typename R, typename... Args>
+std::optional<R> Database::remote(hmisd::Op op, const Args&... args) {
+    HMIS_PERF_TIMER(timer, "daemonRequest");
+    const QByteArray request = hmisd::pack(args...);
+    const auto reply = m_remote->call(op, request);
+    if (!reply) {
+        m_lastError = m_remote->lastError();
+        timer.fail();
+        return std::nullopt;
+    }
+    timer.addBytes(request.size() + reply->size());
+    QDataStream in(*reply);
+    in.setVersion(QDataStream::Qt_6_0);
+    R result{};
+    QString error;
+    in >> result >> error;
+    if (in.status() != QDataStream::Ok) {
+        m_lastError = "Malformed reply from hmisd";
+        timer.fail();
+        return std::nullopt;
+    }
+    if (!error.isEmpty()) {
+        m_lastError = error;
+    }
+    return result;
+}
 
 // ---------------------------------------------------------------------------
 // HMIS data
 // ---------------------------------------------------------------------------
 HMISData Database::fetchHMISData(int year, int month) {
-    QSqlQuery query;
+    HMIS_PERF_TIMER(timer, "fetchHMISData");
+    m_lastError.clear();
+    if (m_remote) {
+        HMISData rows = remote<HMISData>(hmisd::Op::FetchMonth, year, month).value_or(HMISData());
+        timer.addRows(rows.size());
+        return rows;
+    }
+    QSqlQuery query(db);
     query.prepare("SELECT * FROM hmis WHERE year=:year AND month=:month ORDER BY id ASC");
     query.bindValue(":year", year);
     query.bindValue(":month", month);
 
+    HMISData rows = readRows(query, timer);
+    if (m_outbox != nullptr) {
+        mergePending(rows, year, month);
+    }
+    timer.addRows(rows.size());
+    return rows;
+}
+
+HMISData Database::fetchHMISRange(int fromYear, int fromMonth, int toYear, int toMonth) {
+    HMIS_PERF_TIMER(timer, "fetchHMISRange");
+    m_lastError.clear();
+    if (m_remote) {
+        HMISData rows =
+            remote<HMISData>(hmisd::Op::FetchRange, fromYear, fromMonth, toYear, toMonth).value_or(HMISData());
+        timer.addRows(rows.size());
+        return rows;
+    }
+    Database& source = analytics();
+    QSqlQuery query(source.db);
+    query.prepare(
+        "SELECT * FROM hmis WHERE (year > :fy OR (year = :fy2 AND month >= :fm)) "
+        "AND (year < :ty OR (year = :ty2 AND month <= :tm)) ORDER BY year, month, id");
+    query.bindValue(":fy", fromYear);
+    query.bindValue(":fy2", fromYear);
+    query.bindValue(":fm", fromMonth);
+    query.bindValue(":ty", toYear);
+    query.bindValue(":ty2", toYear);
+    query.bindValue(":tm", toMonth);
+
+    HMISData rows = source.readRows(query, timer);
+    timer.addRows(rows.size());
+    return rows;
+}
+
+std::optional<MonthStamp> Database::monthStamp(int year, int month) {
+    HMIS_PERF_TIMER(timer, "monthStamp");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<std::optional<MonthStamp>>(hmisd::Op::MonthStamp, year, month).value_or(std::nullopt);
+    }
+    QSqlQuery q(db);
+    q.prepare(
+        "SELECT (SELECT COALESCE(MAX(id), 0) FROM change_journal), "
+        "(SELECT COUNT(*) FROM change_journal "
+        "WHERE id > (SELECT COALESCE(MAX(id), 0) FROM change_journal) - :lookback), "
+        "COUNT(*), COALESCE(MAX(id), 0) FROM hmis WHERE year=:year AND month=:month");
+    q.bindValue(":lookback", JournalCursor::kLookbackIds);
+    q.bindValue(":year", year);
+    q.bindValue(":month", month);
+    timer.track(q);
+    if (!q.exec() || !q.next()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return std::nullopt;
+    }
+    return MonthStamp{.changeId = q.value(0).toLongLong(),
+                      .recentChanges = q.value(1).toLongLong(),
+                      .rows = q.value(2).toLongLong(),
+                      .maxId = q.value(3).toLongLong()};
+}
+
+HMISData Database::readRows(QSqlQuery& query, PerfTimer& timer) {
     HMISData rows;
     if (query.exec()) {
         while (query.next()) {
@@ -181,39 +636,265 @@ HMISData Database::fetchHMISData(int year, int month) {
             row.newAttendance = query.value(5).toString();
             row.diagnoses = query.value(6).toString().split(dxSeparator, Qt::SkipEmptyParts);
             row.ipNumber = query.value(7).toString();
+            timer.addBytes(rowBytes(row));
             rows << row;
         }
+    } else {
+        m_lastError = query.lastError().text();
+        timer.fail();
     }
+    timer.track(query);
     return rows;
 }
 
-bool Database::saveNewRow(const NewHMISData& data, int actorUserId) {
-    // Duplicate check
-    QSqlQuery checkQuery;
-    checkQuery.prepare("SELECT COUNT(*) FROM hmis WHERE ip_number=:ip AND month=:month AND year=:year");
-    checkQuery.bindValue(":ip", data.ipNumber);
-    checkQuery.bindValue(":month", data.month);
-    checkQuery.bindValue(":year", data.year);
+// ---------------------------------------------------------------------------
+// Read endpoint
+// ---------------------------------------------------------------------------
+void Database::useReadReplica(const ConnOptions& replica) {
+    m_lastError.clear();
+    if (m_remote) {
+        throw std::runtime_error("Read endpoints are set up on hmisd, not on its clients");
+    }
+    auto reader = std::make_unique<Database>();
+    reader->Connect(replica);
+    m_reader = std::move(reader);
+    m_readerIsMirror = false;
+}
+
+void Database::useReadMirror() {
+    m_lastError.clear();
+    if (m_remote) {
+        throw std::runtime_error("Read endpoints are set up on hmisd, not on its clients");
+    }
+    auto reader = std::make_unique<Database>();
+    reader->Connect(ConnOptions(SqliteOptions(":memory:")));
+    reader->createSchema();
+    m_reader = std::move(reader);
+    m_readerIsMirror = true;
+    m_mirrorLoaded = false;
+    if (!loadMirror()) {
+        qWarning() << "Loading the read mirror failed, retrying on the next report:" << m_lastError;
+    }
+}
+
+Database& Database::analytics() {
+    if (!m_reader) {
+        return *this;
+    }
+    if (m_readerIsMirror && !catchUpMirror()) {
+        qWarning() << "Read mirror is behind, using the primary:" << m_lastError;
+        return *this;
+    }
+    return *m_reader;
+}
+
+// Rows committed while the copy runs, including late commits below the
+// stamp, are replayed from the journal by the next catch-up; replay is
+// idempotent.
+bool Database::loadMirror() {
+    HMIS_PERF_TIMER(timer, "loadMirror");
+    const qint64 stamp = maxChangeId();
+    JournalCursor cursor;
+    if (stamp < 0 || !cursor.startAt(*this, stamp, QDateTime::currentMSecsSinceEpoch())) {
+        timer.fail();
+        return false;
+    }
+    TransactionGuard guard(m_reader->db);
+    QSqlQuery q(m_reader->db);
+    if (!guard.active || !q.exec("DELETE FROM hmis") || !q.exec("DELETE FROM diagnoses")) {
+        m_lastError = m_reader->getLastError();
+        timer.fail();
+        return false;
+    }
+
+    qint64 copied = 0;
+    for (const QString table : {QString("diagnoses"), QString("hmis")}) {
+        qint64 cursor = 0;
+        for (;;) {
+            const auto page = tableImages(table, cursor, 5000);
+            if (!page) {
+                timer.fail();
+                return false;
+            }
+            if (page->isEmpty()) {
+                break;
+            }
+            for (const QJsonObject& image : *page) {
+                cursor = image.value("id").toInteger();
+                if (!mirrorRow(table, static_cast<int>(cursor), image)) {
+                    timer.fail();
+                    return false;
+                }
+            }
+            copied += page->size();
+        }
+    }
+    if (!guard.commit()) {
+        m_lastError = m_reader->db.lastError().text();
+        timer.fail();
+        return false;
+    }
+    m_mirrorCursor = cursor;
+    m_mirrorLoaded = true;
+    timer.addRows(copied);
+    return true;
+}
+
+bool Database::catchUpMirror() {
+    if (!m_mirrorLoaded) {
+        return loadMirror();
+    }
+    HMIS_PERF_TIMER(timer, "catchUpMirror");
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    qint64 after = m_mirrorCursor.readFrom();
+    for (;;) {
+        const auto page = getChangesSince(after, 5000);
+        if (!page) {
+            timer.fail();
+            return false;
+        }
+        if (page->isEmpty()) {
+            break;
+        }
+        // Advanced only once the page is in the mirror.
+        JournalCursor cursor = m_mirrorCursor;
+        TransactionGuard guard(m_reader->db);
+        for (const ChangeEntry& e : *page) {
+            if (!cursor.accept(e.id, now) || (e.tableName != "hmis" && e.tableName != "diagnoses")) {
+                continue;
+            }
+            const QJsonObject image = QJsonDocument::fromJson(e.after).object();  // empty for DELETE
+            if (!mirrorRow(e.tableName, e.recordId, image)) {
+                timer.fail();
+                return false;
+            }
+        }
+        if (!guard.commit()) {
+            m_lastError = m_reader->db.lastError().text();
+            timer.fail();
+            return false;
+        }
+        m_mirrorCursor = cursor;
+        after = page->last().id;
+        timer.addRows(page->size());
+    }
+    m_mirrorCursor.expire(now);
+    return true;
+}
 
-    if (!checkQuery.exec()) {
-        qWarning() << "Duplicate check failed:" << checkQuery.lastError().text();
+// Replaces the mirror's copy of a row; an empty image deletes it.
+bool Database::mirrorRow(const QString& table, int id, const QJsonObject& image) {
+    QSqlQuery q(m_reader->db);
+    q.prepare("DELETE FROM " + table + " WHERE id = :id");
+    q.bindValue(":id", id);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
         return false;
     }
-    if (checkQuery.next() && checkQuery.value(0).toInt() > 0) {
-        QMessageBox::warning(nullptr, "Duplicate IP Number", "IP number already exists for the given month and year.");
+    if (image.isEmpty()) {
+        return true;
+    }
+
+    if (table == "diagnoses") {
+        q.prepare("INSERT INTO diagnoses (id, name) VALUES (:id, :name)");
+        q.bindValue(":name", image.value("name").toString());
+    } else {
+        const HMISRow row = hmisRowFromImage(id, image, dxSeparator);
+        q.prepare(
+            "INSERT INTO hmis (id, age_category, month, year, sex, new_attendance, diagnosis, ip_number) "
+            "VALUES (:id, :age, :month, :year, :sex, :att, :dx, :ip)");
+        q.bindValue(":age", row.ageCategory);
+        q.bindValue(":month", row.month);
+        q.bindValue(":year", row.year);
+        q.bindValue(":sex", row.sex);
+        q.bindValue(":att", row.newAttendance);
+        q.bindValue(":dx", row.diagnoses.join(dxSeparator));
+        q.bindValue(":ip", row.ipNumber);
+    }
+    q.bindValue(":id", id);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
         return false;
     }
+    return true;
+}
+
+bool Database::saveNewRow(const NewHMISData& data, int actorUserId) {
+    HMIS_PERF_TIMER(timer, "saveNewRow");
+    m_lastError.clear();
+    if (m_remote) {
+        const int key = (data.year * 100) + data.month;
+        if (!remote<bool>(hmisd::Op::SaveNewRow, data, actorUserId).value_or(false)) {
+            // hmisd moved the counter past a duplicate; our block is stale.
+            if (m_lastError == kDuplicateIpError) {
+                m_ipBlocks.remove(key);
+            }
+            timer.fail();
+            return false;
+        }
+        bool numeric = false;
+        const qint64 n = data.ipNumber.toLongLong(&numeric);
+        const auto block = m_ipBlocks.find(key);
+        if (numeric && block != m_ipBlocks.end() && n < block->end) {
+            block->next = std::max(block->next, n + 1);
+        }
+        return true;
+    }
+    if (m_outbox != nullptr) {
+        if (!queueWrite("INSERT", 0, hmisImage(0, data, dxSeparator), actorUserId)) {
+            timer.fail();
+            return false;
+        }
+        // Consume the number locally; the server advances its counter when
+        // the row arrives.
+        bool numeric = false;
+        const qint64 n = data.ipNumber.toLongLong(&numeric);
+        const auto block = m_ipBlocks.find((data.year * 100) + data.month);
+        if (numeric && block != m_ipBlocks.end() && n < block->end) {
+            block->next = std::max(block->next, n + 1);
+        }
+        return true;
+    }
 
     TransactionGuard guard(db);
     if (!guard.active) {
         qWarning() << "saveNewRow: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+
+    bool duplicate = false;
+    if (insertHMIS(data, actorUserId, timer, &duplicate) < 0) {
+        if (duplicate) {
+            guard.rollback();
+            // Someone used this number outside the sequence (an older client,
+            // an import): move the counter past it and drop our stale block.
+            bool numeric = false;
+            const qint64 n = data.ipNumber.toLongLong(&numeric);
+            if (numeric) {
+                m_ipBlocks.remove((data.year * 100) + data.month);
+                advanceIpSequence(data.year, data.month, n + 1);
+            }
+            return false;
+        }
+        timer.fail();
         return false;
     }
 
-    QSqlQuery query;
+    if (!finishWrite(guard.commit())) {
+        return false;
+    }
+    noteIpNumberUsed(data.year, data.month, data.ipNumber);
+    return true;
+}
+
+int Database::insertHMIS(const NewHMISData& data, int actorUserId, PerfTimer& timer, bool* duplicate) {
+    QSqlQuery query(db);
     query.prepare(
         "INSERT INTO hmis (age_category, month, year, sex, new_attendance, diagnosis, ip_number) "
-        "VALUES(:age_category, :month, :year, :sex, :new_attendance, :diagnosis, :ip_number)");
+        "VALUES(:age_category, :month, :year, :sex, :new_attendance, :diagnosis, :ip_number)" +
+        returningId());
     query.bindValue(":age_category", data.ageCategory);
     query.bindValue(":month", data.month);
     query.bindValue(":year", data.year);
@@ -222,26 +903,176 @@ bool Database::saveNewRow(const NewHMISData& data, int actorUserId) {
     query.bindValue(":diagnosis", data.diagnoses.join(dxSeparator));
     query.bindValue(":ip_number", data.ipNumber);
 
+    timer.track(query);
     if (!query.exec()) {
+        // The UNIQUE(ip_number, year, month) constraint is the duplicate check.
+        if (isUniqueViolation(query.lastError())) {
+            *duplicate = true;
+            m_lastError = kDuplicateIpError;
+            return -1;
+        }
         qWarning() << "saveNewRow insert failed:" << query.lastError().text();
-        return false;
+        m_lastError = query.lastError().text();
+        return -1;
     }
+    timer.addRows(1);
 
-    int newId = query.lastInsertId().toInt();
-    logAudit(query, actorUserId, "INSERT", "hmis", newId,
-             QString("ip=%1 month=%2/%3").arg(data.ipNumber).arg(data.month).arg(data.year));
-
-    return guard.commit();
+    const int newId = static_cast<int>(insertedId(query));
+    if (!indexSearchRows(newId, newId, true)) {
+        return -1;
+    }
+    const QString detail = QString("ip=%1 month=%2/%3").arg(data.ipNumber).arg(data.month).arg(data.year);
+    const qint64 changeId =
+        journalChange("hmis", "INSERT", newId, {}, hmisImage(newId, data, dxSeparator), actorUserId, detail);
+    if (changeId < 0) {
+        return -1;
+    }
+    logAudit(changeId, actorUserId, "INSERT", "hmis", newId, detail);
+    return newId;
 }
 
 bool Database::updateHMISRow(const HMISRow& data, int actorUserId) {
+    HMIS_PERF_TIMER(timer, "updateHMISRow");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::UpdateRow, data, actorUserId).value_or(false);
+    }
+    if (m_outbox != nullptr) {
+        NewHMISData values{.ageCategory = data.ageCategory,
+                           .sex = data.sex,
+                           .newAttendance = data.newAttendance,
+                           .diagnoses = data.diagnoses,
+                           .ipNumber = data.ipNumber,
+                           .month = data.month,
+                           .year = data.year};
+        // Edits never move a row to another month; keep the one it was read with.
+        QJsonObject current = m_seenRows.value(data.id);
+        if (data.id < 0) {
+            const auto queued = m_outbox->find(-data.id);
+            current = queued ? queued->after : QJsonObject();
+        }
+        if (!current.isEmpty()) {
+            values.month = current.value("month").toInt();
+            values.year = current.value("year").toInt();
+        }
+        // Negative ids are rows still in the outbox: edit the queued insert.
+        const bool ok = data.id < 0 ? m_outbox->replacePending(-data.id, hmisImage(0, values, dxSeparator))
+                                    : queueWrite("UPDATE", data.id, hmisImage(data.id, values, dxSeparator),
+                                                 actorUserId);
+        if (!ok) {
+            m_lastError = m_outbox->lastError();
+            timer.fail();
+        }
+        return ok;
+    }
+
     TransactionGuard guard(db);
     if (!guard.active) {
         qWarning() << "updateHMISRow: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+    if (!updateHMIS(data, actorUserId, timer)) {
+        timer.fail();
+        return false;
+    }
+    return finishWrite(guard.commit());
+}
+
+bool Database::updateHMISRows(const QList<HMISRow>& rows, int actorUserId) {
+    HMIS_PERF_TIMER(timer, "updateHMISRows");
+    m_lastError.clear();
+    if (rows.isEmpty()) {
+        return true;
+    }
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::UpdateRows, rows, actorUserId).value_or(false);
+    }
+
+    // One read of the diagnosis list instead of a lookup per diagnosis.
+    std::optional<QList<Diagnosis>> all = getAllDiagnoses();
+    if (!all) {
+        timer.fail();
+        return false;
+    }
+    QSet<QString> known;
+    for (const Diagnosis& d : *all) {
+        known.insert(d.name);
+    }
+    QStringList missing;
+    for (const HMISRow& row : rows) {
+        for (const QString& dx : row.diagnoses) {
+            if (!known.contains(dx)) {
+                known.insert(dx);
+                missing << dx;
+            }
+        }
+    }
+
+    if (m_outbox != nullptr) {
+        // Offline-first edits are local outbox entries, one per row. New
+        // diagnoses go into the cached list for now and reach the server
+        // with the rows that use them (applyPendingWrite).
+        if (!missing.isEmpty()) {
+            // Provisional ids below any the cache holds; the server assigns
+            // the real ones.
+            int provisional = 0;
+            for (const Diagnosis& d : *all) {
+                provisional = std::min(provisional, d.id);
+            }
+            for (const QString& dx : missing) {
+                all->append(Diagnosis{.id = --provisional, .name = dx});
+            }
+            if (!m_outbox->cacheDiagnoses(*all)) {
+                m_lastError = m_outbox->lastError();
+                timer.fail();
+                return false;
+            }
+        }
+        for (const HMISRow& row : rows) {
+            if (!updateHMISRow(row, actorUserId)) {
+                timer.fail();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        qWarning() << "updateHMISRows: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
         return false;
     }
+    // Audit rows are collected and written with one multi-row INSERT per
+    // 100 edits (or handed to the group-commit writer) at the end.
+    m_deferAudit = true;
+    auto fail = [&] {
+        m_deferAudit = false;
+        timer.fail();
+        return finishWrite(false);
+    };
+    if (!missing.isEmpty() && !insertDiagnosisNames(missing, timer)) {
+        return fail();
+    }
+    for (const HMISRow& row : rows) {
+        if (!updateHMIS(row, actorUserId, timer)) {
+            return fail();
+        }
+    }
+    m_deferAudit = false;
+    if (!m_auditWriter && !insertAuditRows(m_pendingAudit)) {
+        timer.fail();  // best-effort, as in logAudit()
+    }
+    return finishWrite(guard.commit());
+}
+
+bool Database::updateHMIS(const HMISRow& data, int actorUserId, PerfTimer& timer) {
+    const QJsonObject before = rowImage("hmis", data.id);
 
-    QSqlQuery query;
+    QSqlQuery query(db);
     query.prepare(
         "UPDATE hmis SET ip_number=:ip, new_attendance=:att, sex=:sex, "
         "age_category=:age, diagnosis=:dx WHERE id=:id");
@@ -252,264 +1083,1792 @@ bool Database::updateHMISRow(const HMISRow& data, int actorUserId) {
     query.bindValue(":dx", data.diagnoses.join(dxSeparator));
     query.bindValue(":id", data.id);
 
+    timer.track(query);
     if (!query.exec()) {
         qWarning() << "updateHMISRow failed:" << query.lastError().text();
+        m_lastError = query.lastError().text();
+        return false;
+    }
+    timer.addRows(query.numRowsAffected());
+    if (!indexSearchRows(data.id, data.id, true)) {
         return false;
     }
 
-    logAudit(query, actorUserId, "UPDATE", "hmis", data.id, QString("ip=%1").arg(data.ipNumber));
-
-    return guard.commit();
+    const QString detail = QString("ip=%1").arg(data.ipNumber);
+    const qint64 changeId =
+        journalChange("hmis", "UPDATE", data.id, before, rowImage("hmis", data.id), actorUserId, detail);
+    if (changeId < 0) {
+        return false;
+    }
+    logAudit(changeId, actorUserId, "UPDATE", "hmis", data.id, detail);
+    return true;
 }
 
 bool Database::deleteHMISRow(int id, int actorUserId) {
+    HMIS_PERF_TIMER(timer, "deleteHMISRow");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::DeleteRow, id, actorUserId).value_or(false);
+    }
+    if (m_outbox != nullptr) {
+        const bool ok = id < 0 ? m_outbox->removePending(-id) : queueWrite("DELETE", id, {}, actorUserId);
+        if (!ok) {
+            m_lastError = m_outbox->lastError();
+            timer.fail();
+        }
+        return ok;
+    }
+
     TransactionGuard guard(db);
     if (!guard.active) {
         qWarning() << "deleteHMISRow: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+    if (!deleteHMIS(id, actorUserId, timer)) {
+        timer.fail();
         return false;
     }
+    return finishWrite(guard.commit());
+}
 
-    QSqlQuery query;
+bool Database::deleteHMIS(int id, int actorUserId, PerfTimer& timer) {
+    const QJsonObject before = rowImage("hmis", id);
+
+    QSqlQuery query(db);
     query.prepare("DELETE FROM hmis WHERE id=:id");
     query.bindValue(":id", id);
 
+    timer.track(query);
     if (!query.exec()) {
         qWarning() << "deleteHMISRow failed:" << query.lastError().text();
+        m_lastError = query.lastError().text();
+        return false;
+    }
+    timer.addRows(query.numRowsAffected());
+    if (!indexSearchRows(id, id, false)) {
+        return false;
+    }
+
+    qint64 changeId = 0;
+    if (!before.isEmpty()) {
+        changeId = journalChange("hmis", "DELETE", id, before, {}, actorUserId, QString());
+        if (changeId < 0) {
+            return false;
+        }
+    }
+    logAudit(changeId, actorUserId, "DELETE", "hmis", id, "");
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Offline-first replication
+// ---------------------------------------------------------------------------
+bool Database::queueWrite(const QString& op, int recordId, const QJsonObject& after, int actorUserId) {
+    // A row edited again before the last edit synced: by the time this one
+    // reaches the server, the server holds the queued after image.
+    QJsonObject before = m_seenRows.value(recordId);
+    for (const PendingWrite& w : m_outbox->pending()) {
+        if (w.op == "UPDATE" && w.recordId == recordId) {
+            before = w.after;
+        }
+    }
+    const PendingWrite write{.op = op,
+                             .recordId = recordId,
+                             .before = before,
+                             .after = after,
+                             .actorUserId = actorUserId};
+    if (m_outbox->enqueue(write) < 0) {
+        m_lastError = m_outbox->lastError();
+        return false;
+    }
+    return true;
+}
+
+// Overlays queued writes on rows read from the server, oldest first. The
+// server copies are kept for every month read, since views of other months
+// stay open and their rows can still be edited.
+void Database::mergePending(HMISData& rows, int year, int month) {
+    for (const HMISRow& row : rows) {
+        const NewHMISData values{.ageCategory = row.ageCategory,
+                                 .sex = row.sex,
+                                 .newAttendance = row.newAttendance,
+                                 .diagnoses = row.diagnoses,
+                                 .ipNumber = row.ipNumber,
+                                 .month = row.month,
+                                 .year = row.year};
+        m_seenRows.insert(row.id, hmisImage(row.id, values, dxSeparator));
+    }
+
+    for (const PendingWrite& w : m_outbox->pending()) {
+        if (w.op == "INSERT") {
+            const HMISRow row = hmisRowFromImage(static_cast<int>(-w.seq), w.after, dxSeparator);
+            if (row.year == year && row.month == month) {
+                rows << row;
+            }
+            continue;
+        }
+        const auto it =
+            std::find_if(rows.begin(), rows.end(), [&](const HMISRow& r) { return r.id == w.recordId; });
+        if (it == rows.end()) {
+            continue;
+        }
+        if (w.op == "DELETE") {
+            rows.erase(it);
+        } else {
+            *it = hmisRowFromImage(w.recordId, w.after, dxSeparator);
+        }
+    }
+}
+
+// Compares the columns the client saw with the server's current row.
+static bool sameRow(const QJsonObject& expected, const QJsonObject& actual) {
+    for (auto it = expected.begin(); it != expected.end(); ++it) {
+        if (it.value().toVariant().toString() != actual.value(it.key()).toVariant().toString()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ApplyResult Database::applyPendingWrite(const PendingWrite& write) {
+    HMIS_PERF_TIMER(timer, "applyPendingWrite");
+    m_lastError.clear();
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return ApplyResult::Failed;
+    }
+
+    // Recorded first: a replay of an entry the server already has stops here.
+    QSqlQuery q(db);
+    q.prepare("INSERT INTO applied_ops (op_key, applied_at) VALUES (:k, :ts)");
+    q.bindValue(":k", write.opKey);
+    q.bindValue(":ts", QDateTime::currentDateTime().toString(Qt::ISODate));
+    if (!q.exec()) {
+        if (isUniqueViolation(q.lastError())) {
+            return ApplyResult::AlreadyApplied;
+        }
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return ApplyResult::Failed;
+    }
+
+    NewHMISData inserted;
+    if (write.op == "INSERT") {
+        const HMISRow row = hmisRowFromImage(0, write.after, dxSeparator);
+        inserted = NewHMISData{.ageCategory = row.ageCategory,
+                               .sex = row.sex,
+                               .newAttendance = row.newAttendance,
+                               .diagnoses = row.diagnoses,
+                               .ipNumber = row.ipNumber,
+                               .month = row.month,
+                               .year = row.year};
+        bool duplicate = false;
+        if (!addMissingDiagnoses(inserted.diagnoses, timer)) {
+            timer.fail();
+            return ApplyResult::Failed;
+        }
+        if (insertHMIS(inserted, write.actorUserId, timer, &duplicate) < 0) {
+            if (duplicate) {
+                return ApplyResult::Conflict;
+            }
+            timer.fail();
+            return ApplyResult::Failed;
+        }
+    } else {
+        const QJsonObject current = rowImage("hmis", write.recordId);
+        if (current.isEmpty()) {
+            if (write.op == "UPDATE") {
+                m_lastError = QString("Record %1 was deleted on the server.").arg(write.recordId);
+                return ApplyResult::Conflict;
+            }
+            // DELETE of a row that is already gone: nothing left to do.
+        } else if (write.before.isEmpty()) {
+            m_lastError = QString("Record %1 was edited without a copy of the row as read.").arg(write.recordId);
+            return ApplyResult::Conflict;
+        } else if (!sameRow(write.before, current)) {
+            m_lastError = QString("Record %1 was changed on the server after it was read.").arg(write.recordId);
+            return ApplyResult::Conflict;
+        } else {
+            const HMISRow row = hmisRowFromImage(write.recordId, write.after, dxSeparator);
+            const bool ok = write.op == "UPDATE"
+                                ? addMissingDiagnoses(row.diagnoses, timer) && updateHMIS(row, write.actorUserId, timer)
+                                : deleteHMIS(write.recordId, write.actorUserId, timer);
+            if (!ok) {
+                timer.fail();
+                return ApplyResult::Failed;
+            }
+        }
+    }
+
+    if (!finishWrite(guard.commit())) {
+        timer.fail();
+        return ApplyResult::Failed;
+    }
+    if (write.op == "INSERT") {
+        noteIpNumberUsed(inserted.year, inserted.month, inserted.ipNumber);
+    }
+    return ApplyResult::Applied;
+}
+
+// ---------------------------------------------------------------------------
+// Multi-facility change feed (central side)
+// ---------------------------------------------------------------------------
+qint64 Database::feedVersion(const QString& facilityId) {
+    m_lastError.clear();
+    QSqlQuery q(db);
+    q.prepare("SELECT applied_version FROM feed_sources WHERE facility_id = :f");
+    q.bindValue(":f", facilityId);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return -1;
+    }
+    return q.next() ? q.value(0).toLongLong() : 0;
+}
+
+qint64 Database::applyFeedBundle(const FeedBundle& bundle) {
+    HMIS_PERF_TIMER(timer, "applyFeedBundle");
+    m_lastError.clear();
+    if (bundle.facilityId.isEmpty() || bundle.facilityCode.isEmpty()) {
+        m_lastError = "Bundle has no facility id or code.";
+        timer.fail();
+        return -1;
+    }
+
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return -1;
+    }
+
+    QSqlQuery q(db);
+    q.prepare("SELECT applied_version, code FROM feed_sources WHERE facility_id = :f");
+    q.bindValue(":f", bundle.facilityId);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+    const bool known = q.next();
+    const qint64 applied = known ? q.value(0).toLongLong() : 0;
+    if (known && q.value(1).toString() != bundle.facilityCode) {
+        // Its rows are already stored under the old prefix.
+        m_lastError = QString("Facility was imported as %1, not %2.").arg(q.value(1).toString(), bundle.facilityCode);
+        timer.fail();
+        return -1;
+    }
+    if (bundle.fromVersion > applied) {
+        m_lastError = QString("Missing changes %1-%2 from %3; import the earlier bundles first.")
+                          .arg(applied + 1)
+                          .arg(bundle.fromVersion)
+                          .arg(bundle.facilityCode);
+        timer.fail();
+        return -1;
+    }
+    if (known && bundle.toVersion <= applied) {
+        return 0;  // already imported
+    }
+
+    qint64 count = 0;
+    for (const FeedEntry& e : bundle.entries) {
+        if (known && e.version <= applied) {
+            continue;
+        }
+        if (!applyFeedEntry(bundle, e, timer)) {
+            m_lastError = QString("%1 %2 #%3: %4").arg(bundle.facilityCode, e.op).arg(e.recordId).arg(m_lastError);
+            timer.fail();
+            return -1;
+        }
+        ++count;
+    }
+
+    q.prepare(known ? "UPDATE feed_sources SET applied_version = :v, updated_at = :ts WHERE facility_id = :f"
+                    : "INSERT INTO feed_sources (facility_id, code, applied_version, updated_at) "
+                      "VALUES (:f, :code, :v, :ts)");
+    q.bindValue(":f", bundle.facilityId);
+    if (!known) {
+        q.bindValue(":code", bundle.facilityCode);
+    }
+    q.bindValue(":v", bundle.toVersion);
+    q.bindValue(":ts", QDateTime::currentDateTime().toString(Qt::ISODate));
+    if (!q.exec()) {
+        // A unique violation here means another facility already uses the code.
+        m_lastError = isUniqueViolation(q.lastError())
+                          ? QString("Facility code %1 is taken by another facility.").arg(bundle.facilityCode)
+                          : q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+
+    if (!finishWrite(guard.commit())) {
+        timer.fail();
+        return -1;
+    }
+    timer.addRows(count);
+    return count;
+}
+
+// Journaled and audited like local edits, with actor 0 (the importer).
+bool Database::applyFeedEntry(const FeedBundle& bundle, const FeedEntry& entry, PerfTimer& timer) {
+    QSqlQuery q(db);
+    if (entry.tableName == "diagnoses") {
+        // Names are shared by all facilities, so the central list only grows:
+        // a facility dropping a name does not remove it for the others.
+        const QString name = entry.row.value("name").toString();
+        if (entry.op == "DELETE" || name.isEmpty() || diagnosisExists(name)) {
+            return true;
+        }
+        q.prepare("INSERT INTO diagnoses(name) VALUES(:name)" + returningId());
+        q.bindValue(":name", name);
+        timer.track(q);
+        if (!q.exec()) {
+            m_lastError = q.lastError().text();
+            return false;
+        }
+        const int newId = static_cast<int>(insertedId(q));
+        return journalChange("diagnoses", "INSERT", newId, {}, QJsonObject{{"id", newId}, {"name", name}}, 0) >= 0;
+    }
+    if (entry.tableName != "hmis") {
+        return true;
+    }
+
+    q.prepare("SELECT local_id FROM feed_rows WHERE facility_id = :f AND remote_id = :r");
+    q.bindValue(":f", bundle.facilityId);
+    q.bindValue(":r", entry.recordId);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    const int localId = q.next() ? q.value(0).toInt() : 0;
+
+    if (entry.op == "DELETE") {
+        if (localId == 0) {
+            return true;  // never reached this server
+        }
+        q.prepare("DELETE FROM feed_rows WHERE facility_id = :f AND remote_id = :r");
+        q.bindValue(":f", bundle.facilityId);
+        q.bindValue(":r", entry.recordId);
+        if (!q.exec()) {
+            m_lastError = q.lastError().text();
+            return false;
+        }
+        return deleteHMIS(localId, 0, timer);
+    }
+
+    // Every facility numbers its own patients from 1.
+    HMISRow row = hmisRowFromImage(localId, entry.row, dxSeparator);
+    row.ipNumber = bundle.facilityCode + "/" + row.ipNumber;
+    if (localId > 0 && !rowImage("hmis", localId).isEmpty()) {
+        return updateHMIS(row, 0, timer);
+    }
+
+    const NewHMISData data{.ageCategory = row.ageCategory,
+                           .sex = row.sex,
+                           .newAttendance = row.newAttendance,
+                           .diagnoses = row.diagnoses,
+                           .ipNumber = row.ipNumber,
+                           .month = row.month,
+                           .year = row.year};
+    bool duplicate = false;
+    const int newId = insertHMIS(data, 0, timer, &duplicate);
+    if (newId < 0) {
+        return false;
+    }
+    q.prepare(localId > 0 ? "UPDATE feed_rows SET local_id = :l WHERE facility_id = :f AND remote_id = :r"
+                          : "INSERT INTO feed_rows (facility_id, remote_id, local_id) VALUES (:f, :r, :l)");
+    q.bindValue(":f", bundle.facilityId);
+    q.bindValue(":r", entry.recordId);
+    q.bindValue(":l", newId);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+std::optional<QList<QJsonObject>> Database::tableImages(const QString& table, qint64 afterId, int limit) {
+    HMIS_PERF_TIMER(timer, "tableImages");
+    m_lastError.clear();
+    if (table != "hmis" && table != "diagnoses") {
+        m_lastError = "No change feed for table " + table;
+        return std::nullopt;
+    }
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare("SELECT * FROM " + table + " WHERE id > :after ORDER BY id ASC LIMIT :lim");
+    q.bindValue(":after", afterId);
+    q.bindValue(":lim", limit);
+    timer.track(q);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return std::nullopt;
+    }
+
+    QList<QJsonObject> images;
+    while (q.next()) {
+        const QSqlRecord rec = q.record();
+        QJsonObject image;
+        for (int i = 0; i < rec.count(); ++i) {
+            image.insert(rec.fieldName(i), QJsonValue::fromVariant(q.value(i)));
+        }
+        images << image;
+    }
+    timer.addRows(images.size());
+    return images;
+}
+
+// ---------------------------------------------------------------------------
+// IP numbers
+// ---------------------------------------------------------------------------
+QString Database::nextIPNumber(int year, int month) {
+    HMIS_PERF_TIMER(timer, "nextIPNumber");
+    m_lastError.clear();
+    const int key = (year * 100) + month;
+    auto it = m_ipBlocks.find(key);
+    if (it == m_ipBlocks.end() || it->next >= it->end) {
+        const qint64 first = reserveIpNumbers(year, month, m_ipBlockSize);
+        if (first < 0) {
+            timer.fail();
+            return {};
+        }
+        it = m_ipBlocks.insert(key, IpBlock{.next = first, .end = first + m_ipBlockSize});
+    }
+    return QString("%1").arg(it->next, 3, 10, QChar('0'));
+}
+
+qint64 Database::reserveIpNumbers(int year, int month, int count) {
+    HMIS_PERF_TIMER(timer, "reserveIpNumbers");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<qint64>(hmisd::Op::ReserveIpNumbers, year, month, count).value_or(-1);
+    }
+    QSqlQuery q(db);
+    q.prepare(m_sql->reserveIpNumbers);
+    q.bindValue(":y", year);
+    q.bindValue(":m", month);
+    q.bindValue(":init", 1 + count);
+    q.bindValue(":step", count);
+
+    timer.track(q);
+    if (!q.exec()) {
+        qWarning() << "reserveIpNumbers failed:" << q.lastError().text();
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+    qint64 next = 1 + count;  // a fresh counter
+    if (m_sql->counterFromLastInsertId) {
+        if (q.numRowsAffected() != 1) {  // 2 = the existing row was updated
+            next = q.lastInsertId().toLongLong();
+        }
+    } else if (q.next()) {
+        next = q.value(0).toLongLong();
+    }
+    return next - count;
+}
+
+// Moves the counter up to at least next. Never moves it back.
+bool Database::advanceIpSequence(int year, int month, qint64 next) {
+    if (m_remote) {
+        return false;  // hmisd keeps the counter
+    }
+    QSqlQuery q(db);
+    q.prepare(m_sql->advanceIpSequence);
+    q.bindValue(":y", year);
+    q.bindValue(":m", month);
+    q.bindValue(":n", next);
+    if (!q.exec()) {
+        qWarning() << "advanceIpSequence failed:" << q.lastError().text();
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// After a successful insert: consume the number if it came from our block,
+// otherwise (typed by hand) make sure the counter never hands it out.
+void Database::noteIpNumberUsed(int year, int month, const QString& ipNumber) {
+    bool numeric = false;
+    const qint64 n = ipNumber.toLongLong(&numeric);
+    if (!numeric) {
+        return;
+    }
+    const auto it = m_ipBlocks.find((year * 100) + month);
+    if (it != m_ipBlocks.end() && n < it->end) {
+        it->next = std::max(it->next, n + 1);
+        return;
+    }
+    advanceIpSequence(year, month, n + 1);
+}
+
+QString Database::returningId() const { return m_sql != nullptr ? QString(m_sql->returningId) : QString(); }
+
+qint64 Database::insertedId(QSqlQuery& q) const {
+    if (m_sql != nullptr && m_sql->insertedIds == sql::InsertedIds::Returning) {
+        return q.next() ? q.value(0).toLongLong() : 0;
+    }
+    return q.lastInsertId().toLongLong();
+}
+
+bool Database::bulkInsertRows(const QList<NewHMISData>& rows) {
+    HMIS_PERF_TIMER(timer, "bulkInsertRows");
+    m_lastError.clear();
+    if (rows.isEmpty()) {
+        return true;
+    }
+
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        qWarning() << "bulkInsertRows: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+
+    QSqlQuery query(db);
+    if (!query.prepare("INSERT INTO hmis (age_category, month, year, sex, new_attendance, diagnosis, ip_number) "
+                       "VALUES(:age_category, :month, :year, :sex, :new_attendance, :diagnosis, :ip_number)" +
+                       returningId())) {
+        qWarning() << "bulkInsertRows prepare failed:" << query.lastError().text();
+        m_lastError = query.lastError().text();
+        timer.fail();
+        return false;
+    }
+    // Full batches go in one multi-row INSERT each, the remainder row by row;
+    // everything row by row where a batch's ids cannot be told.
+    const qsizetype batchRows = m_batchIds ? m_sql->batchRows : rows.size() + 1;
+    QSqlQuery batch(db);
+    if (rows.size() >= batchRows && !batch.prepare(m_sql->insertHmisBatch)) {
+        qWarning() << "bulkInsertRows prepare failed:" << batch.lastError().text();
+        m_lastError = batch.lastError().text();
+        timer.fail();
+        return false;
+    }
+
+    QHash<int, qint64> highest;  // year * 100 + month -> largest numeric IP number
+    QList<qint64> ids;
+    for (qsizetype done = 0; done < rows.size(); done += ids.size()) {
+        ids.clear();
+        QSqlQuery& q = rows.size() - done >= batchRows ? batch : query;
+        if (&q == &batch) {
+            for (int i = 0; i < batchRows; ++i) {
+                const NewHMISData& data = rows.at(done + i);
+                const int at = i * 7;
+                batch.bindValue(at, data.ageCategory);
+                batch.bindValue(at + 1, data.month);
+                batch.bindValue(at + 2, data.year);
+                batch.bindValue(at + 3, data.sex);
+                batch.bindValue(at + 4, data.newAttendance);
+                batch.bindValue(at + 5, data.diagnoses.join(dxSeparator));
+                batch.bindValue(at + 6, data.ipNumber);
+            }
+        } else {
+            const NewHMISData& data = rows.at(done);
+            query.bindValue(":age_category", data.ageCategory);
+            query.bindValue(":month", data.month);
+            query.bindValue(":year", data.year);
+            query.bindValue(":sex", data.sex);
+            query.bindValue(":new_attendance", data.newAttendance);
+            query.bindValue(":diagnosis", data.diagnoses.join(dxSeparator));
+            query.bindValue(":ip_number", data.ipNumber);
+        }
+        if (!q.exec()) {
+            qWarning() << "bulkInsertRows insert failed:" << q.lastError().text();
+            m_lastError = q.lastError().text();
+            timer.track(q);
+            timer.fail();
+            return false;
+        }
+        const qsizetype count = &q == &batch ? batchRows : 1;
+        if (m_sql->insertedIds == sql::InsertedIds::Returning) {
+            while (q.next()) {
+                ids << q.value(0).toLongLong();
+            }
+        } else {
+            // One statement's rows get consecutive ids (see m_batchIds).
+            const qint64 id = q.lastInsertId().toLongLong();
+            const qint64 first = m_sql->insertedIds == sql::InsertedIds::FirstOfBatch ? id : id - count + 1;
+            for (qsizetype i = 0; i < count; ++i) {
+                ids << first + i;
+            }
+        }
+        if (ids.size() != count) {
+            m_lastError = QString("bulkInsertRows: %1 ids for %2 rows").arg(ids.size()).arg(count);
+            timer.fail();
+            return false;
+        }
+        const auto [firstId, lastId] = std::minmax_element(ids.cbegin(), ids.cend());
+        if (!indexSearchRows(*firstId, *lastId, true)) {
+            timer.fail();
+            return false;
+        }
+
+        for (qsizetype i = 0; i < count; ++i) {
+            const NewHMISData& data = rows.at(done + i);
+            // Journaled (unlike audit) so differential backups see imports too.
+            const int newId = static_cast<int>(ids.at(i));
+            if (journalChange("hmis", "INSERT", newId, {}, hmisImage(newId, data, dxSeparator), 0) < 0) {
+                timer.fail();
+                return false;
+            }
+            bool numeric = false;
+            const qint64 n = data.ipNumber.toLongLong(&numeric);
+            if (numeric) {
+                qint64& top = highest[(data.year * 100) + data.month];
+                top = std::max(top, n);
+            }
+        }
+    }
+    // Keep the counters ahead of the imported numbers.
+    for (auto it = highest.cbegin(); it != highest.cend(); ++it) {
+        if (!advanceIpSequence(it.key() / 100, it.key() % 100, it.value() + 1)) {
+            timer.fail();
+            return false;
+        }
+    }
+    timer.addRows(rows.size());
+    if (!guard.commit()) {
         return false;
     }
+    for (auto it = highest.cbegin(); it != highest.cend(); ++it) {
+        const auto block = m_ipBlocks.find(it.key());
+        if (block != m_ipBlocks.end() && block->next <= it.value()) {
+            m_ipBlocks.erase(block);
+        }
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Full-text search
+// ---------------------------------------------------------------------------
+// The words of a search, split the way both indexes split the text.
+static QStringList searchWords(const QString& text) {
+    static const QRegularExpression separators("[^\\p{L}\\p{N}]+");
+    QStringList words = text.toLower().split(separators, Qt::SkipEmptyParts);
+    words.removeDuplicates();
+    return words.mid(0, 8);
+}
+
+std::optional<HMISData> Database::searchRegister(const QString& text, int offset, int limit) {
+    HMIS_PERF_TIMER(timer, "searchRegister");
+    m_lastError.clear();
+    offset = std::max(offset, 0);
+    limit = std::clamp(limit, 1, 1000);
+    if (m_remote) {
+        auto rows = remote<std::optional<HMISData>>(hmisd::Op::SearchRegister, text, offset, limit)
+                        .value_or(std::nullopt);
+        if (!rows) {
+            timer.fail();
+        }
+        return rows;
+    }
+    const QStringList words = searchWords(text);
+    if (words.isEmpty()) {
+        return HMISData();
+    }
+
+    QSqlQuery query(db);
+    if (m_searchIndexed) {
+        QStringList terms;
+        for (const QString& word : words) {
+            terms << QString(m_sql->searchTerm).arg(word);
+        }
+        query.prepare(m_sql->searchRows);
+        query.bindValue(":q", terms.join(m_sql->searchAnd));
+        query.bindValue(":exact", text.trimmed());
+        query.bindValue(":limit", limit);
+        query.bindValue(":offset", offset);
+    } else {
+        // Word prefixes as the indexes see them: at the start, or after a
+        // space, the diagnosis separator ("____") or an IP number's "/" or "-".
+        static const QStringList starts{"", "% ", "%!_", "%/", "%-"};
+        static const QStringList columns{"ip_number", "diagnosis"};
+        QStringList like;
+        for (const QString& column : columns) {
+            for (qsizetype i = 0; i < starts.size(); ++i) {
+                like << column + " LIKE ? ESCAPE '!'";
+            }
+        }
+        const QString matchWord = "(" + like.join(" OR ") + ")";
+        QStringList where;
+        for (qsizetype i = 0; i < words.size(); ++i) {
+            where << matchWord;
+        }
+        query.prepare("SELECT * FROM hmis WHERE " + where.join(" AND ") +
+                      " ORDER BY ip_number = ? DESC, year DESC, month DESC, id DESC LIMIT ? OFFSET ?");
+        for (const QString& word : words) {
+            QString escaped = word;
+            escaped.replace("!", "!!").replace("%", "!%").replace("_", "!_");
+            for (qsizetype column = 0; column < columns.size(); ++column) {
+                for (const QString& start : starts) {
+                    query.addBindValue(start + escaped + "%");
+                }
+            }
+        }
+        query.addBindValue(text.trimmed());
+        query.addBindValue(limit);
+        query.addBindValue(offset);
+    }
+
+    HMISData rows = readRows(query, timer);
+    if (query.lastError().isValid()) {
+        qWarning() << "searchRegister failed:" << query.lastError().text();
+        return std::nullopt;
+    }
+    timer.addRows(rows.size());
+    return rows;
+}
+
+bool Database::indexSearchRows(qint64 fromId, qint64 toId, bool present) {
+    if (!m_searchIndexed) {
+        return true;
+    }
+    QSqlQuery q(db);
+    auto run = [&](QLatin1String statement) {
+        q.prepare(statement);
+        q.bindValue(":from", fromId);
+        q.bindValue(":to", toId);
+        if (!q.exec()) {
+            qWarning() << "Updating the search index failed:" << q.lastError().text();
+            m_lastError = q.lastError().text();
+            return false;
+        }
+        return true;
+    };
+    return run(m_sql->unindexSearchRows) && (!present || run(m_sql->indexSearchRows));
+}
+
+bool Database::rebuildSearchIndex() {
+    HMIS_PERF_TIMER(timer, "rebuildSearchIndex");
+    m_lastError.clear();
+    if (!m_searchIndexed) {
+        return true;  // hmisd clients and scans have nothing to fill
+    }
+    auto fill = [this] {
+        TransactionGuard guard(db);
+        if (!guard.active) {
+            m_lastError = db.lastError().text();
+            return false;
+        }
+        if (!indexSearchRows(0, std::numeric_limits<int>::max(), true)) {
+            return false;
+        }
+        if (!guard.commit()) {
+            m_lastError = db.lastError().text();
+            return false;
+        }
+        return true;
+    };
+    if (fill()) {
+        return true;
+    }
+    // An index missing rows would hide them from searchRegister(). Drop it so
+    // searches scan hmis and the next createSchema() builds it again.
+    timer.fail();
+    m_searchIndexed = false;
+    QSqlQuery q(db);
+    if (!q.exec(QString("DROP TABLE IF EXISTS %1").arg(m_sql->searchTable))) {
+        qWarning() << "Dropping the search index failed:" << q.lastError().text();
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Diagnoses
+// ---------------------------------------------------------------------------
+std::optional<QList<Diagnosis>> Database::getAllDiagnoses() {
+    HMIS_PERF_TIMER(timer, "getAllDiagnoses");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<std::optional<QList<Diagnosis>>>(hmisd::Op::GetDiagnoses).value_or(std::nullopt);
+    }
+    QList<Diagnosis> list;
+    QSqlQuery query(db);
+    if (!query.exec("SELECT id, name FROM diagnoses ORDER BY name ASC")) {
+        // Offline: the list saved at the last successful read.
+        if (m_outbox != nullptr) {
+            list = m_outbox->cachedDiagnoses();
+            if (!list.isEmpty()) {
+                return list;
+            }
+        }
+        qWarning() << "getAllDiagnoses failed:" << query.lastError();
+        m_lastError = query.lastError().text();
+        timer.fail();
+        return std::nullopt;
+    }
+    timer.track(query);
+    while (query.next()) {
+        list << Diagnosis{.id = query.value("id").toInt(), .name = query.value("name").toString()};
+        timer.addBytes(list.last().name.size() * qsizetype(sizeof(QChar)));
+    }
+    timer.addRows(list.size());
+    if (m_outbox != nullptr) {
+        m_outbox->cacheDiagnoses(list);
+    }
+    return list;
+}
+
+bool Database::insertDiagnoses(const QStringList& diagnoses) {
+    HMIS_PERF_TIMER(timer, "insertDiagnoses");
+    m_lastError.clear();
+    if (diagnoses.isEmpty()) {
+        return true;
+    }
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::InsertDiagnoses, diagnoses).value_or(false);
+    }
+
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        qWarning() << "insertDiagnoses: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+    if (!insertDiagnosisNames(diagnoses, timer)) {
+        timer.fail();
+        return false;
+    }
+    return guard.commit();
+}
+
+bool Database::insertDiagnosisNames(const QStringList& diagnoses, PerfTimer& timer) {
+    QSqlQuery query(db);
+    if (!query.prepare("INSERT INTO diagnoses(name) VALUES(:name)")) {
+        qWarning() << "insertDiagnoses prepare failed:" << query.lastError();
+        m_lastError = query.lastError().text();
+        return false;
+    }
+
+    for (const QString& name : diagnoses) {
+        query.bindValue(":name", name);
+        if (!query.exec()) {
+            qWarning() << "insertDiagnoses exec failed:" << query.lastError();
+            m_lastError = query.lastError().text();
+            timer.track(query);
+            return false;
+        }
+        const int newId = query.lastInsertId().toInt();
+        if (journalChange("diagnoses", "INSERT", newId, {}, QJsonObject{{"id", newId}, {"name", name}}, 0) < 0) {
+            return false;
+        }
+    }
+    timer.addRows(diagnoses.size());
+    return true;
+}
+
+// Adds the names the server does not have yet, e.g. ones typed in while
+// offline.
+bool Database::addMissingDiagnoses(const QStringList& diagnoses, PerfTimer& timer) {
+    QSqlQuery query(db);
+    if (!query.prepare("SELECT 1 FROM diagnoses WHERE name=:name")) {
+        m_lastError = query.lastError().text();
+        return false;
+    }
+    QStringList missing;
+    for (const QString& name : diagnoses) {
+        query.bindValue(":name", name);
+        if (!query.exec()) {
+            m_lastError = query.lastError().text();
+            timer.track(query);
+            return false;
+        }
+        if (!query.next() && !missing.contains(name)) {
+            missing << name;
+        }
+    }
+    return missing.isEmpty() || insertDiagnosisNames(missing, timer);
+}
+
+bool Database::diagnosisExists(const QString& name) {
+    HMIS_PERF_TIMER(timer, "diagnosisExists");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::DiagnosisExists, name).value_or(false);
+    }
+    QSqlQuery query(db);
+    if (!query.prepare("SELECT EXISTS(SELECT 1 FROM diagnoses WHERE name=:name LIMIT 1)")) {
+        timer.fail();
+        return false;
+    }
+    query.bindValue(":name", name);
+    if (!query.exec()) {
+        timer.fail();
+        return false;
+    }
+    timer.track(query);
+    return query.next() && query.value(0).toBool();
+}
+
+// ---------------------------------------------------------------------------
+// Authentication helpers
+// ---------------------------------------------------------------------------
+QString Database::generateSalt() {
+    QByteArray bytes(16, Qt::Uninitialized);
+    for (auto& b : bytes) {
+        b = static_cast<char>(QRandomGenerator::global()->bounded(256));
+    }
+    return bytes.toHex();
+}
+
+QString Database::hashPassword(const QString& password, const QString& salt) {
+    QByteArray data = (password + salt).toUtf8();
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+}
+
+// ---------------------------------------------------------------------------
+// Users
+// ---------------------------------------------------------------------------
+bool Database::userExists(const QString& username) {
+    HMIS_PERF_TIMER(timer, "userExists");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::UserExists, username).value_or(false);
+    }
+    QSqlQuery q(db);
+    q.prepare("SELECT EXISTS(SELECT 1 FROM users WHERE username=:u LIMIT 1)");
+    q.bindValue(":u", username);
+    if (!q.exec()) {
+        timer.fail();
+        return false;
+    }
+    timer.track(q);
+    return q.next() && q.value(0).toBool();
+}
+
+bool Database::createUser(const QString& username, const QString& password, UserRole role) {
+    HMIS_PERF_TIMER(timer, "createUser");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::CreateUser, username, password, quint8(role)).value_or(false);
+    }
+    QString salt = generateSalt();
+    QString hash = hashPassword(password, salt);
+    QString roleStr = (role == UserRole::Admin) ? "Admin" : "Clerk";
+
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+
+    QSqlQuery q(db);
+    q.prepare("INSERT INTO users(username, password_hash, salt, role) VALUES(:u, :h, :s, :r)");
+    q.bindValue(":u", username);
+    q.bindValue(":h", hash);
+    q.bindValue(":s", salt);
+    q.bindValue(":r", roleStr);
+
+    if (!q.exec()) {
+        qWarning() << "createUser failed:" << q.lastError();
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return false;
+    }
+    timer.addRows(1);
+
+    const int newId = q.lastInsertId().toInt();
+    if (journalChange("users", "INSERT", newId, {}, rowImage("users", newId), 0) < 0) {
+        timer.fail();
+        return false;
+    }
+    return guard.commit();
+}
+
+std::optional<User> Database::authenticate(const QString& username, const QString& password) {
+    HMIS_PERF_TIMER(timer, "authenticate");
+    m_lastError.clear();
+    if (m_remote) {
+        // hmisd signs the connection in as the user it accepts.
+        auto user = remote<std::optional<User>>(hmisd::Op::Authenticate, username, password).value_or(std::nullopt);
+        if (user) {
+            m_remote->setSignIn(user->id, username, password);
+            m_connOptions = ConnOptions(m_remote->options());
+        }
+        return user;
+    }
+    QSqlQuery q(db);
+    q.prepare("SELECT id, password_hash, salt, role FROM users WHERE username=:u LIMIT 1");
+    q.bindValue(":u", username);
+
+    if (!q.exec()) {
+        // Server unreachable: accept credentials cached at the last online sign-in.
+        if (m_outbox != nullptr) {
+            const auto cached = m_outbox->cachedUser(username);
+            if (cached && hashPassword(password, cached->salt) == cached->passwordHash) {
+                return cached->user;
+            }
+        }
+        return std::nullopt;
+    }
+    if (!q.next()) {
+        return std::nullopt;
+    }
+
+    int id = q.value(0).toInt();
+    QString storedHash = q.value(1).toString();
+    QString salt = q.value(2).toString();
+    QString roleStr = q.value(3).toString();
+
+    if (hashPassword(password, salt) != storedHash) {
+        return std::nullopt;
+    }
+
+    UserRole role = (roleStr == "Admin") ? UserRole::Admin : UserRole::Clerk;
+    const User user{.id = id, .username = username, .role = role};
+    if (m_outbox != nullptr) {
+        m_outbox->cacheUser({.user = user, .passwordHash = storedHash, .salt = salt});
+    }
+    return user;
+}
+
+bool Database::changePassword(int userId, const QString& newPassword) {
+    HMIS_PERF_TIMER(timer, "changePassword");
+    m_lastError.clear();
+    if (m_remote) {
+        const bool ok = remote<bool>(hmisd::Op::ChangePassword, userId, newPassword).value_or(false);
+        if (ok) {
+            m_remote->passwordChanged(userId, newPassword);
+            m_connOptions = ConnOptions(m_remote->options());
+        }
+        return ok;
+    }
+    QString salt = generateSalt();
+    QString hash = hashPassword(newPassword, salt);
+
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        m_lastError = db.lastError().text();
+        timer.fail();
+        return false;
+    }
+    const QJsonObject before = rowImage("users", userId);
+
+    QSqlQuery q(db);
+    q.prepare("UPDATE users SET password_hash=:h, salt=:s WHERE id=:id");
+    q.bindValue(":h", hash);
+    q.bindValue(":s", salt);
+    q.bindValue(":id", userId);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return false;
+    }
+    timer.addRows(q.numRowsAffected());
+
+    if (journalChange("users", "UPDATE", userId, before, rowImage("users", userId), userId) < 0) {
+        timer.fail();
+        return false;
+    }
+    return guard.commit();
+}
+
+QList<User> Database::getAllUsers() {
+    HMIS_PERF_TIMER(timer, "getAllUsers");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<QList<User>>(hmisd::Op::GetUsers).value_or(QList<User>());
+    }
+    QList<User> users;
+    QSqlQuery q(db);
+    if (!q.exec("SELECT id, username, role FROM users ORDER BY username ASC")) {
+        timer.fail();
+        return users;
+    }
+    while (q.next()) {
+        QString r = q.value(2).toString();
+        users << User{.id = q.value(0).toInt(),
+                      .username = q.value(1).toString(),
+                      .role = (r == "Admin") ? UserRole::Admin : UserRole::Clerk};
+    }
+    timer.addRows(users.size());
+    return users;
+}
+
+// ---------------------------------------------------------------------------
+// Audit log
+// ---------------------------------------------------------------------------
+QString Database::usernameFor(int userId) {
+    if (userId <= 0) {
+        return "system";
+    }
+    auto it = m_usernames.constFind(userId);
+    if (it != m_usernames.constEnd()) {
+        return *it;
+    }
+    QString username = "system";
+    QSqlQuery uq(db);
+    uq.prepare("SELECT username FROM users WHERE id=:id");
+    uq.bindValue(":id", userId);
+    if (uq.exec() && uq.next()) {
+        username = uq.value(0).toString();
+        m_usernames.insert(userId, username);  // usernames never change
+    }
+    return username;
+}
+
+void Database::logAudit(qint64 changeId, int actorUserId, const QString& action, const QString& table, int recordId,
+                        const QString& detail) {
+    HMIS_PERF_TIMER(timer, "logAudit");
+    AuditRecord r{.changeId = changeId,
+                  .userId = actorUserId,
+                  .username = usernameFor(actorUserId),
+                  .action = action,
+                  .tableName = table,
+                  .recordId = recordId,
+                  .detail = detail,
+                  .changedAt = changeId > 0 && changeId == m_journaledId
+                                   ? m_journaledAt
+                                   : QDateTime::currentDateTime().toString(Qt::ISODate)};
+
+    if (m_auditWriter || m_deferAudit) {
+        m_pendingAudit << r;  // handed to the writer by finishWrite(), or batched by the caller
+        return;
+    }
+    if (!insertAuditRows({r})) {  // best-effort — don't fail the parent operation if audit fails
+        timer.fail();
+    }
+}
+
+// Call with the result of the write's commit. Group-commit audit records only
+// leave this connection once their transaction is durable.
+bool Database::finishWrite(bool committed) {
+    if (committed && m_auditWriter) {
+        for (AuditRecord& r : m_pendingAudit) {
+            m_auditWriter->enqueue(std::move(r));
+        }
+    }
+    m_pendingAudit.clear();
+    return committed;
+}
+
+// Multi-row INSERT, 100 rows per statement (900 parameters, under SQLite's
+// oldest default limit of 999). Runs in the caller's transaction. A row
+// whose change already has one is skipped, so the group-commit writer and
+// recoverAudit() may both write an entry.
+bool Database::insertAuditRows(const QList<AuditRecord>& records) {
+    HMIS_PERF_TIMER(timer, "insertAuditRows");
+    constexpr qsizetype kRowsPerStatement = 100;
+    const QString tuple = "(?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+    QSqlQuery q(db);
+    QString preparedFor;
+    for (qsizetype start = 0; start < records.size(); start += kRowsPerStatement) {
+        const qsizetype n = std::min(kRowsPerStatement, records.size() - start);
+        QStringList tuples(n, tuple);
+        const QString sql = m_sql->insertAuditRows + tuples.join(", ") + m_sql->ignoreConflict;
+        if (sql != preparedFor && !q.prepare(sql)) {
+            m_lastError = q.lastError().text();
+            timer.fail();
+            return false;
+        }
+        preparedFor = sql;
+        for (qsizetype i = start; i < start + n; ++i) {
+            const AuditRecord& r = records.at(i);
+            q.addBindValue(r.changeId);
+            q.addBindValue(r.userId);
+            q.addBindValue(r.username);
+            q.addBindValue(r.action);
+            q.addBindValue(r.tableName);
+            q.addBindValue(r.recordId);
+            q.addBindValue(r.detail);
+            q.addBindValue(r.changedAt);
+            q.addBindValue(auditPeriodOf(r.changedAt));
+        }
+        timer.track(q);
+        if (!q.exec()) {
+            m_lastError = q.lastError().text();
+            timer.fail();
+            return false;
+        }
+    }
+    timer.addRows(records.size());
+    return true;
+}
+
+bool Database::insertAuditBatch(const QList<AuditRecord>& records) {
+    m_lastError.clear();
+    if (records.isEmpty()) {
+        return true;
+    }
+    TransactionGuard guard(db);
+    if (!guard.active) {
+        m_lastError = db.lastError().text();
+        return false;
+    }
+    return insertAuditRows(records) && guard.commit();
+}
+
+void Database::setAuditDurability(AuditDurability mode, int groupCommitMs) {
+    m_lastError.clear();
+    m_auditWriter.reset();  // flushes the old writer
+    m_auditMode = mode;
+    if (m_remote) {
+        return;  // hmisd writes the audit log with its own setting
+    }
+    if (mode == AuditDurability::GroupCommit) {
+        m_auditWriter = std::make_unique<AuditWriter>(m_connOptions, groupCommitMs);
+    }
+}
+
+bool Database::flushAudit(int timeoutMs) { return !m_auditWriter || m_auditWriter->flush(timeoutMs); }
+
+// Looks for audited journal entries that have no audit_log row, one entry
+// at a time: clients flush independently, so what a crashed one lost can
+// sit below rows others wrote later. Entries younger than kAuditGraceSecs
+// may still be queued in a live client's group-commit writer and are left
+// to it; should both write one, the unique change_id keeps the first. Both
+// take changed_at, and so the period, from the journal entry, which keeps
+// PostgreSQL's (change_id, period) key in one partition. In strict mode
+// this finds nothing.
+//
+// audit.checked_change_id remembers how far every entry is past the grace
+// window and checked, so a start only scans the newer part of the journal.
+qint64 Database::recoverAudit() {
+    HMIS_PERF_TIMER(timer, "recoverAudit");
+    m_lastError.clear();
+    if (m_remote) {
+        return 0;  // hmisd recovers at startup
+    }
+    static constexpr int kAuditGraceSecs = 5 * 60;
+    const QString cutoff = QDateTime::currentDateTime().addSecs(-kAuditGraceSecs).toString(Qt::ISODate);
+    // Archival may have moved audited changes out of the hot table.
+    const qint64 checked = std::max(getState("audit.checked_change_id", "0").toLongLong(),
+                                    getState("audit.archived_change_id", "0").toLongLong());
 
-    logAudit(query, actorUserId, "DELETE", "hmis", id, "");
-    return guard.commit();
+    QSqlQuery q(db);
+    q.prepare(
+        "SELECT (SELECT MIN(id) FROM change_journal WHERE id > :after AND changed_at >= :cutoff), "
+        "(SELECT COALESCE(MAX(id), 0) FROM change_journal)");
+    q.bindValue(":after", checked);
+    q.bindValue(":cutoff", cutoff);
+    if (!q.exec() || !q.next()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+    // Entries up to this one are all past the grace window.
+    const qint64 settled = q.value(0).isNull() ? q.value(1).toLongLong() : q.value(0).toLongLong() - 1;
+
+    qint64 recovered = 0;
+    qint64 cursor = checked;
+    while (cursor < settled) {
+        q.prepare(
+            "SELECT j.id, j.table_name, j.op, j.record_id, j.user_id, j.audit_detail, j.changed_at "
+            "FROM change_journal j WHERE j.id > :after AND j.id <= :settled AND j.audit_detail IS NOT NULL "
+            "AND NOT EXISTS (SELECT 1 FROM audit_log a WHERE a.change_id = j.id) ORDER BY j.id ASC LIMIT 1000");
+        q.bindValue(":after", cursor);
+        q.bindValue(":settled", settled);
+        if (!q.exec()) {
+            m_lastError = q.lastError().text();
+            timer.fail();
+            return -1;
+        }
+        QList<AuditRecord> batch;
+        while (q.next()) {
+            AuditRecord r;
+            r.changeId = q.value(0).toLongLong();
+            r.tableName = q.value(1).toString();
+            r.action = q.value(2).toString();
+            r.recordId = q.value(3).toInt();
+            r.userId = q.value(4).toInt();
+            r.detail = q.value(5).toString();
+            r.changedAt = q.value(6).toString();
+            batch << r;
+        }
+        if (batch.isEmpty()) {
+            break;
+        }
+        for (AuditRecord& r : batch) {
+            r.username = usernameFor(r.userId);
+        }
+        if (!insertAuditBatch(batch)) {
+            timer.fail();
+            return -1;
+        }
+        recovered += batch.size();
+        cursor = batch.last().changeId;
+    }
+    if (settled > checked && !setState("audit.checked_change_id", QString::number(settled))) {
+        timer.fail();
+        return -1;
+    }
+    if (recovered > 0) {
+        qWarning() << "Recovered" << recovered << "audit entries from change_journal";
+    }
+    timer.addRows(recovered);
+    return recovered;
 }
 
-QString Database::nextIPNumber(int year, int month) {
-    QSqlQuery query;
-    query.prepare("SELECT ip_number FROM hmis WHERE year=:year AND month=:month ORDER BY id DESC LIMIT 1");
-    query.bindValue(":year", year);
-    query.bindValue(":month", month);
+QList<AuditEntry> Database::getAuditLog(int limit) { return getAuditPage({}, 0, limit); }
 
-    if (query.exec() && query.next()) {
-        QString ipNumber = query.value(0).toString();
-        if (!ipNumber.isEmpty()) {
-            bool ok;
-            int n = ipNumber.toInt(&ok);
-            if (ok) {
-                return QString("%1").arg(n + 1, 3, 10, QChar('0'));
-            }
-        }
+QList<AuditEntry> Database::getAuditPage(const AuditFilter& filter, qint64 beforeId, int limit) {
+    HMIS_PERF_TIMER(timer, "getAuditPage");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<QList<AuditEntry>>(hmisd::Op::AuditPage, filter, beforeId, limit).value_or(QList<AuditEntry>());
+    }
+    QStringList where;
+    if (beforeId > 0) {
+        where << "id < :before";
+    }
+    if (!filter.username.isEmpty()) {
+        where << "username = :user";
+    }
+    if (!filter.action.isEmpty()) {
+        where << "action = :action";
+    }
+    if (!filter.tableName.isEmpty()) {
+        where << "table_name = :table";
+    }
+    if (filter.recordId) {
+        where << "record_id = :rid";
+    }
+    // changed_at is an ISO string, so date bounds compare lexically.
+    // period bounds let PostgreSQL prune partitions.
+    if (filter.fromDate.isValid()) {
+        where << "changed_at >= :from" << "period >= :fromPeriod";
+    }
+    if (filter.toDate.isValid()) {
+        where << "changed_at < :to" << "period <= :toPeriod";
+    }
+
+    QString sql = "SELECT id, username, action, table_name, record_id, detail, changed_at, change_id FROM audit_log";
+    if (!where.isEmpty()) {
+        sql += " WHERE " + where.join(" AND ");
+    }
+    sql += " ORDER BY id DESC LIMIT :lim";
+
+    QList<AuditEntry> entries;
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare(sql);
+    if (beforeId > 0) {
+        q.bindValue(":before", beforeId);
+    }
+    if (!filter.username.isEmpty()) {
+        q.bindValue(":user", filter.username);
     }
-    return "001";
+    if (!filter.action.isEmpty()) {
+        q.bindValue(":action", filter.action);
+    }
+    if (!filter.tableName.isEmpty()) {
+        q.bindValue(":table", filter.tableName);
+    }
+    if (filter.recordId) {
+        q.bindValue(":rid", *filter.recordId);
+    }
+    if (filter.fromDate.isValid()) {
+        q.bindValue(":from", filter.fromDate.toString(Qt::ISODate));
+        q.bindValue(":fromPeriod", (filter.fromDate.year() * 100) + filter.fromDate.month());
+    }
+    if (filter.toDate.isValid()) {
+        q.bindValue(":to", filter.toDate.addDays(1).toString(Qt::ISODate));
+        q.bindValue(":toPeriod", (filter.toDate.year() * 100) + filter.toDate.month());
+    }
+    q.bindValue(":lim", limit);
+
+    timer.track(q);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return entries;
+    }
+
+    while (q.next()) {
+        entries << AuditEntry{.id = q.value(0).toLongLong(),
+                              .username = q.value(1).toString(),
+                              .action = q.value(2).toString(),
+                              .tableName = q.value(3).toString(),
+                              .recordId = q.value(4).toInt(),
+                              .detail = q.value(5).toString(),
+                              .changedAt = q.value(6).toString(),
+                              .changeId = q.value(7).toLongLong()};
+    }
+    timer.addRows(entries.size());
+    return entries;
 }
 
 // ---------------------------------------------------------------------------
-// Diagnoses
+// Audit archival
 // ---------------------------------------------------------------------------
-std::optional<QList<Diagnosis>> Database::getAllDiagnoses() {
-    QList<Diagnosis> list;
-    QSqlQuery query;
-    if (!query.exec("SELECT id, name FROM diagnoses ORDER BY name ASC")) {
-        qWarning() << "getAllDiagnoses failed:" << query.lastError();
-        return std::nullopt;
+static int nextPeriod(int period) { return (period % 100 == 12) ? ((period / 100) + 1) * 100 + 1 : period + 1; }
+
+void Database::ensureAuditPartitions() {
+    m_lastError.clear();
+    if (!m_auditPartitioned) {
+        return;
     }
-    while (query.next()) {
-        list << Diagnosis{.id = query.value("id").toInt(), .name = query.value("name").toString()};
+    const QDate today = QDate::currentDate();
+    const int current = (today.year() * 100) + today.month();
+    QSqlQuery q(db);
+    for (int period : {current, nextPeriod(current)}) {
+        // Fails if the default partition already holds rows for the period;
+        // those rows are still archived normally.
+        if (!q.exec(QString("CREATE TABLE IF NOT EXISTS audit_log_p%1 PARTITION OF audit_log "
+                            "FOR VALUES FROM (%1) TO (%2)")
+                        .arg(period)
+                        .arg(nextPeriod(period)))) {
+            qWarning() << "Creating audit partition" << period << "failed:" << q.lastError().text();
+        }
     }
-    return list;
 }
 
-bool Database::insertDiagnoses(const QStringList& diagnoses) {
-    if (diagnoses.isEmpty()) {
-        return true;
+QList<int> Database::getAuditPeriodsBefore(int period) {
+    m_lastError.clear();
+    QList<int> periods;
+    QSqlQuery q(db);
+    q.prepare("SELECT DISTINCT period FROM audit_log WHERE period > 0 AND period < :p ORDER BY period");
+    q.bindValue(":p", period);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return periods;
+    }
+    while (q.next()) {
+        periods << q.value(0).toInt();
+    }
+    return periods;
+}
+
+std::optional<QList<AuditEntry>> Database::getAuditPeriodEntries(int period) {
+    HMIS_PERF_TIMER(timer, "getAuditPeriodEntries");
+    m_lastError.clear();
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare(
+        "SELECT id, username, action, table_name, record_id, detail, changed_at, change_id "
+        "FROM audit_log WHERE period = :p ORDER BY id DESC");
+    q.bindValue(":p", period);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return std::nullopt;
+    }
+    QList<AuditEntry> entries;
+    while (q.next()) {
+        entries << AuditEntry{.id = q.value(0).toLongLong(),
+                              .username = q.value(1).toString(),
+                              .action = q.value(2).toString(),
+                              .tableName = q.value(3).toString(),
+                              .recordId = q.value(4).toInt(),
+                              .detail = q.value(5).toString(),
+                              .changedAt = q.value(6).toString(),
+                              .changeId = q.value(7).toLongLong()};
     }
+    timer.addRows(entries.size());
+    return entries;
+}
 
+bool Database::purgeAuditPeriod(int period, qint64 maxId, qint64 rows, qint64 maxChangeId) {
+    HMIS_PERF_TIMER(timer, "purgeAuditPeriod");
+    m_lastError.clear();
     TransactionGuard guard(db);
     if (!guard.active) {
-        qWarning() << "insertDiagnoses: failed to start transaction";
+        m_lastError = db.lastError().text();
+        timer.fail();
         return false;
     }
 
-    QSqlQuery query;
-    if (!query.prepare("INSERT INTO diagnoses(name) VALUES(:name)")) {
-        qWarning() << "insertDiagnoses prepare failed:" << query.lastError();
-        return false;
+    QSqlQuery q(db);
+    const QString partition = QString("audit_log_p%1").arg(period);
+    bool dropped = false;
+    if (m_auditPartitioned && db.tables().contains(partition)) {
+        // Dropping the partition is instant and leaves no dead tuples, but
+        // only if it holds exactly what was archived.
+        if (q.exec("SELECT COUNT(*), COALESCE(MAX(id), 0) FROM " + partition) && q.next() &&
+            q.value(0).toLongLong() == rows && q.value(1).toLongLong() == maxId) {
+            dropped = q.exec("DROP TABLE " + partition);
+        }
     }
-
-    for (const QString& name : diagnoses) {
-        query.bindValue(":name", name);
-        if (!query.exec()) {
-            qWarning() << "insertDiagnoses exec failed:" << query.lastError();
+    if (!dropped) {
+        q.prepare("DELETE FROM audit_log WHERE period = :p AND id <= :max");
+        q.bindValue(":p", period);
+        q.bindValue(":max", maxId);
+        if (!q.exec()) {
+            m_lastError = q.lastError().text();
+            timer.fail();
             return false;
         }
     }
-    return guard.commit();
-}
 
-bool Database::diagnosisExists(const QString& name) {
-    QSqlQuery query;
-    if (!query.prepare("SELECT EXISTS(SELECT 1 FROM diagnoses WHERE name=:name LIMIT 1)")) {
-        return false;
-    }
-    query.bindValue(":name", name);
-    if (!query.exec()) {
+    const qint64 watermark = getState("audit.archived_change_id", "0").toLongLong();
+    if (maxChangeId > watermark && !setState("audit.archived_change_id", QString::number(maxChangeId))) {
+        timer.fail();
         return false;
     }
-    return query.next() && query.value(0).toBool();
+    timer.addRows(rows);
+    return guard.commit();
 }
 
 // ---------------------------------------------------------------------------
-// Authentication helpers
+// app_state
 // ---------------------------------------------------------------------------
-QString Database::generateSalt() {
-    QByteArray bytes(16, Qt::Uninitialized);
-    for (auto& b : bytes) {
-        b = static_cast<char>(QRandomGenerator::global()->bounded(256));
+QString Database::getState(const QString& name, const QString& fallback) {
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<QString>(hmisd::Op::GetState, name, fallback).value_or(fallback);
     }
-    return bytes.toHex();
+    QSqlQuery q(db);
+    q.prepare("SELECT value FROM app_state WHERE name = :n");
+    q.bindValue(":n", name);
+    if (q.exec() && q.next()) {
+        return q.value(0).toString();
+    }
+    return fallback;
 }
 
-QString Database::hashPassword(const QString& password, const QString& salt) {
-    QByteArray data = (password + salt).toUtf8();
-    return QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+bool Database::setState(const QString& name, const QString& value) {
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<bool>(hmisd::Op::SetState, name, value).value_or(false);
+    }
+    QSqlQuery q(db);
+    q.prepare(m_sql->setState);
+    q.bindValue(":n", name);
+    q.bindValue(":v", value);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
 }
 
 // ---------------------------------------------------------------------------
-// Users
+// Change journal
 // ---------------------------------------------------------------------------
-bool Database::userExists(const QString& username) {
-    QSqlQuery q;
-    q.prepare("SELECT EXISTS(SELECT 1 FROM users WHERE username=:u LIMIT 1)");
-    q.bindValue(":u", username);
-    return q.exec() && q.next() && q.value(0).toBool();
+// Full current image of one row, or an empty object if it does not exist.
+// table is always one of our own table names, never user input.
+// Journal image of a row. Credentials are left out: the journal is copied
+// into delta files and served to hmisd clients.
+QJsonObject Database::rowImage(const QString& table, int id) {
+    QSqlQuery q(db);
+    q.prepare("SELECT * FROM " + table + " WHERE id=:id");
+    q.bindValue(":id", id);
+    QJsonObject image;
+    if (q.exec() && q.next()) {
+        const QSqlRecord rec = q.record();
+        for (int i = 0; i < rec.count(); ++i) {
+            image.insert(rec.fieldName(i), QJsonValue::fromVariant(q.value(i)));
+        }
+    }
+    if (table == "users") {
+        image.remove("password_hash");
+        image.remove("salt");
+    }
+    return image;
 }
 
-bool Database::createUser(const QString& username, const QString& password, UserRole role) {
-    QString salt = generateSalt();
-    QString hash = hashPassword(password, salt);
-    QString roleStr = (role == UserRole::Admin) ? "Admin" : "Clerk";
-
-    QSqlQuery q;
-    q.prepare("INSERT INTO users(username, password_hash, salt, role) VALUES(:u, :h, :s, :r)");
-    q.bindValue(":u", username);
-    q.bindValue(":h", hash);
-    q.bindValue(":s", salt);
-    q.bindValue(":r", roleStr);
+// Entries journaled before rowImage() dropped credentials still hold them.
+static QByteArray withoutCredentials(const QByteArray& image) {
+    if (!image.contains("password_hash") && !image.contains("salt")) {
+        return image;
+    }
+    QJsonObject row = QJsonDocument::fromJson(image).object();
+    row.remove("password_hash");
+    row.remove("salt");
+    return QJsonDocument(row).toJson(QJsonDocument::Compact);
+}
 
+// Unlike logAudit this is not best-effort: a change that cannot be journaled
+// would be missing from the next differential backup, so the caller rolls
+// back instead.
+qint64 Database::journalChange(const QString& table, const QString& op, int recordId, const QJsonObject& before,
+                               const QJsonObject& after, int actorUserId, const std::optional<QString>& auditDetail) {
+    HMIS_PERF_TIMER(timer, "journalChange");
+    auto toText = [](const QJsonObject& image) {
+        return image.isEmpty() ? QString() : QString::fromUtf8(QJsonDocument(image).toJson(QJsonDocument::Compact));
+    };
+
+    QSqlQuery q(db);
+    q.prepare(
+        "INSERT INTO change_journal"
+        "(table_name, op, record_id, before_image, after_image, user_id, changed_at, audit_detail) "
+        "VALUES(:t, :op, :rid, :before, :after, :uid, :ts, :audit)" +
+        returningId());
+    q.bindValue(":t", table);
+    q.bindValue(":op", op);
+    q.bindValue(":rid", recordId);
+    q.bindValue(":before", toText(before));
+    q.bindValue(":after", toText(after));
+    q.bindValue(":uid", actorUserId);
+    const QString changedAt = QDateTime::currentDateTime().toString(Qt::ISODate);
+    q.bindValue(":ts", changedAt);
+    // Not-null (possibly empty) marks an audited operation.
+    q.bindValue(":audit", auditDetail ? QVariant(auditDetail->isNull() ? QString("") : *auditDetail) : QVariant());
+    timer.track(q);
     if (!q.exec()) {
-        qWarning() << "createUser failed:" << q.lastError();
-        return false;
+        qWarning() << "journalChange failed:" << q.lastError().text();
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
     }
-    return true;
+    m_journaledId = insertedId(q);
+    m_journaledAt = changedAt;
+    return m_journaledId;
 }
 
-std::optional<User> Database::authenticate(const QString& username, const QString& password) {
-    QSqlQuery q;
-    q.prepare("SELECT id, password_hash, salt, role FROM users WHERE username=:u LIMIT 1");
-    q.bindValue(":u", username);
-
-    if (!q.exec() || !q.next()) {
+std::optional<QList<ChangeEntry>> Database::getChangesSince(qint64 afterId, int limit) {
+    HMIS_PERF_TIMER(timer, "getChangesSince");
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<std::optional<QList<ChangeEntry>>>(hmisd::Op::ChangesSince, afterId, limit)
+            .value_or(std::nullopt);
+    }
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    q.prepare(
+        "SELECT id, table_name, op, record_id, before_image, after_image, user_id, changed_at "
+        "FROM change_journal WHERE id > :after ORDER BY id ASC LIMIT :lim");
+    q.bindValue(":after", afterId);
+    q.bindValue(":lim", limit);
+    timer.track(q);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
         return std::nullopt;
     }
 
-    int id = q.value(0).toInt();
-    QString storedHash = q.value(1).toString();
-    QString salt = q.value(2).toString();
-    QString roleStr = q.value(3).toString();
+    QList<ChangeEntry> entries;
+    while (q.next()) {
+        ChangeEntry e;
+        e.id = q.value(0).toLongLong();
+        e.tableName = q.value(1).toString();
+        e.op = q.value(2).toString();
+        e.recordId = q.value(3).toInt();
+        e.before = q.value(4).toString().toUtf8();
+        e.after = q.value(5).toString().toUtf8();
+        e.userId = q.value(6).toInt();
+        e.changedAt = q.value(7).toString();
+        if (e.tableName == "users") {
+            e.before = withoutCredentials(e.before);
+            e.after = withoutCredentials(e.after);
+        }
+        timer.addBytes(e.before.size() + e.after.size());
+        entries << e;
+    }
+    timer.addRows(entries.size());
+    return entries;
+}
 
-    if (hashPassword(password, salt) != storedHash) {
-        return std::nullopt;
+std::optional<QList<ChangeEntry>> Database::getRegisterChangesSince(qint64 afterId, int limit) {
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<std::optional<QList<ChangeEntry>>>(hmisd::Op::RegisterChangesSince, afterId, limit)
+            .value_or(std::nullopt);
+    }
+    auto entries = getChangesSince(afterId, limit);
+    if (entries) {
+        for (ChangeEntry& e : *entries) {
+            if (e.tableName != "hmis" && e.tableName != "diagnoses") {
+                e.before.clear();
+                e.after.clear();
+            }
+        }
     }
+    return entries;
+}
 
-    UserRole role = (roleStr == "Admin") ? UserRole::Admin : UserRole::Clerk;
-    return User{.id = id, .username = username, .role = role};
+qint64 Database::maxChangeId() {
+    m_lastError.clear();
+    if (m_remote) {
+        return remote<qint64>(hmisd::Op::MaxChangeId).value_or(-1);
+    }
+    QSqlQuery q(db);
+    if (!q.exec("SELECT COALESCE(MAX(id), 0) FROM change_journal") || !q.next()) {
+        m_lastError = q.lastError().text();
+        return -1;
+    }
+    return q.value(0).toLongLong();
 }
 
-bool Database::changePassword(int userId, const QString& newPassword) {
-    QString salt = generateSalt();
-    QString hash = hashPassword(newPassword, salt);
+HMISRow Database::rowFromImage(const QJsonObject& image) const {
+    return hmisRowFromImage(image.value("id").toInt(), image, dxSeparator);
+}
 
-    QSqlQuery q;
-    q.prepare("UPDATE users SET password_hash=:h, salt=:s WHERE id=:id");
-    q.bindValue(":h", hash);
-    q.bindValue(":s", salt);
-    q.bindValue(":id", userId);
-    return q.exec();
+// ---------------------------------------------------------------------------
+// Change notifications
+// ---------------------------------------------------------------------------
+QSqlDriver* Database::listen(const QString& channel) {
+    m_lastError.clear();
+    if (m_sql == nullptr || !m_sql->listenNotify) {
+        return nullptr;
+    }
+    QSqlDriver* driver = db.driver();
+    if (!driver->subscribedToNotifications().contains(channel) && !driver->subscribeToNotification(channel)) {
+        m_lastError = driver->lastError().text();
+        return nullptr;
+    }
+    return driver;
 }
 
-QList<User> Database::getAllUsers() {
-    QList<User> users;
-    QSqlQuery q;
-    if (!q.exec("SELECT id, username, role FROM users ORDER BY username ASC")) {
-        return users;
+qint64 Database::dataVersion() {
+    m_lastError.clear();
+    if (m_connOptions.getDriver() != Driver::SQLITE) {
+        return -1;
     }
-    while (q.next()) {
-        QString r = q.value(2).toString();
-        users << User{.id = q.value(0).toInt(),
-                      .username = q.value(1).toString(),
-                      .role = (r == "Admin") ? UserRole::Admin : UserRole::Clerk};
+    QSqlQuery q(db);
+    if (!q.exec("PRAGMA data_version") || !q.next()) {
+        m_lastError = q.lastError().text();
+        return -1;
     }
-    return users;
+    return q.value(0).toLongLong();
 }
 
-// ---------------------------------------------------------------------------
-// Audit log
-// ---------------------------------------------------------------------------
-void Database::logAudit(QSqlQuery& /*q*/, int actorUserId, const QString& action, const QString& table, int recordId,
-                        const QString& detail) {
-    // Resolve username from id
-    QString username;
-    if (actorUserId > 0) {
-        QSqlQuery uq;
-        uq.prepare("SELECT username FROM users WHERE id=:id");
-        uq.bindValue(":id", actorUserId);
-        if (uq.exec() && uq.next()) {
-            username = uq.value(0).toString();
-        }
-    }
-    if (username.isEmpty()) {
-        username = "system";
-    }
-
-    QSqlQuery aq;
-    aq.prepare(
-        "INSERT INTO audit_log(user_id, username, action, table_name, record_id, detail, changed_at) "
-        "VALUES(:uid, :u, :a, :t, :rid, :d, :ts)");
-    aq.bindValue(":uid", actorUserId);
-    aq.bindValue(":u", username);
-    aq.bindValue(":a", action);
-    aq.bindValue(":t", table);
-    aq.bindValue(":rid", recordId);
-    aq.bindValue(":d", detail);
-    aq.bindValue(":ts", QDateTime::currentDateTime().toString(Qt::ISODate));
-    aq.exec();  // best-effort — don't fail the parent operation if audit fails
-}
-
-QList<AuditEntry> Database::getAuditLog(int limit) {
-    QList<AuditEntry> entries;
-    QSqlQuery q;
+bool Database::recordBackup(const QString& kind, const QString& path, qint64 fromChangeId, qint64 toChangeId) {
+    m_lastError.clear();
+    QSqlQuery q(db);
     q.prepare(
-        "SELECT id, username, action, table_name, record_id, detail, changed_at "
-        "FROM audit_log ORDER BY id DESC LIMIT :lim");
-    q.bindValue(":lim", limit);
+        "INSERT INTO backup_state(kind, path, from_change_id, to_change_id, created_at) "
+        "VALUES(:kind, :path, :from, :to, :ts)");
+    q.bindValue(":kind", kind);
+    q.bindValue(":path", path);
+    q.bindValue(":from", fromChangeId);
+    q.bindValue(":to", toChangeId);
+    q.bindValue(":ts", QDateTime::currentDateTime().toString(Qt::ISODate));
     if (!q.exec()) {
-        return entries;
+        m_lastError = q.lastError().text();
+        return false;
     }
+    return true;
+}
 
-    while (q.next()) {
-        entries << AuditEntry{.id = q.value(0).toInt(),
-                              .username = q.value(1).toString(),
-                              .action = q.value(2).toString(),
-                              .tableName = q.value(3).toString(),
-                              .recordId = q.value(4).toInt(),
-                              .detail = q.value(5).toString(),
-                              .changedAt = q.value(6).toString()};
+qint64 Database::lastBackupChangeId(bool* haveFull) {
+    m_lastError.clear();
+    QSqlQuery q(db);
+    if (!q.exec("SELECT COALESCE(MAX(to_change_id), 0), "
+                "SUM(CASE WHEN kind='full' THEN 1 ELSE 0 END) FROM backup_state") ||
+        !q.next()) {
+        m_lastError = q.lastError().text();
+        return -1;
     }
-    return entries;
+    if (haveFull != nullptr) {
+        *haveFull = q.value(1).toInt() > 0;
+    }
+    return q.value(0).toLongLong();
 }
 
 // ---------------------------------------------------------------------------
 // Stats helpers
 // ---------------------------------------------------------------------------
 MonthlyStats Database::buildAttendanceStats(const HMISData& rows) const {
+    return buildAttendanceStats(std::span<const HMISRow>(rows.constData(), rows.size()));
+}
+
+MonthlyStats Database::buildDiagnosisStats(const HMISData& rows, const QStringList& diagnosisNames) const {
+    return buildDiagnosisStats(std::span<const HMISRow>(rows.constData(), rows.size()), diagnosisNames);
+}
+
+MonthlyStats Database::buildAttendanceStats(std::span<const HMISRow> rows) const {
+    HMIS_PERF_TIMER(timer, "buildAttendanceStats");
+    timer.addRows(rows.size());
     MonthlyStats stats;
     for (const HMISRow& row : rows) {
         stats.increment(row.newAttendance, row.ageCategory, row.sex);
@@ -517,7 +2876,9 @@ MonthlyStats Database::buildAttendanceStats(const HMISData& rows) const {
     return stats;
 }
 
-MonthlyStats Database::buildDiagnosisStats(const HMISData& rows, const QStringList& diagnosisNames) const {
+MonthlyStats Database::buildDiagnosisStats(std::span<const HMISRow> rows, const QStringList& diagnosisNames) const {
+    HMIS_PERF_TIMER(timer, "buildDiagnosisStats");
+    timer.addRows(rows.size());
     MonthlyStats stats;
     // Pre-seed keys so zero-count diagnoses still exist
     for (const QString& dx : diagnosisNames) {
@@ -538,7 +2899,14 @@ MonthlyStats Database::buildDiagnosisStats(const HMISData& rows, const QStringLi
 // Monthly summary for dashboard
 // ---------------------------------------------------------------------------
 Database::MonthlySummary Database::getMonthlySummary(int year, int month) {
-    HMISData rows = fetchHMISData(year, month);
+    HMIS_PERF_TIMER(timer, "getMonthlySummary");
+    m_lastError.clear();
+    HMISData rows = analytics().fetchHMISData(year, month);
+    timer.addRows(rows.size());
+    return buildSummary(rows);
+}
+
+Database::MonthlySummary Database::buildSummary(const HMISData& rows) const {
     MonthlySummary s;
     s.totalPatients = static_cast<int>(rows.size());
 
@@ -578,7 +2946,9 @@ Database::MonthlySummary Database::getMonthlySummary(int year, int month) {
 // CSV export
 // ---------------------------------------------------------------------------
 QString Database::exportCSV(int year, int month) {
-    HMISData rows = fetchHMISData(year, month);
+    HMIS_PERF_TIMER(timer, "exportCSV");
+    m_lastError.clear();
+    HMISData rows = analytics().fetchHMISData(year, month);
     QString csv;
     csv += "ID,IP Number,Age Category,Sex,New Attendance,Diagnoses\n";
     for (const HMISRow& row : rows) {
@@ -591,25 +2961,119 @@ QString Database::exportCSV(int year, int month) {
                    .arg(row.newAttendance)
                    .arg(dxCombined);
     }
+    timer.addRows(rows.size());
+    timer.addBytes(csv.size() * qsizetype(sizeof(QChar)));
     return csv;
 }
 
 // ---------------------------------------------------------------------------
-// SQLite backup
+// SQLite maintenance
 // ---------------------------------------------------------------------------
-bool Database::backupTo(const QString& destPath) {
+bool Database::checkpointWal(bool truncate, bool* busy) {
+    m_lastError.clear();
     if (m_connOptions.getDriver() != Driver::SQLITE) {
-        qWarning() << "Backup only supported for SQLite";
+        return true;
+    }
+    HMIS_PERF_TIMER(timer, "checkpointWal");
+    QSqlQuery q(db);
+    timer.track(q);
+    if (!q.exec(truncate ? "PRAGMA wal_checkpoint(TRUNCATE)" : "PRAGMA wal_checkpoint(PASSIVE)") || !q.next()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
         return false;
     }
-    QString srcPath = m_connOptions.dbFilePath();
-    if (srcPath.isEmpty() || srcPath == ":memory:") {
+    // Columns: busy flag, frames in the WAL, frames copied into the database.
+    if (busy != nullptr) {
+        *busy = q.value(0).toInt() != 0 || q.value(1).toLongLong() != q.value(2).toLongLong();
+    }
+    timer.addRows(q.value(2).toLongLong());
+    return true;
+}
+
+bool Database::optimize(bool fullAnalyze) {
+    m_lastError.clear();
+    if (m_connOptions.getDriver() != Driver::SQLITE) {
+        return true;
+    }
+    HMIS_PERF_TIMER(timer, "optimize");
+    QSqlQuery q(db);
+    timer.track(q);
+    if (!q.exec(fullAnalyze ? "ANALYZE" : "PRAGMA optimize")) {
+        m_lastError = q.lastError().text();
+        timer.fail();
         return false;
     }
+    return true;
+}
+
+qint64 Database::incrementalVacuum(int maxPages) {
+    m_lastError.clear();
+    if (m_connOptions.getDriver() != Driver::SQLITE) {
+        return 0;
+    }
+    HMIS_PERF_TIMER(timer, "incrementalVacuum");
+    QSqlQuery q(db);
+    if (!q.exec("PRAGMA auto_vacuum") || !q.next()) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+    if (q.value(0).toInt() != 2) {
+        return 0;  // NONE or FULL: nothing to do incrementally
+    }
+    auto freelist = [&]() -> qint64 {
+        return q.exec("PRAGMA freelist_count") && q.next() ? q.value(0).toLongLong() : -1;
+    };
+    const qint64 before = freelist();
+    if (before <= 0) {
+        return before;
+    }
+    // The pragma returns a row per page freed; step through them all.
+    if (!q.exec(QString("PRAGMA incremental_vacuum(%1)").arg(std::max(maxPages, 1)))) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+    while (q.next()) {
+    }
+    const qint64 after = freelist();
+    timer.addRows(before - after);
+    return after < 0 ? -1 : before - after;
+}
 
-    if (QFile::exists(destPath)) {
-        QFile::remove(destPath);
+bool Database::enableIncrementalVacuum() {
+    m_lastError.clear();
+    if (m_connOptions.getDriver() != Driver::SQLITE) {
+        return true;
+    }
+    HMIS_PERF_TIMER(timer, "enableIncrementalVacuum");
+    QSqlQuery q(db);
+    if (!q.exec("PRAGMA auto_vacuum=INCREMENTAL") || !q.exec("VACUUM")) {
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return false;
     }
+    return true;
+}
+
+qint64 Database::walSizeBytes() const {
+    const QString path = m_connOptions.dbFilePath();
+    return path.isEmpty() ? 0 : QFileInfo(path + "-wal").size();
+}
 
-    return QFile::copy(srcPath, destPath);
+// ---------------------------------------------------------------------------
+// SQLite backup
+// ---------------------------------------------------------------------------
+bool Database::backupTo(const QString& destPath, const backup::Options& options) {
+    m_lastError.clear();
+    if (m_connOptions.getDriver() != Driver::SQLITE) {
+        m_lastError = "Backup only supported for SQLite";
+        qWarning() << m_lastError;
+        return false;
+    }
+    const backup::Result r = backup::run(m_connOptions.dbFilePath(), destPath, options);
+    if (!r.ok) {
+        m_lastError = r.message;
+    }
+    return r.ok;
 }
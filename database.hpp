@@ -1,18 +1,27 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include <QDate>
+#include <QJsonObject>
 #include <QList>
 #include <QString>
 #include <QtSql/QSql>
 #include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlDriver>
 #include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
+#include <QHash>
+#include <algorithm>
+#include <memory>
 #include <optional>
+#include <span>
 #include <variant>
 
 #include "HMISRow.hpp"
 #include "MonthlyStats.hpp"
+#include "backup.hpp"
 #include "databaseOptions.hpp"
+#include "journalcursor.hpp"
 
 using HMISData = QList<HMISRow>;
 
@@ -41,30 +50,231 @@ struct User {
 };
 
 struct AuditEntry {
-    int id;
+    qint64 id;
     QString username;
     QString action;  // "INSERT" | "UPDATE" | "DELETE"
     QString tableName;
     int recordId;
     QString detail;
     QString changedAt;  // ISO datetime string
+    qint64 changeId = 0;
+};
+
+// yyyymm of an ISO "yyyy-MM-dd..." timestamp or date (audit_log.period).
+inline int auditPeriodOf(const QString& isoTimestamp) {
+    return (isoTimestamp.left(4).toInt() * 100) + isoTimestamp.mid(5, 2).toInt();
+}
+
+// An audit_log row to be written. changeId links it to the change_journal
+// entry of the same operation (0 when there is none).
+struct AuditRecord {
+    qint64 changeId = 0;
+    int userId = 0;
+    QString username;
+    QString action;
+    QString tableName;
+    int recordId = 0;
+    QString detail;
+    QString changedAt;
+};
+
+// When audit_log rows are written:
+//  Strict      - in the user's transaction (the audit row commits with the data).
+//  GroupCommit - after the transaction commits, batched by AuditWriter on a
+//                background connection every N ms. A crash can lose at most the
+//                last window, which recoverAudit() rebuilds from change_journal.
+enum class AuditDurability : uint8_t { Strict, GroupCommit };
+
+class AuditWriter;
+
+// Server-side audit log filter. Empty/unset fields match everything; dates
+// are inclusive and compared against the local changed_at timestamp.
+struct AuditFilter {
+    QString username;
+    QString action;
+    QString tableName;
+    std::optional<int> recordId;
+    QDate fromDate;
+    QDate toDate;
+};
+
+// One row-level change from change_journal. Images are compact JSON objects
+// of the full row (column name -> value); before is empty for inserts and
+// after is empty for deletes. Ids increase monotonically and double as the
+// position for differential backups.
+struct ChangeEntry {
+    qint64 id = 0;
+    QString tableName;  // "hmis" | "diagnoses" | "users"
+    QString op;         // "INSERT" | "UPDATE" | "DELETE"
+    int recordId = 0;
+    QByteArray before;
+    QByteArray after;
+    int userId = 0;
+    QString changedAt;  // ISO datetime string
+};
+
+// A register write queued in the local outbox (offline-first mode, see
+// outbox.hpp). Images use the change_journal row format; before is the row
+// as this client last read it and is compared with the server's copy.
+struct PendingWrite {
+    qint64 seq = 0;     // local outbox order
+    QString opKey;      // idempotency key, recorded in the server's applied_ops
+    QString op;         // "INSERT" | "UPDATE" | "DELETE"
+    int recordId = 0;   // server id; 0 for INSERT
+    QJsonObject before;
+    QJsonObject after;
+    int actorUserId = 0;
+    QString createdAt;
+    QString state;      // "pending" | "conflict"
+    int attempts = 0;
+    QString lastError;
+};
+
+// One row of a facility change feed (see changefeed.hpp). version is the
+// facility's change_journal id of the row's latest change; row is the full
+// row image, empty for deletes.
+struct FeedEntry {
+    qint64 version = 0;
+    QString tableName;  // "hmis" | "diagnoses"
+    QString op;         // "UPSERT" | "DELETE"
+    int recordId = 0;   // id on the facility
+    QJsonObject row;
+};
+
+// A facility's changes in (fromVersion, toVersion], ordered by version.
+struct FeedBundle {
+    QString facilityId;
+    QString facilityCode;   // prefixes its IP numbers on the central server
+    qint64 fromVersion = 0;
+    qint64 toVersion = 0;
+    bool snapshot = false;  // first bundle: every row of both tables
+    QString createdAt;
+    QList<FeedEntry> entries;
+};
+
+// Cheap fingerprint of one month of the register, for cached aggregates
+// (statsnapshot.hpp). Every register write, bulk imports included, adds a
+// change_journal entry: one with a new highest id moves changeId, and one
+// committing late below it (PostgreSQL, MySQL) moves recentChanges. rows
+// and maxId catch rows copied in around the journal, e.g. by a migration.
+struct MonthStamp {
+    qint64 changeId = 0;       // newest change_journal id
+    qint64 recentChanges = 0;  // entries in the JournalCursor::kLookbackIds ids up to changeId
+    qint64 rows = 0;
+    qint64 maxId = 0;
+
+    bool operator==(const MonthStamp&) const = default;
 };
 
+// Outcome of replaying a PendingWrite on the server.
+enum class ApplyResult : uint8_t { Applied, AlreadyApplied, Conflict, Failed };
+
+class DaemonClient;
+class Outbox;
+class PerfTimer;
+namespace hmisd {
+enum class Op : quint16;
+}
+namespace sql {
+struct Dialect;
+}
+
+// Data access layer. Depends on QtCore/QtSql only: failures are reported
+// through return values and getLastError(), never through UI.
 class Database {
   public:
     Database();
+    ~Database();
+
+    Database(const Database&) = delete;
+    Database& operator=(const Database&) = delete;
 
-    // Connection
+    // Connection. With Driver::HMISD the register, diagnosis, user, audit,
+    // app_state and journal calls go to an hmisd process instead (see
+    // daemonclient.hpp); the rest fail or are no-ops, as on a server driver
+    // without the feature.
     void Connect(const ConnOptions& options);
+    // Reopens a connection that failed or dropped. Returns false while the
+    // server is still unreachable.
+    bool reconnect();
+    [[nodiscard]] bool isConnected() const;
     void createSchema();
+    // Why the last call failed. Each call clears it first, so it never
+    // describes an earlier failure.
     QString getLastError() const;
+    [[nodiscard]] const QString& connectionName() const { return m_connectionName; }
+    // For hmisd, includes the user signed in with authenticate(), so other
+    // connections opened with it act as the same user.
+    [[nodiscard]] const ConnOptions& connOptions() const { return m_connOptions; }
 
     // HMIS data
     HMISData fetchHMISData(int year, int month);
+    // Months fromYear/fromMonth to toYear/toMonth inclusive, from the read
+    // endpoint. Queued offline writes are not included.
+    HMISData fetchHMISRange(int fromYear, int fromMonth, int toYear, int toMonth);
+    std::optional<MonthStamp> monthStamp(int year, int month);  // one indexed query
+    // Visits from any month whose IP number or diagnoses contain every word
+    // of text as a word prefix: an exact IP number first, then by relevance,
+    // newest first; limit rows from offset. Served by the FTS5 (SQLite) or
+    // tsvector (PostgreSQL) index that the write paths keep in step, or by a
+    // scan on MySQL. Queued offline writes are not included.
+    std::optional<HMISData> searchRegister(const QString& text, int offset, int limit);
+    // Refills the search index from hmis after rows were written around the
+    // write paths (migrations, restores, older clients). On failure the index
+    // is dropped and searches fall back to a scan until the next open.
+    bool rebuildSearchIndex();
+    [[nodiscard]] bool hasSearchIndex() const { return m_searchIndexed; }
     bool saveNewRow(const NewHMISData& data, int actorUserId = 0);
     bool updateHMISRow(const HMISRow& data, int actorUserId = 0);
+    // Several edited rows (a Register edit session) in one transaction:
+    // diagnoses not yet in the list are added first, and the audit entries
+    // are written together. Offline-first, each row is queued as usual and
+    // new diagnoses wait in the cached list until their rows are synced.
+    bool updateHMISRows(const QList<HMISRow>& rows, int actorUserId = 0);
     bool deleteHMISRow(int id, int actorUserId = 0);
+
+    // IP numbers come from ip_sequences, one counter per (year, month),
+    // allocated atomically so concurrent clients never get the same number.
+    // nextIPNumber() peeks at this client's reserved block (reserving a new
+    // one when it runs out); saveNewRow() consumes it. Reserved but unused
+    // numbers are lost when the client exits, leaving gaps.
     QString nextIPNumber(int year, int month);
+    void setIpBlockSize(int count) { m_ipBlockSize = std::max(count, 1); }
+    // Returns the first of count freshly allocated numbers, or -1.
+    qint64 reserveIpNumbers(int year, int month, int count);
+
+    // Read endpoint for analytic methods (fetchHMISRange, exportCSV,
+    // getMonthlySummary), so reports no longer share the primary connection
+    // with interactive saves. A replica is a second server or SQLite file
+    // that something else keeps in step with the primary. A mirror is an
+    // in-memory SQLite copy of hmis and diagnoses, loaded here and brought up
+    // to date from change_journal before each analytic read. Both throw
+    // like Connect(); if the mirror cannot catch up, reads use the primary.
+    void useReadReplica(const ConnOptions& replica);
+    void useReadMirror();
+    [[nodiscard]] bool hasReadEndpoint() const { return m_reader != nullptr; }
+
+    // Offline-first: register writes go to the outbox and reads merge its
+    // pending entries (not-yet-synced rows get negative ids). Sign-ins are
+    // cached there so clerks can sign in while the server is down.
+    void setOutbox(Outbox* outbox) { m_outbox = outbox; }
+    [[nodiscard]] Outbox* outbox() const { return m_outbox; }
+    // Server side of replication: applies one queued write in a transaction
+    // that also records its op key. Sets getLastError() unless Applied.
+    ApplyResult applyPendingWrite(const PendingWrite& write);
+
+    // Central side of multi-facility sync (see changefeed.hpp). Applies the
+    // entries newer than the version already imported from that facility,
+    // in one transaction; re-importing a bundle is a no-op. Returns the
+    // number of entries applied, or -1.
+    qint64 applyFeedBundle(const FeedBundle& bundle);
+    qint64 feedVersion(const QString& facilityId);  // 0 before the first bundle, -1 on error
+    // Full row images of table with id > afterId, in id order (feed snapshots).
+    std::optional<QList<QJsonObject>> tableImages(const QString& table, qint64 afterId, int limit);
+
+    // Inserts rows in one transaction without duplicate checks or audit
+    // entries. Meant for data generators and imports, not interactive saves.
+    bool bulkInsertRows(const QList<NewHMISData>& rows);
 
     // Diagnoses
     std::optional<QList<Diagnosis>> getAllDiagnoses();
@@ -79,18 +289,82 @@ class Database {
     bool changePassword(int userId, const QString& newPassword);
 
     // Audit log
+    void setAuditDurability(AuditDurability mode, int groupCommitMs = 50);
+    [[nodiscard]] AuditDurability auditDurability() const { return m_auditMode; }
+    bool flushAudit(int timeoutMs = 5000);
+    // Writes records in multi-row INSERTs inside one transaction.
+    bool insertAuditBatch(const QList<AuditRecord>& records);
+    // Backfills audit_log from audited change_journal entries that have no
+    // audit row and are older than a few minutes (lost group-commit
+    // windows, from any client). Returns rows added or -1.
+    qint64 recoverAudit();
     QList<AuditEntry> getAuditLog(int limit = 500);
+    // Newest-first keyset page: entries matching filter with id < beforeId
+    // (0 = start from the newest). Pass the last id of a page to get the next.
+    QList<AuditEntry> getAuditPage(const AuditFilter& filter, qint64 beforeId, int limit);
+
+    // Audit archival (see auditarchive.hpp). Periods are yyyymm.
+    QList<int> getAuditPeriodsBefore(int period);
+    std::optional<QList<AuditEntry>> getAuditPeriodEntries(int period);  // newest first
+    // Removes an archived period (drops its partition on PostgreSQL) and
+    // advances the audit.archived_change_id watermark.
+    bool purgeAuditPeriod(int period, qint64 maxId, qint64 rows, qint64 maxChangeId);
+    // PostgreSQL: creates this and next month's partitions.
+    void ensureAuditPartitions();
+
+    // app_state key/value bookkeeping
+    QString getState(const QString& name, const QString& fallback = {});
+    bool setState(const QString& name, const QString& value);
+
+    // Change journal
+    std::optional<QList<ChangeEntry>> getChangesSince(qint64 afterId, int limit = 5000);
+    // The same entries with images only for hmis and diagnoses, all that
+    // a window watching the register needs. hmisd gives these to any
+    // signed-in user and the full journal only to administrators.
+    std::optional<QList<ChangeEntry>> getRegisterChangesSince(qint64 afterId, int limit = 5000);
+    qint64 maxChangeId();  // 0 when empty, -1 on error
+    // Decodes an hmis row image (ChangeEntry::before/after).
+    HMISRow rowFromImage(const QJsonObject& image) const;
+
+    // Change notifications (see changenotifier.hpp). listen() subscribes
+    // this connection to a PostgreSQL NOTIFY channel and returns the driver
+    // that emits notification(); nullptr on other drivers. dataVersion() is
+    // SQLite's PRAGMA data_version, -1 elsewhere or on error.
+    QSqlDriver* listen(const QString& channel);
+    qint64 dataVersion();
+
+    // Backup catalog (backup_state). kind is "full" or "delta"; toChangeId
+    // is the last journal entry the backup is known to contain.
+    bool recordBackup(const QString& kind, const QString& path, qint64 fromChangeId, qint64 toChangeId);
+    qint64 lastBackupChangeId(bool* haveFull = nullptr);  // -1 on error
 
     // Export
     // Returns CSV text for the given month/year (attendances + diagnoses)
     QString exportCSV(int year, int month);
 
-    // Backup (SQLite only): copies DB file to destPath
-    bool backupTo(const QString& destPath);
+    // Backup (SQLite only): consistent online copy of the live database,
+    // blocking the caller. The GUI runs BackupEngine on a worker instead.
+    bool backupTo(const QString& destPath, const backup::Options& options = {});
+
+    // SQLite maintenance (see maintenance.hpp). No-ops returning true (or 0)
+    // on other drivers; failures set getLastError().
+    // wal_checkpoint(PASSIVE), or TRUNCATE to also shrink the -wal file back to
+    // zero. *busy is set when readers or writers kept it from completing.
+    bool checkpointWal(bool truncate, bool* busy = nullptr);
+    bool optimize(bool fullAnalyze);  // PRAGMA optimize, or a full ANALYZE
+    // Returns freelist pages released (up to maxPages), or -1. Needs
+    // auto_vacuum=INCREMENTAL: new files get it, older ones through
+    // enableIncrementalVacuum(), a full VACUUM that blocks other writers.
+    qint64 incrementalVacuum(int maxPages);
+    bool enableIncrementalVacuum();
+    qint64 walSizeBytes() const;  // size of the -wal file, 0 if none
 
     // Stats helpers
     MonthlyStats buildAttendanceStats(const HMISData& rows) const;
     MonthlyStats buildDiagnosisStats(const HMISData& rows, const QStringList& diagnosisNames) const;
+    // The same folds over a slice of rows (parallelstats.hpp folds chunks).
+    MonthlyStats buildAttendanceStats(std::span<const HMISRow> rows) const;
+    MonthlyStats buildDiagnosisStats(std::span<const HMISRow> rows, const QStringList& diagnosisNames) const;
 
     // Summary counts for dashboard
     struct MonthlySummary {
@@ -102,16 +376,93 @@ class Database {
         QString topDiagnosis3;
     };
     MonthlySummary getMonthlySummary(int year, int month);
+    MonthlySummary buildSummary(const HMISData& rows) const;
 
   private:
     const QString dxSeparator = "____";
 
+    void applySqliteProfile();
+    bool mysqlIndexExists(const QString& name, const QString& table);
+    void ensureAuditChangeUnique();
+    void createIndex(const QString& name, const QString& table, const QString& columns,
+                     const QString& mysqlColumns = {});
+
+    QString m_connectionName;
     QSqlDatabase db;
     ConnOptions m_connOptions;
+    const sql::Dialect* m_sql = nullptr;  // statement text for the driver (sqldialect.hpp)
+    bool m_batchIds = true;               // a multi-row INSERT's ids follow from lastInsertId()
+    bool m_searchIndexed = false;         // the dialect's search table exists
+    QString m_lastError;
+
+    bool m_auditPartitioned = false;  // PostgreSQL native partitions
+    AuditDurability m_auditMode = AuditDurability::Strict;
+    std::unique_ptr<AuditWriter> m_auditWriter;
+    QList<AuditRecord> m_pendingAudit;  // group commit: handed over once the transaction commits
+    bool m_deferAudit = false;          // batch writes collect audit rows in m_pendingAudit too
+    QHash<int, QString> m_usernames;    // user id -> username for audit rows
+    // changed_at of the last journalChange(), reused by its audit row so the
+    // row lands in the period recoverAudit() would give it.
+    qint64 m_journaledId = 0;
+    QString m_journaledAt;
+
+    struct IpBlock {
+        qint64 next = 0;  // next number to hand out
+        qint64 end = 0;   // one past the last reserved number
+    };
+    QHash<int, IpBlock> m_ipBlocks;  // year * 100 + month -> reserved numbers
+    int m_ipBlockSize = 1;
+
+    std::unique_ptr<Database> m_reader;  // read endpoint, see useReadReplica()
+    bool m_readerIsMirror = false;
+    bool m_mirrorLoaded = false;
+    JournalCursor m_mirrorCursor;  // change_journal entries applied to the mirror
+
+    std::unique_ptr<DaemonClient> m_remote;  // Driver::HMISD
+
+    Outbox* m_outbox = nullptr;
+    QHash<int, QJsonObject> m_seenRows;  // offline-first: rows as last read, for conflict checks
 
     // Internal helpers
-    void logAudit(QSqlQuery& q, int actorUserId, const QString& action, const QString& table, int recordId,
+    // One hmisd round trip: sends args, returns the result (nullopt and
+    // getLastError() when the request failed).
+    template <typename R, typename... Args>
+    std::optional<R> remote(hmisd::Op op, const Args&... args);
+    void logAudit(qint64 changeId, int actorUserId, const QString& action, const QString& table, int recordId,
                   const QString& detail);
+    bool insertAuditRows(const QList<AuditRecord>& records);
+    bool insertDiagnosisNames(const QStringList& diagnoses, PerfTimer& timer);  // in the caller's transaction
+    bool addMissingDiagnoses(const QStringList& diagnoses, PerfTimer& timer);   // likewise
+    bool finishWrite(bool committed);
+    // Register writes without their own transaction; the public wrappers
+    // and applyPendingWrite() provide it. insertHMIS returns the id or -1.
+    int insertHMIS(const NewHMISData& data, int actorUserId, PerfTimer& timer, bool* duplicate);
+    bool updateHMIS(const HMISRow& data, int actorUserId, PerfTimer& timer);
+    bool deleteHMIS(int id, int actorUserId, PerfTimer& timer);
+    bool queueWrite(const QString& op, int recordId, const QJsonObject& after, int actorUserId);
+    void mergePending(HMISData& rows, int year, int month);
+    bool applyFeedEntry(const FeedBundle& bundle, const FeedEntry& entry, PerfTimer& timer);
+    HMISData readRows(QSqlQuery& query, PerfTimer& timer);
+    // Re-reads hmis rows fromId..toId into the search index, or with
+    // present=false only drops them. In the caller's transaction.
+    bool indexSearchRows(qint64 fromId, qint64 toId, bool present);
+    Database& analytics();  // the read endpoint, caught up, or *this
+    bool loadMirror();
+    bool catchUpMirror();
+    bool mirrorRow(const QString& table, int id, const QJsonObject& image);
+    bool advanceIpSequence(int year, int month, qint64 next);
+    void noteIpNumberUsed(int year, int month, const QString& ipNumber);
+    // " RETURNING id" where the dialect reads ids that way. Pair with insertedId().
+    QString returningId() const;
+    qint64 insertedId(QSqlQuery& q) const;
+    QString usernameFor(int userId);
+    bool addColumnIfMissing(const QString& table, const QString& column, const QString& definition);
+    QJsonObject rowImage(const QString& table, int id);
+    // Returns the new journal id, or -1 on failure. auditDetail is stored
+    // when the operation is audited, so recoverAudit() can rebuild it.
+    qint64 journalChange(const QString& table, const QString& op, int recordId, const QJsonObject& before,
+                         const QJsonObject& after, int actorUserId,
+                         const std::optional<QString>& auditDetail = std::nullopt);
     static QString hashPassword(const QString& password, const QString& salt);
     static QString generateSalt();
 };
@@ -3,17 +3,49 @@
 
 #include <QString>
 #include <type_traits>
+#include <utility>
 #include <variant>
 
-enum class Driver : uint8_t { SQLITE, POSTGRES, MYSQL };
+// HMISD is not a Qt SQL driver: the Database API is served by an hmisd
+// process that owns the SQLite file (see daemonclient.hpp).
+enum class Driver : uint8_t { SQLITE, POSTGRES, MYSQL, HMISD };
+
+// PRAGMA synchronous levels. In WAL mode NORMAL cannot corrupt the file,
+// but a power cut may roll back the last commits; FULL keeps them.
+enum class SqliteSync : uint8_t { Off, Normal, Full, Extra };
 
 struct SqliteOptions {
     QString dbName = "hmis.sqlite3";
+
+    // Performance profile, applied to every connection by Database::Connect.
+    SqliteSync synchronous = SqliteSync::Full;
+    int cacheSizeKiB = 32 * 1024;         // page cache per connection
+    qint64 mmapSize = 256LL * 1024 * 1024;  // bytes read through mmap; 0 disables
+    bool tempStoreMemory = true;          // temp tables and sort spills in RAM
+    int busyTimeoutMs = 5000;             // wait this long for another connection's lock
+    int walAutocheckpoint = 1000;         // pages; 0 leaves checkpoints to MaintenanceScheduler
+
     SqliteOptions() = default;
     SqliteOptions(QString name) : dbName(std::move(name)) {}
     [[nodiscard]] bool isValid() const { return !dbName.isEmpty(); }
 };
 
+// Where hmisd listens: host:port for TCP, anything else is a local socket
+// name or path (a named pipe on Windows).
+struct DaemonOptions {
+    QString address = "hmisd";
+    QString token;           // shared secret, if hmisd was started with one
+    int timeoutMs = 30000;   // per request; also the connect timeout
+    // hmisd serves a connection only once a user signed in on it; set by
+    // Database::authenticate() and used again on every reconnect.
+    QString username;
+    QString password;
+
+    DaemonOptions() = default;
+    DaemonOptions(QString addr) : address(std::move(addr)) {}
+    [[nodiscard]] bool isValid() const { return !address.isEmpty() && timeoutMs > 0; }
+};
+
 struct PostgresTag {};
 struct MysqlTag {};
 
@@ -70,16 +102,18 @@ using MysqlOptions = DatabaseOptions<MysqlTag>;
 
 template <typename T>
 concept AllowedVariant =
-    std::is_same_v<T, SqliteOptions> || std::is_same_v<T, PostgresOptions> || std::is_same_v<T, MysqlOptions>;
+    std::is_same_v<T, SqliteOptions> || std::is_same_v<T, PostgresOptions> || std::is_same_v<T, MysqlOptions> ||
+    std::is_same_v<T, DaemonOptions>;
 
 class ConnOptions {
   public:
-    using Variant = std::variant<SqliteOptions, PostgresOptions, MysqlOptions>;
+    using Variant = std::variant<SqliteOptions, PostgresOptions, MysqlOptions, DaemonOptions>;
 
     ConnOptions() : m_driver(Driver::SQLITE), m_options(SqliteOptions()) {}
     explicit ConnOptions(SqliteOptions opt) : m_driver(Driver::SQLITE), m_options(std::move(opt)) {}
     explicit ConnOptions(PostgresOptions opt) : m_driver(Driver::POSTGRES), m_options(std::move(opt)) {}
     explicit ConnOptions(MysqlOptions opt) : m_driver(Driver::MYSQL), m_options(std::move(opt)) {}
+    explicit ConnOptions(DaemonOptions opt) : m_driver(Driver::HMISD), m_options(std::move(opt)) {}
 
     [[nodiscard]] Driver getDriver() const { return m_driver; }
 
@@ -91,6 +125,8 @@ class ConnOptions {
                 return "QPSQL";
             case Driver::MYSQL:
                 return "QMYSQL";
+            case Driver::HMISD:
+                return "HMISD";
         }
         return {};
     }
@@ -100,6 +136,8 @@ class ConnOptions {
             [](const auto& opt) {
                 if constexpr (std::is_same_v<std::decay_t<decltype(opt)>, SqliteOptions>) {
                     return opt.dbName;
+                } else if constexpr (std::is_same_v<std::decay_t<decltype(opt)>, DaemonOptions>) {
+                    return opt.address;
                 } else {
                     return opt.getConnectionString();
                 }
@@ -118,6 +156,12 @@ class ConnOptions {
         return std::get<T>(m_options);
     }
 
+    // Calls f with the options of whichever driver this is.
+    template <typename F>
+    decltype(auto) visit(F&& f) const {
+        return std::visit(std::forward<F>(f), m_options);
+    }
+
     [[nodiscard]] QString dbFilePath() const {
         if (m_driver == Driver::SQLITE) {
             return std::get<SqliteOptions>(m_options).dbName;
@@ -0,0 +1,431 @@
+#include "diffbackup.hpp"
+#include "perfstats.hpp"
+#include "sqldialect.hpp"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QTemporaryDir>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+namespace diffbackup {
+
+static const QByteArray kMagic("HMISDLT1");
+static constexpr quint32 kFormatVersion = 1;
+static constexpr int kPageSize = 5000;
+
+// ---------------------------------------------------------------------------
+// Writing
+// ---------------------------------------------------------------------------
+bool writeFull(Database& db, const QString& path, const backup::Options& options, QString* error) {
+    // Entries committed between this read and the copy's snapshot end up in
+    // both the base and the next delta; replay is idempotent, so that is fine.
+    const qint64 stamp = db.maxChangeId();
+    if (stamp < 0) {
+        *error = db.getLastError();
+        return false;
+    }
+    if (!db.backupTo(path, options) || !db.recordBackup("full", path, 0, stamp)) {
+        *error = db.getLastError();
+        return false;
+    }
+    return true;
+}
+
+qint64 writeDelta(Database& db, const QString& path, QString* error) {
+    HMIS_PERF_TIMER(timer, "writeDelta");
+    bool haveFull = false;
+    const qint64 from = db.lastBackupChangeId(&haveFull);
+    const qint64 to = db.maxChangeId();
+    if (from < 0 || to < 0) {
+        *error = db.getLastError();
+        timer.fail();
+        return -1;
+    }
+    if (!haveFull) {
+        *error = "No full backup recorded; take a full backup first.";
+        timer.fail();
+        return -1;
+    }
+
+    QByteArray payload;
+    QDataStream ps(&payload, QIODevice::WriteOnly);
+    ps.setVersion(QDataStream::Qt_6_0);
+
+    qint64 count = 0;
+    qint64 cursor = from;
+    while (cursor < to) {
+        const auto page = db.getChangesSince(cursor, kPageSize);
+        if (!page) {
+            *error = db.getLastError();
+            timer.fail();
+            return -1;
+        }
+        if (page->isEmpty()) {
+            break;
+        }
+        for (const ChangeEntry& e : *page) {
+            if (e.id > to) {
+                break;  // written after we fixed the range; next delta picks it up
+            }
+            ps << e.id << e.tableName << e.op << qint32(e.recordId) << e.before << e.after << qint32(e.userId)
+               << e.changedAt;
+            ++count;
+        }
+        cursor = page->last().id;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        *error = "Cannot write " + path;
+        timer.fail();
+        return -1;
+    }
+    file.write(kMagic);
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << kFormatVersion << from << to << count << QDateTime::currentDateTime().toString(Qt::ISODate)
+        << qCompress(payload, 9);
+    if (!file.commit()) {
+        *error = file.errorString();
+        timer.fail();
+        return -1;
+    }
+
+    if (!db.recordBackup("delta", path, from, to)) {
+        *error = db.getLastError();
+        timer.fail();
+        return -1;
+    }
+    timer.addRows(count);
+    timer.addBytes(payload.size());
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+bool readDelta(const QString& path, DeltaHeader* header, QList<ChangeEntry>* entries, QString* error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = "Cannot read " + path;
+        return false;
+    }
+    if (file.read(kMagic.size()) != kMagic) {
+        *error = path + " is not an HMIS delta file";
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 version = 0;
+    QByteArray compressed;
+    in >> version;
+    if (version != kFormatVersion) {
+        *error = QString("%1: unsupported delta format version %2").arg(path).arg(version);
+        return false;
+    }
+    in >> header->fromChangeId >> header->toChangeId >> header->entries >> header->createdAt >> compressed;
+    if (in.status() != QDataStream::Ok) {
+        *error = path + " is truncated";
+        return false;
+    }
+    if (entries == nullptr) {
+        return true;
+    }
+
+    const QByteArray payload = qUncompress(compressed);
+    if (payload.isEmpty() && header->entries > 0) {
+        *error = path + " is corrupt";
+        return false;
+    }
+    QDataStream ps(payload);
+    ps.setVersion(QDataStream::Qt_6_0);
+    entries->clear();
+    entries->reserve(header->entries);
+    for (qint64 i = 0; i < header->entries; ++i) {
+        ChangeEntry e;
+        qint32 recordId = 0;
+        qint32 userId = 0;
+        ps >> e.id >> e.tableName >> e.op >> recordId >> e.before >> e.after >> userId >> e.changedAt;
+        e.recordId = recordId;
+        e.userId = userId;
+        *entries << e;
+    }
+    if (ps.status() != QDataStream::Ok) {
+        *error = path + " is corrupt";
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Restore
+// ---------------------------------------------------------------------------
+static QVariant jsonToVariant(const QJsonValue& v) {
+    if (v.isDouble()) {
+        const double d = v.toDouble();
+        const auto i = static_cast<qint64>(d);
+        return static_cast<double>(i) == d ? QVariant(i) : QVariant(d);
+    }
+    if (v.isNull() || v.isUndefined()) {
+        return {};
+    }
+    return v.toVariant();
+}
+
+// Upserts the after image (INSERT/UPDATE) or removes the row (DELETE), then
+// copies the journal entry itself so the restored database can continue the
+// chain. Replaying an entry twice leaves the same result.
+static bool applyEntry(QSqlDatabase& db, const ChangeEntry& e, QString* error) {
+    static const QStringList tables = {"hmis", "diagnoses", "users"};
+    static const QRegularExpression column("^[a-z_]+$");
+    if (!tables.contains(e.tableName)) {
+        *error = "Unknown table in journal: " + e.tableName;
+        return false;
+    }
+
+    QSqlQuery q(db);
+    if (e.op == "DELETE") {
+        q.prepare("DELETE FROM " + e.tableName + " WHERE id=?");
+        q.addBindValue(e.recordId);
+    } else {
+        const QJsonObject image = QJsonDocument::fromJson(e.after).object();
+        if (image.isEmpty()) {
+            *error = QString("Journal entry %1 has no row image").arg(e.id);
+            return false;
+        }
+        QStringList cols;
+        QStringList marks;
+        for (auto it = image.begin(); it != image.end(); ++it) {
+            if (!column.match(it.key()).hasMatch()) {
+                *error = "Bad column name in journal: " + it.key();
+                return false;
+            }
+            cols << it.key();
+            marks << "?";
+        }
+        if (e.tableName == "users" && !image.contains("password_hash")) {
+            // Journal images hold no credentials: existing users keep
+            // theirs, and users created after the base get none, so an
+            // administrator has to set a new password.
+            QStringList updates;
+            for (const QString& col : cols) {
+                updates << col + " = excluded." + col;
+            }
+            q.prepare(QString("INSERT INTO users (%1, password_hash, salt) VALUES (%2, '', '') "
+                              "ON CONFLICT(id) DO UPDATE SET %3")
+                          .arg(cols.join(", "), marks.join(", "), updates.join(", ")));
+        } else {
+            q.prepare(QString("INSERT OR REPLACE INTO %1 (%2) VALUES (%3)")
+                          .arg(e.tableName, cols.join(", "), marks.join(", ")));
+        }
+        for (auto it = image.begin(); it != image.end(); ++it) {
+            q.addBindValue(jsonToVariant(it.value()));
+        }
+    }
+    if (!q.exec()) {
+        *error = QString("Replaying journal entry %1 failed: %2").arg(e.id).arg(q.lastError().text());
+        return false;
+    }
+
+    QSqlQuery jq(db);
+    jq.prepare(
+        "INSERT OR IGNORE INTO change_journal"
+        "(id, table_name, op, record_id, before_image, after_image, user_id, changed_at) "
+        "VALUES(?, ?, ?, ?, ?, ?, ?, ?)");
+    jq.addBindValue(e.id);
+    jq.addBindValue(e.tableName);
+    jq.addBindValue(e.op);
+    jq.addBindValue(e.recordId);
+    jq.addBindValue(e.before.isEmpty() ? QVariant() : QVariant(QString::fromUtf8(e.before)));
+    jq.addBindValue(e.after.isEmpty() ? QVariant() : QVariant(QString::fromUtf8(e.after)));
+    jq.addBindValue(e.userId);
+    jq.addBindValue(e.changedAt);
+    if (!jq.exec()) {
+        *error = jq.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// Replayed entries are applied as plain SQL, so the base's FTS5 table (if it
+// has one) is refilled from the restored rows.
+static bool reindexSearch(QSqlDatabase& db, QString* error) {
+    const sql::Dialect& sqlite = sql::dialect<sql::Sqlite>();
+    if (!db.tables().contains(sqlite.searchTable)) {
+        return true;
+    }
+    QSqlQuery q(db);
+    for (const QLatin1String statement : {sqlite.unindexSearchRows, sqlite.indexSearchRows}) {
+        q.prepare(statement);
+        q.bindValue(":from", 0);
+        q.bindValue(":to", std::numeric_limits<int>::max());
+        if (!q.exec()) {
+            *error = "Rebuilding the search index: " + q.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool replay(QSqlDatabase& db, const QStringList& deltaPaths, QString* error) {
+    QSqlQuery q(db);
+    if (!q.exec("SELECT COALESCE(MAX(id), 0) FROM change_journal") || !q.next()) {
+        *error = "Base backup has no change journal: " + q.lastError().text();
+        return false;
+    }
+    qint64 cursor = q.value(0).toLongLong();
+    q.finish();
+
+    QList<QPair<DeltaHeader, QString>> chain;
+    for (const QString& path : deltaPaths) {
+        DeltaHeader h;
+        if (!readDelta(path, &h, nullptr, error)) {
+            return false;
+        }
+        chain << qMakePair(h, path);
+    }
+    std::sort(chain.begin(), chain.end(),
+              [](const auto& a, const auto& b) { return a.first.fromChangeId < b.first.fromChangeId; });
+
+    for (const auto& [header, path] : chain) {
+        if (header.toChangeId <= cursor) {
+            continue;  // already in the base or an earlier delta
+        }
+        if (header.fromChangeId > cursor) {
+            *error = QString("Gap in backup chain: have changes up to %1, %2 starts after %3")
+                         .arg(cursor)
+                         .arg(path)
+                         .arg(header.fromChangeId);
+            return false;
+        }
+
+        DeltaHeader h;
+        QList<ChangeEntry> entries;
+        if (!readDelta(path, &h, &entries, error)) {
+            return false;
+        }
+        if (!db.transaction()) {
+            *error = db.lastError().text();
+            return false;
+        }
+        for (const ChangeEntry& e : entries) {
+            if (e.id <= cursor) {
+                continue;
+            }
+            if (!applyEntry(db, e, error)) {
+                db.rollback();
+                return false;
+            }
+        }
+        if (!db.commit()) {
+            *error = db.lastError().text();
+            return false;
+        }
+        cursor = header.toChangeId;
+    }
+    return reindexSearch(db, error);
+}
+
+bool restore(const QString& basePath, const QStringList& deltaPaths, const QString& targetPath, QString* error) {
+    HMIS_PERF_TIMER(timer, "restore");
+    if (basePath.endsWith(".gz", Qt::CaseInsensitive)) {
+        *error = "Decompress the base backup first (gunzip " + basePath + ")";
+        timer.fail();
+        return false;
+    }
+    if (QFile::exists(targetPath)) {
+        *error = "Restore target already exists: " + targetPath;
+        timer.fail();
+        return false;
+    }
+    if (!QFile::copy(basePath, targetPath)) {
+        *error = "Cannot copy " + basePath + " to " + targetPath;
+        timer.fail();
+        return false;
+    }
+
+    static std::atomic<int> nextId{0};
+    const QString name = QString("hmis_restore_%1").arg(nextId.fetch_add(1));
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(targetPath);
+        if (!db.open()) {
+            *error = db.lastError().text();
+        } else {
+            ok = replay(db, deltaPaths, error);
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    if (!ok) {
+        timer.fail();
+        QFile::remove(targetPath);
+    }
+    return ok;
+}
+
+bool selfTest(QString* report) {
+    QTemporaryDir dir;
+    const QString base = dir.filePath("base.sqlite3");
+    const QString delta = dir.filePath("users.hmisdelta");
+    const QString restored = dir.filePath("restored.sqlite3");
+    QString error;
+    {
+        Database db;
+        try {
+            db.Connect(ConnOptions(SqliteOptions(dir.filePath("live.sqlite3"))));
+            db.createSchema();
+        } catch (const std::exception& e) {
+            *report = QString("scratch database: %1").arg(e.what());
+            return false;
+        }
+        if (!db.createUser("admin", "first-password", UserRole::Admin) || !writeFull(db, base, {}, &error)) {
+            *report = "full backup: " + (error.isEmpty() ? db.getLastError() : error);
+            return false;
+        }
+        const auto admin = db.authenticate("admin", "first-password");
+        if (!admin || !db.createUser("clerk", "clerk-password", UserRole::Clerk) ||
+            !db.changePassword(admin->id, "second-password") || writeDelta(db, delta, &error) < 0) {
+            *report = "user changes: " + (error.isEmpty() ? db.getLastError() : error);
+            return false;
+        }
+    }
+
+    DeltaHeader header;
+    QList<ChangeEntry> entries;
+    if (!readDelta(delta, &header, &entries, &error)) {
+        *report = "reading the delta: " + error;
+        return false;
+    }
+    for (const ChangeEntry& e : entries) {
+        if (e.before.contains("password_hash") || e.after.contains("password_hash") || e.before.contains("salt") ||
+            e.after.contains("salt")) {
+            *report = QString("delta entry %1 (%2) carries credentials").arg(e.id).arg(e.tableName);
+            return false;
+        }
+    }
+    if (entries.size() != 2) {
+        *report = QString("expected 2 user entries in the delta, got %1").arg(entries.size());
+        return false;
+    }
+    if (!restore(base, {delta}, restored, &error)) {
+        *report = "restoring users without credentials: " + error;
+        return false;
+    }
+    *report = "user changes are journaled and restored without password hashes";
+    return true;
+}
+
+}  // namespace diffbackup
@@ -0,0 +1,52 @@
+#ifndef DIFFBACKUP_H
+#define DIFFBACKUP_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "backup.hpp"
+#include "database.hpp"
+
+// Differential backups on top of change_journal.
+//
+// A chain is one full backup (an online SQLite copy, see backup.hpp) followed
+// by delta files, each holding the journal entries written since the previous
+// backup in the chain. backup_state records where each backup ends, so a
+// nightly delta reads only that day's journal entries.
+//
+// Delta file layout: the 8-byte magic "HMISDLT1", then a QDataStream with
+// the format version, the (from, to] journal id range, the entry count, the
+// creation time and a qCompress'd block of serialized ChangeEntry records.
+namespace diffbackup {
+
+struct DeltaHeader {
+    qint64 fromChangeId = 0;  // exclusive
+    qint64 toChangeId = 0;    // inclusive
+    qint64 entries = 0;
+    QString createdAt;
+};
+
+// Full online backup, recorded in backup_state as the start of a new chain.
+bool writeFull(Database& db, const QString& path, const backup::Options& options, QString* error);
+
+// Writes every journal entry since the last recorded backup to path.
+// Requires a full backup first. Returns the number of entries or -1.
+qint64 writeDelta(Database& db, const QString& path, QString* error);
+
+bool readDelta(const QString& path, DeltaHeader* header, QList<ChangeEntry>* entries, QString* error);
+
+// Copies an uncompressed full backup to targetPath (which must not exist) and
+// replays the deltas in journal order. Deltas already contained in the base
+// are skipped; a gap in the chain is an error.
+// Users are journaled without password hashes, so users added after the
+// base come back without a password and password changes are not replayed.
+bool restore(const QString& basePath, const QStringList& deltaPaths, const QString& targetPath, QString* error);
+
+// Backs up a scratch SQLite file, adds a user and changes a password, then
+// checks that the delta holds no credentials and still restores.
+bool selfTest(QString* report);
+
+}  // namespace diffbackup
+
+#endif  // DIFFBACKUP_H
@@ -0,0 +1,106 @@
+#include "editsession.hpp"
+#include "perfstats.hpp"
+
+#include <algorithm>
+
+bool EditSession::sameValues(const HMISRow& a, const HMISRow& b) {
+    return a.ipNumber == b.ipNumber && a.ageCategory == b.ageCategory && a.sex == b.sex &&
+           a.newAttendance == b.newAttendance && a.diagnoses == b.diagnoses;
+}
+
+void EditSession::record(const HMISRow& before, const HMISRow& after) {
+    if (sameValues(before, after)) {
+        return;
+    }
+    if (!m_loaded.contains(before.id)) {
+        m_loaded.insert(before.id, before);
+    }
+    m_current.insert(after.id, after);
+    m_undo << Step{.before = before, .after = after};
+    m_redo.clear();
+}
+
+std::optional<HMISRow> EditSession::undo() {
+    if (m_undo.isEmpty()) {
+        return std::nullopt;
+    }
+    Step step = m_undo.takeLast();
+    m_current.insert(step.before.id, step.before);
+    m_redo << step;
+    return step.before;
+}
+
+std::optional<HMISRow> EditSession::redo() {
+    if (m_redo.isEmpty()) {
+        return std::nullopt;
+    }
+    Step step = m_redo.takeLast();
+    m_current.insert(step.after.id, step.after);
+    m_undo << step;
+    return step.after;
+}
+
+std::optional<HMISRow> EditSession::pendingRow(int id) const {
+    const auto current = m_current.constFind(id);
+    if (current == m_current.constEnd() || sameValues(*current, m_loaded.value(id))) {
+        return std::nullopt;
+    }
+    return *current;
+}
+
+QList<HMISRow> EditSession::pendingRows() const {
+    QList<HMISRow> rows;
+    for (auto it = m_current.constBegin(); it != m_current.constEnd(); ++it) {
+        if (!sameValues(*it, m_loaded.value(it.key()))) {
+            rows << *it;
+        }
+    }
+    // Id order keeps lock order stable between clients saving at once.
+    std::sort(rows.begin(), rows.end(), [](const HMISRow& a, const HMISRow& b) { return a.id < b.id; });
+    return rows;
+}
+
+bool EditSession::hasPending() const {
+    for (auto it = m_current.constBegin(); it != m_current.constEnd(); ++it) {
+        if (!sameValues(*it, m_loaded.value(it.key()))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EditSession::overlay(QList<HMISRow>& rows) const {
+    for (HMISRow& row : rows) {
+        if (auto pending = pendingRow(row.id)) {
+            row = *pending;
+        }
+    }
+}
+
+void EditSession::forget(int id) {
+    auto touches = [id](const Step& s) { return s.before.id == id; };
+    m_undo.removeIf(touches);
+    m_redo.removeIf(touches);
+    m_loaded.remove(id);
+    m_current.remove(id);
+}
+
+void EditSession::clear() {
+    m_undo.clear();
+    m_redo.clear();
+    m_loaded.clear();
+    m_current.clear();
+}
+
+bool EditSession::commit(Database& db, int actorUserId, QString* error) {
+    HMIS_PERF_TIMER(timer, "commitEditSession");
+    const QList<HMISRow> rows = pendingRows();
+    if (!rows.isEmpty() && !db.updateHMISRows(rows, actorUserId)) {
+        *error = db.getLastError();
+        timer.fail();
+        return false;
+    }
+    timer.addRows(rows.size());
+    clear();
+    return true;
+}
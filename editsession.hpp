@@ -0,0 +1,58 @@
+#ifndef EDITSESSION_H
+#define EDITSESSION_H
+
+#include <QHash>
+#include <QList>
+#include <optional>
+
+#include "HMISRow.hpp"
+#include "database.hpp"
+
+// Register cell edits buffered until the clerk saves them.
+//
+// Every validated edit is one undo step holding the row before and after
+// it. Nothing reaches the database until commit(), which writes the latest
+// version of each changed row with Database::updateHMISRows: one
+// transaction and one batch of audit entries however many cells changed.
+// Rows edited back to how they were loaded are not written at all.
+class EditSession {
+  public:
+    struct Step {
+        HMISRow before;
+        HMISRow after;
+    };
+
+    void record(const HMISRow& before, const HMISRow& after);
+
+    [[nodiscard]] bool canUndo() const { return !m_undo.isEmpty(); }
+    [[nodiscard]] bool canRedo() const { return !m_redo.isEmpty(); }
+    // The row as it should be shown again, or nullopt when there is nothing
+    // to undo/redo.
+    std::optional<HMISRow> undo();
+    std::optional<HMISRow> redo();
+
+    // Latest unsaved version of row id, if it differs from the loaded one.
+    [[nodiscard]] std::optional<HMISRow> pendingRow(int id) const;
+    [[nodiscard]] QList<HMISRow> pendingRows() const;
+    [[nodiscard]] bool hasPending() const;
+
+    // Replaces rows with their unsaved versions (after a reload).
+    void overlay(QList<HMISRow>& rows) const;
+    // Drops every step touching row id (deleted here or by another client).
+    void forget(int id);
+    void clear();
+
+    // Writes pendingRows() in one transaction and clears the session. On
+    // failure the session is kept (and, online, nothing was written).
+    bool commit(Database& db, int actorUserId, QString* error);
+
+  private:
+    static bool sameValues(const HMISRow& a, const HMISRow& b);
+
+    QList<Step> m_undo;
+    QList<Step> m_redo;
+    QHash<int, HMISRow> m_loaded;   // id -> row before its first edit
+    QHash<int, HMISRow> m_current;  // id -> row after its latest applied step
+};
+
+#endif  // EDITSESSION_H
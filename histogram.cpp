@@ -0,0 +1,376 @@
+#include "histogram.hpp"
+#include "perfstats.hpp"
+#include "synthetic.hpp"
+
+#include <algorithm>
+#include <array>
+
+// SSE2 is part of the x86-64 baseline, so only AVX2 needs a run-time check.
+#if defined(__x86_64__) || defined(_M_X64)
+#define HMIS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(HMIS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define HMIS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define HMIS_TARGET_AVX2
+#endif
+
+namespace histogram {
+
+static constexpr int kBanks = 4;
+static constexpr qint64 kBlock = 1024;  // rows per index buffer (2 KiB, stays in L1)
+
+// ---------------------------------------------------------------------------
+// Instruction set selection
+// ---------------------------------------------------------------------------
+static bool cpuHasAvx2() {
+#if defined(HMIS_X86) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2");
+#elif defined(HMIS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+        return false;  // the OS does not save YMM registers
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+Isa best() {
+    static const Isa isa = [] {
+#ifdef HMIS_X86
+        return cpuHasAvx2() ? Isa::Avx2 : Isa::Sse2;
+#else
+        return Isa::Scalar;
+#endif
+    }();
+    return isa;
+}
+
+QList<Isa> available() {
+    QList<Isa> out{Isa::Scalar};
+    if (best() >= Isa::Sse2) {
+        out << Isa::Sse2;
+    }
+    if (best() >= Isa::Avx2) {
+        out << Isa::Avx2;
+    }
+    return out;
+}
+
+const char* name(Isa isa) {
+    switch (isa) {
+        case Isa::Scalar:
+            return "scalar";
+        case Isa::Sse2:
+            return "sse2";
+        case Isa::Avx2:
+            return "avx2";
+    }
+    return "?";
+}
+
+// ---------------------------------------------------------------------------
+// Cell indices: out[i] = (key[i] * ages + age[i]) * sexes + sex[i]; key may
+// be null (key 0). The caller guarantees every index fits in 16 bits.
+// ---------------------------------------------------------------------------
+static void cellIndicesScalar(const quint8* key, const quint8* age, const quint8* sex, qint64 n, quint16 ages,
+                              quint16 sexes, quint16* out) {
+    for (qint64 i = 0; i < n; ++i) {
+        const quint16 k = key != nullptr ? key[i] : 0;
+        out[i] = static_cast<quint16>((((k * ages) + age[i]) * sexes) + sex[i]);
+    }
+}
+
+#ifdef HMIS_X86
+static void cellIndicesSse2(const quint8* key, const quint8* age, const quint8* sex, qint64 n, quint16 ages,
+                            quint16 sexes, quint16* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vAges = _mm_set1_epi16(static_cast<short>(ages));
+    const __m128i vSexes = _mm_set1_epi16(static_cast<short>(sexes));
+    auto cells = [&](__m128i k, __m128i a, __m128i s) {
+        return _mm_add_epi16(_mm_mullo_epi16(_mm_add_epi16(_mm_mullo_epi16(k, vAges), a), vSexes), s);
+    };
+    qint64 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i k = key != nullptr ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + i)) : zero;
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(age + i));
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sex + i));
+        const __m128i lo =
+            cells(_mm_unpacklo_epi8(k, zero), _mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(s, zero));
+        const __m128i hi =
+            cells(_mm_unpackhi_epi8(k, zero), _mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(s, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), hi);
+    }
+    cellIndicesScalar(key != nullptr ? key + i : nullptr, age + i, sex + i, n - i, ages, sexes, out + i);
+}
+
+HMIS_TARGET_AVX2 static void cellIndicesAvx2(const quint8* key, const quint8* age, const quint8* sex, qint64 n,
+                                             quint16 ages, quint16 sexes, quint16* out) {
+    const __m256i vAges = _mm256_set1_epi16(static_cast<short>(ages));
+    const __m256i vSexes = _mm256_set1_epi16(static_cast<short>(sexes));
+    // Widening 16 bytes at a time keeps every lane in place (no cross-lane
+    // shuffles). No lambdas here: they would not inherit the avx2 target.
+    qint64 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int half = 0; half < 32; half += 16) {
+            const qint64 at = i + half;
+            const __m256i k = key != nullptr
+                                  ? _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(key + at)))
+                                  : _mm256_setzero_si256();
+            const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(age + at)));
+            const __m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sex + at)));
+            const __m256i c =
+                _mm256_add_epi16(_mm256_mullo_epi16(_mm256_add_epi16(_mm256_mullo_epi16(k, vAges), a), vSexes), s);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + at), c);
+        }
+    }
+    cellIndicesScalar(key != nullptr ? key + i : nullptr, age + i, sex + i, n - i, ages, sexes, out + i);
+}
+#endif
+
+static void cellIndices(Isa isa, const quint8* key, const quint8* age, const quint8* sex, qint64 n, quint16 ages,
+                        quint16 sexes, quint16* out) {
+#ifdef HMIS_X86
+    if (isa == Isa::Avx2 && best() == Isa::Avx2) {
+        cellIndicesAvx2(key, age, sex, n, ages, sexes, out);
+        return;
+    }
+    if (isa != Isa::Scalar) {
+        cellIndicesSse2(key, age, sex, n, ages, sexes, out);
+        return;
+    }
+#else
+    Q_UNUSED(isa);
+#endif
+    cellIndicesScalar(key, age, sex, n, ages, sexes, out);
+}
+
+// ---------------------------------------------------------------------------
+// Banked counting
+// ---------------------------------------------------------------------------
+static void sumBanks(const std::vector<quint32>& banks, quint32* counts, int cells) {
+    for (int c = 0; c < cells; ++c) {
+        quint32 total = 0;
+        for (int b = 0; b < kBanks; ++b) {
+            total += banks[(std::size_t(b) * cells) + c];
+        }
+        counts[c] += total;
+    }
+}
+
+void countCells(const quint8* key, const quint8* age, const quint8* sex, qint64 rows, int ages, int sexes,
+                quint32* counts, int cells, Isa isa) {
+    HMIS_PERF_TIMER(timer, "histogramCells");
+    timer.addRows(rows);
+    if (cells > 65536) {
+        for (qint64 i = 0; i < rows; ++i) {
+            ++counts[(((key[i] * ages) + age[i]) * sexes) + sex[i]];
+        }
+        return;
+    }
+    std::vector<quint32> banks(std::size_t(kBanks) * cells, 0);
+    quint32* b0 = banks.data();
+    quint32* b1 = b0 + cells;
+    quint32* b2 = b1 + cells;
+    quint32* b3 = b2 + cells;
+    std::array<quint16, kBlock> idx;
+    for (qint64 start = 0; start < rows; start += kBlock) {
+        const qint64 n = std::min(kBlock, rows - start);
+        cellIndices(isa, key + start, age + start, sex + start, n, quint16(ages), quint16(sexes), idx.data());
+        qint64 i = 0;
+        for (; i + 4 <= n; i += 4) {
+            ++b0[idx[i]];
+            ++b1[idx[i + 1]];
+            ++b2[idx[i + 2]];
+            ++b3[idx[i + 3]];
+        }
+        for (; i < n; ++i) {
+            ++b0[idx[i]];
+        }
+    }
+    sumBanks(banks, counts, cells);
+}
+
+void countDiagnoses(const quint32* dxOffsets, const quint16* dxIds, const quint8* age, const quint8* sex,
+                    qint64 rows, int ages, int sexes, quint32* counts, int cells, Isa isa) {
+    HMIS_PERF_TIMER(timer, "histogramDiagnoses");
+    timer.addRows(rows);
+    const int perKey = ages * sexes;
+    std::vector<quint32> banks(std::size_t(kBanks) * cells, 0);
+    std::array<quint16, kBlock> idx;
+    for (qint64 start = 0; start < rows; start += kBlock) {
+        const qint64 n = std::min(kBlock, rows - start);
+        cellIndices(isa, nullptr, age + start, sex + start, n, quint16(ages), quint16(sexes), idx.data());
+        for (qint64 i = 0; i < n; ++i) {
+            const quint32 cell = idx[i];
+            const quint32 end = dxOffsets[start + i + 1];
+            // Bank by position so a visit's diagnoses never share a bank slot.
+            for (quint32 j = dxOffsets[start + i]; j < end; ++j) {
+                ++banks[(std::size_t(j % kBanks) * cells) + (std::size_t(dxIds[j]) * perKey) + cell];
+            }
+        }
+    }
+    sumBanks(banks, counts, cells);
+}
+
+MonthlyStats toStats(const std::vector<quint32>& counts, const QStringList& keys, const QStringList& ageNames,
+                     const QStringList& sexNames) {
+    MonthlyStats stats;
+    const qsizetype ages = ageNames.size();
+    const qsizetype sexes = sexNames.size();
+    for (qsizetype k = 0; k < keys.size(); ++k) {
+        for (qsizetype a = 0; a < ages; ++a) {
+            for (qsizetype s = 0; s < sexes; ++s) {
+                const quint32 n = counts[(((k * ages) + a) * sexes) + s];
+                if (n == 0) {
+                    continue;
+                }
+                // Unknown sexes still create the cell, as MonthlyStats::increment does.
+                CategoryCount& cell = stats.data[keys.at(k)][ageNames.at(a)];
+                if (sexNames.at(s) == SEX_MALE) {
+                    cell.male += static_cast<int>(n);
+                } else if (sexNames.at(s) == SEX_FEMALE) {
+                    cell.female += static_cast<int>(n);
+                }
+            }
+        }
+    }
+    return stats;
+}
+
+// ---------------------------------------------------------------------------
+// CodedRows
+// ---------------------------------------------------------------------------
+CodedRows::CodedRows()
+    : ageNames(AGE_CATEGORIES), sexNames{SEX_MALE, SEX_FEMALE}, attendanceNames{ATT_YES, ATT_NO}, dxOffsets{0} {
+    for (int i = 0; i < ageNames.size(); ++i) {
+        m_ageIndex.insert(ageNames.at(i), i);
+    }
+    for (int i = 0; i < sexNames.size(); ++i) {
+        m_sexIndex.insert(sexNames.at(i), i);
+    }
+    for (int i = 0; i < attendanceNames.size(); ++i) {
+        m_attendanceIndex.insert(attendanceNames.at(i), i);
+    }
+}
+
+int CodedRows::codeOf(QStringList& names, QHash<QString, int>& index, const QString& value) {
+    auto it = index.constFind(value);
+    if (it != index.constEnd()) {
+        return *it;
+    }
+    const auto code = static_cast<int>(names.size());
+    index.insert(value, code);
+    names << value;
+    return code;
+}
+
+bool CodedRows::append(const HMISRow& row) {
+    const int a = codeOf(ageNames, m_ageIndex, row.ageCategory);
+    const int s = codeOf(sexNames, m_sexIndex, row.sex);
+    const int t = codeOf(attendanceNames, m_attendanceIndex, row.newAttendance);
+    if (std::max({a, s, t}) > 255) {
+        return false;
+    }
+    const std::size_t mark = dxIds.size();
+    for (const QString& dx : row.diagnoses) {
+        const int d = codeOf(dxNames, m_dxIndex, dx);
+        if (d > 65535) {
+            dxIds.resize(mark);
+            return false;
+        }
+        dxIds.push_back(static_cast<quint16>(d));
+    }
+    age.push_back(static_cast<quint8>(a));
+    sex.push_back(static_cast<quint8>(s));
+    attendance.push_back(static_cast<quint8>(t));
+    dxOffsets.push_back(static_cast<quint32>(dxIds.size()));
+    return true;
+}
+
+MonthlyStats attendanceStats(const CodedRows& rows, Isa isa) {
+    const int ages = static_cast<int>(rows.ageNames.size());
+    const int sexes = static_cast<int>(rows.sexNames.size());
+    std::vector<quint32> counts(rows.attendanceNames.size() * ages * sexes, 0);
+    countCells(rows.attendance.data(), rows.age.data(), rows.sex.data(), rows.size(), ages, sexes, counts.data(),
+               static_cast<int>(counts.size()), isa);
+    return toStats(counts, rows.attendanceNames, rows.ageNames, rows.sexNames);
+}
+
+MonthlyStats diagnosisStats(const CodedRows& rows, Isa isa) {
+    const int ages = static_cast<int>(rows.ageNames.size());
+    const int sexes = static_cast<int>(rows.sexNames.size());
+    std::vector<quint32> counts(rows.dxNames.size() * ages * sexes, 0);
+    countDiagnoses(rows.dxOffsets.data(), rows.dxIds.data(), rows.age.data(), rows.sex.data(), rows.size(), ages,
+                   sexes, counts.data(), static_cast<int>(counts.size()), isa);
+    return toStats(counts, rows.dxNames, rows.ageNames, rows.sexNames);
+}
+
+// ---------------------------------------------------------------------------
+// Self-test
+// ---------------------------------------------------------------------------
+// Compares every (key, age) cell present in either side.
+static bool sameStats(const MonthlyStats& expected, const MonthlyStats& actual, QString* where) {
+    auto covered = [&](const MonthlyStats& a) {
+        for (auto it = a.data.begin(); it != a.data.end(); ++it) {
+            for (auto cell = it->begin(); cell != it->end(); ++cell) {
+                const CategoryCount x = expected.get(it.key(), cell.key());
+                const CategoryCount y = actual.get(it.key(), cell.key());
+                if (x.male != y.male || x.female != y.female) {
+                    *where = QString("%1 / %2: expected %3M %4F, got %5M %6F")
+                                 .arg(it.key(), cell.key())
+                                 .arg(x.male)
+                                 .arg(x.female)
+                                 .arg(y.male)
+                                 .arg(y.female);
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+    return covered(expected) && covered(actual);
+}
+
+bool selfTest(const Database& db, const QStringList& diagnosisNames, qint64 rows, QString* report) {
+    const HMISData data = syntheticRows(diagnosisNames, 4242, 2020, rows);
+    CodedRows coded;
+    for (const HMISRow& row : data) {
+        if (!coded.append(row)) {
+            *report = "Too many distinct values to encode";
+            return false;
+        }
+    }
+
+    const MonthlyStats attendance = db.buildAttendanceStats(data);
+    const MonthlyStats diagnoses = db.buildDiagnosisStats(data, diagnosisNames);
+    QStringList passed;
+    for (Isa isa : available()) {
+        QString where;
+        if (!sameStats(attendance, attendanceStats(coded, isa), &where)) {
+            *report = QString("%1 attendance kernel differs at %2").arg(name(isa), where);
+            return false;
+        }
+        if (!sameStats(diagnoses, diagnosisStats(coded, isa), &where)) {
+            *report = QString("%1 diagnosis kernel differs at %2").arg(name(isa), where);
+            return false;
+        }
+        passed << name(isa);
+    }
+    *report = QString("%1 rows match the row-by-row fold (%2)").arg(rows).arg(passed.join(", "));
+    return true;
+}
+
+}  // namespace histogram
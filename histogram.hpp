@@ -0,0 +1,83 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+#include "MonthlyStats.hpp"
+#include "database.hpp"
+
+// Counting kernels for age x sex x key aggregation over columnar codes
+// (ColumnArchive sections, or rows encoded with CodedRows).
+//
+// Each block of rows is turned into cell indices ((key * ages + age) *
+// sexes + sex) with SSE2 or AVX2, then counted into four interleaved banks
+// so that consecutive rows hitting the same cell do not wait on each
+// other's store; the banks are summed at the end. The instruction set is
+// picked at run time and can be forced for tests and benchmarks.
+namespace histogram {
+
+enum class Isa : uint8_t { Scalar, Sse2, Avx2 };
+
+Isa best();  // widest set this CPU supports
+QList<Isa> available();
+const char* name(Isa isa);
+
+// counts[(key[i] * ages + age[i]) * sexes + sex[i]] += 1 for i in [0, rows).
+// counts holds cells = keys * ages * sexes entries (at most 65536).
+void countCells(const quint8* key, const quint8* age, const quint8* sex, qint64 rows, int ages, int sexes,
+                quint32* counts, int cells, Isa isa = best());
+
+// The same with one key per diagnosis of each row: row r has diagnosis ids
+// dxIds[dxOffsets[r]] .. dxIds[dxOffsets[r + 1] - 1].
+void countDiagnoses(const quint32* dxOffsets, const quint16* dxIds, const quint8* age, const quint8* sex,
+                    qint64 rows, int ages, int sexes, quint32* counts, int cells, Isa isa = best());
+
+// Dense counts back into the string-keyed form the UI uses. Cells with no
+// visits are left out, as when MonthlyStats is built row by row.
+MonthlyStats toStats(const std::vector<quint32>& counts, const QStringList& keys, const QStringList& ageNames,
+                     const QStringList& sexNames);
+
+// Register rows as dictionary codes, the layout the kernels read.
+class CodedRows {
+  public:
+    CodedRows();
+
+    // False when a dictionary outgrows its code width (256 ages, sexes or
+    // attendance values; 65536 diagnoses).
+    bool append(const HMISRow& row);
+    [[nodiscard]] qint64 size() const { return static_cast<qint64>(age.size()); }
+
+    QStringList ageNames;
+    QStringList sexNames;
+    QStringList attendanceNames;
+    QStringList dxNames;
+    std::vector<quint8> age;
+    std::vector<quint8> sex;
+    std::vector<quint8> attendance;
+    std::vector<quint32> dxOffsets;  // size() + 1 entries
+    std::vector<quint16> dxIds;
+
+  private:
+    static int codeOf(QStringList& names, QHash<QString, int>& index, const QString& value);
+
+    QHash<QString, int> m_ageIndex;
+    QHash<QString, int> m_sexIndex;
+    QHash<QString, int> m_attendanceIndex;
+    QHash<QString, int> m_dxIndex;
+};
+
+MonthlyStats attendanceStats(const CodedRows& rows, Isa isa = best());
+MonthlyStats diagnosisStats(const CodedRows& rows, Isa isa = best());
+
+// Folds rows random synthetic visits (with a ragged tail) through
+// Database::buildAttendanceStats/buildDiagnosisStats and through every
+// kernel this CPU supports, and compares the counts. On a mismatch returns
+// false with the first differing cell in *report.
+bool selfTest(const Database& db, const QStringList& diagnosisNames, qint64 rows, QString* report);
+
+}  // namespace histogram
+
+#endif  // HISTOGRAM_H
@@ -0,0 +1,185 @@
+// hmisd: owns the HMIS database and serves it to HMIS clients, so several
+// PCs can enter data without sharing the SQLite file over the network.
+//
+//   hmisd [--local NAME] [--listen HOST:PORT] [--token TOKEN] [--sqlite FILE]
+//         [--perf-json FILE]
+//
+// The database is the one the GUI would open (HMIS_DB_DRIVER and friends,
+// normally the SQLite file); --sqlite serves another SQLite file with the
+// configured profile. Clients run with HMIS_DB_DRIVER=hmisd and
+// HMISD_ADDRESS set to the local socket name or host:port. --local ""
+// disables the local socket; TCP is off unless --listen (or hmisd/listen)
+// is given, and "*:PORT" listens on every interface. TCP needs a token.
+//
+// hmisd also does what each GUI did against its own file: audit recovery
+// at startup, the audit durability setting, daily audit archival and idle
+// SQLite maintenance (idle meaning no requests).
+
+#include <QCoreApplication>
+#include <QDate>
+#include <QFile>
+#include <QFuture>
+#include <QTextStream>
+#include <QTimer>
+#include <QtConcurrent>
+#include <atomic>
+#include <csignal>
+#include <memory>
+
+#include "auditarchive.hpp"
+#include "config.hpp"
+#include "daemonserver.hpp"
+#include "database.hpp"
+#include "maintenance.hpp"
+#include "perfstats.hpp"
+
+static constexpr int kArchiveCheckMs = 60 * 60 * 1000;
+static constexpr int kStopPollMs = 200;
+
+// Set from the signal handler; the event loop notices it and quits, so the
+// audit writer flushes and maintenance stops before exit.
+static std::atomic<bool> stopRequested{false};
+
+static void requestStop(int) { stopRequested.store(true); }
+
+static QString argValue(const QStringList& args, const QString& flag, const QString& fallback) {
+    const qsizetype idx = args.indexOf(flag);
+    if (idx >= 0 && idx + 1 < args.size()) {
+        return args.at(idx + 1);
+    }
+    return fallback;
+}
+
+// Moves closed months out of audit_log once a day, on a worker thread with
+// its own connection.
+static void archiveIfDue(Database& db, const ConnOptions& options, const AuditConfig& cfg, QFuture<void>& running) {
+    const QString today = QDate::currentDate().toString(Qt::ISODate);
+    if (running.isRunning() || db.getState("audit.last_archive_run") == today ||
+        !db.setState("audit.last_archive_run", today)) {
+        return;
+    }
+    running = QtConcurrent::run([options, cfg]() {
+        Database worker;
+        try {
+            worker.Connect(options);
+        } catch (const std::exception& e) {
+            qWarning() << "Audit archival: cannot connect:" << e.what();
+            return;
+        }
+        AuditArchive archive(cfg.archiveDir);
+        QString error;
+        if (archiveClosedAuditPeriods(worker, archive, cfg.keepMonths, &error) < 0) {
+            qWarning() << "Audit archival failed:" << error;
+        }
+    });
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("HMIS");  // the GUI's settings
+    app.setOrganizationName("Yo Medical Files (U) Limited");
+    app.setOrganizationDomain("yomedicalfiles.com");
+    Q_INIT_RESOURCE(CoreResources);
+
+    const QStringList args = QCoreApplication::arguments();
+    QTextStream log(stderr);
+
+    DaemonConfig cfg = loadDaemonConfig();
+    cfg.localName = argValue(args, "--local", cfg.localName);
+    cfg.tcpListen = argValue(args, "--listen", cfg.tcpListen);
+    cfg.token = argValue(args, "--token", cfg.token);
+
+    if (cfg.localName.isEmpty() && cfg.tcpListen.isEmpty()) {
+        log << "hmisd: nothing to listen on; pass --local NAME or --listen HOST:PORT\n";
+        return EXIT_FAILURE;
+    }
+    if (!cfg.tcpListen.isEmpty() && cfg.token.isEmpty()) {
+        log << "hmisd: --listen needs --token (or hmisd/token); without one anyone who can reach "
+            << cfg.tcpListen << " is admitted\n";
+        return EXIT_FAILURE;
+    }
+
+    ConnOptions options;
+    Database db;
+    try {
+        options = loadConnOptions();
+        const QString file = argValue(args, "--sqlite", {});
+        if (!file.isEmpty()) {
+            SqliteOptions sqlite = options.getDriver() == Driver::SQLITE ? options.get<SqliteOptions>() : SqliteOptions();
+            sqlite.dbName = file;
+            options = ConnOptions(sqlite);
+        }
+        if (options.getDriver() == Driver::HMISD) {
+            throw std::runtime_error("HMIS_DB_DRIVER=hmisd names a client setting; hmisd needs the database itself");
+        }
+        db.Connect(options);
+        db.createSchema();
+    } catch (const std::exception& e) {
+        log << "hmisd: " << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+
+    const AuditConfig auditCfg = loadAuditConfig();
+    db.recoverAudit();
+    db.setAuditDurability(auditCfg.durability, auditCfg.groupCommitMs);
+
+    DaemonServer server(db, cfg.token);
+    QString error;
+    if (!cfg.localName.isEmpty() && !server.listenLocal(cfg.localName, &error)) {
+        log << "hmisd: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+    if (!cfg.tcpListen.isEmpty() && !server.listenTcp(cfg.tcpListen, &error)) {
+        log << "hmisd: " << error << "\n";
+        return EXIT_FAILURE;
+    }
+
+    // Declared after the server so it stops first.
+    const MaintenanceConfig maintenanceCfg = loadMaintenanceConfig();
+    std::unique_ptr<MaintenanceScheduler> maintenance;
+    if (maintenanceCfg.enabled && options.getDriver() == Driver::SQLITE) {
+        maintenance = std::make_unique<MaintenanceScheduler>(options, maintenanceCfg.policy);
+        QObject::connect(&server, &DaemonServer::requestsHandled, [&maintenance] { maintenance->noteActivity(); });
+    }
+
+    QFuture<void> archival;
+    struct ArchivalWait {
+        QFuture<void>& future;
+        ~ArchivalWait() { future.waitForFinished(); }
+    } archivalWait{archival};
+    archiveIfDue(db, options, auditCfg, archival);
+    QTimer archiveTimer;
+    QObject::connect(&archiveTimer, &QTimer::timeout, [&] { archiveIfDue(db, options, auditCfg, archival); });
+    archiveTimer.start(kArchiveCheckMs);
+
+    const QString perfPath = argValue(args, "--perf-json", {});
+    if (!perfPath.isEmpty()) {
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [perfPath]() {
+            QFile f(perfPath);
+            if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+                f.write(PerfRegistry::instance().toJson().toJson());
+            }
+        });
+    }
+
+    QStringList endpoints;
+    if (!cfg.localName.isEmpty()) {
+        endpoints << "local socket " + cfg.localName;
+    }
+    if (!cfg.tcpListen.isEmpty()) {
+        endpoints << "tcp " + cfg.tcpListen;
+    }
+    log << "hmisd: serving " << server.description() << " on " << endpoints.join(" and ") << "\n";
+    log.flush();
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    QTimer stopTimer;
+    QObject::connect(&stopTimer, &QTimer::timeout, &app, [] {
+        if (stopRequested.load()) {
+            QCoreApplication::quit();
+        }
+    });
+    stopTimer.start(kStopPollMs);
+    return app.exec();
+}
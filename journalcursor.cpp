@@ -0,0 +1,171 @@
+#include "journalcursor.hpp"
+#include "database.hpp"
+
+#include <QTemporaryDir>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <algorithm>
+
+void JournalCursor::reset(qint64 position) {
+    m_gaps.clear();
+    m_position = position;
+}
+
+bool JournalCursor::startAt(Database& db, qint64 position, qint64 nowMs) {
+    const qint64 from = std::max<qint64>(0, position - kLookbackIds);
+    const auto recent = db.getRegisterChangesSince(from, kLookbackIds);
+    if (!recent) {
+        return false;
+    }
+    reset(from);
+    for (const ChangeEntry& e : *recent) {
+        if (e.id > position) {
+            break;  // committed after the caller's view; read as usual
+        }
+        accept(e.id, nowMs);
+    }
+    if (m_position < position) {
+        m_gaps << Gap{.from = m_position + 1, .to = position, .sinceMs = nowMs};
+        m_position = position;
+    }
+    return true;
+}
+
+bool JournalCursor::accept(qint64 id, qint64 nowMs) {
+    if (id > m_position) {
+        if (id > m_position + 1) {
+            m_gaps << Gap{.from = m_position + 1, .to = id - 1, .sinceMs = nowMs};
+        }
+        m_position = id;
+        return true;
+    }
+    // The first gap ending at or after id.
+    const auto it =
+        std::lower_bound(m_gaps.begin(), m_gaps.end(), id, [](const Gap& gap, qint64 value) { return gap.to < value; });
+    if (it == m_gaps.end() || it->from > id) {
+        return false;  // accepted before
+    }
+    if (it->from == it->to) {
+        m_gaps.erase(it);
+    } else if (id == it->from) {
+        ++it->from;
+    } else if (id == it->to) {
+        --it->to;
+    } else {
+        const Gap tail{.from = id + 1, .to = it->to, .sinceMs = it->sinceMs};
+        it->to = id - 1;
+        m_gaps.insert(std::next(it), tail);
+    }
+    return true;
+}
+
+qint64 JournalCursor::expire(qint64 nowMs) {
+    qint64 dropped = 0;
+    m_gaps.removeIf([&](const Gap& gap) {
+        if (nowMs - gap.sinceMs < m_graceMs) {
+            return false;
+        }
+        dropped += gap.to - gap.from + 1;
+        return true;
+    });
+    return dropped;
+}
+
+namespace journal {
+
+static bool cursorTest(QString* report) {
+    JournalCursor c(1000);
+    // Writers took ids 1-6; 1, 4 and 6 commit first, then 2, 5 and a replay of 4.
+    for (const qint64 id : {1, 4, 6}) {
+        if (!c.accept(id, 0)) {
+            *report = QString("id %1 refused on first sight").arg(id);
+            return false;
+        }
+    }
+    if (c.position() != 6 || c.readFrom() != 1) {
+        *report = QString("expected position 6 reading from 1, got %1 from %2").arg(c.position()).arg(c.readFrom());
+        return false;
+    }
+    if (!c.accept(2, 10) || !c.accept(5, 10) || c.accept(4, 10) || c.accept(6, 10)) {
+        *report = "late ids 2 and 5 should be new, 4 and 6 not";
+        return false;
+    }
+    if (c.readFrom() != 2 || c.expire(999) != 0 || c.expire(1000) != 1 || c.hasGaps() || c.readFrom() != 6) {
+        *report = "id 3 should stay open for the grace window and then be dropped";
+        return false;
+    }
+    return true;
+}
+
+// Two writers on a scratch register: the first takes its journal id, the
+// second commits with a higher one, and the first commits after the mirror
+// has already read past it.
+static bool mirrorTest(QString* report) {
+    QTemporaryDir dir;
+    const QString path = dir.filePath("journal.sqlite3");
+    Database db;
+    try {
+        db.Connect(ConnOptions(SqliteOptions(path)));
+        db.createSchema();
+        db.useReadMirror();
+    } catch (const std::exception& e) {
+        *report = QString("scratch database: %1").arg(e.what());
+        return false;
+    }
+    if (!db.insertDiagnoses({"Malaria"})) {
+        *report = "scratch database: " + db.getLastError();
+        return false;
+    }
+    NewHMISData visit{.ageCategory = AGE_20_PLUS,
+                      .sex = SEX_FEMALE,
+                      .newAttendance = ATT_YES,
+                      .diagnoses = {"Malaria"},
+                      .ipNumber = "1",
+                      .month = 1,
+                      .year = 2024};
+    if (!db.saveNewRow(visit)) {
+        *report = "first writer: " + db.getLastError();
+        return false;
+    }
+    visit.ipNumber = "2";
+    if (!db.saveNewRow(visit)) {
+        *report = "second writer: " + db.getLastError();
+        return false;
+    }
+
+    // Hold the first writer's entry back as if its transaction were still open.
+    const QString name = "hmis_journal_selftest";
+    bool ok = false;
+    {
+        QSqlDatabase raw = QSqlDatabase::addDatabase("QSQLITE", name);
+        raw.setDatabaseName(path);
+        ok = raw.open();
+        QSqlQuery q(raw);
+        const QString held =
+            " change_journal WHERE id = (SELECT MIN(id) FROM change_journal WHERE table_name = 'hmis')";
+        ok = ok && q.exec("CREATE TEMP TABLE held AS SELECT * FROM" + held) && q.exec("DELETE FROM" + held);
+        const qsizetype before = db.fetchHMISRange(2024, 1, 2024, 1).size();
+        ok = ok && q.exec("INSERT INTO change_journal SELECT * FROM temp.held");
+        const qsizetype after = db.fetchHMISRange(2024, 1, 2024, 1).size();
+        if (!ok) {
+            *report = "holding back a journal entry: " + q.lastError().text();
+        } else if (before != 1 || after != 2) {
+            *report = QString("mirror had %1 then %2 rows, expected 1 then 2").arg(before).arg(after);
+            ok = false;
+        }
+        raw.close();
+    }
+    QSqlDatabase::removeDatabase(name);
+    return ok;
+}
+
+bool selfTest(QString* report) {
+    if (!cursorTest(report) || !mirrorTest(report)) {
+        return false;
+    }
+    *report = "late commits below the cursor reach the read mirror";
+    return true;
+}
+
+}  // namespace journal
@@ -0,0 +1,69 @@
+#ifndef JOURNALCURSOR_H
+#define JOURNALCURSOR_H
+
+#include <QList>
+#include <QString>
+#include <QtGlobal>
+
+class Database;
+
+// Follows change_journal in id order without losing entries that commit
+// late.
+//
+// PostgreSQL and MySQL hand out journal ids when a transaction inserts, not
+// when it commits, so an entry below one already read can still appear.
+// The cursor remembers the ids it stepped over as gaps and readers start
+// again from the oldest gap on every pass, until the entry turns up or the
+// gap outlives the grace window (a rolled-back transaction leaves its ids
+// unused for good). Entries already accepted are skipped on the re-reads.
+//
+// It is a plain value: copy it, accept a page, and keep the copy only once
+// the page has been applied.
+class JournalCursor {
+  public:
+    // Longer than an import's transaction; a gap is re-read for this long.
+    static constexpr qint64 kGraceMs = 10 * 60 * 1000;
+    // Ids below the starting position checked for entries still in flight.
+    static constexpr int kLookbackIds = 1000;
+
+    explicit JournalCursor(qint64 graceMs = kGraceMs) : m_graceMs(graceMs) {}
+
+    // Starts after position with no gaps.
+    void reset(qint64 position);
+    // Starts after position, the newest id committed when the caller took
+    // its view of the data. Ids in the kLookbackIds below it that are not in
+    // the journal yet become gaps. Returns false with getLastError() set.
+    bool startAt(Database& db, qint64 position, qint64 nowMs);
+
+    // Whether entry id is new to the cursor; if so it is recorded, and ids
+    // skipped over become gaps stamped nowMs. Pass ids in ascending order.
+    bool accept(qint64 id, qint64 nowMs);
+    // Drops gaps older than the grace window; returns how many ids it gave up.
+    qint64 expire(qint64 nowMs);
+
+    // The afterId for the next getChangesSince(): before the oldest gap.
+    [[nodiscard]] qint64 readFrom() const { return m_gaps.isEmpty() ? m_position : m_gaps.first().from - 1; }
+    [[nodiscard]] qint64 position() const { return m_position; }  // newest id accepted
+    [[nodiscard]] bool hasGaps() const { return !m_gaps.isEmpty(); }
+
+  private:
+    struct Gap {
+        qint64 from = 0;  // inclusive
+        qint64 to = 0;    // inclusive
+        qint64 sinceMs = 0;
+    };
+    QList<Gap> m_gaps;  // ascending, disjoint
+    qint64 m_position = 0;
+    qint64 m_graceMs;
+};
+
+namespace journal {
+
+// Accepts ids out of order on a bare cursor, then has two writers commit to
+// a scratch SQLite register out of id order and checks that a read mirror
+// catching up between the commits ends up with both rows.
+bool selfTest(QString* report);
+
+}  // namespace journal
+
+#endif  // JOURNALCURSOR_H
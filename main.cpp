@@ -1,102 +1,61 @@
 #include <QApplication>
-#include <QDir>
 #include <QFile>
 #include <QMessageBox>
-#include <QStandardPaths>
+#include <QSettings>
+#include <QtConcurrent>
+#include <memory>
 
 #include "LoginDialog.hpp"
+#include "auditarchive.hpp"
+#include "changenotifier.hpp"
+#include "config.hpp"
 #include "database.hpp"
+#include "maintenance.hpp"
 #include "mainwindow.hpp"
+#include "outbox.hpp"
+#include "perfstats.hpp"
+#include "replicator.hpp"
+#include "tracing.hpp"
 
 // ─────────────────────────────────────────────────────────────────────────────
-//  Connection option loaders
+//  Command line
 // ─────────────────────────────────────────────────────────────────────────────
 
-static QString sqlitePath(const QString& dbName) {
-    return QStandardPaths::writableLocation(QStandardPaths::HomeLocation) + QDir::separator() + dbName;
-}
-
-static PostgresOptions loadPostgresOptions() {
-    QByteArray dbName = qgetenv("PGDATABASE");
-    QByteArray host = qgetenv("PGHOST");
-    QByteArray user = qgetenv("PGUSER");
-    QByteArray password = qgetenv("PGPASSWORD");
-    QByteArray port = qgetenv("PGPORT");
-
-    if (dbName.isEmpty()) {
-        throw std::runtime_error("PGDATABASE environment variable is not set");
-    }
-    if (user.isEmpty()) {
-        throw std::runtime_error("PGUSER environment variable is not set");
-    }
-    if (password.isEmpty()) {
-        throw std::runtime_error("PGPASSWORD environment variable is not set");
-    }
-
-    if (host.isEmpty()) {
-        host = "127.0.0.1";
-    }
-
-    // BUG FIX: original code checked port.isEmpty() instead of !port.isEmpty()
-    int portInt = 5432;
-    if (!port.isEmpty()) {
-        bool ok;
-        int p = port.toInt(&ok);
-        if (ok) {
-            portInt = p;
-        }
+// Returns the value following flag (e.g. "--trace out.json"), or an empty string.
+static QString argValue(const QStringList& args, const QString& flag) {
+    const qsizetype idx = args.indexOf(flag);
+    if (idx >= 0 && idx + 1 < args.size()) {
+        return args.at(idx + 1);
     }
-
-    return {dbName, user, password, host, portInt};
+    return {};
 }
 
-static MysqlOptions loadMysqlOptions() {
-    QByteArray dbName = qgetenv("MYSQL_DATABASE");
-    QByteArray host = qgetenv("MYSQL_HOST");
-    QByteArray user = qgetenv("MYSQL_USER");
-    QByteArray password = qgetenv("MYSQL_PASSWORD");
-    QByteArray port = qgetenv("MYSQL_PORT");
-
-    if (dbName.isEmpty()) {
-        throw std::runtime_error("MYSQL_DATABASE environment variable is not set");
-    }
-    if (user.isEmpty()) {
-        throw std::runtime_error("MYSQL_USER environment variable is not set");
-    }
-    if (password.isEmpty()) {
-        throw std::runtime_error("MYSQL_PASSWORD environment variable is not set");
-    }
+// ─────────────────────────────────────────────────────────────────────────────
+//  Idle detection
+// ─────────────────────────────────────────────────────────────────────────────
 
-    if (host.isEmpty()) {
-        host = "127.0.0.1";
-    }
+// Tells the maintenance scheduler about every keystroke and click.
+class ActivityFilter : public QObject {
+  public:
+    explicit ActivityFilter(MaintenanceScheduler& scheduler) : m_scheduler(scheduler) {}
 
-    int portInt = 3306;
-    if (!port.isEmpty()) {
-        bool ok;
-        int p = port.toInt(&ok);
-        if (ok) {
-            portInt = p;
+  protected:
+    bool eventFilter(QObject* watched, QEvent* event) override {
+        switch (event->type()) {
+            case QEvent::KeyPress:
+            case QEvent::MouseButtonPress:
+            case QEvent::Wheel:
+                m_scheduler.noteActivity();
+                break;
+            default:
+                break;
         }
+        return QObject::eventFilter(watched, event);
     }
 
-    return {dbName, user, password, host, portInt};
-}
-
-static ConnOptions loadConnOptions() {
-    const QByteArray driver = qgetenv("HMIS_DB_DRIVER");
-
-    if (driver.isEmpty() || driver == "sqlite3") {
-        return ConnOptions(SqliteOptions(sqlitePath("hmis.sqlite3")));
-    }
-    if (driver == "postgresql") {
-        return ConnOptions(loadPostgresOptions());
-    }
-    if (driver == "mysql") {
-        return ConnOptions(loadMysqlOptions());
-    }
-    throw std::runtime_error("Unknown HMIS_DB_DRIVER: " + driver.toStdString());
-}
+  private:
+    MaintenanceScheduler& m_scheduler;
+};
 
 // ─────────────────────────────────────────────────────────────────────────────
 //  Palette
@@ -134,21 +93,165 @@ int main(int argc, char* argv[]) {
     QCoreApplication::setAttribute(Qt::AA_DisableSessionManager);
 
     Q_INIT_RESOURCE(Resources);
+    Q_INIT_RESOURCE(CoreResources);
     app.setStyle("Fusion");
     setPalette(app);
 
+    const QStringList args = QCoreApplication::arguments();
+
+    // ── Tracing ───────────────────────────────────────────────────
+    // --trace FILE writes Chrome/Perfetto trace-event JSON on exit.
+    // --stall-ms N flags GUI event-loop stalls longer than N ms (0 = off).
+    const QString tracePath = argValue(args, "--trace");
+    if (!tracePath.isEmpty()) {
+        Tracer::instance().start(tracePath);
+    }
+    // Flush on every exit path, including an early return from the login dialog.
+    struct TraceFlush {
+        ~TraceFlush() { Tracer::instance().finish(); }
+    } traceFlush;
+
+    const QString stallArg = argValue(args, "--stall-ms");
+    const int stallMs = stallArg.isEmpty() ? 250 : stallArg.toInt();
+    std::unique_ptr<StallWatchdog> watchdog;
+    if (stallMs > 0) {
+        watchdog = std::make_unique<StallWatchdog>(stallMs);
+    }
+
+    // ── Performance instrumentation ──────────────────────────────
+    // HMIS_SLOW_QUERY_MS overrides the threshold saved from the Performance dialog.
+    {
+        QSettings settings;
+        int slowMs = settings.value("perf/slowQueryMs", PerfRegistry::instance().slowQueryThresholdMs()).toInt();
+        bool ok = false;
+        int envMs = qEnvironmentVariableIntValue("HMIS_SLOW_QUERY_MS", &ok);
+        if (ok) {
+            slowMs = envMs;
+        }
+        PerfRegistry::instance().setSlowQueryThresholdMs(slowMs);
+    }
+
+    // --perf-json FILE: dump per-operation counters when the app exits
+    const QString perfPath = argValue(args, "--perf-json");
+    if (!perfPath.isEmpty()) {
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [perfPath]() {
+            QFile f(perfPath);
+            if (f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+                f.write(PerfRegistry::instance().toJson().toJson());
+            }
+        });
+    }
+
     // ── Database ──────────────────────────────────────────────────
     Database db;
+    ConnOptions connOptions;
     try {
-        db.Connect(loadConnOptions());
-        db.createSchema();
+        connOptions = loadConnOptions();
     } catch (const std::exception& e) {
         QMessageBox::critical(nullptr, "Database Error", e.what());
         return EXIT_FAILURE;
     }
 
+    // Offline-first: register saves go to a local outbox and a background
+    // replicator pushes them to the server, so the app also starts (and
+    // keeps taking saves) while the server is unreachable.
+    // hmisd serves a LAN, so its clients have no offline mode.
+    const SyncConfig syncCfg = loadSyncConfig();
+    std::unique_ptr<Outbox> outbox;
+    if (syncCfg.offlineFirst && connOptions.getDriver() != Driver::HMISD) {
+        outbox = std::make_unique<Outbox>(syncCfg.outboxPath);
+        QString error;
+        if (!outbox->open(&error)) {
+            QMessageBox::critical(nullptr, "Database Error", "Cannot open the local outbox:\n" + error);
+            return EXIT_FAILURE;
+        }
+        db.setOutbox(outbox.get());
+    }
+
+    bool online = true;
+    try {
+        db.Connect(connOptions);
+        db.createSchema();
+    } catch (const std::exception& e) {
+        if (!outbox) {
+            QMessageBox::critical(nullptr, "Database Error", e.what());
+            return EXIT_FAILURE;
+        }
+        online = false;
+        QMessageBox::warning(nullptr, "Working offline",
+                             QString("The database server is unreachable:\n%1\n\n"
+                                     "New entries are kept on this computer and sent when the server is back.")
+                                 .arg(e.what()));
+    }
+    std::unique_ptr<Replicator> replicator;
+    if (outbox) {
+        replicator = std::make_unique<Replicator>(connOptions, syncCfg.outboxPath, syncCfg.batchSize);
+    }
+
+    // Rebuild audit entries lost with a crashed group-commit window, then
+    // start the configured writer.
+    const AuditConfig auditCfg = loadAuditConfig();
+    if (online) {
+        db.recoverAudit();
+    }
+    db.setAuditDurability(auditCfg.durability, auditCfg.groupCommitMs);
+    db.setIpBlockSize(loadIpBlockSize());
+
+    // Reports and exports read from a replica or an in-memory mirror, if configured.
+    const QString readEndpoint = loadReadEndpoint();
+    if (online && !readEndpoint.isEmpty()) {
+        try {
+            if (readEndpoint == "mirror") {
+                db.useReadMirror();
+            } else {
+                db.useReadReplica(replicaOptions(connOptions, readEndpoint));
+            }
+        } catch (const std::exception& e) {
+            qWarning() << "Read endpoint unavailable, reports use the primary:" << e.what();
+        }
+    }
+
+    // ── Audit archival ───────────────────────────────────────────
+    // Once a day, move closed months out of audit_log on a worker thread
+    // with its own connection. Waited for before the database goes away.
+    // hmisd archives its own audit log.
+    QFuture<void> archival;
+    const QString today = QDate::currentDate().toString(Qt::ISODate);
+    if (online && connOptions.getDriver() != Driver::HMISD && db.getState("audit.last_archive_run") != today &&
+        db.setState("audit.last_archive_run", today)) {
+        archival = QtConcurrent::run([connOptions, auditCfg]() {
+            Database worker;
+            try {
+                worker.Connect(connOptions);
+            } catch (const std::exception& e) {
+                qWarning() << "Audit archival: cannot connect:" << e.what();
+                return;
+            }
+            AuditArchive archive(auditCfg.archiveDir);
+            QString error;
+            if (archiveClosedAuditPeriods(worker, archive, auditCfg.keepMonths, &error) < 0) {
+                qWarning() << "Audit archival failed:" << error;
+            }
+        });
+    }
+    struct ArchivalWait {
+        QFuture<void>& future;
+        ~ArchivalWait() { future.waitForFinished(); }
+    } archivalWait{archival};
+
+    // ── SQLite maintenance ───────────────────────────────────────
+    // Checkpoints, ANALYZE and incremental vacuum on a worker thread while
+    // nobody is typing. Declared after archivalWait so it stops first.
+    const MaintenanceConfig maintenanceCfg = loadMaintenanceConfig();
+    std::unique_ptr<MaintenanceScheduler> maintenance;
+    std::unique_ptr<ActivityFilter> activityFilter;
+    if (online && maintenanceCfg.enabled && connOptions.getDriver() == Driver::SQLITE) {
+        maintenance = std::make_unique<MaintenanceScheduler>(connOptions, maintenanceCfg.policy);
+        activityFilter = std::make_unique<ActivityFilter>(*maintenance);
+        app.installEventFilter(activityFilter.get());
+    }
+
     // ── CLI: Create superuser ────────────────────────────────────
-    QStringList args = QCoreApplication::arguments();
     if (args.contains("--create-superuser")) {
         QTextStream qin(stdin), qout(stdout);
         qout << "Create superuser (admin)\n";
@@ -191,6 +294,17 @@ int main(int argc, char* argv[]) {
 
     // ── Main window ───────────────────────────────────────────────
     MainWindow window(db, *user);
+    if (replicator) {
+        window.attachReplicator(replicator.get());
+    }
+    const NotifyConfig notifyCfg = loadNotifyConfig();
+    std::unique_ptr<ChangeNotifier> notifier;
+    if (notifyCfg.enabled) {
+        // hmisd serves the notifier's connection as the user who signed in.
+        notifier = std::make_unique<ChangeNotifier>(
+            connOptions.getDriver() == Driver::HMISD ? db.connOptions() : connOptions, notifyCfg.pollMs);
+        window.attachNotifier(notifier.get());
+    }
     window.showMaximized();
     return app.exec();
 }
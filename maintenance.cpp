@@ -0,0 +1,105 @@
+#include "maintenance.hpp"
+#include "perfstats.hpp"
+
+#include <QDate>
+#include <QDateTime>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <limits>
+
+static const QString kLastAnalyzeKey = "maintenance.last_analyze";
+static constexpr int kTickMs = 5000;
+
+MaintenanceScheduler::MaintenanceScheduler(const ConnOptions& options, MaintenancePolicy policy)
+    : m_options(options), m_policy(policy), m_lastActivityMs(QDateTime::currentMSecsSinceEpoch()) {
+    m_thread.reset(QThread::create([this] { run(); }));
+    m_thread->setObjectName("Maintenance");
+    m_thread->start(QThread::LowPriority);
+}
+
+MaintenanceScheduler::~MaintenanceScheduler() {
+    m_stop.store(true);
+    m_wake.release();
+    m_thread->wait();
+}
+
+void MaintenanceScheduler::noteActivity() {
+    m_lastActivityMs.store(QDateTime::currentMSecsSinceEpoch(), std::memory_order_relaxed);
+}
+
+bool MaintenanceScheduler::idle() const {
+    return QDateTime::currentMSecsSinceEpoch() - m_lastActivityMs.load(std::memory_order_relaxed) >=
+           m_policy.idleMs;
+}
+
+void MaintenanceScheduler::run() {
+    Database db;
+    try {
+        db.Connect(m_options);
+    } catch (const std::exception& e) {
+        qWarning() << "Maintenance: cannot connect:" << e.what();
+        return;
+    }
+
+    QElapsedTimer clock;
+    clock.start();
+    qint64 lastPassive = 0;
+    qint64 lastTruncate = -m_policy.passiveCheckpointMs;
+    qint64 lastOptimize = -m_policy.optimizeMs;  // first idle spell
+    qint64 vacuumDoneAt = -m_policy.optimizeMs;
+    QString analyzedOn = db.getState(kLastAnalyzeKey);
+
+    auto report = [&db](bool ok, const char* task) {
+        if (!ok) {
+            qWarning() << "Maintenance:" << task << "failed:" << db.getLastError();
+        }
+    };
+
+    while (!m_stop.load()) {
+        m_wake.tryAcquire(1, kTickMs);
+        if (m_stop.load() || !idle()) {
+            continue;
+        }
+        const qint64 now = clock.elapsed();
+        const QString today = QDate::currentDate().toString(Qt::ISODate);
+
+        // Readers still on old snapshots make TRUNCATE give up early; retry
+        // at the passive cadence rather than every tick.
+        if (db.walSizeBytes() > m_policy.truncateWalBytes &&
+            now - lastTruncate >= m_policy.passiveCheckpointMs) {
+            lastTruncate = now;
+            lastPassive = now;
+            report(db.checkpointWal(true), "TRUNCATE checkpoint");
+        } else if (now - lastPassive >= m_policy.passiveCheckpointMs) {
+            lastPassive = now;
+            report(db.checkpointWal(false), "PASSIVE checkpoint");
+        } else if (now - lastOptimize >= m_policy.optimizeMs) {
+            lastOptimize = now;
+            report(db.optimize(false), "PRAGMA optimize");
+        } else if (analyzedOn != today) {
+            analyzedOn = today;
+            const bool ok = db.optimize(true);
+            report(ok && db.setState(kLastAnalyzeKey, today), "ANALYZE");
+        } else if (now - vacuumDoneAt >= m_policy.optimizeMs) {
+            const qint64 freed = db.incrementalVacuum(m_policy.vacuumPages);
+            report(freed >= 0, "incremental vacuum");
+            if (freed < m_policy.vacuumPages) {
+                vacuumDoneAt = now;  // freelist drained (or not incremental); look again later
+            }
+        }
+    }
+
+    // Recommended before closing a long-lived connection.
+    db.optimize(false);
+}
+
+bool runMaintenance(Database& db, QString* error) {
+    HMIS_PERF_TIMER(timer, "runMaintenance");
+    const bool ok = db.checkpointWal(true) && db.optimize(true) &&
+                    db.incrementalVacuum(std::numeric_limits<int>::max()) >= 0 && db.checkpointWal(true);
+    if (!ok) {
+        *error = db.getLastError();
+        timer.fail();
+    }
+    return ok;
+}
@@ -0,0 +1,55 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+
+#include <QSemaphore>
+#include <QThread>
+#include <atomic>
+#include <memory>
+
+#include "database.hpp"
+
+struct MaintenancePolicy {
+    int idleMs = 60 * 1000;                       // no user input for this long counts as idle
+    int passiveCheckpointMs = 5 * 60 * 1000;      // between PASSIVE checkpoints
+    qint64 truncateWalBytes = 64LL * 1024 * 1024;  // TRUNCATE once the -wal file grows past this
+    int optimizeMs = 60 * 60 * 1000;              // between PRAGMA optimize runs
+    int vacuumPages = 2000;                       // freelist pages released per idle round
+};
+
+// SQLite housekeeping while nobody is typing.
+//
+// A worker thread with its own connection wakes every few seconds and, once
+// the app has been idle for policy.idleMs, runs at most one task per wake-up
+// so returning users never wait behind a batch: a TRUNCATE checkpoint when
+// the -wal file has outgrown its limit (long sessions otherwise keep it
+// growing and slow every read), a PASSIVE checkpoint every few minutes,
+// PRAGMA optimize hourly, ANALYZE once a day (app_state
+// "maintenance.last_analyze") and incremental vacuum in small steps.
+class MaintenanceScheduler {
+  public:
+    explicit MaintenanceScheduler(const ConnOptions& options, MaintenancePolicy policy = {});
+    ~MaintenanceScheduler();  // finishes the task in flight, then runs PRAGMA optimize
+
+    MaintenanceScheduler(const MaintenanceScheduler&) = delete;
+    MaintenanceScheduler& operator=(const MaintenanceScheduler&) = delete;
+
+    // Call on user input; a single atomic store.
+    void noteActivity();
+
+  private:
+    void run();
+    [[nodiscard]] bool idle() const;
+
+    ConnOptions m_options;
+    MaintenancePolicy m_policy;
+    std::atomic<qint64> m_lastActivityMs;
+    std::atomic<bool> m_stop{false};
+    QSemaphore m_wake;
+    std::unique_ptr<QThread> m_thread;
+};
+
+// Every task at once, for hmis_cli --maintain. Returns false at the first
+// failure with *error set.
+bool runMaintenance(Database& db, QString* error);
+
+#endif  // MAINTENANCE_H
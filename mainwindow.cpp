@@ -1,6 +1,7 @@
 #include <QApplication>
 #include <QCheckBox>
 #include <QComboBox>
+#include <QDebug>
 #include <QDialog>
 #include <QFileDialog>
 #include <QFormLayout>
@@ -8,30 +9,51 @@
 #include <QHBoxLayout>
 #include <QHeaderView>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QPushButton>
+#include <QSet>
 #include <QSettings>
 #include <QVBoxLayout>
 
 #include "./ui_mainwindow.h"
 
 #include "AuditLogDialog.hpp"
+#include "PerfStatsDialog.hpp"
+#include "SearchDialog.hpp"
 #include "mainwindow.hpp"
 #include "register.hpp"
+#include "tracing.hpp"
 
 // ---------------------------------------------------------------------------
 // Construction / destruction
 // ---------------------------------------------------------------------------
 MainWindow::MainWindow(Database& conn, const User& user, QWidget* parent)
-    : QMainWindow(parent), ui(new Ui::MainWindow), db(conn), m_currentUser(user) {
+    : QMainWindow(parent),
+      ui(new Ui::MainWindow),
+      db(conn),
+      m_currentUser(user),
+      m_suggester(QSettings().value("suggest/halfLifeDays", 30).toDouble()) {
     ui->setupUi(this);
     setWindowIcon(QIcon(":/favicon.ico"));
     setWindowTitle(
         QString("HMIS 105  —  %1 [%2]").arg(user.username).arg(user.role == UserRole::Admin ? "Admin" : "Clerk"));
     menuBar()->hide();
 
+    m_searchEdit = new QLineEdit(this);
+    m_searchEdit->setPlaceholderText("Search all months (IP number or diagnosis)");
+    m_searchEdit->setClearButtonEnabled(true);
+    m_searchEdit->setMaximumWidth(320);
+    m_searchEdit->setStyleSheet("color: black; background-color: white;");
+    ui->toolBar->addSeparator();
+    ui->toolBar->addWidget(m_searchEdit);
+
     connectSignals();
     initUI();
+    loadSuggestions();
 
+    // Read before the first dateChanged so the tables are filled before the
+    // window is painted.
+    m_snapshot = statsnapshot::load(statsnapshot::defaultPath());
     QDate date = QDate::currentDate();
     ui->dateEdit->setDate(date);
     ui->dateEdit->setMaximumDate(QDate::currentDate());
@@ -41,6 +63,14 @@ MainWindow::MainWindow(Database& conn, const User& user, QWidget* parent)
 }
 
 MainWindow::~MainWindow() {
+    saveSnapshot();
+    if (!m_suggester.isEmpty()) {
+        QString error;
+        if (!m_suggester.save(DiagnosisSuggester::defaultPath(), statsnapshot::connectionKey(db.connOptions()),
+                              &error)) {
+            qWarning() << "Suggestions not saved:" << error;
+        }
+    }
     QSettings settings;
     settings.setValue("mainwindow/geometry", saveGeometry());
     delete ui;
@@ -130,6 +160,7 @@ void MainWindow::connectSignals() {
     connect(ui->actionExit, &QAction::triggered, this, &MainWindow::onExit);
     connect(ui->actionExpand, &QAction::triggered, this, &MainWindow::onToggleSidebar);
     connect(ui->actionView_Register, &QAction::triggered, this, &MainWindow::onViewRegister);
+    connect(m_searchEdit, &QLineEdit::returnPressed, this, &MainWindow::onSearchRegister);
     connect(ui->checkHideEmpty, &QCheckBox::checkStateChanged, this, &MainWindow::toggleHideEmptyDiagnoses);
     connect(ui->txtFilter, &QLineEdit::textChanged, this, &MainWindow::filterVisibleDiagnoses);
     connect(ui->actionView_All_Diagnoses, &QAction::triggered, this, &MainWindow::onViewDiagnoses);
@@ -137,12 +168,14 @@ void MainWindow::connectSignals() {
     connect(ui->actionExport_CSV, &QAction::triggered, this, &MainWindow::onExportCSV);
     connect(ui->actionBackup_Database, &QAction::triggered, this, &MainWindow::onBackupDatabase);
     connect(ui->actionAudit_Log, &QAction::triggered, this, &MainWindow::onViewAuditLog);
+    connect(ui->actionPerformance, &QAction::triggered, this, &MainWindow::onViewPerformance);
     connect(ui->actionManage_Users, &QAction::triggered, this, &MainWindow::onManageUsers);
     connect(ui->actionChange_Password, &QAction::triggered, this, &MainWindow::onChangePassword);
 
     // Hide admin-only actions from clerks
     if (m_currentUser.role != UserRole::Admin) {
         ui->actionAudit_Log->setVisible(false);
+        ui->actionPerformance->setVisible(false);
         ui->actionManage_Users->setVisible(false);
         ui->actionBackup_Database->setVisible(false);
     }
@@ -169,6 +202,7 @@ QStringList MainWindow::validateForm() const {
 // Save
 // ---------------------------------------------------------------------------
 void MainWindow::onSave() {
+    TraceSpan span("MainWindow::onSave");
     QStringList errors = validateForm();
     if (!errors.isEmpty()) {
         QMessageBox::warning(this, "Validation Error", "Please fix the following:\n\n• " + errors.join("\n• "));
@@ -178,10 +212,7 @@ void MainWindow::onSave() {
     QDate d = ui->dateEdit->date();
     QString ipNum = ui->IPN->text().trimmed();
 
-    QStringList dxList;
-    for (int i = 0; i < ui->listWidgetSelected->count(); ++i) {
-        dxList << ui->listWidgetSelected->item(i)->text();
-    }
+    const QStringList dxList = selectedDiagnoses();
 
     NewHMISData data = {
         .ageCategory = ui->comboBoxCategory->currentText(),
@@ -194,16 +225,20 @@ void MainWindow::onSave() {
     };
 
     if (db.saveNewRow(data, m_currentUser.id)) {
+        m_suggester.learn(m_currentUser.id, dxList, QDateTime::currentSecsSinceEpoch());
         onResetForm();
-        populateAttendances(d.year(), d.month());
-        populateDiagnoses(d.year(), d.month());
-        updateDashboard(d.year(), d.month());
+        filterDiagnoses(ui->lineEdit->text());
+        // The notifier delivers the new row to applyMonthChanges(); only
+        // queued offline rows need the reload that merges them in.
+        if (m_notifier != nullptr && db.outbox() == nullptr) {
+            m_notifier->checkNow();
+        } else {
+            reloadMonth();
+        }
         statusBar()->showMessage("Record inserted successfully", 5000);
-
-        bool ok;
-        int n = ipNum.toInt(&ok);
-        if (ok) {
-            ui->IPN->setText(QString("%1").arg(n + 1, 3, 10, QChar('0')));
+        ui->IPN->setText(db.nextIPNumber(d.year(), d.month()));
+        if (m_replicator != nullptr) {
+            m_replicator->syncNow();
         }
     } else {
         QMessageBox::critical(this, "Insert Error", "Unable to insert record:\n" + db.getLastError());
@@ -261,40 +296,111 @@ void MainWindow::setDiagnosisTableItem(int row, int col, int number) {
 // ---------------------------------------------------------------------------
 // Populate tables
 // ---------------------------------------------------------------------------
-void MainWindow::populateAttendances(int year, int month) {
-    HMISData rows = db.fetchHMISData(year, month);
-    MonthlyStats st = db.buildAttendanceStats(rows);
-
+void MainWindow::populateAttendances() {
+    TraceSpan span("MainWindow::populateAttendances");
     for (int r = 0; r < 2; r++) {
         QString att = (r == 0) ? ATT_YES : ATT_NO;
         int col = 0;
         for (const QString& age : AGE_CATEGORIES) {
-            auto cnt = st.get(att, age);
+            auto cnt = m_attendanceStats.get(att, age);
             setAttendanceTableItem(r, col++, cnt.male);
             setAttendanceTableItem(r, col++, cnt.female);
         }
     }
 }
 
-void MainWindow::populateDiagnoses(int year, int month) {
-    HMISData rows = db.fetchHMISData(year, month);
-    MonthlyStats st = db.buildDiagnosisStats(rows, diagnosisNames);
-
+void MainWindow::populateDiagnoses() {
+    TraceSpan span("MainWindow::populateDiagnoses");
     for (int row = 0; row < static_cast<int>(diagnosisNames.size()); row++) {
         int col = 0;
         for (const QString& age : AGE_CATEGORIES) {
-            auto cnt = st.get(diagnosisNames[row], age);
+            auto cnt = m_diagnosisStats.get(diagnosisNames[row], age);
             setDiagnosisTableItem(row, col++, cnt.male);
             setDiagnosisTableItem(row, col++, cnt.female);
         }
     }
 }
 
+void MainWindow::showMonth() {
+    // Offline-first reads merge outbox rows the stamp cannot see.
+    if (m_snapshot && db.outbox() == nullptr &&
+        statsnapshot::isCurrent(*m_snapshot, db, currentYear, currentMonth)) {
+        TraceSpan span("MainWindow::showMonth(snapshot)");
+        m_attendanceStats = m_snapshot->attendance;
+        m_diagnosisStats = m_snapshot->diagnoses;
+        m_summary = m_snapshot->summary;
+        m_monthStamp = m_snapshot->stamp;
+        m_monthRows.clear();
+        m_monthRowsLoaded = false;
+        m_snapshot.reset();
+        populateAttendances();
+        populateDiagnoses();
+        updateDashboard();
+        return;
+    }
+    m_snapshot.reset();
+    reloadMonth();
+}
+
+void MainWindow::reloadMonth() {
+    // Stamp first: a write landing in between leaves the stamp behind the
+    // rows, which costs at most one recomputation at the next start.
+    m_monthStamp = db.outbox() == nullptr ? db.monthStamp(currentYear, currentMonth) : std::nullopt;
+    m_monthRows = db.fetchHMISData(currentYear, currentMonth);
+    m_monthRowsLoaded = true;
+    refreshMonthViews();
+}
+
+void MainWindow::refreshMonthViews() {
+    m_attendanceStats = db.buildAttendanceStats(m_monthRows);
+    m_diagnosisStats = db.buildDiagnosisStats(m_monthRows, diagnosisNames);
+    m_summary = db.buildSummary(m_monthRows);
+    populateAttendances();
+    populateDiagnoses();
+    updateDashboard();
+}
+
+// Only the current calendar month is worth keeping: it is what the next
+// start shows.
+void MainWindow::saveSnapshot() {
+    const QDate today = QDate::currentDate();
+    if (currentYear != today.year() || currentMonth != today.month() || db.outbox() != nullptr) {
+        return;
+    }
+    StatsSnapshot snapshot;
+    snapshot.source = statsnapshot::connectionKey(db.connOptions());
+    snapshot.year = currentYear;
+    snapshot.month = currentMonth;
+    if (m_monthStamp) {
+        snapshot.stamp = *m_monthStamp;
+        snapshot.attendance = m_attendanceStats;
+        snapshot.diagnoses = m_diagnosisStats;
+        snapshot.summary = m_summary;
+    } else {
+        // Patched by change notifications since the last stamp: rebuild
+        // from a fresh read rather than guess which stamp the rows match.
+        const auto stamp = db.monthStamp(currentYear, currentMonth);
+        if (!stamp) {
+            return;
+        }
+        const HMISData rows = db.fetchHMISData(currentYear, currentMonth);
+        snapshot.stamp = *stamp;
+        snapshot.attendance = db.buildAttendanceStats(rows);
+        snapshot.diagnoses = db.buildDiagnosisStats(rows, diagnosisNames);
+        snapshot.summary = db.buildSummary(rows);
+    }
+    QString error;
+    if (!statsnapshot::save(statsnapshot::defaultPath(), snapshot, &error)) {
+        qWarning() << "Stats snapshot not saved:" << error;
+    }
+}
+
 // ---------------------------------------------------------------------------
 // Dashboard summary
 // ---------------------------------------------------------------------------
-void MainWindow::updateDashboard(int year, int month) {
-    auto s = db.getMonthlySummary(year, month);
+void MainWindow::updateDashboard() {
+    TraceSpan span("MainWindow::updateDashboard");
+    const auto& s = m_summary;
     QString msg =
         QString("Total: %1  |  New: %2  |  Re-att: %3").arg(s.totalPatients).arg(s.newAttendances).arg(s.reAttendances);
     if (!s.topDiagnosis1.isEmpty()) {
@@ -313,11 +419,13 @@ void MainWindow::updateDashboard(int year, int month) {
 // Date change
 // ---------------------------------------------------------------------------
 void MainWindow::onDateChanged(const QDate& date) {
+    TraceSpan span("MainWindow::onDateChanged");
+    if (date.year() != currentYear || date.month() != currentMonth) {
+        saveSnapshot();  // the month on screen is being closed
+    }
     currentYear = date.year();
     currentMonth = date.month();
-    populateAttendances(currentYear, currentMonth);
-    populateDiagnoses(currentYear, currentMonth);
-    updateDashboard(currentYear, currentMonth);
+    showMonth();
     ui->IPN->setText(db.nextIPNumber(date.year(), date.month()));
 }
 
@@ -332,27 +440,64 @@ void MainWindow::addToSelectedDiagnoses(QListWidgetItem* item) {
         }
     }
     ui->listWidgetSelected->addItem(item->text());
+    // Re-rank for what goes with the selection; queued because item belongs
+    // to the list being rebuilt.
+    QMetaObject::invokeMethod(this, [this] { filterDiagnoses(ui->lineEdit->text()); }, Qt::QueuedConnection);
 }
 
 void MainWindow::removeFromSelectedDiagnoses(QListWidgetItem* item) {
     delete ui->listWidgetSelected->takeItem(ui->listWidgetSelected->row(item));
+    filterDiagnoses(ui->lineEdit->text());
+}
+
+QStringList MainWindow::selectedDiagnoses() const {
+    QStringList out;
+    for (int i = 0; i < ui->listWidgetSelected->count(); ++i) {
+        out << ui->listWidgetSelected->item(i)->text();
+    }
+    return out;
 }
 
 void MainWindow::diagnosisQueryChanged(const QString& query) { filterDiagnoses(query); }
 
+// Suggested diagnoses come first, in bold, then the other matches in list
+// order.
 void MainWindow::filterDiagnoses(const QString& query) {
+    static constexpr int kSuggestions = 8;
+    const QString needle = query.trimmed();
+    auto matches = [&needle](const QString& d) { return needle.isEmpty() || d.contains(needle, Qt::CaseInsensitive); };
+
     ui->listWidgetAllDiagnoses->clear();
-    if (query.trimmed().isEmpty()) {
-        ui->listWidgetAllDiagnoses->addItems(diagnosisNames);
-        return;
+    QSet<QString> shown;
+    for (const QString& d : m_suggester.suggest(m_currentUser.id, selectedDiagnoses(), kSuggestions)) {
+        if (matches(d) && diagnosisNames.contains(d)) {
+            auto* item = new QListWidgetItem(d);
+            QFont font = item->font();
+            font.setBold(true);
+            item->setFont(font);
+            ui->listWidgetAllDiagnoses->addItem(item);
+            shown.insert(d);
+        }
     }
     for (const QString& d : diagnosisNames) {
-        if (d.contains(query, Qt::CaseInsensitive)) {
+        if (matches(d) && !shown.contains(d)) {
             ui->listWidgetAllDiagnoses->addItem(d);
         }
     }
 }
 
+void MainWindow::loadSuggestions() {
+    TraceSpan span("MainWindow::loadSuggestions");
+    const QString source = statsnapshot::connectionKey(db.connOptions());
+    if (!m_suggester.load(DiagnosisSuggester::defaultPath(), source)) {
+        // First start on this database: learn the facility's last three months.
+        const QDate to = QDate::currentDate();
+        const QDate from = to.addMonths(-2);
+        m_suggester.learnRows(db.fetchHMISRange(from.year(), from.month(), to.year(), to.month()));
+    }
+    filterDiagnoses(ui->lineEdit->text());
+}
+
 void MainWindow::toggleHideEmptyDiagnoses(Qt::CheckState state) {
     int cols = ui->tableDiagnoses->columnCount();
     for (int row = 0; row < ui->tableDiagnoses->rowCount(); ++row) {
@@ -388,15 +533,37 @@ void MainWindow::onToggleSidebar(bool toggled) {
 // View register
 // ---------------------------------------------------------------------------
 void MainWindow::onViewRegister() {
-    QDate date = ui->dateEdit->date();
-    HMISData rows = db.fetchHMISData(date.year(), date.month());
-    auto* reg = new Register(&db, date.year(), date.month(), this);
+    TraceSpan span("MainWindow::onViewRegister");
+    const QDate date = ui->dateEdit->date();
+    openRegister(date.year(), date.month());
+}
+
+void MainWindow::openRegister(int year, int month, const QString& ipNumber) {
+    HMISData rows = db.fetchHMISData(year, month);
+    auto* reg = new Register(&db, year, month, this);
     reg->setCurrentUser(m_currentUser);
+    if (m_notifier != nullptr) {
+        connect(m_notifier, &ChangeNotifier::monthChanged, reg, &Register::applyChanges);
+    }
     reg->setData(rows);
+    if (!ipNumber.isEmpty()) {
+        reg->showPatient(ipNumber);
+    }
     reg->showMaximized();
     reg->plotData(db.buildDiagnosisStats(rows, diagnosisNames), db.buildAttendanceStats(rows));
 }
 
+// Modeless, so registers opened from the results can be used alongside it.
+void MainWindow::onSearchRegister() {
+    if (m_searchEdit->text().trimmed().isEmpty()) {
+        return;
+    }
+    auto* dlg = new SearchDialog(db, m_searchEdit->text(), this);
+    dlg->setAttribute(Qt::WA_DeleteOnClose);
+    connect(dlg, &SearchDialog::openMonth, this, &MainWindow::openRegister);
+    dlg->show();
+}
+
 // ---------------------------------------------------------------------------
 // Diagnoses management
 // ---------------------------------------------------------------------------
@@ -471,20 +638,143 @@ void MainWindow::onExportCSV() {
     statusBar()->showMessage("Exported to " + path, 5000);
 }
 
+// ---------------------------------------------------------------------------
+// Offline-first sync status
+// ---------------------------------------------------------------------------
+void MainWindow::attachReplicator(Replicator* replicator) {
+    m_replicator = replicator;
+    m_syncLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(m_syncLabel);
+
+    connect(replicator, &Replicator::statusChanged, this, [this](bool online, qint64 pending, qint64 conflicts) {
+        QString text = online ? "Server: online" : "Server: offline";
+        if (pending > 0) {
+            text += QString("  |  %1 waiting to sync").arg(pending);
+        }
+        if (conflicts > 0) {
+            text += QString("  |  %1 sync conflict(s), see hmis_cli --sync-status").arg(conflicts);
+        }
+        m_syncLabel->setText(text);
+        m_syncLabel->setStyleSheet(online && conflicts == 0 ? QString() : "color: #b00020;");
+
+        // Started offline: pick the server back up. Once everything is
+        // synced, reload the month so queued rows show their server ids.
+        if (online && !db.isConnected()) {
+            db.reconnect();
+        }
+        if (online && pending == 0) {
+            reloadMonth();
+        }
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Changes from other clients
+// ---------------------------------------------------------------------------
+void MainWindow::attachNotifier(ChangeNotifier* notifier) {
+    m_notifier = notifier;
+    connect(notifier, &ChangeNotifier::monthChanged, this, &MainWindow::applyMonthChanges);
+    connect(notifier, &ChangeNotifier::diagnosesChanged, this, &MainWindow::reloadDiagnoses);
+}
+
+void MainWindow::applyMonthChanges(int year, int month, const QList<RowChange>& rows) {
+    if (year != currentYear || month != currentMonth) {
+        return;
+    }
+    TraceSpan span("MainWindow::applyMonthChanges");
+    // Queued offline rows carry placeholder ids that no change can match.
+    // Views filled from the snapshot have no rows to patch yet.
+    if (rows.isEmpty() || db.outbox() != nullptr || !m_monthRowsLoaded) {
+        reloadMonth();
+        return;
+    }
+    applyRowChanges(m_monthRows, rows);
+    m_monthStamp.reset();
+    refreshMonthViews();
+}
+
+void MainWindow::reloadDiagnoses() {
+    const auto stored = db.getAllDiagnoses();
+    if (!stored) {
+        return;
+    }
+    diagnoses = *stored;
+    diagnosisNames.clear();
+    for (const Diagnosis& d : diagnoses) {
+        diagnosisNames << d.name;
+    }
+    filterDiagnoses(ui->lineEdit->text());
+    ui->tableDiagnoses->setRowCount(static_cast<int>(diagnosisNames.size()));
+    ui->tableDiagnoses->setVerticalHeaderLabels(diagnosisNames);
+    populateDiagnoses();
+    toggleHideEmptyDiagnoses(ui->checkHideEmpty->checkState());
+}
+
 // ---------------------------------------------------------------------------
 // Backup
 // ---------------------------------------------------------------------------
 void MainWindow::onBackupDatabase() {
+    if (db.connOptions().getDriver() != Driver::SQLITE) {
+        QMessageBox::critical(this, "Backup Failed", "Only SQLite databases can be backed up this way.");
+        return;
+    }
+    if (m_backup != nullptr && m_backup->isRunning()) {
+        QMessageBox::information(this, "Backup", "A backup is already running.");
+        return;
+    }
+
     QString path = QFileDialog::getSaveFileName(this, "Backup Database", "hmis_backup.sqlite3",
-                                                "SQLite (*.sqlite3);;All Files (*)");
+                                                "SQLite (*.sqlite3);;Compressed SQLite (*.sqlite3.gz);;All Files (*)");
     if (path.isEmpty()) {
         return;
     }
-    if (db.backupTo(path)) {
-        QMessageBox::information(this, "Backup Complete", "Backed up to:\n" + path);
-    } else {
-        QMessageBox::critical(this, "Backup Failed", "Backup failed. Only SQLite databases can be backed up this way.");
+
+    backup::Options options;
+    if (path.endsWith(".gz", Qt::CaseInsensitive)) {
+        options.compression = backup::Compression::Gzip;
     }
+
+    if (m_backup == nullptr) {
+        m_backup = new BackupEngine(this);
+    }
+
+    // Non-modal: clerks keep entering data while the copy runs.
+    auto* progress = new QProgressDialog("Copying database...", "Cancel", 0, 1000, this);
+    progress->setWindowTitle("Backup Database");
+    progress->setWindowModality(Qt::NonModal);
+    progress->setAutoClose(false);
+    progress->setAutoReset(false);
+    progress->setMinimumDuration(0);
+    progress->setAttribute(Qt::WA_DeleteOnClose);
+
+    connect(progress, &QProgressDialog::canceled, m_backup, &BackupEngine::cancel);
+    connect(m_backup, &BackupEngine::progress, progress, [progress](int phase, qint64 done, qint64 total) {
+        static const QStringList labels = {"Copying database...", "Verifying backup...", "Compressing backup..."};
+        progress->setLabelText(labels.value(phase));
+        progress->setValue(total > 0 ? static_cast<int>(done * 1000 / total) : 0);
+    });
+    // Start of a new differential backup chain; see diffbackup.hpp.
+    const qint64 stamp = db.maxChangeId();
+
+    // Both connections die with the dialog, so each backup gets its own.
+    connect(m_backup, &BackupEngine::finished, progress,
+            [this, progress, path, stamp](bool ok, bool cancelled, const QString& message) {
+                progress->close();
+                if (ok && stamp >= 0) {
+                    db.recordBackup("full", path, 0, stamp);
+                }
+                if (ok) {
+                    statusBar()->showMessage("Backed up to " + path, 10000);
+                    QMessageBox::information(this, "Backup Complete", "Backed up to:\n" + path);
+                } else if (cancelled) {
+                    statusBar()->showMessage("Backup cancelled", 5000);
+                } else {
+                    QMessageBox::critical(this, "Backup Failed", "Backup failed:\n" + message);
+                }
+            });
+
+    m_backup->start(db.connOptions().dbFilePath(), path, options);
+    progress->show();
 }
 
 // ---------------------------------------------------------------------------
@@ -495,6 +785,14 @@ void MainWindow::onViewAuditLog() {
     dlg.exec();
 }
 
+// ---------------------------------------------------------------------------
+// Performance
+// ---------------------------------------------------------------------------
+void MainWindow::onViewPerformance() {
+    PerfStatsDialog dlg(this);
+    dlg.exec();
+}
+
 // ---------------------------------------------------------------------------
 // User management
 // ---------------------------------------------------------------------------
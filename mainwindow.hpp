@@ -2,6 +2,7 @@
 #define MAINWINDOW_H
 
 #include <QLabel>
+#include <QLineEdit>
 #include <QListWidgetItem>
 #include <QMainWindow>
 #include <QTableWidget>
@@ -11,8 +12,13 @@
 #include <QtSql/QSqlQuery>
 #include <optional>
 
+#include "backup.hpp"
+#include "changenotifier.hpp"
 #include "database.hpp"
 #include "register.hpp"
+#include "replicator.hpp"
+#include "statsnapshot.hpp"
+#include "suggester.hpp"
 
 const QStringList diagnosisTableHeaders = {
     "0-28d(M)", "0-28d(F)",  "29d-4y(M)", "29d-4y(F)", "5-9y(M)",
@@ -36,15 +42,40 @@ class MainWindow : public QMainWindow {
     QStringList diagnosisNames;
     QList<QString> matchingDiagnoses;
 
-    int currentYear;
-    int currentMonth;
+    int currentYear = 0;
+    int currentMonth = 0;
+    HMISData m_monthRows;      // register rows of the month on screen
+    bool m_monthRowsLoaded = false;  // false while the views come from the startup snapshot
+    // Aggregates shown in the tables and status bar, and the stamp they
+    // were built at (reset once notifier patches move them past it).
+    MonthlyStats m_attendanceStats;
+    MonthlyStats m_diagnosisStats;
+    Database::MonthlySummary m_summary;
+    std::optional<MonthStamp> m_monthStamp;
+    std::optional<StatsSnapshot> m_snapshot;  // read once at startup
+    DiagnosisSuggester m_suggester;           // ranks listWidgetAllDiagnoses
+
+    BackupEngine* m_backup = nullptr;  // created on first backup
+    Replicator* m_replicator = nullptr;  // offline-first mode only
+    QLabel* m_syncLabel = nullptr;
+    QLineEdit* m_searchEdit = nullptr;  // toolbar search across all months
+    ChangeNotifier* m_notifier = nullptr;
 
     void initializeTableWidget(QTableWidget* w, int rowCount);
-    void populateAttendances(int year, int month);
-    void populateDiagnoses(int year, int month);
+    void populateAttendances();
+    void populateDiagnoses();
     void connectSignals();
     void initUI();
-    void updateDashboard(int year, int month);
+    void updateDashboard();
+    void showMonth();    // from the startup snapshot if still current, else reloadMonth()
+    void reloadMonth();  // fetches m_monthRows and refreshes everything derived from it
+    void refreshMonthViews();  // rebuilds the aggregates from m_monthRows
+    void saveSnapshot();
+    void applyMonthChanges(int year, int month, const QList<RowChange>& rows);
+    void reloadDiagnoses();
+    void openRegister(int year, int month, const QString& ipNumber = {});
+    void loadSuggestions();  // saved model, else seeded from recent months
+    QStringList selectedDiagnoses() const;
     void setDiagnosisTableItem(int row, int column, int number);
     void setAttendanceTableItem(int row, int column, int number);
 
@@ -57,6 +88,13 @@ class MainWindow : public QMainWindow {
 
     void filterDiagnoses(const QString& query);
 
+    // Offline-first mode: shows sync state in the status bar and reconnects
+    // once the server is reachable again.
+    void attachReplicator(Replicator* replicator);
+    // Patches the month on screen (and open registers) as other clients
+    // commit, instead of waiting for the next date change.
+    void attachNotifier(ChangeNotifier* notifier);
+
   private slots:
     void onResetForm();
     void onSave();
@@ -66,6 +104,7 @@ class MainWindow : public QMainWindow {
     void onDateChanged(const QDate& date);
     void onToggleSidebar(bool toggled);
     void onViewRegister();
+    void onSearchRegister();
     void onExit();
     void toggleHideEmptyDiagnoses(Qt::CheckState state);
     void filterVisibleDiagnoses(const QString& query);
@@ -74,6 +113,7 @@ class MainWindow : public QMainWindow {
     void onExportCSV();
     void onBackupDatabase();
     void onViewAuditLog();
+    void onViewPerformance();
     void onManageUsers();
     void onChangePassword();
 };
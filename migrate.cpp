@@ -0,0 +1,549 @@
+#include "migrate.hpp"
+#include "perfstats.hpp"
+#include "sqldialect.hpp"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlDriver>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlRecord>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#ifdef HMIS_HAVE_LIBPQ
+#include <libpq-fe.h>
+#endif
+
+namespace migrate {
+
+// Every table createSchema() makes, parents before the tables holding their ids.
+static const QStringList kTables = {"diagnoses",    "users",          "hmis",         "ip_sequences",
+                                    "audit_log",    "change_journal", "backup_state", "app_state",
+                                    "applied_ops",  "feed_sources",   "feed_rows"};
+
+namespace {
+
+struct TablePlan {
+    QString name;
+    QStringList columns;  // in both databases, in the target's order
+    bool hasId = false;
+};
+
+struct Chunk {
+    int table = 0;  // index into the plan
+    QList<QVariantList> rows;
+    bool last = false;  // the table's final (possibly empty) chunk
+    qint64 count = 0;   // on the last chunk: rows read and their checksum
+    quint64 checksum = 0;
+};
+
+// Chunks on their way from the reader to the writer. push() waits while the
+// queue is full, which is what bounds memory.
+class ChunkQueue {
+  public:
+    explicit ChunkQueue(int capacity) : m_capacity(std::max(capacity, 1)) {}
+
+    // False once the writer has given up.
+    bool push(Chunk chunk) {
+        std::unique_lock lock(m_mutex);
+        m_notFull.wait(lock, [this] { return m_cancelled || qsizetype(m_chunks.size()) < m_capacity; });
+        if (m_cancelled) {
+            return false;
+        }
+        m_chunks.push_back(std::move(chunk));
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    // nullopt once the reader failed and everything it read was taken.
+    std::optional<Chunk> pop() {
+        std::unique_lock lock(m_mutex);
+        m_notEmpty.wait(lock, [this] { return !m_chunks.empty() || m_failed; });
+        if (m_chunks.empty()) {
+            return std::nullopt;
+        }
+        Chunk chunk = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        m_notFull.notify_one();
+        return chunk;
+    }
+
+    void fail(const QString& error) {
+        const std::lock_guard lock(m_mutex);
+        m_failed = true;
+        m_error = error;
+        m_notEmpty.notify_all();
+    }
+
+    void cancel() {
+        const std::lock_guard lock(m_mutex);
+        m_cancelled = true;
+        m_notFull.notify_all();
+    }
+
+    QString error() {
+        const std::lock_guard lock(m_mutex);
+        return m_error;
+    }
+
+  private:
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+    std::deque<Chunk> m_chunks;
+    qsizetype m_capacity;
+    bool m_failed = false;
+    bool m_cancelled = false;
+    QString m_error;
+};
+
+// Drivers return the same column as different QVariant types (qlonglong
+// from SQLite, int from PostgreSQL), so rows are compared as text.
+quint64 rowHash(const QVariantList& row) {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (const QVariant& value : row) {
+        hash.addData(value.isNull() ? QByteArray("\x01N") : value.toString().toUtf8());
+        hash.addData(QByteArray("\x1f", 1));
+    }
+    quint64 h = 0;
+    std::memcpy(&h, hash.result().constData(), sizeof h);
+    return h;
+}
+
+QString selectSql(const TablePlan& plan) {
+    return QString("SELECT %1 FROM %2%3").arg(plan.columns.join(", "), plan.name, plan.hasId ? " ORDER BY id" : "");
+}
+
+// Rows and checksum of what a connection holds for plan's columns.
+bool scanTable(QSqlDatabase db, const TablePlan& plan, qint64* count, quint64* checksum, QString* error) {
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (!q.exec(selectSql(plan))) {
+        *error = QString("Reading %1: %2").arg(plan.name, q.lastError().text());
+        return false;
+    }
+    const qsizetype columns = plan.columns.size();
+    QVariantList row;
+    while (q.next()) {
+        row.clear();
+        for (int c = 0; c < columns; ++c) {
+            row << q.value(c);
+        }
+        *checksum += rowHash(row);
+        ++*count;
+    }
+    return true;
+}
+
+// The reader thread. It opens its own source connection, since QtSql
+// connections belong to the thread that made them.
+void readTables(const ConnOptions& from, const QList<TablePlan>& plan, int chunkRows, ChunkQueue& queue) {
+    Database source;
+    try {
+        source.Connect(from);
+    } catch (const std::exception& e) {
+        queue.fail(QString("Cannot open the source: %1").arg(e.what()));
+        return;
+    }
+    const QSqlDatabase db = QSqlDatabase::database(source.connectionName(), false);
+    for (int t = 0; t < plan.size(); ++t) {
+        QSqlQuery q(db);
+        q.setForwardOnly(true);
+        if (!q.exec(selectSql(plan.at(t)))) {
+            queue.fail(QString("Reading %1: %2").arg(plan.at(t).name, q.lastError().text()));
+            return;
+        }
+        const qsizetype columns = plan.at(t).columns.size();
+        Chunk chunk{.table = t};
+        qint64 count = 0;
+        quint64 checksum = 0;
+        while (q.next()) {
+            QVariantList row;
+            row.reserve(columns);
+            for (int c = 0; c < columns; ++c) {
+                row << q.value(c);
+            }
+            checksum += rowHash(row);
+            ++count;
+            chunk.rows << std::move(row);
+            if (chunk.rows.size() == chunkRows && !queue.push(std::exchange(chunk, Chunk{.table = t}))) {
+                return;
+            }
+        }
+        if (q.lastError().isValid()) {
+            queue.fail(QString("Reading %1: %2").arg(plan.at(t).name, q.lastError().text()));
+            return;
+        }
+        chunk.last = true;
+        chunk.count = count;
+        chunk.checksum = checksum;
+        if (!queue.push(std::move(chunk))) {
+            return;
+        }
+    }
+}
+
+// Loads one table in one transaction: COPY when the target is PostgreSQL
+// and libpq is built in, multi-row INSERTs otherwise.
+class TableWriter {
+  public:
+    TableWriter(QSqlDatabase db, const sql::Dialect& dialect, const TablePlan& plan)
+        : m_db(std::move(db)), m_dialect(dialect), m_plan(plan) {}
+
+    ~TableWriter() {
+        if (m_open) {
+#ifdef HMIS_HAVE_LIBPQ
+            if (m_pg != nullptr) {
+                PQputCopyEnd(m_pg, "migration aborted");
+                while (PGresult* res = PQgetResult(m_pg)) {
+                    PQclear(res);
+                }
+            }
+#endif
+            m_db.rollback();
+        }
+    }
+
+    TableWriter(const TableWriter&) = delete;
+    TableWriter& operator=(const TableWriter&) = delete;
+
+    bool begin(bool useCopy, QString* error) {
+        if (!m_db.transaction()) {
+            *error = QString("Writing %1: %2").arg(m_plan.name, m_db.lastError().text());
+            return false;
+        }
+        m_open = true;
+#ifdef HMIS_HAVE_LIBPQ
+        const QVariant handle = m_db.driver()->handle();
+        if (useCopy && m_dialect.copyFromStdin && qstrcmp(handle.typeName(), "PGconn*") == 0) {
+            m_pg = *static_cast<PGconn* const*>(handle.constData());
+            const QByteArray sql = QString("COPY %1 (%2) FROM STDIN").arg(m_plan.name, m_plan.columns.join(", ")).toUtf8();
+            PGresult* res = PQexec(m_pg, sql.constData());
+            const bool ok = PQresultStatus(res) == PGRES_COPY_IN;
+            PQclear(res);
+            if (!ok) {
+                *error = QString("COPY %1: %2").arg(m_plan.name, QString::fromUtf8(PQerrorMessage(m_pg)));
+                m_pg = nullptr;
+                return false;
+            }
+            return true;
+        }
+#else
+        Q_UNUSED(useCopy);
+#endif
+        // As many rows per statement as the placeholder limit allows.
+        const int columns = int(m_plan.columns.size());
+        m_statementRows = std::clamp(m_dialect.bindLimit / columns, 1, 1000);
+        if (!m_insert.prepare(insertSql(m_statementRows))) {
+            *error = QString("Writing %1: %2").arg(m_plan.name, m_insert.lastError().text());
+            return false;
+        }
+        return true;
+    }
+
+    bool write(QList<QVariantList> rows, QString* error) {
+#ifdef HMIS_HAVE_LIBPQ
+        if (m_pg != nullptr) {
+            return copyRows(rows, error);
+        }
+#endif
+        m_pending.append(std::move(rows));
+        qsizetype done = 0;
+        while (m_pending.size() - done >= m_statementRows) {
+            if (!insertRows(m_insert, done, m_statementRows, error)) {
+                return false;
+            }
+            done += m_statementRows;
+        }
+        m_pending.remove(0, done);
+        return true;
+    }
+
+    bool finish(QString* error) {
+#ifdef HMIS_HAVE_LIBPQ
+        if (m_pg != nullptr) {
+            bool ok = PQputCopyEnd(m_pg, nullptr) == 1;
+            while (PGresult* res = PQgetResult(m_pg)) {
+                ok = ok && PQresultStatus(res) == PGRES_COMMAND_OK;
+                PQclear(res);
+            }
+            if (!ok) {
+                *error = QString("COPY %1: %2").arg(m_plan.name, QString::fromUtf8(PQerrorMessage(m_pg)));
+                m_pg = nullptr;
+                return false;
+            }
+            m_pg = nullptr;
+        }
+#endif
+        if (!m_pending.isEmpty()) {
+            QSqlQuery tail(m_db);
+            if (!tail.prepare(insertSql(int(m_pending.size()))) ||
+                !insertRows(tail, 0, int(m_pending.size()), error)) {
+                if (error->isEmpty()) {
+                    *error = QString("Writing %1: %2").arg(m_plan.name, tail.lastError().text());
+                }
+                return false;
+            }
+            m_pending.clear();
+        }
+        if (m_plan.hasId && !m_dialect.resetIdSequence.isEmpty()) {
+            QSqlQuery q(m_db);
+            if (!q.exec(QString(m_dialect.resetIdSequence).arg(m_plan.name))) {
+                *error = QString("Resetting the id sequence of %1: %2").arg(m_plan.name, q.lastError().text());
+                return false;
+            }
+        }
+        if (!m_db.commit()) {
+            *error = QString("Committing %1: %2").arg(m_plan.name, m_db.lastError().text());
+            return false;
+        }
+        m_open = false;
+        return true;
+    }
+
+    [[nodiscard]] bool copying() const {
+#ifdef HMIS_HAVE_LIBPQ
+        return m_pg != nullptr;
+#else
+        return false;
+#endif
+    }
+
+  private:
+    QString insertSql(int rows) const {
+        const QString tuple = "(" + QStringList(m_plan.columns.size(), QString("?")).join(", ") + ")";
+        return QString("INSERT INTO %1 (%2) VALUES %3")
+            .arg(m_plan.name, m_plan.columns.join(", "), QStringList(rows, tuple).join(","));
+    }
+
+    bool insertRows(QSqlQuery& q, qsizetype from, int rows, QString* error) {
+        const int columns = int(m_plan.columns.size());
+        for (int r = 0; r < rows; ++r) {
+            const QVariantList& row = m_pending.at(from + r);
+            for (int c = 0; c < columns; ++c) {
+                q.bindValue((r * columns) + c, row.at(c));
+            }
+        }
+        if (!q.exec()) {
+            *error = QString("Writing %1: %2").arg(m_plan.name, q.lastError().text());
+            return false;
+        }
+        return true;
+    }
+
+#ifdef HMIS_HAVE_LIBPQ
+    // COPY text format: tab-separated, \N for NULL, backslash escapes.
+    bool copyRows(const QList<QVariantList>& rows, QString* error) {
+        QByteArray buffer;
+        for (const QVariantList& row : rows) {
+            for (qsizetype c = 0; c < row.size(); ++c) {
+                if (c > 0) {
+                    buffer += '\t';
+                }
+                const QVariant& value = row.at(c);
+                if (value.isNull()) {
+                    buffer += "\\N";
+                    continue;
+                }
+                for (const char ch : value.toString().toUtf8()) {
+                    switch (ch) {
+                        case '\\':
+                            buffer += "\\\\";
+                            break;
+                        case '\t':
+                            buffer += "\\t";
+                            break;
+                        case '\n':
+                            buffer += "\\n";
+                            break;
+                        case '\r':
+                            buffer += "\\r";
+                            break;
+                        default:
+                            buffer += ch;
+                    }
+                }
+            }
+            buffer += '\n';
+        }
+        if (PQputCopyData(m_pg, buffer.constData(), int(buffer.size())) != 1) {
+            *error = QString("COPY %1: %2").arg(m_plan.name, QString::fromUtf8(PQerrorMessage(m_pg)));
+            return false;
+        }
+        return true;
+    }
+
+    PGconn* m_pg = nullptr;  // set while a COPY is open; owned by the QPSQL driver
+#endif
+
+    QSqlDatabase m_db;
+    const sql::Dialect& m_dialect;
+    const TablePlan& m_plan;
+    QSqlQuery m_insert{m_db};
+    int m_statementRows = 1;
+    QList<QVariantList> m_pending;  // rows short of a full statement
+    bool m_open = false;
+};
+
+}  // namespace
+
+bool copyAvailable() {
+#ifdef HMIS_HAVE_LIBPQ
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool run(const ConnOptions& from, const ConnOptions& to, const Options& options, QList<TableReport>* report,
+         QString* error, const Progress& progress) {
+    HMIS_PERF_TIMER(timer, "migrate");
+    if (from.getDriver() == Driver::HMISD || to.getDriver() == Driver::HMISD) {
+        *error = "Migrate the database hmisd serves, not hmisd itself";
+        timer.fail();
+        return false;
+    }
+
+    Database source;
+    Database target;
+    try {
+        source.Connect(from);
+        target.Connect(to);
+        target.createSchema();
+    } catch (const std::exception& e) {
+        *error = e.what();
+        timer.fail();
+        return false;
+    }
+    const QSqlDatabase sourceDb = QSqlDatabase::database(source.connectionName(), false);
+    const QSqlDatabase targetDb = QSqlDatabase::database(target.connectionName(), false);
+
+    // Columns an older source lacks keep the target's defaults.
+    QList<TablePlan> plan;
+    const QStringList sourceTables = sourceDb.tables();
+    for (const QString& table : kTables) {
+        if (!sourceTables.contains(table)) {
+            continue;
+        }
+        const QSqlRecord sourceColumns = sourceDb.record(table);
+        const QSqlRecord targetColumns = targetDb.record(table);
+        TablePlan p{.name = table};
+        for (int i = 0; i < targetColumns.count(); ++i) {
+            if (sourceColumns.contains(targetColumns.fieldName(i))) {
+                p.columns << targetColumns.fieldName(i);
+            }
+        }
+        p.hasId = p.columns.contains("id");
+        QSqlQuery q(targetDb);
+        if (!q.exec("SELECT COUNT(*) FROM " + table) || !q.next()) {
+            *error = QString("Reading %1: %2").arg(table, q.lastError().text());
+            timer.fail();
+            return false;
+        }
+        if (q.value(0).toLongLong() > 0) {
+            *error = QString("%1 already has rows in the target; migrate into an empty database").arg(table);
+            timer.fail();
+            return false;
+        }
+        if (!p.columns.isEmpty()) {
+            plan << p;
+        }
+    }
+
+    ChunkQueue queue(options.queueChunks);
+    const int chunkRows = std::max(options.chunkRows, 1);
+    std::unique_ptr<QThread> reader(QThread::create([&] { readTables(from, plan, chunkRows, queue); }));
+    reader->start();
+    // Unblocks and joins the reader on every way out.
+    struct JoinReader {
+        ChunkQueue& queue;
+        QThread& thread;
+        ~JoinReader() {
+            queue.cancel();
+            thread.wait();
+        }
+    } joinReader{queue, *reader};
+
+    const sql::Dialect& dialect = *sql::dialectFor(to);
+    for (int t = 0; t < plan.size(); ++t) {
+        HMIS_PERF_TIMER(tableTimer, "migrateTable");
+        QElapsedTimer clock;
+        clock.start();
+        TableReport r{.table = plan.at(t).name};
+
+        TableWriter writer(targetDb, dialect, plan.at(t));
+        if (!writer.begin(options.useCopy, error)) {
+            tableTimer.fail();
+            timer.fail();
+            return false;
+        }
+        r.copied = writer.copying();
+        for (;;) {
+            std::optional<Chunk> chunk = queue.pop();
+            if (!chunk || chunk->table != t) {
+                *error = chunk ? QString("Reader and writer disagree on table %1").arg(t) : queue.error();
+                tableTimer.fail();
+                timer.fail();
+                return false;
+            }
+            tableTimer.addRows(chunk->rows.size());
+            if (!writer.write(std::move(chunk->rows), error)) {
+                tableTimer.fail();
+                timer.fail();
+                return false;
+            }
+            if (chunk->last) {
+                r.rows = chunk->count;
+                r.checksum = chunk->checksum;
+                break;
+            }
+        }
+        if (!writer.finish(error)) {
+            tableTimer.fail();
+            timer.fail();
+            return false;
+        }
+
+        qint64 written = 0;
+        quint64 checksum = 0;
+        if (!scanTable(targetDb, plan.at(t), &written, &checksum, error)) {
+            timer.fail();
+            return false;
+        }
+        if (written != r.rows || checksum != r.checksum) {
+            *error = QString("%1 does not match: %2 rows (checksum %3) read, %4 rows (checksum %5) in the target")
+                         .arg(r.table)
+                         .arg(r.rows)
+                         .arg(r.checksum, 16, 16, QChar('0'))
+                         .arg(written)
+                         .arg(checksum, 16, 16, QChar('0'));
+            timer.fail();
+            return false;
+        }
+        r.ms = static_cast<double>(clock.nsecsElapsed()) / 1e6;
+        timer.addRows(r.rows);
+        *report << r;
+        if (progress) {
+            progress(r);
+        }
+    }
+    // The copy went around the write paths that keep the search index in step.
+    if (!target.rebuildSearchIndex()) {
+        *error = "Building the search index: " + target.getLastError();
+        timer.fail();
+        return false;
+    }
+    return true;
+}
+
+}  // namespace migrate
@@ -0,0 +1,56 @@
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <QList>
+#include <QString>
+#include <functional>
+
+#include "database.hpp"
+#include "databaseOptions.hpp"
+
+// Copies a whole HMIS database to another driver, e.g. a facility moving
+// from its SQLite file to a PostgreSQL or MySQL server.
+//
+// A reader thread with its own source connection streams each table in
+// chunks through a bounded queue; the calling thread writes them to the
+// target while the next chunk is read, so memory stays at a few chunks
+// however large the register is. PostgreSQL targets are loaded with COPY
+// FROM STDIN when hmis_core is built with libpq (HMIS_HAVE_LIBPQ); other
+// targets, and PostgreSQL without libpq, get multi-row INSERTs.
+//
+// Ids are copied as they are and the id sequences are moved past them, so
+// change_journal, feed_rows and backup_state still refer to the right rows.
+// The target schema is created first and its tables must be empty. Every
+// table is read back and its row count and checksum compared with what the
+// reader saw; the target's search index is then built from the copied rows.
+namespace migrate {
+
+struct Options {
+    int chunkRows = 5000;  // rows per chunk handed from the reader to the writer
+    int queueChunks = 4;   // chunks buffered between them
+    bool useCopy = true;   // COPY for PostgreSQL targets when available
+};
+
+struct TableReport {
+    QString table;
+    qint64 rows = 0;
+    quint64 checksum = 0;  // order-independent; equal on both sides after a good copy
+    double ms = 0;         // reading, writing and verifying
+    bool copied = false;   // loaded with COPY
+};
+
+// Called after each table is written and verified.
+using Progress = std::function<void(const TableReport&)>;
+
+// Copies every HMIS table from `from` to `to`. Neither may be Driver::HMISD.
+// Returns false with *error on the first failure; tables already written
+// stay in the target, so a failed run should be repeated on an empty one.
+bool run(const ConnOptions& from, const ConnOptions& to, const Options& options, QList<TableReport>* report,
+         QString* error, const Progress& progress = {});
+
+// Whether this build can load PostgreSQL with COPY.
+bool copyAvailable();
+
+}  // namespace migrate
+
+#endif  // MIGRATE_H
@@ -0,0 +1,79 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+// Unbounded multi-producer / single-consumer queue (Vyukov's intrusive node
+// queue). push() is wait-free: one atomic exchange and one store, so writers
+// on the GUI thread never block on the consumer. pop() must only be called
+// from one thread at a time.
+template <typename T>
+class MpscQueue {
+  public:
+    MpscQueue() : m_head(&m_stub), m_tail(&m_stub) {}
+    ~MpscQueue() {
+        while (pop()) {
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T value) { pushNode(new Node(std::move(value))); }
+
+    std::optional<T> pop() {
+        Node* tail = m_tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub) {
+            if (next == nullptr) {
+                return std::nullopt;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr) {
+            m_tail = next;
+            return take(tail);
+        }
+        if (tail != m_head.load(std::memory_order_acquire)) {
+            return std::nullopt;  // a producer is between its exchange and its link
+        }
+        // tail is the last node: park the stub behind it so tail can be freed.
+        pushNode(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr) {
+            m_tail = next;
+            return take(tail);
+        }
+        return std::nullopt;
+    }
+
+  private:
+    struct Node {
+        Node() = default;
+        explicit Node(T v) : value(std::move(v)) {}
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+
+    void pushNode(Node* n) {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        Node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    static std::optional<T> take(Node* n) {
+        std::optional<T> out(std::move(n->value));
+        delete n;
+        return out;
+    }
+
+    Node m_stub;
+    std::atomic<Node*> m_head;  // producers
+    Node* m_tail;               // consumer only
+};
+
+#endif  // MPSCQUEUE_H
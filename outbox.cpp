@@ -0,0 +1,333 @@
+#include "outbox.hpp"
+#include "perfstats.hpp"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QUuid>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <atomic>
+
+static std::atomic<int> nextOutboxConnection{0};
+
+static QString toText(const QJsonObject& image) {
+    return image.isEmpty() ? QString() : QString::fromUtf8(QJsonDocument(image).toJson(QJsonDocument::Compact));
+}
+
+static QJsonObject fromText(const QString& text) {
+    return text.isEmpty() ? QJsonObject() : QJsonDocument::fromJson(text.toUtf8()).object();
+}
+
+Outbox::Outbox(QString path)
+    : m_path(std::move(path)), m_connectionName(QString("hmis_outbox_%1").arg(nextOutboxConnection.fetch_add(1))) {}
+
+Outbox::~Outbox() {
+    if (m_db.isValid()) {
+        m_db.close();
+        m_db = QSqlDatabase();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
+}
+
+bool Outbox::open(QString* error) {
+    QDir().mkpath(QFileInfo(m_path).absolutePath());
+    m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    m_db.setDatabaseName(m_path);
+    m_db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+    if (!m_db.open()) {
+        *error = m_db.lastError().text();
+        return false;
+    }
+
+    // FULL: a save the clerk saw succeed must survive a power cut, since
+    // this file is the only copy until the replicator catches up.
+    QSqlQuery q(m_db);
+    q.exec("PRAGMA journal_mode=WAL");
+    q.exec("PRAGMA synchronous=FULL");
+    if (!q.exec("CREATE TABLE IF NOT EXISTS outbox ("
+                "seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+                "op_key TEXT NOT NULL UNIQUE,"
+                "op TEXT NOT NULL,"
+                "record_id INTEGER NOT NULL DEFAULT 0,"
+                "before_image TEXT,"
+                "after_image TEXT,"
+                "user_id INTEGER NOT NULL DEFAULT 0,"
+                "created_at TEXT NOT NULL,"
+                "state TEXT NOT NULL DEFAULT 'pending',"
+                "attempts INTEGER NOT NULL DEFAULT 0,"
+                "last_error TEXT NOT NULL DEFAULT '')") ||
+        !q.exec("CREATE INDEX IF NOT EXISTS idx_outbox_state ON outbox (state, seq)") ||
+        !q.exec("CREATE TABLE IF NOT EXISTS user_cache ("
+                "username TEXT NOT NULL PRIMARY KEY,"
+                "user_id INTEGER NOT NULL,"
+                "role TEXT NOT NULL,"
+                "password_hash TEXT NOT NULL,"
+                "salt TEXT NOT NULL)") ||
+        !q.exec("CREATE TABLE IF NOT EXISTS diagnosis_cache ("
+                "id INTEGER NOT NULL PRIMARY KEY,"
+                "name TEXT NOT NULL)")) {
+        *error = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+qint64 Outbox::enqueue(PendingWrite write) {
+    HMIS_PERF_TIMER(timer, "outboxEnqueue");
+    write.opKey = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    write.createdAt = QDateTime::currentDateTime().toString(Qt::ISODate);
+
+    QSqlQuery q(m_db);
+    q.prepare(
+        "INSERT INTO outbox (op_key, op, record_id, before_image, after_image, user_id, created_at) "
+        "VALUES (:k, :op, :rid, :before, :after, :uid, :ts)");
+    q.bindValue(":k", write.opKey);
+    q.bindValue(":op", write.op);
+    q.bindValue(":rid", write.recordId);
+    q.bindValue(":before", toText(write.before));
+    q.bindValue(":after", toText(write.after));
+    q.bindValue(":uid", write.actorUserId);
+    q.bindValue(":ts", write.createdAt);
+    timer.track(q);
+    if (!q.exec()) {
+        qWarning() << "Outbox enqueue failed:" << q.lastError().text();
+        m_lastError = q.lastError().text();
+        timer.fail();
+        return -1;
+    }
+    timer.addRows(1);
+    return q.lastInsertId().toLongLong();
+}
+
+bool Outbox::replacePending(qint64 seq, const QJsonObject& after) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE outbox SET after_image = :after WHERE seq = :seq AND state = 'pending' AND op = 'INSERT'");
+    q.bindValue(":after", toText(after));
+    q.bindValue(":seq", seq);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    if (q.numRowsAffected() != 1) {
+        m_lastError = "The record has already been synced; reload and try again.";
+        return false;
+    }
+    return true;
+}
+
+bool Outbox::removePending(qint64 seq) {
+    QSqlQuery q(m_db);
+    q.prepare("DELETE FROM outbox WHERE seq = :seq AND state = 'pending' AND op = 'INSERT'");
+    q.bindValue(":seq", seq);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    if (q.numRowsAffected() != 1) {
+        m_lastError = "The record has already been synced; reload and try again.";
+        return false;
+    }
+    return true;
+}
+
+QList<PendingWrite> Outbox::select(const QString& where, int limit) {
+    QList<PendingWrite> out;
+    QSqlQuery q(m_db);
+    q.setForwardOnly(true);
+    QString sql =
+        "SELECT seq, op_key, op, record_id, before_image, after_image, user_id, created_at, state, attempts, "
+        "last_error FROM outbox WHERE " +
+        where + " ORDER BY seq";
+    if (limit > 0) {
+        sql += QString(" LIMIT %1").arg(limit);
+    }
+    if (!q.exec(sql)) {
+        qWarning() << "Outbox read failed:" << q.lastError().text();
+        m_lastError = q.lastError().text();
+        return out;
+    }
+    while (q.next()) {
+        out << PendingWrite{.seq = q.value(0).toLongLong(),
+                            .opKey = q.value(1).toString(),
+                            .op = q.value(2).toString(),
+                            .recordId = q.value(3).toInt(),
+                            .before = fromText(q.value(4).toString()),
+                            .after = fromText(q.value(5).toString()),
+                            .actorUserId = q.value(6).toInt(),
+                            .createdAt = q.value(7).toString(),
+                            .state = q.value(8).toString(),
+                            .attempts = q.value(9).toInt(),
+                            .lastError = q.value(10).toString()};
+    }
+    return out;
+}
+
+std::optional<PendingWrite> Outbox::find(qint64 seq) {
+    const QList<PendingWrite> found = select(QString("seq = %1").arg(seq), 1);
+    if (found.isEmpty()) {
+        return std::nullopt;
+    }
+    return found.first();
+}
+
+QList<PendingWrite> Outbox::pending(int limit) { return select("state IN ('pending', 'sending')", limit); }
+
+QList<PendingWrite> Outbox::conflicts() { return select("state = 'conflict'", -1); }
+
+qint64 Outbox::count(const QString& state) {
+    QSqlQuery q(m_db);
+    if (state == "pending") {
+        q.prepare("SELECT COUNT(*) FROM outbox WHERE state IN ('pending', 'sending')");
+    } else {
+        q.prepare("SELECT COUNT(*) FROM outbox WHERE state = :s");
+        q.bindValue(":s", state);
+    }
+    if (!q.exec() || !q.next()) {
+        m_lastError = q.lastError().text();
+        return -1;
+    }
+    return q.value(0).toLongLong();
+}
+
+bool Outbox::claim(qint64 seq) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE outbox SET state = 'sending' WHERE seq = :seq AND state = 'pending'");
+    q.bindValue(":seq", seq);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return q.numRowsAffected() == 1;
+}
+
+void Outbox::resetInflight() {
+    QSqlQuery q(m_db);
+    if (!q.exec("UPDATE outbox SET state = 'pending' WHERE state = 'sending'")) {
+        qWarning() << "Outbox reset failed:" << q.lastError().text();
+    }
+}
+
+bool Outbox::markApplied(qint64 seq) {
+    QSqlQuery q(m_db);
+    q.prepare("DELETE FROM outbox WHERE seq = :seq");
+    q.bindValue(":seq", seq);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool Outbox::markConflict(qint64 seq, const QString& error) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE outbox SET state = 'conflict', attempts = attempts + 1, last_error = :e WHERE seq = :seq");
+    q.bindValue(":e", error);
+    q.bindValue(":seq", seq);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool Outbox::markAttempt(qint64 seq, const QString& error) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE outbox SET state = 'pending', attempts = attempts + 1, last_error = :e WHERE seq = :seq");
+    q.bindValue(":e", error);
+    q.bindValue(":seq", seq);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool Outbox::requeue(qint64 seq) {
+    QSqlQuery q(m_db);
+    q.prepare("UPDATE outbox SET state = 'pending', last_error = '' WHERE seq = :seq AND state = 'conflict'");
+    q.bindValue(":seq", seq);
+    if (!q.exec() || q.numRowsAffected() != 1) {
+        m_lastError = q.lastError().isValid() ? q.lastError().text() : QString("No conflict with seq %1").arg(seq);
+        return false;
+    }
+    return true;
+}
+
+bool Outbox::discard(qint64 seq) {
+    QSqlQuery q(m_db);
+    q.prepare("DELETE FROM outbox WHERE seq = :seq AND state = 'conflict'");
+    q.bindValue(":seq", seq);
+    if (!q.exec() || q.numRowsAffected() != 1) {
+        m_lastError = q.lastError().isValid() ? q.lastError().text() : QString("No conflict with seq %1").arg(seq);
+        return false;
+    }
+    return true;
+}
+
+bool Outbox::cacheUser(const CachedUser& entry) {
+    QSqlQuery q(m_db);
+    q.prepare(
+        "INSERT OR REPLACE INTO user_cache (username, user_id, role, password_hash, salt) "
+        "VALUES (:u, :id, :r, :h, :s)");
+    q.bindValue(":u", entry.user.username);
+    q.bindValue(":id", entry.user.id);
+    q.bindValue(":r", entry.user.role == UserRole::Admin ? "Admin" : "Clerk");
+    q.bindValue(":h", entry.passwordHash);
+    q.bindValue(":s", entry.salt);
+    if (!q.exec()) {
+        m_lastError = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+std::optional<Outbox::CachedUser> Outbox::cachedUser(const QString& username) {
+    QSqlQuery q(m_db);
+    q.prepare("SELECT user_id, role, password_hash, salt FROM user_cache WHERE username = :u");
+    q.bindValue(":u", username);
+    if (!q.exec() || !q.next()) {
+        return std::nullopt;
+    }
+    return CachedUser{.user = User{.id = q.value(0).toInt(),
+                                   .username = username,
+                                   .role = q.value(1).toString() == "Admin" ? UserRole::Admin : UserRole::Clerk},
+                      .passwordHash = q.value(2).toString(),
+                      .salt = q.value(3).toString()};
+}
+
+bool Outbox::cacheDiagnoses(const QList<Diagnosis>& diagnoses) {
+    if (!m_db.transaction()) {
+        m_lastError = m_db.lastError().text();
+        return false;
+    }
+    QSqlQuery q(m_db);
+    bool ok = q.exec("DELETE FROM diagnosis_cache") &&
+              q.prepare("INSERT INTO diagnosis_cache (id, name) VALUES (:id, :n)");
+    for (qsizetype i = 0; ok && i < diagnoses.size(); ++i) {
+        q.bindValue(":id", diagnoses.at(i).id);
+        q.bindValue(":n", diagnoses.at(i).name);
+        ok = q.exec();
+    }
+    if (!ok) {
+        m_lastError = q.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+    return m_db.commit();
+}
+
+QList<Diagnosis> Outbox::cachedDiagnoses() {
+    QList<Diagnosis> list;
+    QSqlQuery q(m_db);
+    if (!q.exec("SELECT id, name FROM diagnosis_cache ORDER BY name ASC")) {
+        m_lastError = q.lastError().text();
+        return list;
+    }
+    while (q.next()) {
+        list << Diagnosis{.id = q.value(0).toInt(), .name = q.value(1).toString()};
+    }
+    return list;
+}
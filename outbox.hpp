@@ -0,0 +1,79 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <QList>
+#include <QString>
+#include <QtSql/QSqlDatabase>
+#include <optional>
+
+#include "database.hpp"
+
+// Local SQLite journal of register writes waiting to reach the central
+// server (offline-first mode).
+//
+// Database::saveNewRow/updateHMISRow/deleteHMISRow append here instead of
+// writing to the server, so a save costs one local commit. Replicator pushes
+// the entries in order; each carries a random op key that the server records
+// in applied_ops, so an entry replayed after a crash is recognised and
+// skipped. Entries the server rejects stay behind in state "conflict".
+//
+// One instance per thread: each opens its own connection to the file.
+class Outbox {
+  public:
+    explicit Outbox(QString path);
+    ~Outbox();
+
+    Outbox(const Outbox&) = delete;
+    Outbox& operator=(const Outbox&) = delete;
+
+    bool open(QString* error);
+    [[nodiscard]] const QString& path() const { return m_path; }
+
+    // Returns the new entry's seq, or -1. Fills in opKey and createdAt.
+    qint64 enqueue(PendingWrite write);
+
+    // Edits or drops a not-yet-synced INSERT. False if it has already been
+    // pushed (or is in conflict), so the caller must reload.
+    bool replacePending(qint64 seq, const QJsonObject& after);
+    bool removePending(qint64 seq);
+
+    std::optional<PendingWrite> find(qint64 seq);
+    QList<PendingWrite> pending(int limit = -1);  // not yet on the server, oldest first
+    QList<PendingWrite> conflicts();
+    qint64 count(const QString& state);  // "sending" entries count as "pending"
+
+    // Replicator side. claim() moves an entry to "sending" so the clerk can
+    // no longer edit it; the outcome then removes it, parks it as a
+    // conflict or (markAttempt) returns it to "pending".
+    bool claim(qint64 seq);
+    bool markApplied(qint64 seq);
+    bool markConflict(qint64 seq, const QString& error);
+    bool markAttempt(qint64 seq, const QString& error);
+    void resetInflight();  // after a crash mid-send; replays are idempotent
+    bool requeue(qint64 seq);  // conflict -> pending, e.g. after fixing the server row
+    bool discard(qint64 seq);  // drops a conflict
+
+    // Credentials of users who signed in while online, for offline sign-in.
+    struct CachedUser {
+        User user;
+        QString passwordHash;
+        QString salt;
+    };
+    bool cacheUser(const CachedUser& entry);
+    std::optional<CachedUser> cachedUser(const QString& username);
+    // Diagnosis list for data entry while offline.
+    bool cacheDiagnoses(const QList<Diagnosis>& diagnoses);
+    QList<Diagnosis> cachedDiagnoses();
+
+    [[nodiscard]] QString lastError() const { return m_lastError; }
+
+  private:
+    QList<PendingWrite> select(const QString& where, int limit);
+
+    QString m_path;
+    QString m_connectionName;
+    QSqlDatabase m_db;
+    QString m_lastError;
+};
+
+#endif  // OUTBOX_H
@@ -0,0 +1,122 @@
+#include "parallelstats.hpp"
+#include "perfstats.hpp"
+#include "synthetic.hpp"
+
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// A pool of its own: report folds neither queue behind nor starve backups
+// and audit archival on the global pool.
+Q_GLOBAL_STATIC(QThreadPool, aggregationPool)
+
+namespace parallel {
+
+static int threadsFor(const ParallelOptions& options) {
+    return options.threads > 0 ? options.threads : std::max(1, QThread::idealThreadCount());
+}
+
+int workersFor(qint64 rows, const ParallelOptions& options) {
+    const qint64 minChunk = std::max<qint64>(1, options.minChunkRows);
+    return static_cast<int>(std::clamp<qint64>(rows / minChunk, 1, threadsFor(options)));
+}
+
+void forEachChunk(qint64 rows, const ParallelOptions& options,
+                  const std::function<void(qint64 begin, qint64 end, int worker)>& fold) {
+    if (rows <= 0) {
+        return;
+    }
+    const int workers = workersFor(rows, options);
+    if (workers == 1) {
+        fold(0, rows, 0);
+        return;
+    }
+
+    const qint64 minChunk = std::max<qint64>(1, options.minChunkRows);
+    std::atomic<qint64> next{0};
+    auto work = [&](int worker) {
+        qint64 begin = next.load(std::memory_order_relaxed);
+        for (;;) {
+            if (begin >= rows) {
+                return;
+            }
+            const qint64 size = std::max(minChunk, (rows - begin) / (4 * qint64(workers)));
+            if (next.compare_exchange_weak(begin, begin + size, std::memory_order_relaxed)) {
+                fold(begin, std::min(rows, begin + size), worker);
+                begin = next.load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    QThreadPool* pool = aggregationPool();
+    if (pool->maxThreadCount() < workers - 1) {
+        pool->setMaxThreadCount(workers - 1);
+    }
+    // Release/acquire on the semaphore publishes each worker's partial.
+    QSemaphore done;
+    for (int w = 1; w < workers; ++w) {
+        pool->start([&work, &done, w] {
+            work(w);
+            done.release();
+        });
+    }
+    work(0);
+    done.acquire(workers - 1);
+}
+
+MonthlyStats attendanceStats(const Database& db, const HMISData& rows, const ParallelOptions& options) {
+    HMIS_PERF_TIMER(timer, "parallelAttendanceStats");
+    timer.addRows(rows.size());
+    std::vector<MonthlyStats> partials(workersFor(rows.size(), options));
+    forEachChunk(rows.size(), options, [&](qint64 begin, qint64 end, int worker) {
+        partials[worker].merge(
+            db.buildAttendanceStats(std::span<const HMISRow>(rows.constData() + begin, std::size_t(end - begin))));
+    });
+    MonthlyStats stats = std::move(partials.front());
+    for (std::size_t i = 1; i < partials.size(); ++i) {
+        stats.merge(partials[i]);
+    }
+    return stats;
+}
+
+MonthlyStats diagnosisStats(const Database& db, const HMISData& rows, const QStringList& diagnosisNames,
+                            const ParallelOptions& options) {
+    HMIS_PERF_TIMER(timer, "parallelDiagnosisStats");
+    timer.addRows(rows.size());
+    std::vector<MonthlyStats> partials(workersFor(rows.size(), options));
+    forEachChunk(rows.size(), options, [&](qint64 begin, qint64 end, int worker) {
+        partials[worker].merge(db.buildDiagnosisStats(
+            std::span<const HMISRow>(rows.constData() + begin, std::size_t(end - begin)), {}));
+    });
+    // Seeded like the sequential fold, so zero-count diagnoses still exist.
+    MonthlyStats stats = db.buildDiagnosisStats(std::span<const HMISRow>(), diagnosisNames);
+    for (const MonthlyStats& partial : partials) {
+        stats.merge(partial);
+    }
+    return stats;
+}
+
+bool selfTest(const Database& db, const QStringList& diagnosisNames, qint64 rows, QString* report) {
+    const HMISData data = syntheticRows(diagnosisNames, 4243, 2021, rows);
+    const MonthlyStats attendance = db.buildAttendanceStats(data);
+    const MonthlyStats diagnoses = db.buildDiagnosisStats(data, diagnosisNames);
+    for (int threads : {1, 2, 3, 4, 8}) {
+        // Small chunks so every worker takes several, ragged ones included.
+        const ParallelOptions options{.threads = threads, .minChunkRows = 97};
+        if (attendanceStats(db, data, options).data != attendance.data) {
+            *report = QString("attendance differs at %1 threads").arg(threads);
+            return false;
+        }
+        if (diagnosisStats(db, data, diagnosisNames, options).data != diagnoses.data) {
+            *report = QString("diagnoses differ at %1 threads").arg(threads);
+            return false;
+        }
+    }
+    *report = QString("%1 rows match the sequential fold at 1-8 threads").arg(rows);
+    return true;
+}
+
+}  // namespace parallel
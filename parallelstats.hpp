@@ -0,0 +1,48 @@
+#ifndef PARALLELSTATS_H
+#define PARALLELSTATS_H
+
+#include <QStringList>
+#include <functional>
+
+#include "MonthlyStats.hpp"
+#include "database.hpp"
+
+// Folding large row ranges (multi-year reports) on every core.
+//
+// The range is cut into chunks that workers claim from a shared cursor:
+// chunks start at remaining / (4 * threads) rows and shrink as the range
+// drains, down to minChunkRows, so a worker that finishes early takes more
+// of what is left instead of idling behind a slow one. Each worker folds
+// into its own partial; partials are merged once all chunks are done. The
+// counts are integers, so the result is the sequential one exactly.
+struct ParallelOptions {
+    int threads = 0;             // 0: QThread::idealThreadCount()
+    qint64 minChunkRows = 8192;  // below 2 chunks' worth, fold on the calling thread
+};
+
+namespace parallel {
+
+// Workers forEachChunk uses for rows (1 when parallelism would not pay).
+int workersFor(qint64 rows, const ParallelOptions& options);
+
+// Calls fold(begin, end, worker) over disjoint chunks covering [0, rows).
+// worker is in [0, workersFor(rows, options)) and one worker's calls never
+// overlap, so fold may write to partials[worker] without locking. The
+// calling thread is worker 0; returns when every chunk is folded.
+void forEachChunk(qint64 rows, const ParallelOptions& options,
+                  const std::function<void(qint64 begin, qint64 end, int worker)>& fold);
+
+// Database::buildAttendanceStats/buildDiagnosisStats, chunked.
+MonthlyStats attendanceStats(const Database& db, const HMISData& rows, const ParallelOptions& options);
+MonthlyStats diagnosisStats(const Database& db, const HMISData& rows, const QStringList& diagnosisNames,
+                            const ParallelOptions& options);
+
+// Folds rows synthetic visits sequentially and at 1, 2, 3, 4 and 8 threads
+// with small chunks, and requires identical MonthlyStats (same keys and
+// cells, zero cells included). On a mismatch returns false with the thread
+// count in *report.
+bool selfTest(const Database& db, const QStringList& diagnosisNames, qint64 rows, QString* report);
+
+}  // namespace parallel
+
+#endif  // PARALLELSTATS_H
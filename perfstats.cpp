@@ -0,0 +1,188 @@
+#include "perfstats.hpp"
+
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <bit>
+#include <cstring>
+
+// ---------------------------------------------------------------------------
+// PerfCounter
+// ---------------------------------------------------------------------------
+int PerfCounter::bucketFor(uint64_t us) {
+    if (us < 4) {
+        return static_cast<int>(us);
+    }
+    const int msb = 63 - std::countl_zero(us);
+    const int sub = static_cast<int>((us >> (msb - 2)) & 3);
+    const int bucket = (4 * (msb - 1)) + sub;
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+}
+
+uint64_t PerfCounter::bucketUpperBound(int bucket) {
+    if (bucket < 4) {
+        return static_cast<uint64_t>(bucket);
+    }
+    const int msb = (bucket / 4) + 1;
+    const uint64_t sub = static_cast<uint64_t>(bucket % 4);
+    const uint64_t low = (4 + sub) << (msb - 2);
+    return low + (uint64_t{1} << (msb - 2)) - 1;
+}
+
+void PerfCounter::record(uint64_t us, uint64_t nRows, uint64_t nBytes, bool failed) {
+    constexpr auto relaxed = std::memory_order_relaxed;
+    count.fetch_add(1, relaxed);
+    if (failed) {
+        errors.fetch_add(1, relaxed);
+    }
+    rows.fetch_add(nRows, relaxed);
+    bytes.fetch_add(nBytes, relaxed);
+    totalUs.fetch_add(us, relaxed);
+    buckets[static_cast<size_t>(bucketFor(us))].fetch_add(1, relaxed);
+
+    uint64_t prev = maxUs.load(relaxed);
+    while (us > prev && !maxUs.compare_exchange_weak(prev, us, relaxed)) {
+    }
+}
+
+void PerfCounter::reset() {
+    constexpr auto relaxed = std::memory_order_relaxed;
+    count.store(0, relaxed);
+    errors.store(0, relaxed);
+    rows.store(0, relaxed);
+    bytes.store(0, relaxed);
+    totalUs.store(0, relaxed);
+    maxUs.store(0, relaxed);
+    for (auto& b : buckets) {
+        b.store(0, relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PerfRegistry
+// ---------------------------------------------------------------------------
+PerfRegistry& PerfRegistry::instance() {
+    static PerfRegistry registry;
+    return registry;
+}
+
+PerfCounter& PerfRegistry::counter(const char* name) {
+    QMutexLocker lock(&m_registerMutex);
+    const int used = m_used.load(std::memory_order_relaxed);
+    for (int i = 0; i < used; ++i) {
+        if (std::strcmp(m_counters[static_cast<size_t>(i)].name, name) == 0) {
+            return m_counters[static_cast<size_t>(i)];
+        }
+    }
+
+    // Out of slots: everything else shares the last one.
+    if (used == kMaxCounters) {
+        return m_counters[kMaxCounters - 1];
+    }
+
+    PerfCounter& c = m_counters[static_cast<size_t>(used)];
+    c.name = (used == kMaxCounters - 1) ? "other" : name;
+    m_used.store(used + 1, std::memory_order_release);
+    return c;
+}
+
+static double percentileMs(const PerfCounter& c, uint64_t total, double p) {
+    if (total == 0) {
+        return 0;
+    }
+    const auto target = static_cast<uint64_t>((p * static_cast<double>(total)) + 0.5);
+    uint64_t seen = 0;
+    for (int b = 0; b < PerfCounter::kBuckets; ++b) {
+        seen += c.buckets[static_cast<size_t>(b)].load(std::memory_order_relaxed);
+        if (seen >= target && seen > 0) {
+            return static_cast<double>(PerfCounter::bucketUpperBound(b)) / 1000.0;
+        }
+    }
+    return static_cast<double>(c.maxUs.load(std::memory_order_relaxed)) / 1000.0;
+}
+
+QList<PerfSnapshot> PerfRegistry::snapshot() const {
+    QList<PerfSnapshot> out;
+    const int used = m_used.load(std::memory_order_acquire);
+    for (int i = 0; i < used; ++i) {
+        const PerfCounter& c = m_counters[static_cast<size_t>(i)];
+        PerfSnapshot s;
+        s.name = QString::fromLatin1(c.name);
+        s.count = c.count.load(std::memory_order_relaxed);
+        s.errors = c.errors.load(std::memory_order_relaxed);
+        s.rows = c.rows.load(std::memory_order_relaxed);
+        s.bytes = c.bytes.load(std::memory_order_relaxed);
+        s.maxMs = static_cast<double>(c.maxUs.load(std::memory_order_relaxed)) / 1000.0;
+
+        uint64_t histTotal = 0;
+        for (const auto& b : c.buckets) {
+            histTotal += b.load(std::memory_order_relaxed);
+        }
+        if (s.count > 0) {
+            s.meanMs = static_cast<double>(c.totalUs.load(std::memory_order_relaxed)) / 1000.0 /
+                       static_cast<double>(s.count);
+        }
+        s.p50Ms = percentileMs(c, histTotal, 0.50);
+        s.p95Ms = percentileMs(c, histTotal, 0.95);
+        s.p99Ms = percentileMs(c, histTotal, 0.99);
+        out << s;
+    }
+    return out;
+}
+
+QJsonDocument PerfRegistry::toJson() const {
+    QJsonArray ops;
+    for (const PerfSnapshot& s : snapshot()) {
+        QJsonObject o;
+        o["name"] = s.name;
+        o["count"] = static_cast<qint64>(s.count);
+        o["errors"] = static_cast<qint64>(s.errors);
+        o["rows"] = static_cast<qint64>(s.rows);
+        o["bytes"] = static_cast<qint64>(s.bytes);
+        o["mean_ms"] = s.meanMs;
+        o["p50_ms"] = s.p50Ms;
+        o["p95_ms"] = s.p95Ms;
+        o["p99_ms"] = s.p99Ms;
+        o["max_ms"] = s.maxMs;
+        ops.append(o);
+    }
+
+    QJsonObject root;
+    root["slow_query_threshold_ms"] = slowQueryThresholdMs();
+    root["operations"] = ops;
+    return QJsonDocument(root);
+}
+
+void PerfRegistry::reset() {
+    const int used = m_used.load(std::memory_order_acquire);
+    for (int i = 0; i < used; ++i) {
+        m_counters[static_cast<size_t>(i)].reset();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// PerfTimer
+// ---------------------------------------------------------------------------
+void PerfTimer::track(const QSqlQuery& query) {
+    if (PerfRegistry::instance().slowQueryThresholdUs() == 0) {
+        return;
+    }
+    m_query = query;
+}
+
+PerfTimer::~PerfTimer() {
+    const auto us = static_cast<uint64_t>(m_timer.nsecsElapsed() / 1000);
+    m_counter.record(us, m_rows, m_bytes, m_failed);
+    if (m_traceStartUs >= 0) {
+        Tracer::instance().addComplete(m_counter.name, "db", m_traceStartUs, static_cast<qint64>(us));
+    }
+
+    const uint64_t threshold = PerfRegistry::instance().slowQueryThresholdUs();
+    if (threshold > 0 && us >= threshold && m_query && !m_query->lastQuery().isEmpty()) {
+        const QString header = QString("Slow query in %1 (%2 ms):")
+                                   .arg(QString::fromLatin1(m_counter.name))
+                                   .arg(static_cast<double>(us) / 1000.0, 0, 'f', 1);
+        qWarning().noquote() << header << m_query->lastQuery() << "params:" << m_query->boundValues();
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef PERFSTATS_H
+#define PERFSTATS_H
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QVariantList>
+#include <QtSql/QSqlQuery>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+#include "tracing.hpp"
+
+// Per-operation counters. All fields are relaxed atomics so recording from
+// any thread is lock-free; readers get a best-effort consistent view.
+struct PerfCounter {
+    // Log-linear latency buckets in microseconds: 0-3 exact, then 4 sub-buckets
+    // per power of two. 160 buckets cover up to ~2^40us.
+    static constexpr int kBuckets = 160;
+
+    const char* name = nullptr;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> rows{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> totalUs{0};
+    std::atomic<uint64_t> maxUs{0};
+    std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+
+    void record(uint64_t us, uint64_t nRows, uint64_t nBytes, bool failed);
+    void reset();
+
+    static int bucketFor(uint64_t us);
+    static uint64_t bucketUpperBound(int bucket);
+};
+
+// Point-in-time copy of a PerfCounter, used by the dialog and JSON export.
+struct PerfSnapshot {
+    QString name;
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    uint64_t rows = 0;
+    uint64_t bytes = 0;
+    double meanMs = 0;
+    double p50Ms = 0;
+    double p95Ms = 0;
+    double p99Ms = 0;
+    double maxMs = 0;
+};
+
+class PerfRegistry {
+  public:
+    static PerfRegistry& instance();
+
+    // Returns the counter registered under name, creating it on first use.
+    // Call sites cache the reference in a function-local static, so the
+    // mutex is only taken once per call site.
+    PerfCounter& counter(const char* name);
+
+    QList<PerfSnapshot> snapshot() const;
+    QJsonDocument toJson() const;
+    void reset();
+
+    // Queries slower than this are logged with SQL text and bound values.
+    // 0 disables slow-query logging.
+    void setSlowQueryThresholdMs(int ms) { m_slowQueryUs.store(static_cast<uint64_t>(ms) * 1000); }
+    int slowQueryThresholdMs() const { return static_cast<int>(m_slowQueryUs.load() / 1000); }
+    uint64_t slowQueryThresholdUs() const { return m_slowQueryUs.load(std::memory_order_relaxed); }
+
+  private:
+    PerfRegistry() = default;
+
+    static constexpr int kMaxCounters = 128;
+    std::array<PerfCounter, kMaxCounters> m_counters;
+    std::atomic<int> m_used{0};
+    std::atomic<uint64_t> m_slowQueryUs{250 * 1000};
+    mutable QMutex m_registerMutex;
+};
+
+// RAII timer: records elapsed time, rows and bytes into a counter on scope exit.
+class PerfTimer {
+  public:
+    explicit PerfTimer(PerfCounter& counter)
+        : m_counter(counter), m_traceStartUs(Tracer::instance().isEnabled() ? Tracer::instance().nowUs() : -1) {
+        m_timer.start();
+    }
+    ~PerfTimer();
+
+    PerfTimer(const PerfTimer&) = delete;
+    PerfTimer& operator=(const PerfTimer&) = delete;
+
+    void addRows(qsizetype n) { m_rows += static_cast<uint64_t>(n); }
+    void addBytes(qsizetype n) { m_bytes += static_cast<uint64_t>(n); }
+    void fail() { m_failed = true; }
+
+    // Remembers the statement for slow-query logging. The query usually goes
+    // out of scope before the timer does, so this keeps a handle on it (a
+    // shared copy, not the text); its SQL and bound values are only read if
+    // the call turns out slow.
+    void track(const QSqlQuery& query);
+
+  private:
+    PerfCounter& m_counter;
+    QElapsedTimer m_timer;
+    qint64 m_traceStartUs;  // -1 when tracing is off
+    uint64_t m_rows = 0;
+    uint64_t m_bytes = 0;
+    bool m_failed = false;
+    std::optional<QSqlQuery> m_query;
+};
+
+// Declares PerfTimer `var` bound to a counter registered once per call site.
+#define HMIS_PERF_TIMER(var, name)                                                   \
+    static PerfCounter& var##Counter = PerfRegistry::instance().counter(name);     \
+    PerfTimer var(var##Counter)
+
+#endif  // PERFSTATS_H
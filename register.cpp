@@ -1,10 +1,13 @@
+#include <QCloseEvent>
 #include <QMainWindow>
 #include <QMessageBox>
+#include <QStatusBar>
 #include <algorithm>
 
 #include "./ui_register.h"
 #include "charts.hpp"
 #include "register.hpp"
+#include "tracing.hpp"
 
 Register::Register(Database* db, int year, int month, QWidget* parent)
     : QMainWindow(parent), ui(new Ui::Register), m_db(db), year(year), month(month) {
@@ -18,6 +21,13 @@ Register::Register(Database* db, int year, int month, QWidget* parent)
     connect(ui->search, &QLineEdit::textChanged, this, &Register::onSearchTextChanged);
     connect(ui->tableWidget, &QTableWidget::itemChanged, this, &Register::itemChanged);
     connect(ui->btnDelete, &QPushButton::clicked, this, &Register::deleteSelectedRow);
+    connect(ui->btnUndo, &QPushButton::clicked, this, &Register::undoEdit);
+    connect(ui->btnRedo, &QPushButton::clicked, this, &Register::redoEdit);
+    connect(ui->btnSave, &QPushButton::clicked, this, &Register::saveEdits);
+    connect(ui->btnDiscard, &QPushButton::clicked, this, &Register::discardEdits);
+    ui->btnUndo->setShortcut(QKeySequence::Undo);
+    ui->btnRedo->setShortcut(QKeySequence::Redo);
+    ui->btnSave->setShortcut(QKeySequence::Save);
 
     ui->search->setPlaceholderText("Search by Patient ID or Diagnosis");
 
@@ -26,6 +36,7 @@ Register::Register(Database* db, int year, int month, QWidget* parent)
     ui->registerLabel->setStyleSheet("font-size:20px; font-weight:bold; color:blue;");
 
     itemChangeEnabled = false;
+    updateEditActions();
 }
 
 Register::~Register() {
@@ -125,34 +136,34 @@ void Register::setData(const QList<HMISRow>& tableData) {
 }
 
 void Register::plotData(const MonthlyStats& dxMap, const MonthlyStats& attendanceMap) {
+    TraceSpan span("Register::plotData");
     layoutCharts(ui, createDiagnosisCharts(dxMap), createAttendanceCharts(attendanceMap));
 }
 
 // ---------------------------------------------------------------------------
 // Search
 // ---------------------------------------------------------------------------
+void Register::showPatient(const QString& ipNumber) {
+    ui->comboBoxSearch->setCurrentIndex(0);
+    ui->search->setText(ipNumber);
+}
+
 void Register::onSearchTypeChanged(int /*unused*/) {
     if (!ui->search->text().isEmpty()) onSearchTextChanged(ui->search->text());
 }
 
-void Register::onSearchTextChanged(const QString& text) {
-    if (text.trimmed().isEmpty()) {
-        filteredData = data;
-        populateTableWithData();
-        return;
-    }
+bool Register::matchesSearch(const HMISRow& row) const {
+    const QString text = ui->search->text();
+    if (text.trimmed().isEmpty()) return true;
+    if (ui->comboBoxSearch->currentIndex() == 0) return row.ipNumber.startsWith(text);
+    return std::any_of(row.diagnoses.begin(), row.diagnoses.end(),
+                       [&](const QString& diag) { return diag.contains(text, Qt::CaseInsensitive); });
+}
+
+void Register::onSearchTextChanged(const QString& /*text*/) {
     filteredData.clear();
-    if (ui->comboBoxSearch->currentIndex() == 0) {
-        for (const HMISRow& row : data)
-            if (row.ipNumber.startsWith(text)) filteredData << row;
-    } else {
-        for (const HMISRow& row : data)
-            for (const QString& diag : row.diagnoses)
-                if (diag.contains(text, Qt::CaseInsensitive)) {
-                    filteredData << row;
-                    break;
-                }
-    }
+    for (const HMISRow& row : data)
+        if (matchesSearch(row)) filteredData << row;
     populateTableWithData();
 }
 
@@ -195,6 +206,8 @@ static bool validateRowData(const QStringList& rowData, QString& error) {
     return true;
 }
 
+// Edits are validated and buffered in m_session; nothing is written until
+// SAVE CHANGES.
 void Register::itemChanged(QTableWidgetItem* item) {
     if (!itemChangeEnabled || item == nullptr) return;
 
@@ -207,43 +220,117 @@ void Register::itemChanged(QTableWidgetItem* item) {
         rowData << (cell != nullptr ? cell->text() : "");
     }
 
+    const int id = rowData[0].toInt();
+    const auto current = std::find_if(data.begin(), data.end(), [id](const HMISRow& r) { return r.id == id; });
+    if (current == data.end()) return;
+
     QString error;
     if (!validateRowData(rowData, error)) {
         QMessageBox::warning(this, "Validation Error", error);
+        showRow(*current);  // put the cell back
+        return;
+    }
+
+    HMISRow edited = *current;
+    edited.ipNumber = rowData[1];
+    edited.ageCategory = rowData[2];
+    edited.sex = rowData[3];
+    edited.newAttendance = rowData[4];
+    edited.diagnoses.clear();
+    for (const QString& diag : rowData[5].split(",")) {
+        if (!diag.trimmed().isEmpty()) edited.diagnoses << diag.trimmed();
+    }
+    if (edited.diagnoses.isEmpty()) {
+        QMessageBox::warning(this, "Validation Error", "At least one diagnosis is required");
+        showRow(*current);
+        return;
+    }
+
+    m_session.record(*current, edited);
+    showRow(edited);
+}
+
+void Register::showRow(const HMISRow& row) {
+    for (HMISRow& r : data)
+        if (r.id == row.id) r = row;
+    for (HMISRow& r : filteredData)
+        if (r.id == row.id) r = row;
+
+    const int tableRow = tableRowOf(row.id);
+    if (tableRow >= 0) {
+        const bool wasEnabled = itemChangeEnabled;
+        itemChangeEnabled = false;
+        setTableRow(tableRow, row);
+        itemChangeEnabled = wasEnabled;
+    }
+    updateEditActions();
+}
+
+void Register::updateEditActions() {
+    const qsizetype pending = m_session.pendingRows().size();
+    ui->btnUndo->setEnabled(m_session.canUndo());
+    ui->btnRedo->setEnabled(m_session.canRedo());
+    ui->btnSave->setEnabled(pending > 0);
+    ui->btnDiscard->setEnabled(pending > 0);
+    setWindowTitle(pending > 0 ? QString("HMIS Register - %1 unsaved row(s)").arg(pending) : "HMIS Register");
+}
+
+void Register::undoEdit() {
+    if (auto row = m_session.undo()) showRow(*row);
+}
+
+void Register::redoEdit() {
+    if (auto row = m_session.redo()) showRow(*row);
+}
+
+void Register::saveEdits() {
+    TraceSpan span("Register::saveEdits");
+    const qsizetype count = m_session.pendingRows().size();
+    if (count == 0) return;
+
+    QString error;
+    if (!m_session.commit(*m_db, m_currentUser.id, &error)) {
+        QMessageBox::warning(this, "Update Error", "Saving failed: " + error);
         return;
     }
+    populateTableWithData();  // clears the unsaved-row highlight
+    updateEditActions();
+    statusBar()->showMessage(QString("Saved %1 row(s)").arg(count), 5000);
+}
+
+void Register::discardEdits() {
+    while (auto row = m_session.undo()) showRow(*row);
+    m_session.clear();
+    updateEditActions();
+}
 
-    HMISRow hmisRow = {
-        .id = rowData[0].toInt(),
-        .ageCategory = rowData[2],
-        .sex = rowData[3],
-        .newAttendance = rowData[4],
-        .diagnoses = rowData[5].split(","),
-        .ipNumber = rowData[1],
-        .year = 0,
-        .month = 0,
-    };
-
-    for (const QString& diag : hmisRow.diagnoses)
-        if (!m_db->diagnosisExists(diag.trimmed())) m_db->insertDiagnoses(QStringList{diag.trimmed()});
-
-    if (!m_db->updateHMISRow(hmisRow, m_currentUser.id))
-        QMessageBox::warning(this, "Update Error", "Update failed: " + m_db->getLastError());
+void Register::closeEvent(QCloseEvent* event) {
+    if (m_session.hasPending()) {
+        const auto choice = QMessageBox::question(this, "Unsaved Changes", "Save the edited rows before closing?",
+                                                  QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
+        if (choice == QMessageBox::Cancel) {
+            event->ignore();
+            return;
+        }
+        if (choice == QMessageBox::Save) {
+            saveEdits();
+            if (m_session.hasPending()) {  // save failed; keep the window open
+                event->ignore();
+                return;
+            }
+        }
+    }
+    QMainWindow::closeEvent(event);
 }
 
 void Register::populateTableWithData() {
+    TraceSpan span("Register::populateTableWithData");
     itemChangeEnabled = false;
     ui->tableWidget->clearContents();
     ui->tableWidget->setRowCount(static_cast<int>(filteredData.size()));
 
     for (int row = 0; row < static_cast<int>(filteredData.size()); ++row) {
-        const HMISRow& r = filteredData[row];
-        ui->tableWidget->setItem(row, 0, new QTableWidgetItem(QString::number(r.id)));
-        ui->tableWidget->setItem(row, 1, new QTableWidgetItem(r.ipNumber));
-        ui->tableWidget->setItem(row, 2, new QTableWidgetItem(r.ageCategory));
-        ui->tableWidget->setItem(row, 3, new QTableWidgetItem(r.sex));
-        ui->tableWidget->setItem(row, 4, new QTableWidgetItem(r.newAttendance));
-        ui->tableWidget->setItem(row, 5, new QTableWidgetItem(r.diagnoses.join(", ")));
+        setTableRow(row, filteredData[row]);
     }
 
     ui->tableWidget->horizontalHeader()->resizeSections(QHeaderView::ResizeToContents);
@@ -252,6 +339,70 @@ void Register::populateTableWithData() {
     itemChangeEnabled = true;
 }
 
+void Register::setTableRow(int row, const HMISRow& r) {
+    const QStringList values{QString::number(r.id), r.ipNumber,      r.ageCategory,
+                             r.sex,                 r.newAttendance, r.diagnoses.join(", ")};
+    const bool unsaved = m_session.pendingRow(r.id).has_value();
+    for (int col = 0; col < static_cast<int>(values.size()); ++col) {
+        // Reuse items: this also runs from inside itemChanged for the edited cell.
+        QTableWidgetItem* item = ui->tableWidget->item(row, col);
+        if (item == nullptr) {
+            item = new QTableWidgetItem;
+            ui->tableWidget->setItem(row, col, item);
+        }
+        item->setText(values.at(col));
+        item->setBackground(unsaved ? QBrush(QColor(255, 243, 176)) : QBrush());
+    }
+}
+
+int Register::tableRowOf(int id) const {
+    const QString key = QString::number(id);
+    for (int row = 0; row < ui->tableWidget->rowCount(); ++row) {
+        const auto* item = ui->tableWidget->item(row, 0);
+        if (item != nullptr && item->text() == key) return row;
+    }
+    return -1;
+}
+
+void Register::applyChanges(int changedYear, int changedMonth, const QList<RowChange>& rows) {
+    if (changedYear != year || changedMonth != month) return;
+    TraceSpan span("Register::applyChanges");
+
+    // Too many to patch, or offline rows with placeholder ids: reload.
+    // Unsaved edits stay on top of what other clients wrote.
+    if (rows.isEmpty() || m_db->outbox() != nullptr) {
+        data = m_db->fetchHMISData(year, month);
+        m_session.overlay(data);
+        onSearchTextChanged(ui->search->text());
+        return;
+    }
+
+    applyRowChanges(data, rows);
+    for (const RowChange& c : rows)
+        if (c.deleted) m_session.forget(c.id);
+    m_session.overlay(data);
+    itemChangeEnabled = false;
+    for (const RowChange& c : rows) {
+        const HMISRow shown = m_session.pendingRow(c.id).value_or(c.row);
+        const int tableRow = tableRowOf(c.id);
+        const bool visible = !c.deleted && matchesSearch(shown);
+        if (tableRow >= 0 && !visible) {
+            ui->tableWidget->removeRow(tableRow);
+        } else if (tableRow >= 0) {
+            setTableRow(tableRow, shown);
+        } else if (visible) {
+            const int newRow = ui->tableWidget->rowCount();
+            ui->tableWidget->insertRow(newRow);
+            setTableRow(newRow, shown);
+        }
+    }
+    filteredData.clear();
+    for (const HMISRow& row : data)
+        if (matchesSearch(row)) filteredData << row;
+    itemChangeEnabled = true;
+    updateEditActions();
+}
+
 void Register::deleteSelectedRow() {
     if (QMessageBox::question(this, "Delete Row", "Delete the selected record?", QMessageBox::Yes | QMessageBox::No) ==
         QMessageBox::No)
@@ -270,8 +421,11 @@ void Register::deleteSelectedRow() {
         return;
     }
 
-    if (m_db->deleteHMISRow(id, m_currentUser.id))
+    if (m_db->deleteHMISRow(id, m_currentUser.id)) {
         ui->tableWidget->removeRow(row);
-    else
+        m_session.forget(id);
+        updateEditActions();
+    } else {
         QMessageBox::critical(this, "Error", "Delete failed: " + m_db->getLastError());
+    }
 }
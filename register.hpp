@@ -7,7 +7,9 @@
 
 #include "HMISRow.hpp"
 #include "MonthlyStats.hpp"
+#include "changenotifier.hpp"
 #include "database.hpp"
+#include "editsession.hpp"
 
 namespace Ui {
 class Register;
@@ -20,6 +22,7 @@ class Register : public QMainWindow {
     Database* m_db;
     User m_currentUser;
     bool itemChangeEnabled = false;
+    EditSession m_session;  // cell edits not yet saved
 
     QStringList headers;
     QList<HMISRow> data;
@@ -28,7 +31,12 @@ class Register : public QMainWindow {
 
     void buildTableWidget();
     void populateTableWithData();
+    void setTableRow(int row, const HMISRow& r);
+    int tableRowOf(int id) const;
+    bool matchesSearch(const HMISRow& row) const;
     void hideIDColumn();
+    void showRow(const HMISRow& row);  // after an edit, undo or redo
+    void updateEditActions();
 
   public:
     explicit Register(Database* db, int year, int month, QWidget* parent = nullptr);
@@ -36,13 +44,24 @@ class Register : public QMainWindow {
 
     void setCurrentUser(const User& user) { m_currentUser = user; }
     void setData(const QList<HMISRow>& data);
+    // Filters the table to one patient, e.g. when opened from a search.
+    void showPatient(const QString& ipNumber);
     void plotData(const MonthlyStats& dxMap, const MonthlyStats& attendanceMap);
+    // Patches the table for rows other clients changed (ChangeNotifier).
+    void applyChanges(int changedYear, int changedMonth, const QList<RowChange>& rows);
+
+  protected:
+    void closeEvent(QCloseEvent* event) override;
 
   private slots:
     void onSearchTextChanged(const QString& text);
     void onSearchTypeChanged(int index);
     void itemChanged(QTableWidgetItem* item);
     void deleteSelectedRow();
+    void undoEdit();
+    void redoEdit();
+    void saveEdits();
+    void discardEdits();
 };
 
 #endif  // REGISTER_H
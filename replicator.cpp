@@ -0,0 +1,275 @@
+#include "replicator.hpp"
+#include "perfstats.hpp"
+
+#include <QDebug>
+#include <QSet>
+#include <QTemporaryDir>
+#include <algorithm>
+
+SyncPass replicatePending(Database& remote, Outbox& outbox, int limit) {
+    HMIS_PERF_TIMER(timer, "replicatePending");
+    SyncPass pass;
+    for (const PendingWrite& queued : outbox.pending(limit)) {
+        // Re-read after claiming: the clerk may have edited it in between.
+        if (!outbox.claim(queued.seq)) {
+            continue;
+        }
+        const auto write = outbox.find(queued.seq);
+        if (!write) {
+            continue;
+        }
+
+        switch (remote.applyPendingWrite(*write)) {
+            case ApplyResult::Applied:
+            case ApplyResult::AlreadyApplied:
+                outbox.markApplied(write->seq);
+                ++pass.applied;
+                break;
+            case ApplyResult::Conflict:
+                qWarning() << "Sync conflict on outbox entry" << write->seq << ":" << remote.getLastError();
+                outbox.markConflict(write->seq, remote.getLastError());
+                ++pass.conflicts;
+                break;
+            case ApplyResult::Failed:
+                outbox.markAttempt(write->seq, remote.getLastError());
+                pass.ok = false;
+                pass.error = remote.getLastError();
+                timer.fail();
+                timer.addRows(pass.applied);
+                return pass;
+        }
+    }
+    timer.addRows(pass.applied);
+    return pass;
+}
+
+Replicator::Replicator(const ConnOptions& remote, QString outboxPath, int batchSize, QObject* parent)
+    : QObject(parent), m_options(remote), m_outboxPath(std::move(outboxPath)), m_batchSize(std::max(batchSize, 1)) {
+    m_thread.reset(QThread::create([this] { run(); }));
+    m_thread->setObjectName("Replicator");
+    m_thread->start();
+}
+
+Replicator::~Replicator() {
+    m_stop.store(true);
+    m_wake.release();
+    m_thread->wait();
+}
+
+void Replicator::run() {
+    static constexpr int kIdleMs = 1000;
+    static constexpr int kMaxBackoffMs = 60000;
+
+    // Both connections must be created and used on this thread.
+    Outbox outbox(m_outboxPath);
+    QString error;
+    if (!outbox.open(&error)) {
+        qWarning() << "Replicator: cannot open outbox" << m_outboxPath << ":" << error;
+        return;
+    }
+    outbox.resetInflight();
+
+    Database remote;
+    bool connectCalled = false;
+    bool healthy = false;  // last attempt reached the server
+    int backoffMs = 0;
+    bool lastOnline = false;
+    qint64 lastPending = -1;
+    qint64 lastConflicts = -1;
+
+    while (!m_stop.load()) {
+        if (!healthy) {
+            if (!connectCalled) {
+                connectCalled = true;
+                try {
+                    remote.Connect(m_options);
+                    remote.createSchema();  // the app may have started offline
+                    healthy = true;
+                } catch (const std::exception& e) {
+                    qWarning() << "Replicator: server unreachable:" << e.what();
+                }
+            } else {
+                healthy = remote.reconnect();
+            }
+        }
+
+        SyncPass pass;
+        if (healthy) {
+            pass = replicatePending(remote, outbox, m_batchSize);
+            if (!pass.ok) {
+                qWarning() << "Replicator: push failed, will retry:" << pass.error;
+                healthy = false;  // reconnect before the next attempt
+            }
+        }
+
+        const qint64 pending = outbox.count("pending");
+        const qint64 conflicts = outbox.count("conflict");
+        const bool online = healthy;
+        if (online != lastOnline || pending != lastPending || conflicts != lastConflicts) {
+            lastOnline = online;
+            lastPending = pending;
+            lastConflicts = conflicts;
+            emit statusChanged(online, pending, conflicts);
+        }
+
+        int waitMs = kIdleMs;
+        if (!healthy) {
+            backoffMs = backoffMs == 0 ? 1000 : std::min(backoffMs * 2, kMaxBackoffMs);
+            waitMs = backoffMs;
+        } else {
+            backoffMs = 0;
+            if (pass.applied + pass.conflicts >= m_batchSize) {
+                waitMs = 0;  // more queued behind this batch
+            }
+        }
+        m_wake.tryAcquire(1, waitMs);
+    }
+}
+
+namespace replication {
+
+// A scratch server register with one visit, and a client queueing into an
+// outbox next to it.
+struct Scratch {
+    QTemporaryDir dir;
+    Database server;
+    Database client;
+    Outbox outbox{dir.filePath("outbox.sqlite3")};
+
+    bool open(QString* report) {
+        const ConnOptions options(SqliteOptions(dir.filePath("server.sqlite3")));
+        try {
+            server.Connect(options);
+            server.createSchema();
+            client.Connect(options);
+        } catch (const std::exception& e) {
+            *report = QString("scratch database: %1").arg(e.what());
+            return false;
+        }
+        QString error;
+        if (!outbox.open(&error)) {
+            *report = "scratch outbox: " + error;
+            return false;
+        }
+        client.setOutbox(&outbox);
+        const NewHMISData visit{.ageCategory = AGE_20_PLUS,
+                                .sex = SEX_FEMALE,
+                                .newAttendance = ATT_YES,
+                                .diagnoses = {"Malaria"},
+                                .ipNumber = "1",
+                                .month = 1,
+                                .year = 2024};
+        if (!server.insertDiagnoses({"Malaria"}) || !server.saveNewRow(visit)) {
+            *report = "scratch database: " + server.getLastError();
+            return false;
+        }
+        return true;
+    }
+};
+
+// An edit that adds two diagnoses the server does not know yet.
+static bool newDiagnosesTest(QString* report) {
+    Scratch s;
+    if (!s.open(report)) {
+        return false;
+    }
+    HMISData rows = s.client.fetchHMISData(2024, 1);
+    if (rows.size() != 1) {
+        *report = QString("expected 1 visit, got %1").arg(rows.size());
+        return false;
+    }
+    rows[0].diagnoses << "Typhoid" << "Cholera";
+    if (!s.client.updateHMISRows(rows)) {
+        *report = "queueing an edit with two new diagnoses: " + s.client.getLastError();
+        return false;
+    }
+    QSet<int> ids;
+    for (const Diagnosis& d : s.outbox.cachedDiagnoses()) {
+        ids.insert(d.id);
+    }
+    if (ids.size() != 3) {
+        *report = QString("the diagnosis cache holds %1 distinct ids, expected 3").arg(ids.size());
+        return false;
+    }
+    const SyncPass pass = replicatePending(s.server, s.outbox, 100);
+    if (!pass.ok || pass.applied != 1 || pass.conflicts != 0) {
+        *report =
+            QString("sync applied %1 with %2 conflicts: %3").arg(pass.applied).arg(pass.conflicts).arg(pass.error);
+        return false;
+    }
+    if (!s.server.diagnosisExists("Typhoid") || !s.server.diagnosisExists("Cholera")) {
+        *report = "the new diagnoses did not reach the server";
+        return false;
+    }
+    return true;
+}
+
+// Two queued edits of one row: the second is checked against the first's
+// result, not against the row as first read.
+static bool editTwiceTest(QString* report) {
+    Scratch s;
+    if (!s.open(report)) {
+        return false;
+    }
+    HMISData rows = s.client.fetchHMISData(2024, 1);
+    if (rows.size() != 1) {
+        *report = QString("expected 1 visit, got %1").arg(rows.size());
+        return false;
+    }
+    HMISRow row = rows.first();
+    row.sex = SEX_MALE;
+    bool ok = s.client.updateHMISRow(row);
+    row.ipNumber = "1A";
+    ok = ok && s.client.updateHMISRow(row);
+    if (!ok) {
+        *report = "queueing two edits: " + s.client.getLastError();
+        return false;
+    }
+    const SyncPass pass = replicatePending(s.server, s.outbox, 100);
+    if (!pass.ok || pass.applied != 2 || pass.conflicts != 0) {
+        *report = QString("two edits of one row: %1 applied, %2 conflicts").arg(pass.applied).arg(pass.conflicts);
+        return false;
+    }
+    return true;
+}
+
+// A server-side change to a row read before the client moved on to another
+// month must still stop the client's later edit.
+static bool otherMonthTest(QString* report) {
+    Scratch s;
+    if (!s.open(report)) {
+        return false;
+    }
+    const HMISData rows = s.client.fetchHMISData(2024, 1);
+    if (rows.size() != 1) {
+        *report = QString("expected 1 visit, got %1").arg(rows.size());
+        return false;
+    }
+    s.client.fetchHMISData(2024, 2);
+    HMISRow theirs = rows.first();
+    theirs.ipNumber = "1B";
+    HMISRow mine = rows.first();
+    mine.sex = SEX_MALE;
+    if (!s.server.updateHMISRow(theirs) || !s.client.updateHMISRow(mine)) {
+        *report = "editing on both sides: " + s.server.getLastError() + s.client.getLastError();
+        return false;
+    }
+    const SyncPass pass = replicatePending(s.server, s.outbox, 100);
+    if (!pass.ok || pass.applied != 0 || pass.conflicts != 1) {
+        *report = QString("edit over a server change: %1 applied, %2 conflicts, expected a conflict")
+                      .arg(pass.applied)
+                      .arg(pass.conflicts);
+        return false;
+    }
+    return true;
+}
+
+bool selfTest(QString* report) {
+    if (!newDiagnosesTest(report) || !editTwiceTest(report) || !otherMonthTest(report)) {
+        return false;
+    }
+    *report = "offline edits reach the server with their new diagnoses, and only real conflicts are parked";
+    return true;
+}
+
+}  // namespace replication
@@ -0,0 +1,61 @@
+#ifndef REPLICATOR_H
+#define REPLICATOR_H
+
+#include <QObject>
+#include <QSemaphore>
+#include <QThread>
+#include <atomic>
+#include <memory>
+
+#include "database.hpp"
+#include "outbox.hpp"
+
+struct SyncPass {
+    qint64 applied = 0;    // including replays the server already had
+    qint64 conflicts = 0;  // parked in the outbox for review
+    bool ok = true;        // false: stopped at an entry the server could not take
+    QString error;
+};
+
+// Pushes up to limit queued writes to the server, oldest first. Each entry
+// is applied in its own server transaction; the pass stops at the first
+// failure so later entries never overtake it.
+SyncPass replicatePending(Database& remote, Outbox& outbox, int limit);
+
+namespace replication {
+
+// Queues offline edits against a scratch SQLite register through an outbox
+// and replays them with replicatePending(), checking what reaches the server.
+bool selfTest(QString* report);
+
+}  // namespace replication
+
+// Background half of offline-first mode. A worker thread with its own
+// server connection and outbox handle drains the outbox every second and
+// right after syncNow(). While the server is unreachable it retries with
+// exponential backoff (1 s doubling up to 60 s).
+class Replicator : public QObject {
+    Q_OBJECT
+  public:
+    Replicator(const ConnOptions& remote, QString outboxPath, int batchSize = 100, QObject* parent = nullptr);
+    ~Replicator() override;  // finishes the entry in flight, then stops
+
+    void syncNow() { m_wake.release(); }
+
+  signals:
+    // Emitted from the worker thread whenever one of the values changes.
+    void statusChanged(bool online, qint64 pending, qint64 conflicts);
+
+  private:
+    void run();
+
+    ConnOptions m_options;
+    QString m_outboxPath;
+    int m_batchSize;
+
+    std::atomic<bool> m_stop{false};
+    QSemaphore m_wake;
+    std::unique_ptr<QThread> m_thread;
+};
+
+#endif  // REPLICATOR_H
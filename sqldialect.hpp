@@ -0,0 +1,356 @@
+#ifndef SQLDIALECT_H
+#define SQLDIALECT_H
+
+#include <QLatin1String>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "databaseOptions.hpp"
+
+// SQL whose text differs between SQLite, PostgreSQL and MySQL.
+//
+// Each backend is a policy type (Sqlite, Postgres, Mysql) holding its
+// fragments: key columns, upsert clauses, casts and capabilities.
+// dialect<D>() assembles the statements from them at compile time into one
+// constant table, and Database picks its table once, in Connect(), from the
+// ConnOptions alternative. The write paths then use each backend's own
+// constructs (RETURNING, ON CONFLICT / ON DUPLICATE KEY, multi-row VALUES)
+// without asking which driver they run on. Statements every backend
+// accepts as written stay inline in database.cpp.
+namespace sql {
+
+// A string literal that can be concatenated in constant expressions.
+template <std::size_t N>
+struct Text {
+    char chars[N]{};
+
+    constexpr Text() = default;
+    constexpr Text(const char (&s)[N]) { std::copy_n(s, N, chars); }
+
+    [[nodiscard]] constexpr QLatin1String view() const { return QLatin1String(chars, qsizetype(N - 1)); }
+};
+
+template <std::size_t... Ns>
+constexpr auto concat(const Text<Ns>&... parts) {
+    Text<(Ns + ...) - sizeof...(Ns) + 1> out;
+    std::size_t at = 0;
+    ((std::copy_n(parts.chars, Ns - 1, out.chars + at), at += Ns - 1), ...);
+    return out;
+}
+
+// rows copies of row, comma-separated: the tuples of a multi-row VALUES.
+template <std::size_t Rows, std::size_t N>
+constexpr auto repeat(const Text<N>& row) {
+    static_assert(Rows > 0);
+    Text<(Rows * (N - 1)) + Rows> out;
+    std::size_t at = 0;
+    for (std::size_t r = 0; r < Rows; ++r) {
+        if (r > 0) {
+            out.chars[at++] = ',';
+        }
+        std::copy_n(row.chars, N - 1, out.chars + at);
+        at += N - 1;
+    }
+    return out;
+}
+
+// How the ids of an INSERT come back.
+enum class InsertedIds : uint8_t {
+    Returning,    // RETURNING id, one result row per inserted row, in VALUES order
+    LastOfBatch,  // lastInsertId() is the last row's; a batch's ids are consecutive
+    FirstOfBatch  // lastInsertId() is the first row's; a batch's ids are consecutive
+};
+
+// ---------------------------------------------------------------------------
+// Dialects
+// ---------------------------------------------------------------------------
+
+// ON CONFLICT upserts, shared by SQLite (3.24+) and PostgreSQL.
+struct OnConflict {
+    template <std::size_t N>
+    static constexpr auto upsert(const Text<N>& keys) {
+        return concat(Text{" ON CONFLICT ("}, keys, Text{") DO UPDATE SET "});
+    }
+    template <std::size_t N>
+    static constexpr auto incoming(const Text<N>& column) {
+        return concat(Text{"excluded."}, column);
+    }
+};
+
+struct Sqlite : OnConflict {
+    static constexpr Driver driver = Driver::SQLITE;
+    static constexpr Text autoId{"id integer NOT NULL PRIMARY KEY AUTOINCREMENT"};
+    static constexpr Text intCast{"INTEGER"};
+    static constexpr Text counterCast{"INTEGER"};
+    static constexpr Text numericIpNumber{"ip_number <> '' AND ip_number NOT GLOB '*[^0-9]*'"};
+    static constexpr Text greatest{"MAX"};
+    static constexpr Text returningId{""};  // last_insert_rowid() is free
+    static constexpr Text reserveCounter{"next_value = ip_sequences.next_value + :step RETURNING next_value"};
+    static constexpr bool counterFromLastInsertId = false;
+    static constexpr InsertedIds insertedIds = InsertedIds::LastOfBatch;
+    static constexpr std::size_t batchRows = 128;  // 7 * 128 binds stays under the old 999-variable limit
+    static constexpr int bindLimit = 999;
+    static constexpr Text resetIdSequence{""};  // sqlite_sequence follows explicit ids
+    static constexpr bool createIndexIfNotExists = true;
+    static constexpr bool nativePartitions = false;
+    static constexpr bool listenNotify = false;
+    static constexpr bool copyFromStdin = false;
+    static constexpr Text insertIgnore{"INSERT OR IGNORE INTO"};
+    static constexpr Text ignoreConflict{""};
+    static constexpr Text auditChangeKey{""};
+    static constexpr Text uniqueAuditChange{
+        "CREATE UNIQUE INDEX IF NOT EXISTS idx_audit_change_once ON audit_log (change_id) WHERE change_id > 0"};
+    // FTS5 splits on everything but letters and digits, so "KAB/12" and
+    // "Malaria____Cough" index as separate words.
+    static constexpr Text searchTable{"hmis_fts"};
+    static constexpr Text createSearchTable{
+        "CREATE VIRTUAL TABLE IF NOT EXISTS hmis_fts USING fts5(ip_number, diagnosis)"};
+    static constexpr Text createSearchIndex{""};
+    static constexpr Text indexSearchRows{
+        "INSERT INTO hmis_fts (rowid, ip_number, diagnosis) "
+        "SELECT id, ip_number, diagnosis FROM hmis WHERE id BETWEEN :from AND :to"};
+    static constexpr Text unindexSearchRows{"DELETE FROM hmis_fts WHERE rowid BETWEEN :from AND :to"};
+    static constexpr Text searchRank{"-bm25(hmis_fts, 10.0, 1.0)"};  // an IP number hit outweighs a diagnosis
+    static constexpr Text searchMatch{"hmis_fts JOIN hmis h ON h.id = hmis_fts.rowid WHERE hmis_fts MATCH :q"};
+    static constexpr Text searchTerm{"\"%1\"*"};
+    static constexpr Text searchAnd{" "};
+};
+
+struct Postgres : OnConflict {
+    static constexpr Driver driver = Driver::POSTGRES;
+    static constexpr Text autoId{"id SERIAL PRIMARY KEY"};
+    static constexpr Text intCast{"INTEGER"};
+    static constexpr Text counterCast{"BIGINT"};
+    static constexpr Text numericIpNumber{"ip_number ~ '^[0-9]+$'"};
+    static constexpr Text greatest{"GREATEST"};
+    static constexpr Text returningId{" RETURNING id"};  // saves lastInsertId()'s lastval() round trip
+    static constexpr Text reserveCounter{"next_value = ip_sequences.next_value + :step RETURNING next_value"};
+    static constexpr bool counterFromLastInsertId = false;
+    static constexpr InsertedIds insertedIds = InsertedIds::Returning;
+    static constexpr std::size_t batchRows = 1000;
+    static constexpr int bindLimit = 65535;
+    // After rows were inserted with explicit ids; %1 is the table.
+    static constexpr Text resetIdSequence{
+        "SELECT setval(pg_get_serial_sequence('%1', 'id'), COALESCE(MAX(id), 0) + 1, false) FROM %1"};
+    static constexpr bool createIndexIfNotExists = true;
+    static constexpr bool nativePartitions = true;
+    static constexpr bool listenNotify = true;
+    static constexpr bool copyFromStdin = true;  // through libpq; QtSql cannot stream COPY
+    static constexpr Text insertIgnore{"INSERT INTO"};
+    static constexpr Text ignoreConflict{" ON CONFLICT DO NOTHING"};
+    static constexpr Text auditChangeKey{""};
+    // Unique keys of a partitioned table must hold the partition key; a
+    // change's audit rows all take changed_at from its journal entry, so they
+    // share its period.
+    static constexpr Text uniqueAuditChange{
+        "CREATE UNIQUE INDEX IF NOT EXISTS idx_audit_change_once ON audit_log (change_id, period) "
+        "WHERE change_id > 0"};
+    // Punctuation becomes spaces before parsing, as FTS5 treats it, so the
+    // parser does not keep "KAB/12" whole as a file path.
+    static constexpr Text searchTable{"hmis_search"};
+    static constexpr Text createSearchTable{
+        "CREATE TABLE IF NOT EXISTS hmis_search (id INT NOT NULL PRIMARY KEY, document TSVECTOR NOT NULL)"};
+    static constexpr Text createSearchIndex{
+        "CREATE INDEX IF NOT EXISTS idx_hmis_search ON hmis_search USING GIN (document)"};
+    static constexpr Text indexSearchRows{
+        "INSERT INTO hmis_search (id, document) SELECT id, "
+        "setweight(to_tsvector('simple', regexp_replace(translate(ip_number, '_', ' '), '\\W+', ' ', 'g')), 'A') || "
+        "setweight(to_tsvector('simple', regexp_replace(translate(COALESCE(diagnosis, ''), '_', ' '), '\\W+', ' ', "
+        "'g')), 'B') FROM hmis WHERE id BETWEEN :from AND :to"};
+    static constexpr Text unindexSearchRows{"DELETE FROM hmis_search WHERE id BETWEEN :from AND :to"};
+    static constexpr Text searchRank{"ts_rank(s.document, query)"};  // weight A (IP number) over B
+    static constexpr Text searchMatch{
+        "hmis_search s JOIN hmis h ON h.id = s.id, to_tsquery('simple', :q) query WHERE s.document @@ query"};
+    static constexpr Text searchTerm{"%1:*"};
+    static constexpr Text searchAnd{" & "};
+};
+
+struct Mysql {
+    static constexpr Driver driver = Driver::MYSQL;
+    static constexpr Text autoId{"id INT NOT NULL AUTO_INCREMENT PRIMARY KEY"};
+    static constexpr Text intCast{"SIGNED"};
+    static constexpr Text counterCast{"UNSIGNED"};
+    static constexpr Text numericIpNumber{"ip_number REGEXP '^[0-9]+$'"};
+    static constexpr Text greatest{"GREATEST"};
+    static constexpr Text returningId{""};
+    // LAST_INSERT_ID(expr) hands the updated value back without a SELECT.
+    static constexpr Text reserveCounter{"next_value = LAST_INSERT_ID(next_value + :step)"};
+    static constexpr bool counterFromLastInsertId = true;
+    // Consecutive only with innodb_autoinc_lock_mode 0 or 1; Connect()
+    // checks, and imports go row by row on servers in mode 2.
+    static constexpr InsertedIds insertedIds = InsertedIds::FirstOfBatch;
+    static constexpr std::size_t batchRows = 1000;
+    static constexpr int bindLimit = 65535;
+    static constexpr Text resetIdSequence{""};  // AUTO_INCREMENT moves past explicit ids
+    static constexpr bool createIndexIfNotExists = false;
+    static constexpr bool nativePartitions = false;
+    static constexpr bool listenNotify = false;
+    static constexpr bool copyFromStdin = false;
+    static constexpr Text insertIgnore{"INSERT IGNORE INTO"};
+    static constexpr Text ignoreConflict{""};
+    // No partial indexes: the unique key is a column that is NULL for change_id 0.
+    static constexpr Text auditChangeKey{"BIGINT AS (NULLIF(change_id, 0)) STORED"};
+    static constexpr Text uniqueAuditChange{"CREATE UNIQUE INDEX idx_audit_change_once ON audit_log (change_key)"};
+    static constexpr Text searchTable{""};  // searches scan hmis with LIKE
+    static constexpr Text createSearchTable{""};
+    static constexpr Text createSearchIndex{""};
+    static constexpr Text indexSearchRows{""};
+    static constexpr Text unindexSearchRows{""};
+    static constexpr Text searchRank{"0"};
+    static constexpr Text searchMatch{""};
+    static constexpr Text searchTerm{""};
+    static constexpr Text searchAnd{""};
+
+    template <std::size_t N>
+    static constexpr auto upsert(const Text<N>&) {
+        return Text{" ON DUPLICATE KEY UPDATE "};  // any unique key
+    }
+    template <std::size_t N>
+    static constexpr auto incoming(const Text<N>& column) {
+        return concat(Text{"VALUES("}, column, Text{")"});
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Statements
+// ---------------------------------------------------------------------------
+
+// One backend's statement table. Everything is constant; Database holds a
+// pointer to the table for its driver (null for Driver::HMISD).
+struct Dialect {
+    Driver driver;
+    QLatin1String autoId;           // id column of the id-keyed tables
+    QLatin1String intCast;          // CAST(x AS intCast) for small integers
+    QLatin1String counterCast;      // and for IP numbers
+    QLatin1String numericIpNumber;  // condition: ip_number is all digits
+    QLatin1String returningId;      // appended to single-row INSERTs; see insertedIds
+    QLatin1String reserveIpNumbers;
+    QLatin1String advanceIpSequence;
+    QLatin1String setState;
+    QLatin1String insertHmisBatch;  // batchRows rows of 7 positional binds, in Statements::hmisColumns order
+    int batchRows;
+    int bindLimit;                  // placeholders one statement may hold
+    QLatin1String resetIdSequence;  // empty where the backend needs none
+    InsertedIds insertedIds;
+    bool counterFromLastInsertId;  // reserveIpNumbers returns no row
+    bool createIndexIfNotExists;
+    bool nativePartitions;  // audit_log as monthly range partitions
+    bool listenNotify;      // LISTEN/NOTIFY for ChangeNotifier
+    bool copyFromStdin;
+    // One audit_log row per change_journal entry (change_id > 0).
+    QLatin1String insertAuditRows;  // up to the VALUES tuples; append ignoreConflict after them
+    QLatin1String ignoreConflict;   // keeps the existing row on a duplicate key
+    QLatin1String auditChangeKey;   // definition of audit_log.change_key; empty where not needed
+    QLatin1String uniqueAuditChange;
+    // Full-text index of hmis (Database::searchRegister). Empty searchTable:
+    // none on this backend. The index statements take the id range :from..:to.
+    QLatin1String searchTable;
+    QLatin1String createSearchTable;
+    QLatin1String createSearchIndex;  // empty where the table is its own index
+    QLatin1String indexSearchRows;
+    QLatin1String unindexSearchRows;
+    QLatin1String searchRows;  // :q, :exact, :limit, :offset; hmis columns in table order, best first
+    QLatin1String searchTerm;  // one word of :q, matched as a prefix; %1 is lowercase letters and digits
+    QLatin1String searchAnd;   // between the terms of :q
+};
+
+template <typename D>
+struct Statements {
+    static constexpr Text hmisColumns{"age_category, month, year, sex, new_attendance, diagnosis, ip_number"};
+
+    static constexpr auto reserveIpNumbers =
+        concat(Text{"INSERT INTO ip_sequences (year, month, next_value) VALUES (:y, :m, :init)"},
+               D::upsert(Text{"year, month"}), D::reserveCounter);
+    // Moves the counter up, never back.
+    static constexpr auto advanceIpSequence =
+        concat(Text{"INSERT INTO ip_sequences (year, month, next_value) VALUES (:y, :m, :n)"},
+               D::upsert(Text{"year, month"}), Text{"next_value = "}, D::greatest, Text{"(ip_sequences.next_value, "},
+               D::incoming(Text{"next_value"}), Text{")"});
+    static constexpr auto setState = concat(Text{"INSERT INTO app_state (name, value) VALUES (:n, :v)"},
+                                            D::upsert(Text{"name"}), Text{"value = "}, D::incoming(Text{"value"}));
+    static constexpr auto insertHmisBatch =
+        concat(Text{"INSERT INTO hmis ("}, hmisColumns, Text{") VALUES "},
+               repeat<D::batchRows>(Text{"(?, ?, ?, ?, ?, ?, ?)"}), D::returningId);
+    static constexpr auto insertAuditRows =
+        concat(D::insertIgnore, Text{" audit_log (change_id, user_id, username, action, table_name, record_id, "
+                                     "detail, changed_at, period) VALUES "});
+    static constexpr auto searchRows =
+        concat(Text{"SELECT h.id, h.age_category, h.month, h.year, h.sex, h.new_attendance, h.diagnosis, "},
+               Text{"h.ip_number, "}, D::searchRank, Text{" AS score FROM "}, D::searchMatch,
+               Text{" ORDER BY h.ip_number = :exact DESC, score DESC, h.year DESC, h.month DESC, h.id DESC "
+                    "LIMIT :limit OFFSET :offset"});
+
+    static constexpr Dialect table{
+        .driver = D::driver,
+        .autoId = D::autoId.view(),
+        .intCast = D::intCast.view(),
+        .counterCast = D::counterCast.view(),
+        .numericIpNumber = D::numericIpNumber.view(),
+        .returningId = D::returningId.view(),
+        .reserveIpNumbers = reserveIpNumbers.view(),
+        .advanceIpSequence = advanceIpSequence.view(),
+        .setState = setState.view(),
+        .insertHmisBatch = insertHmisBatch.view(),
+        .batchRows = int(D::batchRows),
+        .bindLimit = D::bindLimit,
+        .resetIdSequence = D::resetIdSequence.view(),
+        .insertedIds = D::insertedIds,
+        .counterFromLastInsertId = D::counterFromLastInsertId,
+        .createIndexIfNotExists = D::createIndexIfNotExists,
+        .nativePartitions = D::nativePartitions,
+        .listenNotify = D::listenNotify,
+        .copyFromStdin = D::copyFromStdin,
+        .insertAuditRows = insertAuditRows.view(),
+        .ignoreConflict = D::ignoreConflict.view(),
+        .auditChangeKey = D::auditChangeKey.view(),
+        .uniqueAuditChange = D::uniqueAuditChange.view(),
+        .searchTable = D::searchTable.view(),
+        .createSearchTable = D::createSearchTable.view(),
+        .createSearchIndex = D::createSearchIndex.view(),
+        .indexSearchRows = D::indexSearchRows.view(),
+        .unindexSearchRows = D::unindexSearchRows.view(),
+        .searchRows = D::searchMatch.chars[0] != 0 ? searchRows.view() : D::searchMatch.view(),
+        .searchTerm = D::searchTerm.view(),
+        .searchAnd = D::searchAnd.view(),
+    };
+};
+
+template <typename D>
+constexpr const Dialect& dialect() {
+    return Statements<D>::table;
+}
+
+// The dialect of each ConnOptions alternative; hmisd clients send no SQL.
+template <typename Options>
+struct DialectOf {
+    using type = void;
+};
+template <>
+struct DialectOf<SqliteOptions> {
+    using type = Sqlite;
+};
+template <>
+struct DialectOf<PostgresOptions> {
+    using type = Postgres;
+};
+template <>
+struct DialectOf<MysqlOptions> {
+    using type = Mysql;
+};
+
+inline const Dialect* dialectFor(const ConnOptions& options) {
+    return options.visit([](const auto& opt) -> const Dialect* {
+        using D = typename DialectOf<std::decay_t<decltype(opt)>>::type;
+        if constexpr (std::is_void_v<D>) {
+            return nullptr;
+        } else {
+            return &dialect<D>();
+        }
+    });
+}
+
+}  // namespace sql
+
+#endif  // SQLDIALECT_H
@@ -0,0 +1,135 @@
+#include "statsnapshot.hpp"
+#include "perfstats.hpp"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+static const QByteArray kMagic("HMISSNP1");
+static constexpr quint32 kFormatVersion = 2;
+
+// Only non-zero cells are written; pre-seeded zero cells come back as
+// defaults from MonthlyStats::get().
+static QDataStream& operator<<(QDataStream& s, const MonthlyStats& stats) {
+    qint32 cells = 0;
+    for (const auto& byAge : stats.data) {
+        for (const CategoryCount& c : byAge) {
+            cells += c.total() > 0 ? 1 : 0;
+        }
+    }
+    s << cells;
+    for (auto it = stats.data.begin(); it != stats.data.end(); ++it) {
+        for (auto cell = it->begin(); cell != it->end(); ++cell) {
+            if (cell->total() > 0) {
+                s << it.key() << cell.key() << qint32(cell->male) << qint32(cell->female);
+            }
+        }
+    }
+    return s;
+}
+
+static QDataStream& operator>>(QDataStream& s, MonthlyStats& stats) {
+    qint32 cells = 0;
+    s >> cells;
+    for (qint32 i = 0; i < cells && s.status() == QDataStream::Ok; ++i) {
+        QString key;
+        QString age;
+        qint32 male = 0;
+        qint32 female = 0;
+        s >> key >> age >> male >> female;
+        stats.data[key][age] = CategoryCount{.male = male, .female = female};
+    }
+    return s;
+}
+
+namespace statsnapshot {
+
+QString defaultPath() {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).filePath("stats-snapshot.bin");
+}
+
+QString connectionKey(const ConnOptions& options) {
+    const QByteArray id = (options.getDriverName() + '\n' + options.getConnectionString()).toUtf8();
+    return QCryptographicHash::hash(id, QCryptographicHash::Sha256).toHex().left(32);
+}
+
+bool save(const QString& path, const StatsSnapshot& snapshot, QString* error) {
+    HMIS_PERF_TIMER(timer, "saveStatsSnapshot");
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        const Database::MonthlySummary& s = snapshot.summary;
+        out << kFormatVersion << snapshot.source << qint32(snapshot.year) << qint32(snapshot.month)
+            << snapshot.stamp.changeId << snapshot.stamp.recentChanges << snapshot.stamp.rows << snapshot.stamp.maxId
+            << snapshot.attendance
+            << snapshot.diagnoses << qint32(s.totalPatients) << qint32(s.newAttendances) << qint32(s.reAttendances)
+            << s.topDiagnosis1 << s.topDiagnosis2 << s.topDiagnosis3;
+    }
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(kMagic + data) != kMagic.size() + data.size() ||
+        !file.commit()) {
+        *error = "Cannot write " + path + ": " + file.errorString();
+        timer.fail();
+        return false;
+    }
+    timer.addBytes(kMagic.size() + data.size());
+    return true;
+}
+
+std::optional<StatsSnapshot> load(const QString& path) {
+    HMIS_PERF_TIMER(timer, "loadStatsSnapshot");
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return std::nullopt;
+    }
+    const QByteArray data = file.readAll();
+    if (!data.startsWith(kMagic)) {
+        return std::nullopt;
+    }
+    QDataStream in(data.sliced(kMagic.size()));
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 version = 0;
+    in >> version;
+    if (version != kFormatVersion) {
+        return std::nullopt;
+    }
+
+    StatsSnapshot snapshot;
+    Database::MonthlySummary& s = snapshot.summary;
+    qint32 year = 0;
+    qint32 month = 0;
+    qint32 total = 0;
+    qint32 fresh = 0;
+    qint32 repeat = 0;
+    in >> snapshot.source >> year >> month >> snapshot.stamp.changeId >> snapshot.stamp.recentChanges >>
+        snapshot.stamp.rows >> snapshot.stamp.maxId >> snapshot.attendance >> snapshot.diagnoses >> total >> fresh >> repeat >>
+        s.topDiagnosis1 >> s.topDiagnosis2 >> s.topDiagnosis3;
+    if (in.status() != QDataStream::Ok) {
+        timer.fail();
+        return std::nullopt;
+    }
+    snapshot.year = year;
+    snapshot.month = month;
+    s.totalPatients = total;
+    s.newAttendances = fresh;
+    s.reAttendances = repeat;
+    timer.addBytes(data.size());
+    return snapshot;
+}
+
+bool isCurrent(const StatsSnapshot& snapshot, Database& db, int year, int month) {
+    if (snapshot.year != year || snapshot.month != month ||
+        snapshot.source != connectionKey(db.connOptions())) {
+        return false;
+    }
+    const auto stamp = db.monthStamp(year, month);
+    return stamp && *stamp == snapshot.stamp;
+}
+
+}  // namespace statsnapshot
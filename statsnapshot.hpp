@@ -0,0 +1,42 @@
+#ifndef STATSNAPSHOT_H
+#define STATSNAPSHOT_H
+
+#include <QString>
+#include <optional>
+
+#include "MonthlyStats.hpp"
+#include "database.hpp"
+
+// The main window's tables and dashboard line for one month, saved on exit
+// so the next start can fill them before the window is painted instead of
+// fetching and folding the month's rows.
+//
+// File layout: the 8-byte magic "HMISSNP1", then a QDataStream with the
+// format version, a hash of the connection (never the password itself),
+// the month, its MonthStamp and the aggregates. The file is small and read
+// in one call; a snapshot is used only while Database::monthStamp() still
+// returns the stamp it was saved with.
+struct StatsSnapshot {
+    QString source;  // connectionKey() of the database it was built from
+    int year = 0;
+    int month = 0;
+    MonthStamp stamp;
+    MonthlyStats attendance;
+    MonthlyStats diagnoses;
+    Database::MonthlySummary summary;
+};
+
+namespace statsnapshot {
+
+QString defaultPath();  // stats-snapshot.bin in the app data directory
+QString connectionKey(const ConnOptions& options);
+
+bool save(const QString& path, const StatsSnapshot& snapshot, QString* error);
+std::optional<StatsSnapshot> load(const QString& path);
+
+// True when snapshot describes year/month of db as it is now.
+bool isCurrent(const StatsSnapshot& snapshot, Database& db, int year, int month);
+
+}  // namespace statsnapshot
+
+#endif  // STATSNAPSHOT_H
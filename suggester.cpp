@@ -0,0 +1,279 @@
+#include "suggester.hpp"
+#include "perfstats.hpp"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+static const QByteArray kMagic("HMISSUG1");
+static constexpr quint32 kFormatVersion = 1;
+
+// Weight of a visit relative to the epoch beyond which all counts are
+// scaled down and the epoch moved, long before doubles overflow.
+static constexpr double kMaxExponent = 64;
+
+// With something selected, co-occurrence decides and usage breaks ties.
+static constexpr double kClerkShare = 0.6;
+static constexpr double kUsageWeightWithSelection = 0.1;
+
+DiagnosisSuggester::DiagnosisSuggester(double halfLifeDays)
+    : m_halfLifeSecs(std::max(halfLifeDays, 1.0) * 86400.0) {}
+
+int DiagnosisSuggester::idOf(const QString& name) {
+    auto it = m_ids.constFind(name);
+    if (it != m_ids.constEnd()) {
+        return *it;
+    }
+    const auto id = static_cast<int>(m_names.size());
+    m_ids.insert(name, id);
+    m_names << name;
+    m_pairs.resize(m_names.size());
+    return id;
+}
+
+double DiagnosisSuggester::weightAt(qint64 atSecs) {
+    if (m_facility.total <= 0) {
+        m_epoch = atSecs;
+    }
+    double exponent = static_cast<double>(atSecs - m_epoch) / m_halfLifeSecs;
+    if (exponent > kMaxExponent) {
+        rescale(std::exp2(-exponent));
+        m_epoch = atSecs;
+        exponent = 0;
+    }
+    return std::exp2(exponent);
+}
+
+void DiagnosisSuggester::rescale(double factor) {
+    auto scale = [factor](Counts& c) {
+        for (double& v : c.byDx) {
+            v *= factor;
+        }
+        c.total *= factor;
+    };
+    scale(m_facility);
+    for (Counts& c : m_clerks) {
+        scale(c);
+    }
+    for (QHash<int, double>& row : m_pairs) {
+        for (double& v : row) {
+            v *= factor;
+        }
+    }
+}
+
+void DiagnosisSuggester::add(Counts& counts, int dx, double weight) {
+    if (counts.byDx.size() <= dx) {
+        counts.byDx.resize(dx + 1, 0.0);
+    }
+    counts.byDx[dx] += weight;
+}
+
+void DiagnosisSuggester::learn(int clerkId, const QStringList& diagnoses, qint64 atSecs) {
+    QList<int> ids;
+    for (const QString& dx : diagnoses) {
+        if (dx.trimmed().isEmpty()) {
+            continue;
+        }
+        const int id = idOf(dx.trimmed());
+        if (!ids.contains(id)) {
+            ids << id;
+        }
+    }
+    if (ids.isEmpty()) {
+        return;
+    }
+
+    const double w = weightAt(atSecs);
+    m_facility.total += w;
+    Counts* clerk = clerkId > 0 ? &m_clerks[clerkId] : nullptr;
+    if (clerk != nullptr) {
+        clerk->total += w;
+    }
+    for (int a : ids) {
+        add(m_facility, a, w);
+        if (clerk != nullptr) {
+            add(*clerk, a, w);
+        }
+        for (int b : ids) {
+            if (a != b) {
+                m_pairs[a][b] += w;
+            }
+        }
+    }
+}
+
+void DiagnosisSuggester::learnRows(const HMISData& rows) {
+    HMIS_PERF_TIMER(timer, "learnDiagnosisHistory");
+    timer.addRows(rows.size());
+    for (const HMISRow& row : rows) {
+        const QDateTime at(QDate(row.year, row.month, 15), QTime(12, 0));
+        learn(0, row.diagnoses, at.toSecsSinceEpoch());
+    }
+}
+
+QStringList DiagnosisSuggester::suggest(int clerkId, const QStringList& selected, int limit) const {
+    HMIS_PERF_TIMER(timer, "suggestDiagnoses");
+    const auto n = static_cast<int>(m_names.size());
+    if (isEmpty() || limit <= 0) {
+        return {};
+    }
+
+    std::vector<double> score(n, 0.0);
+    const auto clerk = m_clerks.constFind(clerkId);
+    const bool haveClerk = clerk != m_clerks.constEnd() && clerk->total > 0;
+    for (int d = 0; d < m_facility.byDx.size(); ++d) {
+        const double facility = m_facility.byDx[d] / m_facility.total;
+        if (haveClerk) {
+            const double own = d < clerk->byDx.size() ? clerk->byDx[d] / clerk->total : 0.0;
+            score[d] = (kClerkShare * own) + ((1.0 - kClerkShare) * facility);
+        } else {
+            score[d] = facility;
+        }
+    }
+
+    QList<int> chosen;
+    for (const QString& name : selected) {
+        auto it = m_ids.constFind(name);
+        if (it != m_ids.constEnd()) {
+            chosen << *it;
+        }
+    }
+    if (!chosen.isEmpty()) {
+        for (double& s : score) {
+            s *= kUsageWeightWithSelection;
+        }
+        // Sum over the selection of P(d | s), from the pair and single counts.
+        for (int s : chosen) {
+            const double seen = s < m_facility.byDx.size() ? m_facility.byDx[s] : 0.0;
+            if (seen <= 0) {
+                continue;
+            }
+            for (auto it = m_pairs[s].constBegin(); it != m_pairs[s].constEnd(); ++it) {
+                score[it.key()] += it.value() / seen;
+            }
+        }
+        for (int s : chosen) {
+            score[s] = 0;
+        }
+    }
+
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    const auto top = std::min(n, limit);
+    std::partial_sort(order.begin(), order.begin() + top, order.end(), [&score](int a, int b) {
+        return score[a] != score[b] ? score[a] > score[b] : a < b;
+    });
+
+    QStringList out;
+    for (int i = 0; i < top && score[order[i]] > 0; ++i) {
+        out << m_names.at(order[i]);
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Persistence
+// ---------------------------------------------------------------------------
+QString DiagnosisSuggester::defaultPath() {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).filePath("suggestions.bin");
+}
+
+bool DiagnosisSuggester::save(const QString& path, const QString& source, QString* error) const {
+    HMIS_PERF_TIMER(timer, "saveSuggestions");
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_6_0);
+        out << kFormatVersion << source << m_halfLifeSecs << m_epoch << m_names << m_facility.byDx << m_facility.total
+            << qint32(m_clerks.size());
+        for (auto it = m_clerks.constBegin(); it != m_clerks.constEnd(); ++it) {
+            out << qint32(it.key()) << it->byDx << it->total;
+        }
+        out << m_pairs;
+    }
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(kMagic + data) != kMagic.size() + data.size() ||
+        !file.commit()) {
+        *error = "Cannot write " + path + ": " + file.errorString();
+        timer.fail();
+        return false;
+    }
+    timer.addBytes(kMagic.size() + data.size());
+    return true;
+}
+
+bool DiagnosisSuggester::load(const QString& path, const QString& source) {
+    HMIS_PERF_TIMER(timer, "loadSuggestions");
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    if (!data.startsWith(kMagic)) {
+        return false;
+    }
+    QDataStream in(data.sliced(kMagic.size()));
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 version = 0;
+    QString savedSource;
+    double halfLifeSecs = 0;
+    in >> version >> savedSource >> halfLifeSecs;
+    // Counts weighted under another half-life would rank wrongly; relearn.
+    if (version != kFormatVersion || savedSource != source || halfLifeSecs != m_halfLifeSecs) {
+        return false;
+    }
+
+    qint64 epoch = 0;
+    QStringList names;
+    Counts facility;
+    qint32 clerkCount = 0;
+    in >> epoch >> names >> facility.byDx >> facility.total >> clerkCount;
+    QHash<int, Counts> clerks;
+    for (qint32 i = 0; i < clerkCount && in.status() == QDataStream::Ok; ++i) {
+        qint32 id = 0;
+        Counts c;
+        in >> id >> c.byDx >> c.total;
+        clerks.insert(id, c);
+    }
+    QList<QHash<int, double>> pairs;
+    in >> pairs;
+
+    // Every id must index names, so suggest() can skip bounds checks.
+    bool ok = in.status() == QDataStream::Ok && facility.byDx.size() <= names.size() &&
+              pairs.size() == names.size() && names.size() == QSet<QString>(names.begin(), names.end()).size();
+    for (const Counts& c : clerks) {
+        ok = ok && c.byDx.size() <= names.size();
+    }
+    for (const QHash<int, double>& row : pairs) {
+        for (auto it = row.constBegin(); ok && it != row.constEnd(); ++it) {
+            ok = it.key() >= 0 && it.key() < names.size();
+        }
+    }
+    if (!ok) {
+        timer.fail();
+        return false;
+    }
+
+    m_epoch = epoch;
+    m_names = names;
+    m_ids.clear();
+    for (int i = 0; i < names.size(); ++i) {
+        m_ids.insert(names.at(i), i);
+    }
+    m_facility = facility;
+    m_clerks = clerks;
+    m_pairs = pairs;
+    timer.addBytes(data.size());
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef SUGGESTER_H
+#define SUGGESTER_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "database.hpp"
+
+// Diagnoses a clerk is likely to pick next, ranked from what was recorded
+// before: how often each diagnosis was used at this facility and by this
+// clerk, and how often it was recorded together with the ones already
+// selected for the visit (Malaria Confirmed with Anaemia, say).
+//
+// Counts decay with a half-life, so this season's diseases outrank last
+// year's. Decay is applied forward: a visit at time t adds
+// 2^((t - epoch) / halfLife) instead of shrinking every count as time
+// passes, which leaves the ranking the same and keeps learn() O(diagnoses^2)
+// per visit. Everything lives in flat arrays indexed by diagnosis, so
+// suggest() is a scan over a few hundred doubles.
+//
+// File layout: the 8-byte magic "HMISSUG1", then a QDataStream with the
+// format version, the connection key (statsnapshot::connectionKey), the
+// half-life in seconds, the epoch, the diagnosis names and the counts.
+class DiagnosisSuggester {
+  public:
+    explicit DiagnosisSuggester(double halfLifeDays = 30);
+
+    // One saved visit. clerkId 0 counts for the facility only (history
+    // seeded from the register, which does not record the clerk).
+    void learn(int clerkId, const QStringList& diagnoses, qint64 atSecs);
+    // Seeds the facility counts from register rows, dated mid-month.
+    void learnRows(const HMISData& rows);
+
+    // Up to limit diagnoses, best first, leaving out those already
+    // selected. With nothing selected the ranking is the clerk's and the
+    // facility's usage; otherwise what co-occurs with the selection leads.
+    [[nodiscard]] QStringList suggest(int clerkId, const QStringList& selected, int limit) const;
+    [[nodiscard]] bool isEmpty() const { return m_facility.total <= 0; }
+
+    static QString defaultPath();  // suggestions.bin in the app data directory
+    bool save(const QString& path, const QString& source, QString* error) const;
+    // False (and the suggester unchanged) when the file is missing, damaged
+    // or was built from another database.
+    bool load(const QString& path, const QString& source);
+
+  private:
+    struct Counts {
+        QList<double> byDx;  // indexed by diagnosis id
+        double total = 0;    // sum of visit weights
+    };
+
+    int idOf(const QString& name);
+    double weightAt(qint64 atSecs);
+    void rescale(double factor);
+    static void add(Counts& counts, int dx, double weight);
+
+    double m_halfLifeSecs;
+    qint64 m_epoch = 0;  // weights are 2^((t - m_epoch) / halfLife)
+    QStringList m_names;
+    QHash<QString, int> m_ids;
+    Counts m_facility;
+    QHash<int, Counts> m_clerks;
+    QList<QHash<int, double>> m_pairs;  // [a][b]: weight of visits with both a and b
+};
+
+#endif  // SUGGESTER_H
@@ -0,0 +1,220 @@
+#include "synthetic.hpp"
+
+#include <QDate>
+#include <QDebug>
+#include <QFile>
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+// Diagnoses that dominate a typical Ugandan OPD register. They take the top
+// ranks of the Zipf distribution; the rest follow in a seeded random order.
+static const QStringList kCommonDiagnoses = {
+    "Malaria Confirmed",
+    "Cough or cold - No pneumonia",
+    "Urinary Tract Infections (UTI)",
+    "Intestinal Worms",
+    "Diarrhea - Acute",
+    "Skin Diseases",
+    "Gastro-intestinal disorders(non-infective)",
+    "Pneumonia",
+    "Other types of anaemia",
+    "Hypertension",
+    "Typhoid Fever",
+    "Soft tissue injuries",
+    "Dental Caries",
+    "Suspected Malaria",
+};
+
+static QList<double> makeCdf(const QList<double>& weights) {
+    QList<double> cdf;
+    cdf.reserve(weights.size());
+    double total = 0;
+    for (double w : weights) {
+        total += w;
+        cdf << total;
+    }
+    for (double& c : cdf) {
+        c /= total;
+    }
+    return cdf;
+}
+
+// ---------------------------------------------------------------------------
+// SyntheticGenerator
+// ---------------------------------------------------------------------------
+SyntheticGenerator::SyntheticGenerator(const QStringList& diagnoses, quint32 seed) : m_rng(seed) {
+    QStringList rest;
+    for (const QString& dx : diagnoses) {
+        if (kCommonDiagnoses.contains(dx)) {
+            continue;
+        }
+        rest << dx;
+    }
+    std::shuffle(rest.begin(), rest.end(), m_rng);
+
+    for (const QString& dx : kCommonDiagnoses) {
+        if (diagnoses.contains(dx)) {
+            m_diagnoses << dx;
+        }
+    }
+    m_diagnoses << rest;
+
+    QList<double> dxWeights;
+    dxWeights.reserve(m_diagnoses.size());
+    for (qsizetype rank = 0; rank < m_diagnoses.size(); ++rank) {
+        dxWeights << 1.0 / std::pow(static_cast<double>(rank + 1), 1.1);
+    }
+    m_dxCdf = makeCdf(dxWeights);
+
+    // Order matches AGE_CATEGORIES.
+    m_ageCdf = makeCdf({0.03, 0.22, 0.10, 0.15, 0.50});
+    m_dxCountCdf = makeCdf({0.60, 0.28, 0.09, 0.03});
+}
+
+double SyntheticGenerator::uniform() {
+    return static_cast<double>(m_rng()) / (static_cast<double>(std::mt19937::max()) + 1.0);
+}
+
+qsizetype SyntheticGenerator::pick(const QList<double>& cdf) {
+    const double u = uniform();
+    auto it = std::upper_bound(cdf.begin(), cdf.end(), u);
+    return std::min<qsizetype>(std::distance(cdf.begin(), it), cdf.size() - 1);
+}
+
+NewHMISData SyntheticGenerator::visit(int year, int month, int serial) {
+    NewHMISData v;
+    v.year = year;
+    v.month = month;
+    v.ipNumber = QString("%1").arg(serial, 3, 10, QChar('0'));
+    v.ageCategory = AGE_CATEGORIES.at(pick(m_ageCdf));
+
+    // Adult OPD skews female (antenatal, family planning follow-ups).
+    const double femaleShare = (v.ageCategory == AGE_20_PLUS) ? 0.62 : 0.51;
+    v.sex = uniform() < femaleShare ? SEX_FEMALE : SEX_MALE;
+    v.newAttendance = uniform() < 0.8 ? ATT_YES : ATT_NO;
+
+    if (m_diagnoses.isEmpty()) {
+        return v;
+    }
+    const qsizetype nDx = std::min<qsizetype>(pick(m_dxCountCdf) + 1, m_diagnoses.size());
+    while (v.diagnoses.size() < nDx) {
+        const QString& dx = m_diagnoses.at(pick(m_dxCdf));
+        if (!v.diagnoses.contains(dx)) {
+            v.diagnoses << dx;
+        }
+    }
+    return v;
+}
+
+// ---------------------------------------------------------------------------
+// Helpers
+// ---------------------------------------------------------------------------
+QStringList loadDiagnosisNames(const QString& path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Unable to open diagnoses file:" << path;
+        return {};
+    }
+    QStringList out;
+    while (!file.atEnd()) {
+        QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (!line.isEmpty()) {
+            out << line;
+        }
+    }
+    return out;
+}
+
+HMISData syntheticRows(const QStringList& diagnoses, quint32 seed, int year, qint64 count) {
+    SyntheticGenerator gen(diagnoses, seed);
+    HMISData rows;
+    rows.reserve(count);
+    for (qint64 i = 0; i < count; ++i) {
+        const NewHMISData v = gen.visit(year, 1 + int(i % 12), int(i));
+        rows << HMISRow{.id = int(i) + 1,
+                        .ageCategory = v.ageCategory,
+                        .sex = v.sex,
+                        .newAttendance = v.newAttendance,
+                        .diagnoses = v.diagnoses,
+                        .ipNumber = v.ipNumber,
+                        .year = v.year,
+                        .month = v.month};
+    }
+    return rows;
+}
+
+qint64 seedSyntheticData(Database& db, const QStringList& diagnoses, const SyntheticConfig& cfg) {
+    // Make sure every generated diagnosis exists in the lookup table.
+    auto stored = db.getAllDiagnoses();
+    if (!stored) {
+        return -1;
+    }
+    QSet<QString> known;
+    for (const Diagnosis& d : *stored) {
+        known.insert(d.name);
+    }
+    QStringList missing;
+    for (const QString& dx : diagnoses) {
+        if (!known.contains(dx)) {
+            missing << dx;
+        }
+    }
+    if (!db.insertDiagnoses(missing)) {
+        return -1;
+    }
+
+    const int lastYear = cfg.lastYear > 0 ? cfg.lastYear : QDate::currentDate().year();
+    const int firstYear = lastYear - std::max(cfg.years, 1) + 1;
+
+    // Seasonal profile: more visits in the rainy-season malaria peaks.
+    QList<QPair<int, int>> months;
+    QList<double> weights;
+    for (int y = firstYear; y <= lastYear; ++y) {
+        for (int m = 1; m <= 12; ++m) {
+            months << qMakePair(y, m);
+            weights << 1.0 + (0.2 * std::sin(2.0 * std::numbers::pi * (m - 3) / 6.0));
+        }
+    }
+    double totalWeight = 0;
+    for (double w : weights) {
+        totalWeight += w;
+    }
+
+    SyntheticGenerator gen(diagnoses, cfg.seed);
+    constexpr qsizetype kBatch = 5000;
+    QList<NewHMISData> batch;
+    batch.reserve(kBatch);
+
+    qint64 written = 0;
+    qint64 allocated = 0;
+    for (qsizetype i = 0; i < months.size(); ++i) {
+        const auto [year, month] = months.at(i);
+        qint64 count = (i == months.size() - 1)
+                           ? cfg.rows - allocated
+                           : std::llround(static_cast<double>(cfg.rows) * weights.at(i) / totalWeight);
+        count = std::min(count, cfg.rows - allocated);
+        allocated += count;
+
+        // Continue after whatever the month already holds so IP numbers stay unique.
+        int serial = db.nextIPNumber(year, month).toInt();
+        for (qint64 n = 0; n < count; ++n) {
+            batch << gen.visit(year, month, serial++);
+            if (batch.size() == kBatch) {
+                if (!db.bulkInsertRows(batch)) {
+                    return -1;
+                }
+                written += batch.size();
+                batch.clear();
+            }
+        }
+    }
+    if (!batch.isEmpty()) {
+        if (!db.bulkInsertRows(batch)) {
+            return -1;
+        }
+        written += batch.size();
+    }
+    return written;
+}
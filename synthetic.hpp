@@ -0,0 +1,49 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <random>
+
+#include "database.hpp"
+
+// Realistic fake registers for benchmarks and load tests.
+struct SyntheticConfig {
+    qint64 rows = 10000;  // total visits to generate
+    int lastYear = 0;     // 0 = current year
+    int years = 3;        // visits are spread over this many years, ending at lastYear
+    quint32 seed = 105;   // same seed => same data
+};
+
+class SyntheticGenerator {
+  public:
+    SyntheticGenerator(const QStringList& diagnoses, quint32 seed);
+
+    // One visit in the given month. serial becomes the zero-padded IP number.
+    NewHMISData visit(int year, int month, int serial);
+
+  private:
+    double uniform();
+    qsizetype pick(const QList<double>& cdf);
+
+    std::mt19937 m_rng;
+    QStringList m_diagnoses;  // ordered by popularity (rank 0 = most common)
+    QList<double> m_dxCdf;    // Zipf-like CDF over m_diagnoses
+    QList<double> m_ageCdf;
+    QList<double> m_dxCountCdf;  // 1..4 diagnoses per visit
+};
+
+// Reads one diagnosis per line, skipping blank lines. Works with ":/diagnoses.txt".
+QStringList loadDiagnosisNames(const QString& path);
+
+// count visits spread over the months of year as register rows (ids from 1)
+// without touching a database, for checking one aggregation path against
+// another.
+HMISData syntheticRows(const QStringList& diagnoses, quint32 seed, int year, qint64 count);
+
+// Seeds db with cfg.rows visits spread over cfg.years with a seasonal monthly
+// profile, inserting missing diagnoses first. Returns rows written or -1.
+qint64 seedSyntheticData(Database& db, const QStringList& diagnoses, const SyntheticConfig& cfg);
+
+#endif  // SYNTHETIC_H
@@ -0,0 +1,151 @@
+#include "tracing.hpp"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QThread>
+
+// ---------------------------------------------------------------------------
+// Tracer
+// ---------------------------------------------------------------------------
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::start(const QString& outputPath) {
+    QMutexLocker lock(&m_mutex);
+    m_outputPath = outputPath;
+    m_events.clear();
+    m_events.reserve(4096);
+    m_enabled.store(true, std::memory_order_relaxed);
+}
+
+static quint64 currentTid() { return reinterpret_cast<quintptr>(QThread::currentThreadId()); }
+
+void Tracer::addComplete(const char* name, const char* category, qint64 startUs, qint64 durationUs) {
+    if (!isEnabled()) {
+        return;
+    }
+    QMutexLocker lock(&m_mutex);
+    if (m_events.size() < kMaxEvents) {
+        m_events.append(Event{name, category, 'X', startUs, durationUs, currentTid(), {}});
+    }
+}
+
+void Tracer::addInstant(const char* name, const char* category, const QString& detail) {
+    if (!isEnabled()) {
+        return;
+    }
+    const qint64 ts = nowUs();
+    QMutexLocker lock(&m_mutex);
+    if (m_events.size() < kMaxEvents) {
+        m_events.append(Event{name, category, 'i', ts, 0, currentTid(), detail});
+    }
+}
+
+bool Tracer::finish() {
+    if (!isEnabled()) {
+        return true;
+    }
+    m_enabled.store(false, std::memory_order_relaxed);
+
+    QMutexLocker lock(&m_mutex);
+    const qint64 pid = QCoreApplication::applicationPid();
+
+    // Map raw thread ids to small numbers and name the GUI thread.
+    QHash<quint64, int> tids;
+    QJsonArray events;
+    for (const Event& e : m_events) {
+        if (!tids.contains(e.tid)) {
+            const int small = static_cast<int>(tids.size()) + 1;
+            tids.insert(e.tid, small);
+            QJsonObject meta;
+            meta["name"] = "thread_name";
+            meta["ph"] = "M";
+            meta["pid"] = pid;
+            meta["tid"] = small;
+            meta["args"] = QJsonObject{{"name", small == 1 ? "Main" : QString("Thread %1").arg(small)}};
+            events.append(meta);
+        }
+
+        QJsonObject o;
+        o["name"] = QString::fromLatin1(e.name);
+        o["cat"] = QString::fromLatin1(e.category);
+        o["ph"] = QString(QChar::fromLatin1(e.phase));
+        o["ts"] = e.ts;
+        o["pid"] = pid;
+        o["tid"] = tids.value(e.tid);
+        if (e.phase == 'X') {
+            o["dur"] = e.dur;
+        } else {
+            o["s"] = "t";  // instant events scoped to the thread
+        }
+        if (!e.detail.isEmpty()) {
+            o["args"] = QJsonObject{{"detail", e.detail}};
+        }
+        events.append(o);
+    }
+    m_events.clear();
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    QFile f(m_outputPath);
+    if (!f.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write trace file:" << m_outputPath;
+        return false;
+    }
+    f.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// TraceSpan
+// ---------------------------------------------------------------------------
+TraceSpan::TraceSpan(const char* name, const char* category)
+    : m_name(name),
+      m_category(category),
+      m_startUs(Tracer::instance().isEnabled() ? Tracer::instance().nowUs() : -1) {}
+
+TraceSpan::~TraceSpan() {
+    if (m_startUs < 0) {
+        return;
+    }
+    Tracer& t = Tracer::instance();
+    t.addComplete(m_name, m_category, m_startUs, t.nowUs() - m_startUs);
+}
+
+// ---------------------------------------------------------------------------
+// StallWatchdog
+// ---------------------------------------------------------------------------
+StallWatchdog::StallWatchdog(int thresholdMs, QObject* parent) : QObject(parent), m_thresholdMs(thresholdMs) {
+    m_timer.setTimerType(Qt::PreciseTimer);
+    m_timer.setInterval(kTickMs);
+    connect(&m_timer, &QTimer::timeout, this, &StallWatchdog::onTick);
+    m_sinceTick.start();
+    m_timer.start();
+}
+
+void StallWatchdog::onTick() {
+    const qint64 gapMs = m_sinceTick.restart();
+    const qint64 lateMs = gapMs - kTickMs;
+    if (lateMs < m_thresholdMs) {
+        return;
+    }
+
+    qWarning().noquote() << QString("GUI event loop stalled for %1 ms").arg(gapMs);
+
+    Tracer& t = Tracer::instance();
+    if (t.isEnabled()) {
+        const qint64 endUs = t.nowUs();
+        t.addComplete("EventLoopStall", "watchdog", endUs - (gapMs * 1000), gapMs * 1000);
+    }
+    emit stallDetected(gapMs);
+}
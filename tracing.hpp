@@ -0,0 +1,87 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <atomic>
+
+// Collects Chrome/Perfetto trace events ("Trace Event Format") in memory and
+// writes them as JSON. Disabled unless started with an output path, so spans
+// cost one relaxed atomic load in normal use.
+class Tracer {
+  public:
+    static Tracer& instance();
+
+    void start(const QString& outputPath);
+    bool finish();  // writes the JSON file; returns false on I/O error
+
+    [[nodiscard]] bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    [[nodiscard]] qint64 nowUs() const { return m_clock.nsecsElapsed() / 1000; }
+
+    void addComplete(const char* name, const char* category, qint64 startUs, qint64 durationUs);
+    void addInstant(const char* name, const char* category, const QString& detail = {});
+
+  private:
+    Tracer() { m_clock.start(); }
+
+    struct Event {
+        const char* name;
+        const char* category;
+        char phase;  // 'X' complete, 'i' instant
+        qint64 ts;
+        qint64 dur;
+        quint64 tid;
+        QString detail;
+    };
+
+    static constexpr qsizetype kMaxEvents = 2'000'000;
+
+    QElapsedTimer m_clock;
+    std::atomic<bool> m_enabled{false};
+    QString m_outputPath;
+    QMutex m_mutex;
+    QList<Event> m_events;
+};
+
+// RAII span: emits one complete ('X') event covering its lifetime.
+class TraceSpan {
+  public:
+    explicit TraceSpan(const char* name, const char* category = "ui");
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+  private:
+    const char* m_name;
+    const char* m_category;
+    qint64 m_startUs;
+};
+
+// Detects GUI event-loop stalls: a short timer on the GUI thread measures how
+// late each tick fires. A tick more than thresholdMs late means the loop was
+// blocked; the stall is logged and added to the trace.
+class StallWatchdog : public QObject {
+    Q_OBJECT
+  public:
+    explicit StallWatchdog(int thresholdMs, QObject* parent = nullptr);
+
+  signals:
+    void stallDetected(qint64 durationMs);
+
+  private slots:
+    void onTick();
+
+  private:
+    static constexpr int kTickMs = 20;
+
+    int m_thresholdMs;
+    QTimer m_timer;
+    QElapsedTimer m_sinceTick;
+};
+
+#endif  // TRACING_H